@@ -24,20 +24,65 @@
 // http://www.cmsoft.com.br/downloads/cmsoft-stereoscopic-picture-editor-converter/3d-picture-gallery/
 // https://dmitrybrant.com/2011/02/08/the-fujifilm-mpo-3d-photo-format
 //
+#if defined(__linux__)
+#define _GNU_SOURCE     // for MAP_POPULATE, O_CLOEXEC and fseeko
+#endif
+#if !defined(_MSC_VER)
+#define _FILE_OFFSET_BITS 64    // 64-bit off_t on 32-bit systems
+#endif
 #ifdef _MSC_VER
 #include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
 #define vsnprintf _vsnprintf
+#define fseeko _fseeki64
+#define ftello _ftelli64
 #endif
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <string.h>
 #include <memory.h>
 #include <ctype.h>
+#include <math.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define EXIF_HAVE_MMAP
+#define EXIF_HAVE_PREAD
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 #include "exif.h"
 
-#pragma pack(2)
+#ifndef MAX_PATH
+#define MAX_PATH 260
+#endif
+
+// positional reads on a file descriptor
+#if defined(EXIF_HAVE_PREAD) || defined(_MSC_VER)
+#define EXIF_HAVE_FD_IO
+#endif
+
+// the parser state below is kept per thread so that several files
+// can be parsed at the same time
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
 
 #define VERSION  "1.0.1"
 
@@ -45,6 +90,19 @@
 #define APP1_MARKER		0xFFE1
 #define APP2_MARKER		0xFFE2
 
+#define EXIF_ID_STR     "Exif\0"
+#define EXIF_ID_STR_LEN 5
+#define FPXR_ID_STR     "FPXR\0"
+#define FPXR_ID_STR_LEN 5
+#define MPF_ID_STR		"MPF\0"
+#define MPF_ID_STR_LEN	4
+#define ADOBE_METADATA_ID     "http://ns.adobe.com/xap/"
+#define ADOBE_METADATA_ID_LEN 24
+
+// the headers below are read from and written to the file as they are;
+// only they are packed, the other structures keep their natural alignment
+#pragma pack(push, 2)
+
 // TIFF Header
 typedef struct _tiff_Header {
     uint16_t byteOrder;
@@ -76,6 +134,8 @@ typedef struct {
     unsigned int offset;
 } IFD_TAG;
 
+#pragma pack(pop)
+
 // tag node - internal use
 typedef struct _tagNode TagNode;
 struct _tagNode {
@@ -89,6 +149,63 @@ struct _tagNode {
     TagNode *next;
 };
 
+// tag IDs defined in exif.h in ascending order, each one owns a bit
+// of the presence bitmap of the IFD table
+static const uint16_t KnownTagIds[] = {
+    TAG_GPSVersionID, TAG_GPSLatitudeRef, TAG_GPSLatitude, TAG_GPSLongitudeRef,
+    TAG_GPSLongitude, TAG_GPSAltitudeRef, TAG_GPSAltitude, TAG_GPSTimeStamp,
+    TAG_GPSSatellites, TAG_GPSStatus, TAG_GPSMeasureMode, TAG_GPSDOP,
+    TAG_GPSSpeedRef, TAG_GPSSpeed, TAG_GPSTrackRef, TAG_GPSTrack,
+    TAG_GPSImgDirectionRef, TAG_GPSImgDirection, TAG_GPSMapDatum,
+    TAG_GPSDestLatitudeRef, TAG_GPSDestLatitude, TAG_GPSDestLongitudeRef,
+    TAG_GPSDestLongitude, TAG_GPSBearingRef, TAG_GPSBearing,
+    TAG_GPSDestDistanceRef, TAG_GPSDestDistance, TAG_GPSProcessingMethod,
+    TAG_GPSAreaInformation, TAG_GPSDateStamp, TAG_GPSDifferential,
+    TAG_GPSHPositioningError, TAG_ImageWidth, TAG_ImageLength,
+    TAG_BitsPerSample, TAG_Compression, TAG_PhotometricInterpretation,
+    TAG_ImageDescription, TAG_Make, TAG_Model, TAG_StripOffsets,
+    TAG_Orientation, TAG_SamplesPerPixel, TAG_RowsPerStrip,
+    TAG_StripByteCounts, TAG_XResolution, TAG_YResolution,
+    TAG_PlanarConfiguration, TAG_ResolutionUnit, TAG_TransferFunction,
+    TAG_Software, TAG_DateTime, TAG_Artist, TAG_WhitePoint,
+    TAG_PrimaryChromaticities, TAG_JPEGInterchangeFormat,
+    TAG_JPEGInterchangeFormatLength, TAG_YCbCrCoefficients,
+    TAG_YCbCrSubSampling, TAG_YCbCrPositioning, TAG_ReferenceBlackWhite,
+    TAG_RelatedImageFileFormat, TAG_RelatedImageWidth, TAG_RelatedImageHeight,
+    TAG_Rating, TAG_Copyright, TAG_ExposureTime, TAG_FNumber,
+    TAG_ExifIFDPointer, TAG_ExposureProgram, TAG_SpectralSensitivity,
+    TAG_GPSInfoIFDPointer, TAG_PhotographicSensitivity, TAG_OECF,
+    TAG_SensitivityType, TAG_StandardOutputSensitivity,
+    TAG_RecommendedExposureIndex, TAG_ISOSpeed, TAG_ISOSpeedLatitudeyyy,
+    TAG_ISOSpeedLatitudezzz, TAG_ExifVersion, TAG_DateTimeOriginal,
+    TAG_DateTimeDigitized, TAG_OffsetTime, TAG_OffsetTimeOriginal,
+    TAG_OffsetTimeDigitized, TAG_ComponentsConfiguration,
+    TAG_CompressedBitsPerPixel, TAG_ShutterSpeedValue, TAG_ApertureValue,
+    TAG_BrightnessValue, TAG_ExposureBiasValue, TAG_MaxApertureValue,
+    TAG_SubjectDistance, TAG_MeteringMode, TAG_LightSource, TAG_Flash,
+    TAG_FocalLength, TAG_SubjectArea, TAG_MakerNote, TAG_UserComment,
+    TAG_SubSecTime, TAG_SubSecTimeOriginal, TAG_SubSecTimeDigitized,
+    TAG_FlashPixVersion, TAG_ColorSpace, TAG_PixelXDimension,
+    TAG_PixelYDimension, TAG_RelatedSoundFile, TAG_InteroperabilityIFDPointer,
+    TAG_FlashEnergy, TAG_SpatialFrequencyResponse, TAG_FocalPlaneXResolution,
+    TAG_FocalPlaneYResolution, TAG_FocalPlaneResolutionUnit,
+    TAG_SubjectLocation, TAG_ExposureIndex, TAG_SensingMethod, TAG_FileSource,
+    TAG_SceneType, TAG_CFAPattern, TAG_CustomRendered, TAG_ExposureMode,
+    TAG_WhiteBalance, TAG_DigitalZoomRatio, TAG_FocalLengthIn35mmFormat,
+    TAG_SceneCaptureType, TAG_GainControl, TAG_Contrast, TAG_Saturation,
+    TAG_Sharpness, TAG_DeviceSettingDescription, TAG_SubjectDistanceRange,
+    TAG_ImageUniqueID, TAG_CameraOwnerName, TAG_BodySerialNumber,
+    TAG_LensSpecification, TAG_LensMake, TAG_LensModel, TAG_LensSerialNumber,
+    TAG_Gamma, TAG_MPFVersion, TAG_NumberOfImage, TAG_MPImageList,
+    TAG_ImageUIDList, TAG_TotalFrames, TAG_MPIndividualNum, TAG_PanOrientation,
+    TAG_PanOverlapH, TAG_PanOverlapV, TAG_BaseViewpointNum,
+    TAG_ConvergenceAngle, TAG_BaselineLength, TAG_VerticalDivergence,
+    TAG_AxisDistanceX, TAG_AxisDistanceY, TAG_AxisDistanceZ, TAG_YawAngle,
+    TAG_PitchAngle, TAG_RollAngle, TAG_PrintIM, TAG_Padding
+};
+#define KNOWN_TAG_COUNT (int)(sizeof(KnownTagIds) / sizeof(KnownTagIds[0]))
+#define KNOWN_TAG_WORDS ((KNOWN_TAG_COUNT + 63) / 64)
+
 // IFD table - internal use
 typedef struct _ifdTable IfdTable;
 struct _ifdTable {
@@ -99,14 +216,267 @@ struct _ifdTable {
     uint16_t offset;
     uint16_t length;
     uint8_t *p;
+    uint64_t knownTags[KNOWN_TAG_WORDS]; // presence of the known tags
+    uint64_t otherTags;                  // hashed presence of the other tags
 };
 
-static int init(FILE*);
+// binary format of serializeIfdTableArray(), all values are little-endian
+//
+//  header (16 bytes)
+//    char magic[4] "EXTB", uint16 version, uint16 number of IFDs,
+//    uint32 total length, uint32 number of entries
+//  IFD records (24 bytes each)
+//    uint16 ifdType, uint16 tagCount, uint32 nextIfdOffset,
+//    uint32 first entry, uint32 number of entries,
+//    uint32 thumbnail offset, uint32 thumbnail length
+//  entries (12 bytes each)
+//    uint16 tagId, uint8 type, uint8 flags, uint32 count, uint32 value offset
+//  values, each aligned to 4 bytes
+//    numeric types as uint32 arrays (rationals as pairs), the others as bytes
+#define BLOB_MAGIC          "EXTB"
+#define BLOB_VERSION        1
+#define BLOB_HEADER_SIZE    16
+#define BLOB_IFD_SIZE       24
+#define BLOB_ENTRY_SIZE     12
+#define BLOB_FLAG_ERROR     0x01
+
+// growable text buffer of the dump functions - internal use
+// When writer is set, the text is handed to it in chunks of about
+// STR_BUF_FLUSH_SIZE bytes instead of being kept in memory.
+typedef struct _strBuf {
+    char *data;
+    size_t length;
+    size_t capacity;
+    ExifDumpWriter writer;
+    void *context;
+    int error;
+} STR_BUF;
+
+#define STR_BUF_FLUSH_SIZE  4096
+
+// Arrow type of a column (Type union of Schema.fbs) - internal use
+#define ARROW_TYPE_INT          2   // int64
+#define ARROW_TYPE_FLOAT        3   // double
+#define ARROW_TYPE_UTF8         5
+
+// one column of the column writer - internal use
+typedef struct _columnBuf {
+    STR_BUF data;       // values of the batch, concatenated (8 bytes each
+                        // for the int64 and double columns)
+    STR_BUF offsets;    // int32 start of each value, rows + 1 entries,
+                        // only for the utf8 columns
+    STR_BUF validity;   // one bit per row, set if the value is not null
+    unsigned int nullCount;
+    int type;           // ARROW_TYPE_*, always utf8 for CSV and TSV
+    char *name;
+} COLUMN_BUF;
+
+// column writer - internal use
+typedef struct _columnWriter {
+    FILE *fp;
+    int format;
+    int columnCount;        // the file name column and one per tag
+    ExifColumnSpec *specs;  // columnCount - 1 entries
+    COLUMN_BUF *columns;
+    unsigned int rows;      // rows in the current batch
+    int error;
+} COLUMN_WRITER;
+
+// rows per Arrow record batch, a batch is also closed when a column
+// holds more than COLUMN_BATCH_BYTES to stay within the int32 offsets
+#define COLUMN_BATCH_ROWS   65536
+#define COLUMN_BATCH_BYTES  (256 * 1024 * 1024)
+
+// TIFF structure of an Exif segment in memory - internal use
+typedef struct _tiffView {
+    const uint8_t *tiff;    // TIFF header, the base of all the offsets
+    uint32_t length;
+    int bigEndian;
+} TIFF_VIEW;
+
+// frame header of a JPEG image - internal use
+typedef struct _jpegSof {
+    uint8_t marker;         // SOFn marker
+    uint8_t components;
+    uint16_t width;
+    uint16_t height;
+} JPEG_SOF;
+
+// buffer of the segment walk of jpegScanFrame() - internal use
+#define JPEG_SCAN_BLOCK     4096
+typedef struct _jpegScan {
+    ExifIO *io;
+    int64_t end;            // end of the image
+    int64_t start;          // offset of data[0]
+    size_t length;
+    uint8_t data[JPEG_SCAN_BLOCK];
+} JPEG_SCAN;
+
+// Huffman table of the DC-only decoder - internal use
+typedef struct _jpegHuff {
+    int32_t maxcode[18];    // largest code of each length, -1 if none
+    int32_t mincode[17];
+    int32_t valptr[17];
+    uint8_t vals[256];
+    uint8_t fastLen[256];   // codes of up to 8 bits by their first byte
+    uint8_t fastVal[256];
+    int defined;
+} JPEG_HUFF;
+
+// bit reader over the entropy-coded data - internal use
+#define JPEG_END_OF_DATA    0x100   // 'marker' when the data ran out
+typedef struct _jpegBits {
+    ExifIO *io;
+    int64_t pos;            // offset of the next block
+    uint32_t acc;           // bits not consumed yet, from the top
+    int count;
+    int marker;             // marker that ended the data, 0 if none
+    size_t bufPos;
+    size_t bufLength;
+    uint8_t buf[65536];
+} JPEG_BITS;
+
+// component of the DC-only decoder - internal use
+typedef struct _jpegComponent {
+    int id, h, v, tq, td, ta;
+    int blocksX, blocksY;
+    uint8_t *dc;            // average of each block
+} JPEG_COMPONENT;
+
+// DC-only decoder of createThumbnailFromJPEGIO() - internal use
+typedef struct _jpegDecoder {
+    ExifIO *io;
+    int width, height;
+    int componentCount;
+    int maxH, maxV;
+    int restartInterval;
+    int64_t scanOffset;     // start of the entropy-coded data
+    int dcQuant[4];
+    JPEG_HUFF dc[4];
+    JPEG_HUFF ac[4];
+    JPEG_COMPONENT components[3];
+} JPEG_DECODER;
+
+// Huffman codes of the encoder - internal use
+typedef struct _jpegEHuff {
+    uint16_t code[256];
+    uint8_t size[256];
+} JPEG_EHUFF;
+
+// baseline encoder writing to a memory backend - internal use
+typedef struct _jpegEncoder {
+    ExifIO out;
+    uint32_t acc;           // pending bits, in the low 24 bits
+    int count;
+    int error;
+    size_t length;
+    uint8_t buf[4096];
+} JPEG_ENCODER;
+
+// XXH3 of xxHash 0.8 with seed 0 and the default secret
+#define XXH_PRIME32_1   0x9E3779B1U
+#define XXH_PRIME32_2   0x85EBCA77U
+#define XXH_PRIME32_3   0xC2B2AE3DU
+#define XXH_PRIME64_1   0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3   0x165667B19E3779F9ULL
+#define XXH_PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5   0x27D4EB2F165667C5ULL
+#define XXH_STRIPE_LEN  64
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPES_PER_BLOCK   ((XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8)
+
+// state of the streaming XXH3 - internal use
+typedef struct _xxh3State {
+    uint64_t acc[8];
+    uint8_t buffer[256];
+    size_t bufferedSize;
+    size_t stripesSoFar;
+    uint64_t totalLength;
+} XXH3_STATE;
+
+// block reader of the pixel hash - internal use
+#define PIXEL_HASH_BLOCK    (1024 * 1024)
+typedef struct _pixelReader {
+    ExifIO *io;
+    int64_t size;           // size of the input
+    int64_t start;          // offset of data[0]
+    size_t length;
+    uint8_t *data;          // PIXEL_HASH_BLOCK bytes
+    XXH3_STATE hash;
+} PIXEL_READER;
+
+#if defined(EXIF_HAVE_PREAD)
+// work on item 'index' of runBatch(), a non-zero return stops the items
+// not taken yet - internal use
+typedef int (*BATCH_WORK)(void *context, int index);
+
+// state shared by the threads of runBatch() - internal use
+typedef struct _batchJob {
+    BATCH_WORK work;
+    void *context;
+    int count;
+    int next;
+    int status;             // first non-zero return of work
+    pthread_mutex_t lock;
+} BATCH_JOB;
+_Static_assert(offsetof(BATCH_JOB, lock) % _Alignof(pthread_mutex_t) == 0,
+               "BATCH_JOB must not be packed");
+#endif
+
+// key of the metadata cache - internal use
+typedef struct _cacheKey {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtimeNs;
+} CACHE_KEY;
+
+// one range fetched by the read planner - internal use
+typedef struct _planRange {
+    int64_t offset;
+    size_t length;
+    uint8_t *data;
+} PLAN_RANGE;
+
+// read planner, the context of the planned backend - internal use
+typedef struct _readPlanner {
+    ExifIO *base;
+    size_t prefixSize;
+    int64_t end;            // end of the data once a short read is seen, else -1
+    PLAN_RANGE *ranges;
+    int rangeCount;
+    int rangeCapacity;
+    ExifReadStats stats;
+} READ_PLANNER;
+
+// images of an MPO file, see openMpoFrameReader() - internal use
+typedef struct _mpoReader {
+    ExifIO file;            // opened by openMpoFrameReader()
+    ExifIO *io;             // backend of the whole file
+    int count;
+    ExifMpoEntry *entries;
+    void ***ifdArrays;      // IFD tables of each image, parsed on demand
+    int *results;           // result of each image
+    uint8_t *parsed;        // set once the image has been parsed
+} MPO_READER;
+
+// segments walked by the planner, and the size of the on-demand reads
+#define PLAN_MAX_SEGMENTS   256
+#define PLAN_MAX_GAPS       32
+#define PLAN_MISS_SIZE      4096
+
+static int init(ExifIO*);
 static int systemIsLittleEndian();
 static int dataIsLittleEndian();
 static void freeIfdTable(void*);
-static void *parseIFD(FILE*, unsigned int, unsigned int, IFD_TYPE);
+static void *parseIFD(ExifIO*, int64_t, unsigned int, IFD_TYPE);
 static TagNode *getTagNodePtrFromIfd(IfdTable*, uint16_t);
+static void setTagPresence(IfdTable*, uint16_t);
+static int testTagPresence(IfdTable*, uint16_t);
+static int testTagPresenceAt(IfdTable*, uint16_t, int);
+static int getKnownTagIndex(uint16_t);
+static void rebuildTagPresence(IfdTable*);
 static TagNode *duplicateTagNode(TagNode*);
 static void freeTagNode(void*);
 static const char *getTagName(int, uint16_t);
@@ -115,31 +485,137 @@ static IfdTable *getIfdTableFromIfdTableArray(void **ifdTableArray, IFD_TYPE ifd
 static void *createIfdTable(IFD_TYPE IfdType, uint16_t tagCount, unsigned int nextOfs);
 static void *addTagNodeToIfd(void *pIfd, uint16_t tagId, uint16_t type,
                       unsigned int count, unsigned int *numData,uint8_t *byteData);
-static int writeExifSegment(FILE *fp, void **ifdTableArray);
+static int writeExifSegment(ExifIO *out, void **ifdTableArray);
 static int removeTagOnIfd(void *pIfd, uint16_t tagId);
 static int fixLengthAndOffsetInIfdTables(void **ifdTableArray);
 static int setSingleNumDataToTag(TagNode *tag, unsigned int value);
-static int getAppNStartOffset(FILE *fp, uint16_t appMarkerN, const char *App1IDString,
-                              size_t App1IDStringLength, int *pDQTOffset);
+static int64_t getAppNStartOffset(ExifIO *io, uint16_t appMarkerN, const char *App1IDString,
+                                  size_t App1IDStringLength, int64_t *pDQTOffset,
+                                  ExifJpegInfo *pInfo);
+static int64_t ioRead(ExifIO *io, int64_t offset, void *buf, size_t length);
+static int ioReadFull(ExifIO *io, int64_t offset, void *buf, size_t length);
+static int ioWriteFull(ExifIO *io, const void *buf, size_t length);
+static int ioCopyRange(ExifIO *in, int64_t start, int64_t end, ExifIO *out);
+static int copyWithoutSegment(ExifIO *in, ExifIO *out, int64_t segmentOffset);
+static int copyWithNewExifSegment(ExifIO *in, ExifIO *out, void **ifdTableArray,
+                                  int hasExifSegment);
+static void initStdioIO(ExifIO *io, FILE *fp);
+static int fdOpenRead(const char *fileName);
+static int fdCreate(const char *fileName);
+static int fdWriteAll(int fd, const uint8_t *buf, size_t length);
+static int64_t fdReadAt(void *context, int64_t offset, void *buf, size_t length);
+static int64_t fdSize(void *context);
+static void fdClose(void *context);
+static int64_t stdioWrite(void *context, const void *buf, size_t length);
+static void stdioClose(void *context);
+static int64_t memoryReadAt(void *context, int64_t offset, void *buf, size_t length);
+static int64_t memorySize(void *context);
+static int64_t memoryWrite(void *context, const void *buf, size_t length);
+static int64_t rangeReadAt(void *context, int64_t offset, void *buf, size_t length);
+static int64_t rangeSize(void *context);
+static int plannerBuild(READ_PLANNER *p);
+static int64_t plannerReadAt(void *context, int64_t offset, void *buf, size_t length);
+static int64_t plannerSize(void *context);
+static void plannerClose(void *context);
 static uint16_t swab16(uint16_t us);
-static void PRINTF(char **ms, const char *fmt, ...);
-static void _dumpIfdTable(void *pIfd, char **p);
+static void PRINTF(STR_BUF *sb, const char *fmt, ...);
+static void fileDumpWriter(void *context, const char *text, size_t length);
+static void strBufFlush(STR_BUF *sb);
+static void _dumpIfdTable(void *pIfd, STR_BUF *p);
+static void strBufAppend(STR_BUF *sb, const char *str, size_t length);
+static void _emitIfdTableArrayJson(void **ifdArray, int flags, STR_BUF *sb);
+static void columnPutTagValue(STR_BUF *sb, TagNode *tag);
+static int columnPutTagNumber(STR_BUF *sb, int type, TagNode *tag);
+static int columnTagType(IFD_TYPE ifdType, uint16_t tagId);
+static TagNode *columnFindTag(void **ifdArray, const ExifColumnSpec *spec);
+static int columnFlushBatch(COLUMN_WRITER *w);
+static int columnWriteSchema(COLUMN_WRITER *w);
+static const char *getIfdName(IFD_TYPE ifdType);
+static int tiffInitView(TIFF_VIEW *v, const uint8_t *segment, size_t length);
+static int tiffInitHeader(TIFF_VIEW *v, const uint8_t *tiff, size_t length);
+static int parseDecimal(const char *p, int n, int *pValue);
+static int64_t daysFromCivil(int year, int month, int day);
+static int tiffGetIfd(const TIFF_VIEW *v, uint32_t offset, const uint8_t **pEntries);
+static const uint8_t *tiffGetValue(const TIFF_VIEW *v, const uint8_t *entry,
+                                   uint16_t *pType, uint32_t *pCount);
+static uint16_t tiffGet16(const TIFF_VIEW *v, const uint8_t *p);
+static const uint8_t *jpegScanFetch(JPEG_SCAN *scan, int64_t pos, size_t length);
+static int mpoParseSegment(const uint8_t *data, size_t length, int64_t ofs,
+                           ExifMpoEntry *entries, int maxEntries);
+static int jpegScanFrame(ExifIO *io, int64_t pos, int64_t end, ExifJpegInfo *info,
+                         int estimateQuality);
+static int jpegScanSof(ExifIO *io, int64_t start, int64_t end, JPEG_SOF *sof);
+static int jpegQualityScale(int quality);
+static int jpegScaledQuant(const uint8_t std[64], int index, int scale);
+static long jpegQualityError(const uint16_t *luma, const uint16_t *chroma, int quality);
+static int jpegEstimateQuality(const uint16_t *luma, const uint16_t *chroma, int *pExact);
+static int jpegHuffBuild(JPEG_HUFF *h, const uint8_t bits[16], const uint8_t *vals, int count);
+static int jpegBitsByte(JPEG_BITS *b);
+static void jpegBitsFill(JPEG_BITS *b);
+static int jpegBitsGet(JPEG_BITS *b, int n);
+static int jpegBitsDecode(JPEG_BITS *b, const JPEG_HUFF *h);
+static int jpegBitsExtend(JPEG_BITS *b, int s);
+static void jpegBitsRestart(JPEG_BITS *b);
+static int jpegDecodeHeaders(JPEG_DECODER *d);
+static int jpegDecodeDc(JPEG_DECODER *d);
+static void jpegResample(const JPEG_DECODER *d, int comp, uint8_t *out,
+                         int width, int height);
+static void jpegEncodeFlushBytes(JPEG_ENCODER *e);
+static void jpegEncodeByte(JPEG_ENCODER *e, uint8_t c);
+static void jpegEncodeBits(JPEG_ENCODER *e, uint32_t code, int size);
+static void jpegEncodeHuffBuild(JPEG_EHUFF *h, const uint8_t bits[16], const uint8_t *vals);
+static void jpegEncodeSegment(JPEG_ENCODER *e, uint8_t marker, const uint8_t *data, int length);
+static void jpegEncodeDht(JPEG_ENCODER *e, uint8_t tableClass, const uint8_t bits[16],
+                          const uint8_t *vals, int count);
+static void jpegEncodeBlock(JPEG_ENCODER *e, const uint8_t *pixels, int stride,
+                            const uint16_t *quant, int *pred,
+                            const JPEG_EHUFF *dc, const JPEG_EHUFF *ac);
+static int jpegEncode(JPEG_ENCODER *e, uint8_t *planes[3], int components,
+                      int width, int height, int quality);
+static void xxh3Reset(XXH3_STATE *h);
+static void xxh3Update(XXH3_STATE *h, const uint8_t *p, size_t length);
+static uint64_t xxh3Digest64(const XXH3_STATE *h);
+static void xxh3Digest128(const XXH3_STATE *h, uint64_t *pLow, uint64_t *pHigh);
+#if defined(EXIF_HAVE_PREAD)
+static int runBatch(BATCH_WORK work, void *context, int count, int threads);
+#endif
+static uint32_t tiffGet32(const TIFF_VIEW *v, const uint8_t *p);
+static void summaryFillIfd(const TIFF_VIEW *v, const uint8_t *entries, int count,
+                           IFD_TYPE ifdType, ExifSummary *summary,
+                           uint32_t *pExifOffset, uint32_t *pGpsOffset);
+static const char *getTagKey(IFD_TYPE ifdType, uint16_t tagId, char buf[8]);
+static void **copyIfdTableArray(void* ifdTable[32], int count);
+static uint16_t getLE16(const uint8_t *p);
+static uint32_t getLE32(const uint8_t *p);
+static void putLE16(uint8_t *p, uint16_t v);
+static void putLE32(uint8_t *p, uint32_t v);
+static void putLE64(uint8_t *p, uint64_t v);
+static uint32_t blobValueLength(TagNode *tag);
+static uint32_t blobThumbnailLength(IfdTable *ifd);
+static int cacheGetKey(const char *fileName, CACHE_KEY *key);
+static void **lookupIfdTableCache(const CACHE_KEY *key, int *result, int *pHit);
+static void storeIfdTableCache(const CACHE_KEY *key, void **ifdTable, int result);
 
 static int Verbose = 0;
-static int App1StartOffset = -1;
-static int App2StartOffset = -1;
-static int MPFStartOffset = -1;
-static int JpegDQTOffset = -1;
-static APP_HEADER App1Header;
-static APP_HEADER App2Header;
-static MPF_HEADER MPFHeader;
+// file offsets are 64-bit, stitched MPO panoramas exceed 2 GB
+static THREAD_LOCAL int64_t App1StartOffset = -1;
+static THREAD_LOCAL int64_t App2StartOffset = -1;
+static THREAD_LOCAL int64_t MPFStartOffset = -1;
+static THREAD_LOCAL int64_t JpegDQTOffset = -1;
+static THREAD_LOCAL APP_HEADER App1Header;
+static THREAD_LOCAL APP_HEADER App2Header;
+static THREAD_LOCAL MPF_HEADER MPFHeader;
+// byte order of the MPF segment while it is read, the MPF segment does not
+// have to use the byte order of the Exif segment. 0 otherwise
+static THREAD_LOCAL uint16_t MPFByteOrder;
 
 
 // private functions
 
 static int dataIsLittleEndian()
 {
-	return (App1Header.tiff.byteOrder == 0x4949) ? 1 : 0;
+	uint16_t byteOrder = MPFByteOrder ? MPFByteOrder : App1Header.tiff.byteOrder;
+	return (byteOrder == 0x4949) ? 1 : 0;
 }
 
 static int systemIsLittleEndian()
@@ -208,77 +684,56 @@ void setVerbose(int v)
 int removeExifSegmentFromJPEGFile(const char *inJPEGFileName,
                                   const char *outJPGEFileName)
 {
-    int ofs;
-    int i, sts = 1;
-    size_t readLen, writeLen;
-    uint8_t buf[8192], *p;
-    FILE *fpr = NULL, *fpw = NULL;
+    ExifIO in, out;
+    int sts;
 
-    fpr = fopen(inJPEGFileName, "rb");
-    if (!fpr) {
-        sts = ERR_READ_FILE;
-        goto DONE;
-    }
-    sts = init(fpr);
-    if (sts <= 0) {
-        goto DONE;
-    }
-    fpw = fopen(outJPGEFileName, "wb");
-    if (!fpw) {
-        sts = ERR_WRITE_FILE;
-        goto DONE;
-    }
-    // copy the data in front of the Exif segment
-    rewind(fpr);
-    p = buf;
-    if (App1StartOffset > sizeof(buf)) {
-        // allocate new buffer if needed
-        p = (uint8_t*)malloc(App1StartOffset);
-    }
-    if (!p) {
-        for (i = 0; i < App1StartOffset; i++) {
-            fread(buf, 1, sizeof(char), fpr);
-            fwrite(buf, 1, sizeof(char), fpw);
-        }
-    } else {
-        if (fread(p, 1, App1StartOffset, fpr) < (size_t)App1StartOffset) {
-            sts = ERR_READ_FILE;
-            goto DONE;
-        }
-        if (fwrite(p, 1, App1StartOffset, fpw) < (size_t)App1StartOffset) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
-        }
-        if (p != &buf[0]) {
-            free(p);
-        }
-    }
-    // seek to the end of the Exif segment
-    ofs = App1StartOffset + sizeof(App1Header.marker) + App1Header.length;
-    if (fseek(fpr, ofs, SEEK_SET) != 0) {
-        sts = ERR_READ_FILE;
-        goto DONE;
+    sts = openExifFileIO(&in, inJPEGFileName, 0);
+    if (sts != 0) {
+        return sts;
     }
-    // read & write
-    for (;;) {
-        readLen = fread(buf, 1, sizeof(buf), fpr);
-        if (readLen <= 0) {
-            break;
-        }
-        writeLen = fwrite(buf, 1, readLen, fpw);
-        if (writeLen != readLen) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
+    sts = init(&in);
+    if (sts > 0) {
+        sts = openExifFileIO(&out, outJPGEFileName, 1);
+        if (sts == 0) {
+            sts = copyWithoutSegment(&in, &out, App1StartOffset);
+            closeExifIO(&out);
         }
     }
-DONE:
-    if (fpw) {
-        fclose(fpw);
+    closeExifIO(&in);
+    return sts;
+}
+
+/**
+ * removeExifSegmentFromJPEGIO()
+ *
+ * Remove the Exif segment from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_POINTER
+ */
+int removeExifSegmentFromJPEGIO(ExifIO *in, ExifIO *out)
+{
+    int sts;
+
+    if (!in || !out || !out->write) {
+        return ERR_INVALID_POINTER;
     }
-    if (fpr) {
-        fclose(fpr);
+    sts = init(in);
+    if (sts <= 0) {
+        return sts;
     }
-    return sts;
+    return copyWithoutSegment(in, out, App1StartOffset);
 }
 
 /**
@@ -300,24 +755,83 @@ DONE:
  *      ERR_INVALID_IFD
  */
 int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
+{
+    ExifIO io;
+    int sts;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        memset(ifdArray, 0, sizeof(void*) * 32);
+        return ERR_READ_FILE;
+    }
+    sts = fillIfdTableArrayFromIO(&io, ifdArray);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * fillIfdTableArrayFromStream()
+ *
+ * Parse the JPEG header read from an opened stream and fill in the IFD table
+ *
+ * parameters
+ *  [in] fp : stream opened in binary mode
+ *  [out] ifdArray[32] : array of IfdTable pointers
+ *
+ * return
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ */
+int fillIfdTableArrayFromStream(FILE *fp, void* ifdArray[32])
+{
+    ExifIO io;
+    if (!fp) {
+        memset(ifdArray, 0, sizeof(void*) * 32);
+        return ERR_READ_FILE;
+    }
+    // the stream stays open, the backend is not closed
+    initStdioIO(&io, fp);
+    return fillIfdTableArrayFromIO(&io, ifdArray);
+}
+
+/**
+ * fillIfdTableArrayFromIO()
+ *
+ * Parse the JPEG header read through an I/O backend and fill in the IFD table
+ *
+ * parameters
+ *  [in] io : input backend
+ *  [out] ifdArray[32] : array of IfdTable pointers
+ *
+ * return
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ */
+int fillIfdTableArrayFromIO(ExifIO *io, void* ifdArray[32])
 {
     #define FMT_ERR "critical error in %s IFD\n"
 
     int sts = 1, ifdCount = 0;
     unsigned int ifdOffset;
-    FILE *fp = NULL;
     TagNode *tag;
 	IfdTable *ifd_0th, *ifd_exif, *ifd_gps, *ifd_io, *ifd_1st, *mpf_ifd;
 
     ifd_0th = ifd_exif = ifd_gps = ifd_io = ifd_1st = NULL;
     memset(ifdArray, 0, sizeof(void*) * 32);
 
-    fp = fopen(JPEGFileName, "rb");
-    if (!fp) {
+    if (!io) {
         sts = ERR_READ_FILE;
         goto DONE;
     }
-    sts = init(fp);
+    sts = init(io);
     if (sts <= 0) {
         goto DONE;
     }
@@ -328,7 +842,7 @@ int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
     }
 
     // for 0th IFD
-	ifd_0th = parseIFD(fp, App1StartOffset + offsetof(APP_HEADER, tiff), App1Header.tiff.Ifd0thOffset, IFD_0TH);
+	ifd_0th = parseIFD(io, App1StartOffset + offsetof(APP_HEADER, tiff), App1Header.tiff.Ifd0thOffset, IFD_0TH);
     if (!ifd_0th) {
         if (Verbose) {
             printf(FMT_ERR, "0th");
@@ -339,24 +853,43 @@ int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
     ifdArray[ifdCount++] = ifd_0th;
 
 	if (MPFStartOffset > 0) {
-		mpf_ifd = parseIFD(fp, MPFStartOffset + offsetof(MPF_HEADER, tiff), MPFHeader.tiff.Ifd0thOffset, IFD_MPF);
-		ifdArray[ifdCount++] = mpf_ifd;
+		MPFByteOrder = MPFHeader.tiff.byteOrder;
+		mpf_ifd = parseIFD(io, MPFStartOffset + offsetof(MPF_HEADER, tiff), MPFHeader.tiff.Ifd0thOffset, IFD_MPF);
+		MPFByteOrder = 0;
+		if (mpf_ifd) {
+			TagNode *list = getTagNodePtrFromIfd(mpf_ifd, TAG_MPImageList);
+			if (list && list->byteData &&
+				MPFHeader.tiff.byteOrder != App1Header.tiff.byteOrder) {
+				// keep the MP entries in the byte order of the Exif segment
+				// like the rest of the tables
+				unsigned int k;
+				for (k = 0; k + 16 <= list->count; k += 16) {
+					IMAGE_DIR_ENT *pDir = (IMAGE_DIR_ENT*)(list->byteData + k);
+					pDir->ImageFlags = swab32(pDir->ImageFlags);
+					pDir->ImageLength = swab32(pDir->ImageLength);
+					pDir->ImageStart = swab32(pDir->ImageStart);
+					pDir->Image1EntryNum = swab16(pDir->Image1EntryNum);
+					pDir->Image2EntryNum = swab16(pDir->Image2EntryNum);
+				}
+			}
+			ifdArray[ifdCount++] = mpf_ifd;
+		}
 	}
 
     // for Exif IFD 
     tag = getTagNodePtrFromIfd(ifd_0th, TAG_ExifIFDPointer);
-    if (tag && !tag->error) {
+    if (tag && !tag->error && tag->numData) {
         ifdOffset = tag->numData[0];
         if (ifdOffset != 0) {
-			ifd_exif = parseIFD(fp, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_EXIF);
+			ifd_exif = parseIFD(io, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_EXIF);
             if (ifd_exif) {
                 ifdArray[ifdCount++] = ifd_exif;
                 // for InteroperabilityIFDPointer IFD
                 tag = getTagNodePtrFromIfd(ifd_exif, TAG_InteroperabilityIFDPointer);
-                if (tag && !tag->error) {
+                if (tag && !tag->error && tag->numData) {
                     ifdOffset = tag->numData[0];
                     if (ifdOffset != 0) {
-						ifd_io = parseIFD(fp, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_IO);
+						ifd_io = parseIFD(io, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_IO);
                         if (ifd_io) {
                             ifdArray[ifdCount++] = ifd_io;
                         } else {
@@ -378,10 +911,10 @@ int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
 
     // for GPS IFD
     tag = getTagNodePtrFromIfd(ifd_0th, TAG_GPSInfoIFDPointer);
-    if (tag && !tag->error) {
+    if (tag && !tag->error && tag->numData) {
         ifdOffset = tag->numData[0];
         if (ifdOffset != 0) {
-			ifd_gps = parseIFD(fp, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_GPS);
+			ifd_gps = parseIFD(io, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_GPS);
             if (ifd_gps) {
                 ifdArray[ifdCount++] = ifd_gps;
             } else {
@@ -399,7 +932,7 @@ int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
         printf("1st IFD ifdOffset=%u\n", ifdOffset);
     }
     if (ifdOffset != 0) {
-		ifd_1st = parseIFD(fp, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_1ST);
+		ifd_1st = parseIFD(io, App1StartOffset + offsetof(APP_HEADER, tiff), ifdOffset, IFD_1ST);
         if (ifd_1st) {
             ifdArray[ifdCount++] = ifd_1st;
         } else {
@@ -411,9 +944,6 @@ int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32])
     }
 
 DONE:
-    if (fp) {
-        fclose(fp);
-    }
     return (sts <= 0) ? sts : ifdCount;
 }
 
@@ -440,2469 +970,10577 @@ DONE:
 void **createIfdTableArray(const char *JPEGFileName, int *result)
 {
     void* ifdTable[32];
-    void** ppIfdArray = NULL;
-    int i, count = fillIfdTableArray(JPEGFileName, ifdTable);
-    *result = count;
-    if (count > 0) {
-        // +1 extra NULL element to the array 
-        ppIfdArray = (void**)malloc(sizeof(void*)*(count+1));
-        memset(ppIfdArray, 0, sizeof(void*)*(count+1));
-        for (i = 0; ifdTable[i] != NULL; i++) {
-            ppIfdArray[i] = ifdTable[i];
+    void **ifdArray;
+    CACHE_KEY key;
+    int count, hit, useCache = cacheGetKey(JPEGFileName, &key);
+
+    // consult the metadata cache first if it is opened
+    if (useCache) {
+        ifdArray = lookupIfdTableCache(&key, result, &hit);
+        if (hit) {
+            return ifdArray;
         }
     }
-    return ppIfdArray;
+    count = fillIfdTableArray(JPEGFileName, ifdTable);
+    *result = count;
+    if (useCache && count != ERR_READ_FILE) {
+        storeIfdTableCache(&key, ifdTable, count);
+    }
+    return copyIfdTableArray(ifdTable, count);
 }
 
 /**
- * freeIfdTables()
+ * createIfdTableArrayFromIO()
  *
- * Free the pointer array of the IFD tables
+ * Parse the JPEG header read through an I/O backend and create the
+ * pointer array of the IFD tables
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [in] io : input backend
+ *  [out] result : result status value, same as createIfdTableArray()
+ *
+ * return
+ *   NULL: error or no Exif segment
+ *  !NULL: pointer array of the IFD tables
  */
-void freeIfdTables(void* ifdArray[32])
+void **createIfdTableArrayFromIO(ExifIO *io, int *result)
 {
-    int i;
-    for (i = 0; ifdArray[i] != NULL; i++) {
-        freeIfdTable(ifdArray[i]);
-    }
+    void* ifdTable[32];
+    int count = fillIfdTableArrayFromIO(io, ifdTable);
+    *result = count;
+    return copyIfdTableArray(ifdTable, count);
 }
 
 /**
- * freeIfdTableArray()
+ * openExifFileIO()
  *
- * Free the pointer array of the IFD tables
+ * Open a file as an I/O backend
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [out] io : backend to initialize
+ *  [in] fileName : target file
+ *  [in] forWrite : 0: open for reading  1: create for writing
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
  */
-void freeIfdTableArray(void **ifdArray)
+int openExifFileIO(ExifIO *io, const char *fileName, int forWrite)
 {
-    freeIfdTables(ifdArray);
-    free(ifdArray);
+    FILE *fp;
+#if defined(EXIF_HAVE_FD_IO)
+    if (!forWrite) {
+        int fd = fdOpenRead(fileName);
+        if (fd < 0) {
+            return ERR_READ_FILE;
+        }
+        openExifFdIO(io, fd);
+        io->close = fdClose;
+        return 0;
+    }
+#endif
+    fp = fopen(fileName, forWrite ? "wb" : "rb");
+    if (!fp) {
+        return forWrite ? ERR_WRITE_FILE : ERR_READ_FILE;
+    }
+    initStdioIO(io, fp);
+    if (forWrite) {
+        io->write = stdioWrite;
+    }
+    io->close = stdioClose;
+    return 0;
 }
 
 /**
- * getIfdType()
+ * openExifFdIO()
  *
- * Returns the type of the IFD
+ * Set up a read-only I/O backend over an opened file descriptor. The
+ * reads are positional (pread), the file position is neither used nor
+ * moved, so one descriptor can be shared by the backends of several
+ * threads parsing the same file at the same time.
  *
  * parameters
- *  [in] ifd: target IFD
+ *  [out] io : backend to initialize
+ *  [in] fd : file descriptor opened for reading
  *
  * return
- *  IFD TYPE value
+ *   0: OK
+ *  ERR_READ_FILE : invalid descriptor or not supported on the platform
+ *
+ * note
+ * closeExifIO() does not close the descriptor.
  */
-IFD_TYPE getIfdType(void *pIfd)
+int openExifFdIO(ExifIO *io, int fd)
 {
-    IfdTable *ifd = (IfdTable*)pIfd;
-    if (!ifd) {
-        return IFD_UNKNOWN;
+    memset(io, 0, sizeof(ExifIO));
+#if defined(EXIF_HAVE_FD_IO)
+    if (fd < 0) {
+        return ERR_READ_FILE;
     }
-    return ifd->ifdType;
+    io->readAt = fdReadAt;
+    io->size = fdSize;
+    io->context = (void*)(intptr_t)fd;
+    return 0;
+#else
+    (void)fd;
+    return ERR_READ_FILE;
+#endif
 }
 
 /**
- * dumpIfdTable()
+ * initExifMemoryIO()
  *
- * Dump the IFD table
+ * Set up an I/O backend over memory. Reads are served from 'data' and
+ * writes are appended to mem->out.
  *
  * parameters
- *  [in] ifd: target IFD
+ *  [out] io : backend to initialize
+ *  [out] mem : context of the backend, must outlive the backend
+ *  [in] data : data to read, may be NULL for an output-only backend
+ *  [in] length : length of the data
  */
+void initExifMemoryIO(ExifIO *io, ExifMemoryIO *mem,
+                      const void *data, size_t length)
+{
+    memset(mem, 0, sizeof(ExifMemoryIO));
+    mem->data = (const uint8_t*)data;
+    mem->length = data ? length : 0;
+    memset(io, 0, sizeof(ExifIO));
+    io->readAt = memoryReadAt;
+    io->size = memorySize;
+    io->write = memoryWrite;
+    io->context = mem;
+}
 
-void dumpIfdTable(void *pIfd, const char* filename)
+/**
+ * initExifRangeIO()
+ *
+ * Set up a read-only I/O backend over a range of another backend, e.g.
+ * one image of an MPO file. Offset 0 of the backend is 'offset' of the
+ * base, and nothing beyond the range is read.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [out] range : context of the backend, must outlive the backend
+ *  [in] base : backend the range is read from, must outlive the backend
+ *  [in] offset : start of the range
+ *  [in] length : length of the range, -1 up to the end of the base
+ */
+void initExifRangeIO(ExifIO *io, ExifRangeIO *range, ExifIO *base,
+                     int64_t offset, int64_t length)
 {
-    _dumpIfdTable(pIfd, NULL, filename);
+    range->base = base;
+    range->offset = offset;
+    range->length = length;
+    memset(io, 0, sizeof(ExifIO));
+    io->readAt = rangeReadAt;
+    io->size = rangeSize;
+    io->context = range;
 }
 
-void getIfdTableDump(void *pIfd, char **pp)
+/**
+ * closeExifIO()
+ *
+ * Release an I/O backend
+ *
+ * parameters
+ *  [in] io : backend to release
+ */
+void closeExifIO(ExifIO *io)
 {
-    if (pp) {
-        *pp = NULL;
+    if (io && io->close) {
+        io->close(io->context);
+        io->close = NULL;
     }
-    _dumpIfdTable(pIfd, pp);
 }
 
-static void _dumpIfdTable(void *pIfd, char **p, const char* filename)
+/**
+ * openExifPlannedIO()
+ *
+ * Set up a read planner over a backend with expensive range reads
+ * (network file systems, object storage). The first 'prefixSize' bytes
+ * are read speculatively, the JPEG segment chain is walked to find the
+ * Exif and MPF segments, and the parts of them beyond the prefix are
+ * fetched as a few coalesced range reads. The reads of the parser are
+ * then served from memory; a read outside of the plan is fetched on
+ * demand and counted as a miss.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [in] base : underlying backend, must outlive the planned backend
+ *  [in] prefixSize : size of the speculative read, 0 for
+ *                    EXIF_PLAN_PREFIX_SIZE
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The backend is read-only and must be released with closeExifIO(),
+ * which does not close 'base'.
+ */
+int openExifPlannedIO(ExifIO *io, ExifIO *base, size_t prefixSize)
 {
-    int i;
-    IfdTable *ifd;
-    TagNode *tag;
-    char tagName[512];
-    int cnt = 0;
-    unsigned int count;
+    READ_PLANNER *p;
+    int sts;
 
-    if (!pIfd) {
-        return;
+    if (!io || !base || !base->readAt) {
+        return ERR_READ_FILE;
     }
-    ifd = (IfdTable*)pIfd;
-
-    PRINTF(p, "\n{%s IFD}",
-        (ifd->ifdType == IFD_0TH)  ? "0TH" :
-        (ifd->ifdType == IFD_1ST)  ? "1ST" :
-        (ifd->ifdType == IFD_EXIF) ? "EXIF" :
-        (ifd->ifdType == IFD_GPS)  ? "GPS" :
-        (ifd->ifdType == IFD_IO)   ? "Interoperability" :
-		(ifd->ifdType == IFD_MPF)  ? "MPF" : "");
-
-    if (Verbose) {
-        PRINTF(p, " tags=%u\n", ifd->tagCount);
-    } else {
-        PRINTF(p, "\n");
+    p = (READ_PLANNER*)calloc(1, sizeof(READ_PLANNER));
+    if (!p) {
+        return ERR_MEMALLOC;
+    }
+    p->base = base;
+    p->prefixSize = (prefixSize > 0) ? prefixSize : EXIF_PLAN_PREFIX_SIZE;
+    p->end = -1;
+    sts = plannerBuild(p);
+    if (sts != 0) {
+        plannerClose(p);
+        return sts;
     }
-
-    tag = ifd->tags;
-    while (tag) {
-        if (Verbose) {
-            PRINTF(p, "tag[%02d] 0x%04X %s\n",
-                cnt++, tag->tagId, getTagName(ifd->ifdType, tag->tagId));
-            PRINTF(p, "\ttype=%u count=%u ", tag->type, tag->count);
-            PRINTF(p, "val=");
-        } else {
-            strcpy(tagName, getTagName(ifd->ifdType, tag->tagId));
-            PRINTF(p, " - %s: ", (strlen(tagName) > 0) ? tagName : "(unknown)");
-        }
-        if (tag->error) {
-            PRINTF(p, "(error)");
-        } else {
-            switch (tag->type) {
-            case TYPE_BYTE:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%u ", (uint8_t)tag->numData[i]);
-                }
-                break;
-
-            case TYPE_ASCII:
-                PRINTF(p, "[%s]", (char*)tag->byteData);
-                break;
-
-            case TYPE_SHORT:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%hu ", (uint16_t)tag->numData[i]);
-                }
-                break;
-
-            case TYPE_LONG:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%u ", tag->numData[i]);
-                }
-                break;
-
-            case TYPE_RATIONAL:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%u/%u ", tag->numData[i*2], tag->numData[i*2+1]);
-                }
-                break;
-
-            case TYPE_SBYTE:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%d ", (char)tag->numData[i]);
-                }
-                break;
-
-            case TYPE_UNDEFINED:
-                count = tag->count;
-                // omit too long data if !Verbose
-                if (count > 16 && !Verbose) {
-                    count = 16;
-                }
-				if (Verbose && tag->tagId == TAG_MPImageList) {
-					for (i = 0; i < count; i += 16) {
-						IMAGE_DIR_ENT* pDir = (IMAGE_DIR_ENT*) (tag->byteData + i);
-						PRINTF(p, "\n%08x ", fix_int((unsigned int)pDir->ImageFlags));
-						uint32_t length = fix_int((unsigned int)pDir->ImageLength);
-						PRINTF(p, "(%u bytes) ", length);
-                        uint32_t off = fix_int((unsigned int)pDir->ImageStart);
-						uint32_t start = (off > 0) ? (MPFStartOffset + 8 + off) : 0;
-						PRINTF(p, "@ %08x => %08x ", off, start);
-						PRINTF(p, "%04x %04x", fix_short(pDir->Image1EntryNum), fix_short(pDir->Image2EntryNum));
-						// Extract image from original filename
-						char pathname[MAX_PATH];
-						sprintf(pathname, "Extract%d.jpg", i / 16);
-						fprintf(stderr, "Write %s (%u bytes)\n", pathname, length);
-						FILE* fextract = fopen(pathname, "wb");
-						FILE* finput = fopen(filename, "rb");
-						fseek(finput, start, SEEK_SET);
-						for (int b = 0; b < length; ++b)
-						{
-							int c = fgetc(finput);
-							fputc(c, fextract);
-						}
-						fclose(finput);
-						fclose(fextract);
-					}
-				}
-				else {
-					for (i = 0; i < (int)count; i++) {
-						if (Verbose) {
-							// Always show hex if Verbose
-							const char* fmt = ((i & 31) == 31) ? "%02X\n" : "%02X ";
-							PRINTF(p, fmt, tag->byteData[i]);
-						}
-						else if (isgraph(tag->byteData[i])) {
-							// if character is printable
-							PRINTF(p, "%c ", tag->byteData[i]);
-						}
-						else {
-							PRINTF(p, "0x%02x ", tag->byteData[i]);
-						}
-					}
-				}
-                if (count < tag->count) {
-                    PRINTF(p, "(omitted)");
-                }
-                break;
-
-            case TYPE_SSHORT:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%hd ", (short)tag->numData[i]);
-                }
-                break;
-
-            case TYPE_SLONG:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%d ", (int)tag->numData[i]);
-                }
-                break;
-
-            case TYPE_SRATIONAL:
-                for (i = 0; i < (int)tag->count; i++) {
-                    PRINTF(p, "%d/%d ", (int)tag->numData[i*2], (int)tag->numData[i*2+1]);
-                }
-                break;
-
-            default:
-                break;
-            }
-        }
-        PRINTF(p, "\n");
-
-        tag = tag->next;
-    }
-    return;
-}
+    memset(io, 0, sizeof(ExifIO));
+    io->readAt = plannerReadAt;
+    io->size = plannerSize;
+    io->close = plannerClose;
+    io->context = p;
+    return 0;
+}
 
 /**
- * dumpIfdTableArray()
+ * getExifReadStats()
  *
- * Dump the array of the IFD tables
+ * Get the read statistics of a backend opened by openExifPlannedIO()
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [in] io : planned backend
+ *  [out] stats : statistics
+ *
+ * return
+ *   0: OK
+ *  ERR_INVALID_POINTER : 'io' is not a planned backend
  */
-void dumpIfdTableArray(void **ifdArray, const char* filename)
+int getExifReadStats(const ExifIO *io, ExifReadStats *stats)
 {
-    int i;
-    if (ifdArray) {
-        for (i = 0; ifdArray[i] != NULL; i++) {
-            dumpIfdTable(ifdArray[i], filename);
-        }
+    if (!io || !stats || io->readAt != plannerReadAt || !io->context) {
+        return ERR_INVALID_POINTER;
     }
+    *stats = ((READ_PLANNER*)io->context)->stats;
+    return 0;
 }
 
 /**
- * getTagInfo()
+ * getMpoEntries()
  *
- * Get the TagNodeInfo that matches the IFD_TYPE & TagId
+ * List the images of an MPO file from the MP entries of its MPF segment
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
- *  [in] ifdType : target IFD TYPE
- *  [in] tagId : target tag ID
+ *  [in] JPEGFileName : target file
+ *  [out] entries : array of the entries, may be NULL when maxEntries is 0
+ *  [in] maxEntries : size of the array
  *
  * return
- *   NULL: tag is not found
- *  !NULL: address of the TagNodeInfo structure
+ *   n: number of the images, may be larger than maxEntries
+ *   0: the MPF segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
+ *      ERR_MEMALLOC
  */
-TagNodeInfo *getTagInfo(void **ifdArray,
-                       IFD_TYPE ifdType,
-                       uint16_t tagId)
+int getMpoEntries(const char *JPEGFileName, ExifMpoEntry *entries, int maxEntries)
 {
-    int i;
-    if (!ifdArray) {
-        return NULL;
-    }
-    for (i = 0; ifdArray[i] != NULL; i++) {
-        if (getIfdType(ifdArray[i]) == ifdType) {
-            void *targetTag = getTagNodePtrFromIfd(ifdArray[i], tagId);
-            if (!targetTag) {
-                return NULL;
-            }
-            return (TagNodeInfo*)duplicateTagNode(targetTag);
-        }
+    ExifIO io;
+    int sts;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        return ERR_READ_FILE;
     }
-    return NULL;
+    sts = getMpoEntriesFromIO(&io, entries, maxEntries);
+    closeExifIO(&io);
+    return sts;
 }
 
 /**
- * getTagInfoFromIfd()
- *
- * Get the TagNodeInfo that matches the TagId
- *
- * parameters
- *  [in] ifd : target IFD table
- *  [in] tagId : target tag ID
+ * getMpoEntriesFromIO()
  *
- * return
- *  NULL: tag is not found
- *  !NULL: address of the TagNodeInfo structure
+ * List the images of an MPO file read through an I/O backend, same as
+ * getMpoEntries()
  */
-TagNodeInfo *getTagInfoFromIfd(void *ifd,
-                               uint16_t tagId)
+int getMpoEntriesFromIO(ExifIO *io, ExifMpoEntry *entries, int maxEntries)
 {
-    if (!ifd) {
-        return NULL;
+    uint8_t hdr[4], *buf = NULL;
+    uint16_t len;
+    int64_t ofs;
+    int sts;
+
+    if (!io || (maxEntries > 0 && !entries)) {
+        return ERR_READ_FILE;
     }
-    return (TagNodeInfo*)getTagNodePtrFromIfd(ifd, tagId);
+    ofs = getAppNStartOffset(io, APP2_MARKER, MPF_ID_STR, MPF_ID_STR_LEN, NULL, NULL);
+    if (ofs <= 0) {
+        return (int)ofs;
+    }
+    if (!ioReadFull(io, ofs, hdr, sizeof(hdr))) {
+        return ERR_READ_FILE;
+    }
+    len = (uint16_t)((hdr[2] << 8) | hdr[3]);
+    if (len < 2 + MPF_ID_STR_LEN + 8) {
+        return ERR_INVALID_IFD;
+    }
+    len -= 2;
+    buf = (uint8_t*)malloc(len);
+    if (!buf) {
+        return ERR_MEMALLOC;
+    }
+    if (!ioReadFull(io, ofs + 4, buf, len)) {
+        sts = ERR_READ_FILE;
+        goto DONE;
+    }
+    sts = mpoParseSegment(buf, len, ofs, entries, maxEntries);
+DONE:
+    free(buf);
+    return sts;
+}
+
+// MP entries of the MPF segment at 'ofs' from its data following the
+// length field; returns the number of images or ERR_INVALID_IFD
+static int mpoParseSegment(const uint8_t *data, size_t length, int64_t ofs,
+                           ExifMpoEntry *entries, int maxEntries)
+{
+    TIFF_VIEW v;
+    const uint8_t *ifd, *list = NULL;
+    uint32_t count = 0;
+    uint16_t type;
+    int i, n;
+
+    // the MPF segment has its own byte order
+    if (length < MPF_ID_STR_LEN + 8 ||
+        !tiffInitHeader(&v, data + MPF_ID_STR_LEN, length - MPF_ID_STR_LEN)) {
+        return ERR_INVALID_IFD;
+    }
+    n = tiffGetIfd(&v, tiffGet32(&v, v.tiff + 4), &ifd);
+    for (i = 0; i < n; i++) {
+        if (tiffGet16(&v, ifd + i * 12) == TAG_MPImageList) {
+            list = tiffGetValue(&v, ifd + i * 12, &type, &count);
+            break;
+        }
+    }
+    if (!list) {
+        return ERR_INVALID_IFD;
+    }
+    // the offsets are relative to the TIFF header, 0 for the first image
+    n = (int)(count / 16);
+    for (i = 0; i < n && i < maxEntries; i++) {
+        const uint8_t *p = list + i * 16;
+        uint32_t start = tiffGet32(&v, p + 8);
+        entries[i].flags = tiffGet32(&v, p);
+        entries[i].length = tiffGet32(&v, p + 4);
+        entries[i].offset = (start > 0) ? ofs + 4 + MPF_ID_STR_LEN + start : 0;
+        entries[i].dependent1 = tiffGet16(&v, p + 12);
+        entries[i].dependent2 = tiffGet16(&v, p + 14);
+    }
+    return n;
 }
 
 /**
- * freeTagInfo()
+ * extractMpoFrameIO()
  *
- * Free the TagNodeInfo allocated by getTagInfo() or getTagInfoFromIfd()
+ * Copy one image of an MPO file to the output in large blocks. Use the
+ * memory backend (initExifMemoryIO()) to get the image in a buffer.
  *
  * parameters
- *  [in] tag : target TagNodeInfo
+ *  [in] in : input backend
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE : the image is out of the input
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
  */
-void freeTagInfo(void *tag)
+int extractMpoFrameIO(ExifIO *in, const ExifMpoEntry *entry, ExifIO *out)
 {
-    freeTagNode(tag);
+    int sts;
+    if (!in || !entry || !out || !out->write || entry->offset < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    sts = ioCopyRange(in, entry->offset, entry->offset + entry->length, out);
+    return (sts != 0) ? sts : 1;
 }
 
 /**
- * queryTagNodeIsExist()
+ * extractMpoFrameToFd()
  *
- * Query if the specified tag node is exist in the IFD tables
+ * Copy one image of an MPO file between file descriptors. The input is
+ * read at the offset of the image without moving its file position; the
+ * output is written at its current position. On Linux the data is copied
+ * in the kernel (copy_file_range) when the file systems allow it.
  *
  * parameters
- *  [in] ifdTableArray: address of the IFD tables array
- *  [in] ifdType : target IFD type
- *  [in] tagId : target tag ID
+ *  [in] inFd : input file descriptor
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] outFd : output file descriptor
  *
  * return
- *  0: not exist
- *  1: exist
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE : the image is out of the input
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
  */
-int queryTagNodeIsExist(void **ifdTableArray,
-                        IFD_TYPE ifdType,
-                        uint16_t tagId)
+int extractMpoFrameToFd(int inFd, const ExifMpoEntry *entry, int outFd)
 {
-    IfdTable *ifd;
-    TagNode *tag;
-    if (!ifdTableArray) {
-        return 0;
+    #define MPO_COPY_SIZE (1024 * 1024)
+
+#if defined(EXIF_HAVE_FD_IO)
+    ExifIO in;
+    uint8_t *buf;
+    int64_t pos, end;
+    size_t want;
+    int sts = 1;
+
+    if (inFd < 0 || outFd < 0 || !entry || entry->offset < 0) {
+        return ERR_INVALID_POINTER;
     }
-    ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
-    if (!ifd) {
-        return 0;
+    pos = entry->offset;
+    end = entry->offset + entry->length;
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    while (pos < end) {
+        int64_t inOffset = pos;
+        long n = syscall(__NR_copy_file_range, inFd, &inOffset, outFd, NULL,
+                         (size_t)(end - pos), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            // not supported between these files, copy in blocks instead
+            if (pos == entry->offset && (errno == EXDEV || errno == EINVAL ||
+                errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                break;
+            }
+            return ERR_WRITE_FILE;
+        }
+        if (n == 0) {
+            return ERR_READ_FILE; // the image is out of the input
+        }
+        pos += n;
     }
-    tag = getTagNodePtrFromIfd(ifd, tagId);
-    if (!tag) {
-        return 0;
+    if (pos == end) {
+        return 1;
     }
-    return 1;
+#endif
+    buf = (uint8_t*)malloc(MPO_COPY_SIZE);
+    if (!buf) {
+        return ERR_MEMALLOC;
+    }
+    openExifFdIO(&in, inFd);
+    while (pos < end) {
+        want = (end - pos < MPO_COPY_SIZE) ? (size_t)(end - pos) : MPO_COPY_SIZE;
+        if (ioRead(&in, pos, buf, want) != (int64_t)want) {
+            sts = ERR_READ_FILE;
+            break;
+        }
+        if (!fdWriteAll(outFd, buf, want)) {
+            sts = ERR_WRITE_FILE;
+            break;
+        }
+        pos += want;
+    }
+    free(buf);
+    return sts;
+#else
+    (void)inFd; (void)entry; (void)outFd;
+    return ERR_READ_FILE;
+#endif
 }
 
 /**
- * createTagInfo()
+ * extractMpoFrameToFile()
  *
- * Create new TagNodeInfo block
+ * Write one image of an MPO file to a new file, see extractMpoFrameToFd()
  *
  * parameters
- *  [in] tagId: id of the tag
- *  [in] type: type of the tag
- *  [in] count: data count of the tag
- *  [out] pResult : error status
- *   0: OK
- *  -n: error
- *      ERR_INVALID_TYPE
- *      ERR_INVALID_COUNT
- *      ERR_MEMALLOC
+ *  [in] JPEGFileName : input MPO file
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] outFileName : file to create
  *
  * return
- *  NULL: error
- * !NULL: address of the newly created TagNodeInfo
+ *   same as extractMpoFrameToFd()
  */
-TagNodeInfo *createTagInfo(uint16_t tagId,
-                           uint16_t type,
-                           unsigned int count,
-                           int *pResult)
+int extractMpoFrameToFile(const char *JPEGFileName, const ExifMpoEntry *entry,
+                          const char *outFileName)
 {
-    TagNode *tag;
-    if (type < TYPE_BYTE || type > TYPE_SRATIONAL) {
-        if (pResult) {
-            *pResult = ERR_INVALID_TYPE;
-        }
-        return NULL;
+    int sts;
+#if defined(EXIF_HAVE_FD_IO)
+    int inFd, outFd;
+    if (!entry) {
+        return ERR_INVALID_POINTER;
     }
-    if (count <= 0) {
-        if (pResult) {
-            *pResult = ERR_INVALID_COUNT;
-        }
-        return NULL;
+    inFd = fdOpenRead(JPEGFileName);
+    if (inFd < 0) {
+        return ERR_READ_FILE;
     }
-    tag = (TagNode*)malloc(sizeof(TagNode));
-    if (!tag) {
-        if (pResult) {
-            *pResult = ERR_MEMALLOC;
-        }
-        return NULL;
+    outFd = fdCreate(outFileName);
+    if (outFd < 0) {
+        fdClose((void*)(intptr_t)inFd);
+        return ERR_WRITE_FILE;
     }
-    memset(tag, 0, sizeof(TagNode));
-    tag->tagId = tagId;
-    tag->type = type;
-    tag->count = count;
-
-    if (type == TYPE_ASCII || type == TYPE_UNDEFINED) {
-        tag->byteData = (uint8_t*)malloc(count*sizeof(char));
+    sts = extractMpoFrameToFd(inFd, entry, outFd);
+    fdClose((void*)(intptr_t)outFd);
+    fdClose((void*)(intptr_t)inFd);
+#else
+    ExifIO in, out;
+    if (!entry) {
+        return ERR_INVALID_POINTER;
     }
-    else if (type == TYPE_BYTE   ||
-             type == TYPE_SBYTE  ||
-             type == TYPE_SHORT  ||
-             type == TYPE_LONG   ||
-             type == TYPE_SSHORT ||
-             type == TYPE_SLONG) {
-        tag->numData = (unsigned int*)malloc(count*sizeof(int));
+    sts = openExifFileIO(&in, JPEGFileName, 0);
+    if (sts != 0) {
+        return sts;
     }
-    else if (type == TYPE_RATIONAL ||
-             type == TYPE_SRATIONAL) {
-        tag->numData = (unsigned int*)malloc(count*sizeof(int)*2);
+    sts = openExifFileIO(&out, outFileName, 1);
+    if (sts == 0) {
+        sts = extractMpoFrameIO(&in, entry, &out);
+        closeExifIO(&out);
     }
-    if (pResult) {
-        *pResult = 0;
+    closeExifIO(&in);
+#endif
+    return sts;
+}
+
+// name of image i of extractMpoFrames() and the temporary name it is
+// written to, returns 0 if they fit in the buffers of MAX_MPO_NAME bytes
+#define MAX_MPO_NAME    4096
+static int mpoOutputName(const char *outFormat, int i, char *name, char *tmpName)
+{
+    if (snprintf(name, MAX_MPO_NAME, outFormat, i) >= MAX_MPO_NAME ||
+        snprintf(tmpName, MAX_MPO_NAME, "%s.tmp", name) >= MAX_MPO_NAME) {
+        return -1;
     }
-    return (TagNodeInfo*)tag;
+    return 0;
 }
 
-/**
- * removeIfdTableFromIfdTableArray()
- *
- * Remove the IFD table from the ifdTableArray
- *
- * parameters
- *  [in] ifdTableArray: address of the IFD tables array
- *  [in] ifdType : target IFD type
- *
- * return
- *  n: number of the removed IFD tables
- */
-int removeIfdTableFromIfdTableArray(void **ifdTableArray, IFD_TYPE ifdType)
+// rename the temporary files of the first 'count' images of
+// extractMpoFrames() to their names, or remove them if !keep
+static int mpoFinishOutputs(const char *outFormat, int count, int keep)
 {
-    int i, num = 0, ret = 0;
-    if (!ifdTableArray) {
-        return 0;
+    char name[MAX_MPO_NAME], tmpName[MAX_MPO_NAME];
+    int i, sts = 0;
+
+    for (i = 0; i < count; i++) {
+        if (mpoOutputName(outFormat, i, name, tmpName) != 0) {
+            continue;
+        }
+        if (keep && sts == 0) {
+#if !defined(EXIF_HAVE_PREAD)
+            remove(name);
+#endif
+            if (rename(tmpName, name) == 0) {
+                continue;
+            }
+            sts = ERR_WRITE_FILE;
+        }
+        remove(tmpName);
     }
-    // count IFD tables
-    num = countIfdTableOnIfdTableArray(ifdTableArray);
-    for (;;) { // possibility of multiple entries
-        for (i = 0; i < num; i++) {
-            IfdTable *ifd = ifdTableArray[i];
-            if (ifd->ifdType == ifdType) {
-                freeIfdTable(ifd);
-                ifdTableArray[i] = NULL;
-                ret++;
-                break;
+    return sts;
+}
+
+#if defined(EXIF_HAVE_PREAD)
+
+static void *batchWorker(void *arg)
+{
+    BATCH_JOB *job = (BATCH_JOB*)arg;
+    int index, sts;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        index = (job->status == 0 && job->next < job->count) ? job->next++ : -1;
+        pthread_mutex_unlock(&job->lock);
+        if (index < 0) {
+            break;
+        }
+        sts = job->work(job->context, index);
+        if (sts != 0) {
+            pthread_mutex_lock(&job->lock);
+            if (job->status == 0) {
+                job->status = sts;
             }
+            pthread_mutex_unlock(&job->lock);
         }
-        if (i == num) {
-            break; // no more found
+    }
+    return NULL;
+}
+
+// call work(context, i) for i = 0 .. count-1 on 'threads' threads (0 or
+// less: one per CPU), the calling thread being one of them; the items
+// are taken in order, returns the first non-zero return of work or 0
+static int runBatch(BATCH_WORK work, void *context, int count, int threads)
+{
+    BATCH_JOB job;
+    pthread_t *workers;
+    int i, started = 0;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (int)cpus : 1;
+    }
+    if (threads > count) {
+        threads = (count > 0) ? count : 1;
+    }
+    job.work = work;
+    job.context = context;
+    job.count = count;
+    job.next = 0;
+    job.status = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    if (workers) {
+        for (started = 0; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, batchWorker, &job) != 0) {
+                break;
+            }
         }
-        // left justify the array
-        memcpy(&ifdTableArray[i], &ifdTableArray[i+1], (num-i) * sizeof(void*));
-        num--;
     }
-    return ret;
+    batchWorker(&job); // the calling thread works too
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+    free(workers);
+    return job.status;
 }
 
+#endif
+
 /**
- * insertIfdTableToIfdTableArray()
+ * extractMpoFrames()
  *
- * Insert new IFD table to the ifdTableArray
+ * Write every image of an MPO file to its own file on several threads.
+ * The images are split into chunks that the threads copy with positional
+ * reads and writes (copy_file_range on Linux) from one shared descriptor,
+ * so a few large images are spread over the threads too.
  *
  * parameters
- *  [in] ifdTableArray: address of the IFD tables array
- *  [in] ifdType : target IFD type
- *  [out] pResult : error status
- *   0: OK
- *  -n: error
- *      ERR_ALREADY_EXIST
- *      ERR_MEMALLOC
+ *  [in] JPEGFileName : input MPO file
+ *  [in] outFormat : printf format of the output file names with one %d
+ *                   for the image index, e.g. "frame%d.jpg"
+ *  [in] threads : number of threads, 0 for the number of CPUs
+ *  [in] progress : called after each chunk, may be NULL
+ *  [in] context : passed to progress
  *
  * return
- *  NULL: error
- * !NULL: address of the newly created ifdTableArray
+ *   n: number of the images written
+ *   0: the MPF segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
+ *      ERR_MEMALLOC
+ *      ERR_INVALID_POINTER
  *
  * note
- * This function frees old ifdTableArray if is not NULL.
+ * Each image is written to "<name>.tmp" and all of them are renamed once
+ * every image is complete; on an error the temporary files are removed,
+ * so no truncated image is left under its name.
+ * Without POSIX threads the images are written one after another.
  */
-void **insertIfdTableToIfdTableArray(void **ifdTableArray,
-                                     IFD_TYPE ifdType,
-                                     int *pResult)
+#if defined(EXIF_HAVE_PREAD)
+
+// size of the pieces the images are split into
+#define MPO_CHUNK_SIZE  (8 * 1024 * 1024)
+
+// state shared by the threads of extractMpoFrames() - internal use
+typedef struct _mpoJob {
+    int inFd;
+    const ExifMpoEntry *entries;
+    const int *outFds;
+    int *firstChunk;        // index of the first chunk of each image, count + 1
+    int *chunksLeft;        // chunks of each image not copied yet
+    int count;
+    int framesDone;
+    uint64_t bytesDone;
+    uint64_t bytesTotal;
+    ExifMpoProgress progress;
+    void *context;
+    pthread_mutex_t lock;   // for the progress counters
+} MPO_JOB;
+_Static_assert(offsetof(MPO_JOB, lock) % _Alignof(pthread_mutex_t) == 0,
+               "MPO_JOB must not be packed");
+
+// copy 'length' bytes at inOffset of the input to outOffset of the output
+static int mpoCopyChunk(int inFd, int64_t inOffset, int outFd, int64_t outOffset,
+                        size_t length, uint8_t *buf)
 {
-    void *newIfd;
-    void **newIfdTableArray;
-    int num = 0;
-    if (!ifdTableArray) {
-        num = 0;
-    } else {
-        num = countIfdTableOnIfdTableArray(ifdTableArray);
+    ssize_t n;
+    size_t want, done;
+#if defined(__linux__) && defined(__NR_copy_file_range)
+    int first = 1;
+    while (length > 0) {
+        int64_t in = inOffset, out = outOffset;
+        long copied = syscall(__NR_copy_file_range, inFd, &in, outFd, &out, length, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied < 0) {
+            // not supported between these files, copy in blocks instead
+            if (first && (errno == EXDEV || errno == EINVAL ||
+                errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                break;
+            }
+            return ERR_WRITE_FILE;
+        }
+        if (copied == 0) {
+            return ERR_READ_FILE; // the image is out of the input
+        }
+        first = 0;
+        inOffset += copied;
+        outOffset += copied;
+        length -= (size_t)copied;
     }
-    if (num > 0 && getIfdTableFromIfdTableArray(ifdTableArray, ifdType) != NULL) {
-        if (pResult) {
-            *pResult = ERR_ALREADY_EXIST;
+#endif
+    while (length > 0) {
+        want = (length < MPO_COPY_SIZE) ? length : MPO_COPY_SIZE;
+        do {
+            n = pread(inFd, buf, want, (off_t)inOffset);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) {
+            return ERR_READ_FILE;
         }
-        return NULL;
+        want = (size_t)n;
+        for (done = 0; done < want; done += (size_t)n) {
+            n = pwrite(outFd, buf + done, want - done, (off_t)(outOffset + done));
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            if (n <= 0) {
+                return ERR_WRITE_FILE;
+            }
+        }
+        inOffset += want;
+        outOffset += want;
+        length -= want;
     }
-    // create the new IFD table
-    newIfd = createIfdTable(ifdType, 0, 0);
-    if (!newIfd) {
-        if (pResult) {
-            *pResult = ERR_MEMALLOC;
+    return 0;
+}
+
+// copy chunk 'index' of the images
+static int mpoCopyWork(void *context, int index)
+{
+    MPO_JOB *job = (MPO_JOB*)context;
+    const ExifMpoEntry *entry;
+    uint8_t *buf;
+    int64_t offset;
+    size_t length;
+    int frame = 0, sts;
+
+    while (job->firstChunk[frame + 1] <= index) {
+        frame++;
+    }
+    entry = &job->entries[frame];
+    offset = (int64_t)(index - job->firstChunk[frame]) * MPO_CHUNK_SIZE;
+    length = (entry->length - offset < MPO_CHUNK_SIZE) ?
+             (size_t)(entry->length - offset) : MPO_CHUNK_SIZE;
+    buf = (uint8_t*)malloc(MPO_COPY_SIZE);
+    if (!buf) {
+        return ERR_MEMALLOC;
+    }
+    sts = mpoCopyChunk(job->inFd, entry->offset + offset,
+                       job->outFds[frame], offset, length, buf);
+    free(buf);
+    if (sts != 0) {
+        return sts;
+    }
+    pthread_mutex_lock(&job->lock);
+    job->bytesDone += length;
+    if (--job->chunksLeft[frame] == 0) {
+        job->framesDone++;
+    }
+    if (job->progress) {
+        job->progress(job->context, job->framesDone, job->count,
+                      job->bytesDone, job->bytesTotal);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return 0;
+}
+
+int extractMpoFrames(const char *JPEGFileName, const char *outFormat, int threads,
+                     ExifMpoProgress progress, void *context)
+{
+    MPO_JOB job;
+    ExifMpoEntry *entries = NULL;
+    int *outFds = NULL;
+    char name[MAX_MPO_NAME], tmpName[MAX_MPO_NAME];
+    ExifIO io;
+    int64_t chunks = 0;
+    int i, n, created = 0, sts;
+
+    if (!outFormat) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(&job, 0, sizeof(job));
+    job.inFd = fdOpenRead(JPEGFileName);
+    if (job.inFd < 0) {
+        return ERR_READ_FILE;
+    }
+    openExifFdIO(&io, job.inFd);
+    n = getMpoEntriesFromIO(&io, NULL, 0);
+    if (n <= 0) {
+        close(job.inFd);
+        return n;
+    }
+    entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+    outFds = (int*)malloc(sizeof(int) * n);
+    job.firstChunk = (int*)calloc(n + 1, sizeof(int));
+    job.chunksLeft = (int*)calloc(n, sizeof(int));
+    if (!entries || !outFds || !job.firstChunk || !job.chunksLeft) {
+        sts = ERR_MEMALLOC;
+        n = 0;
+        goto DONE;
+    }
+    for (i = 0; i < n; i++) {
+        outFds[i] = -1;
+    }
+    getMpoEntriesFromIO(&io, entries, n);
+
+    // create the outputs in their final size, the chunks are written
+    // at their offsets
+    for (i = 0; i < n; i++) {
+        if (mpoOutputName(outFormat, i, name, tmpName) != 0) {
+            sts = ERR_WRITE_FILE;
+            goto DONE;
         }
-        return NULL;
+        outFds[i] = fdCreate(tmpName);
+        if (outFds[i] >= 0) {
+            created = i + 1;
+        }
+        if (outFds[i] < 0 || ftruncate(outFds[i], (off_t)entries[i].length) != 0) {
+            sts = ERR_WRITE_FILE;
+            goto DONE;
+        }
+        job.chunksLeft[i] = (int)((entries[i].length + (uint64_t)MPO_CHUNK_SIZE - 1) / MPO_CHUNK_SIZE);
+        if (job.chunksLeft[i] == 0) {
+            job.framesDone++;
+        }
+        chunks += job.chunksLeft[i];
+        if (chunks > INT_MAX) {
+            sts = ERR_INVALID_JPEG;
+            goto DONE;
+        }
+        job.firstChunk[i + 1] = (int)chunks;
+        job.bytesTotal += entries[i].length;
+    }
+    job.entries = entries;
+    job.outFds = outFds;
+    job.count = n;
+    job.progress = progress;
+    job.context = context;
+
+    pthread_mutex_init(&job.lock, NULL);
+    sts = runBatch(mpoCopyWork, &job, (int)chunks, threads);
+    pthread_mutex_destroy(&job.lock);
+    if (sts == 0) {
+        sts = n;
     }
-    // copy existing IFD tables to the new array
-    newIfdTableArray = (void**)malloc(sizeof(void*)*(num+2));
-    if (!newIfdTableArray) {
-        if (pResult) {
-            *pResult = ERR_MEMALLOC;
+
+DONE:
+    if (outFds) {
+        for (i = 0; i < n; i++) {
+            if (outFds[i] >= 0) {
+                close(outFds[i]);
+            }
         }
-        free(newIfd);
-        return NULL;
     }
-    memset(newIfdTableArray, 0, sizeof(void*)*(num+2));
-    if (num > 0) {
-        memcpy(newIfdTableArray, ifdTableArray, num * sizeof(void*));
+    if (mpoFinishOutputs(outFormat, created, sts > 0) != 0) {
+        sts = ERR_WRITE_FILE;
     }
-    // add the new IFD table
-    newIfdTableArray[num] = newIfd;
-    if (ifdTableArray) {
-        free(ifdTableArray); // free the old array
+    close(job.inFd);
+    free(job.firstChunk);
+    free(job.chunksLeft);
+    free(outFds);
+    free(entries);
+    return sts;
+}
+
+#else
+
+int extractMpoFrames(const char *JPEGFileName, const char *outFormat, int threads,
+                     ExifMpoProgress progress, void *context)
+{
+    ExifMpoEntry *entries;
+    uint64_t bytesDone = 0, bytesTotal = 0;
+    char name[MAX_MPO_NAME], tmpName[MAX_MPO_NAME];
+    int i, n, sts;
+
+    (void)threads;
+    if (!outFormat) {
+        return ERR_INVALID_POINTER;
     }
-    if (pResult) {
-        *pResult = 0;
+    n = getMpoEntries(JPEGFileName, NULL, 0);
+    if (n <= 0) {
+        return n;
     }
-    return newIfdTableArray;
+    entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+    if (!entries) {
+        return ERR_MEMALLOC;
+    }
+    n = getMpoEntries(JPEGFileName, entries, n);
+    for (i = 0; i < n; i++) {
+        bytesTotal += entries[i].length;
+    }
+    sts = n;
+    for (i = 0; i < n; i++) {
+        if (mpoOutputName(outFormat, i, name, tmpName) != 0) {
+            sts = ERR_WRITE_FILE;
+            break;
+        }
+        sts = extractMpoFrameToFile(JPEGFileName, &entries[i], tmpName);
+        if (sts != 1) {
+            i++; // the temporary file may have been created
+            break;
+        }
+        sts = n;
+        bytesDone += entries[i].length;
+        if (progress) {
+            progress(context, i + 1, n, bytesDone, bytesTotal);
+        }
+    }
+    if (mpoFinishOutputs(outFormat, i, sts > 0) != 0) {
+        sts = ERR_WRITE_FILE;
+    }
+    free(entries);
+    return sts;
 }
 
+#endif
+
 /**
- * removeTagNodeFromIfdTableArray()
+ * getExifPreviews()
  *
- * Remove the specified tag node from the IFD table
+ * List the JPEG previews embedded in a JPEG file: the thumbnail of the
+ * 1st IFD and the images of the MPF segment other than the primary one.
+ * The dimensions are read from the frame header of each preview, which
+ * is found by walking its segments; nothing is copied or decoded.
  *
  * parameters
- *  [in] ifdTableArray: address of the IFD tables array
- *  [in] ifdType : target IFD type
- *  [in] tagId : target tag ID
+ *  [in] JPEGFileName : target file
+ *  [out] previews : array of the previews, may be NULL when maxPreviews is 0
+ *  [in] maxPreviews : size of the array
  *
  * return
- *  n: number of the removed tags
+ *   n: number of the previews, may be larger than maxPreviews
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_MEMALLOC
+ *
+ * note
+ * A preview whose frame header cannot be read is left out.
  */
-int removeTagNodeFromIfdTableArray(void **ifdTableArray,
-                             IFD_TYPE ifdType,
-                             uint16_t tagId)
+int getExifPreviews(const char *JPEGFileName, ExifPreview *previews, int maxPreviews)
 {
-    IfdTable *ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
-    if (!ifd) {
-        return 0;
+    ExifIO io;
+    int sts;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        return ERR_READ_FILE;
     }
-    return removeTagOnIfd(ifd, tagId);
+    sts = getExifPreviewsFromIO(&io, previews, maxPreviews);
+    closeExifIO(&io);
+    return sts;
 }
 
 /**
- * insertTagNodeToIfdTableArray()
+ * getExifPreviewsFromIO()
  *
- * Insert the specified tag node to the IFD table
- *
- * parameters
- *  [in] ifdTableArray: address of the IFD tables array
- *  [in] ifdType : target IFD type
- *  [in] tagNodeInfo: address of the TagNodeInfo
- *
- * note
- * This function uses the copy of the specified tag data.
- * The caller must free it after this function returns.
- *
- * return
- *  0: OK
- *  ERR_INVALID_POINTER:
- *  ERR_NOT_EXIST:
- *  ERR_ALREADY_EXIST:
- *  ERR_UNKNOWN:
+ * Same as getExifPreviews() for a JPEG read through an I/O backend
  */
-int insertTagNodeToIfdTableArray(void **ifdTableArray,
-                             IFD_TYPE ifdType,
-                             TagNodeInfo *tagNodeInfo)
+int getExifPreviewsFromIO(ExifIO *io, ExifPreview *previews, int maxPreviews)
 {
-    IfdTable *ifd;
-    if (!ifdTableArray) {
-        return ERR_INVALID_POINTER;
+    ExifMpoEntry *entries = NULL;
+    ExifPreview preview;
+    JPEG_SOF sof;
+    int64_t offset, fileSize;
+    uint32_t length;
+    int i, n, count = 0, sts;
+
+    if (!io || (maxPreviews > 0 && !previews)) {
+        return ERR_READ_FILE;
     }
-    if (!tagNodeInfo) {
-        return ERR_INVALID_POINTER;
+    // a preview must lie within the file, a truncated one is left out
+    fileSize = io->size(io->context);
+    if (fileSize < 0) {
+        return ERR_READ_FILE;
     }
-    ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
-    if (!ifd) {
-        return ERR_NOT_EXIST;
+    // the thumbnail of the 1st IFD
+    sts = getExifThumbnailRangeFromIO(io, &offset, &length);
+    if (sts == ERR_READ_FILE || sts == ERR_INVALID_JPEG) {
+        return sts;
     }
-    // already exists the same type entry
-    if (getTagNodePtrFromIfd(ifd, tagNodeInfo->tagId) != NULL) {
-        return ERR_ALREADY_EXIST;
+    if (sts == 1 && offset + length <= fileSize &&
+        jpegScanSof(io, offset, offset + length, &sof) == 1) {
+        preview.source = EXIF_PREVIEW_IFD1;
+        preview.index = 0;
+        preview.offset = offset;
+        preview.length = length;
+        preview.width = sof.width;
+        preview.height = sof.height;
+        if (count < maxPreviews) {
+            previews[count] = preview;
+        }
+        count++;
     }
-    // add to the IFD table
-    if (!addTagNodeToIfd(ifd, 
-                    tagNodeInfo->tagId,
-                    tagNodeInfo->type,
-                    tagNodeInfo->count,
-                    tagNodeInfo->numData,
-                    tagNodeInfo->byteData)) {
-        return ERR_UNKNOWN;
+
+    // the images of the MPF segment except the primary one
+    n = getMpoEntriesFromIO(io, NULL, 0);
+    if (n > 1) {
+        entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+        if (!entries) {
+            return ERR_MEMALLOC;
+        }
+        n = getMpoEntriesFromIO(io, entries, n);
+        for (i = 1; i < n; i++) {
+            if (entries[i].offset <= 0 || entries[i].length == 0 ||
+                entries[i].offset > fileSize ||
+                entries[i].length > (uint64_t)(fileSize - entries[i].offset) ||
+                jpegScanSof(io, entries[i].offset,
+                            entries[i].offset + entries[i].length, &sof) != 1) {
+                continue;
+            }
+            preview.source = EXIF_PREVIEW_MPF;
+            preview.index = i;
+            preview.offset = entries[i].offset;
+            preview.length = entries[i].length;
+            preview.width = sof.width;
+            preview.height = sof.height;
+            if (count < maxPreviews) {
+                previews[count] = preview;
+            }
+            count++;
+        }
+        free(entries);
     }
-    ifd->tagCount++;
-    return 0;
+    return count;
 }
 
 /**
- * getThumbnailDataOnIfdTableArray()
+ * selectExifPreview()
  *
- * Get a copy of the thumbnail data from the 1st IFD table
+ * Choose the smallest preview that is at least minWidth x minHeight
  *
  * parameters
- *  [in] ifdTableArray : address of the IFD tables array
- *  [out] pLength : returns the length of the thumbnail data
- *  [out] pResult : error status
- *   0: OK
+ *  [in] previews : from getExifPreviews()
+ *  [in] count : number of the previews
+ *  [in] minWidth : required width
+ *  [in] minHeight : required height
+ *
+ * return
+ *   n: index of the preview
+ *  -1: no preview is large enough, the primary image has to be used
+ */
+int selectExifPreview(const ExifPreview *previews, int count,
+                      unsigned int minWidth, unsigned int minHeight)
+{
+    uint64_t area, bestArea = 0;
+    int i, best = -1;
+
+    for (i = 0; previews && i < count; i++) {
+        if (previews[i].width < minWidth || previews[i].height < minHeight) {
+            continue;
+        }
+        area = (uint64_t)previews[i].width * previews[i].height;
+        if (best < 0 || area < bestArea ||
+            (area == bestArea && previews[i].length < previews[best].length)) {
+            best = i;
+            bestArea = area;
+        }
+    }
+    return best;
+}
+
+/**
+ * openMpoFrameReader()
+ *
+ * Open an MPO file to read the Exif data of each image on demand. Only
+ * the MP entries are read here; getMpoFrameIfdTableArray() parses the
+ * segments of one image within its byte range when it is first asked
+ * for, and keeps the result.
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] result : result status
+ *   n: number of the images
+ *   0: the MPF segment is not found
  *  -n: error
- *      ERR_INVALID_POINTER
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
  *      ERR_MEMALLOC
- *      ERR_NOT_EXIST
  *
  * return
- *  NULL: error
- * !NULL: the thumbnail data
+ *   NULL: error or no MPF segment
+ *  !NULL: reader, release with closeMpoFrameReader()
  *
  * note
- * This function returns the copy of the thumbnail data.
- * The caller must free it.
+ * A reader must not be used by several threads at the same time.
  */
-uint8_t *getThumbnailDataOnIfdTableArray(void **ifdTableArray,
-                                               unsigned int *pLength,
-                                               int *pResult)
+void *openMpoFrameReader(const char *JPEGFileName, int *result)
 {
-    IfdTable *ifd;
-    TagNode *tag;
-    unsigned int len;
-    uint8_t *retp;
-    if (!ifdTableArray || !pLength) {
-        if (pResult) {
-            *pResult = ERR_INVALID_POINTER;
-        }
+    ExifIO file;
+    MPO_READER *reader;
+
+    if (openExifFileIO(&file, JPEGFileName, 0) != 0) {
+        *result = ERR_READ_FILE;
         return NULL;
     }
-    ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
-    if (!ifd || !ifd->p) {
-        if (pResult) {
-            *pResult = ERR_NOT_EXIST;
-        }
+    reader = (MPO_READER*)openMpoFrameReaderFromIO(&file, result);
+    if (!reader) {
+        closeExifIO(&file);
         return NULL;
     }
-    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
-    if (!tag || tag->error) {
-        if (pResult) {
-            *pResult = ERR_NOT_EXIST;
-        }
+    // the reader owns the file from now on
+    reader->file = file;
+    reader->io = &reader->file;
+    return reader;
+}
+
+/**
+ * openMpoFrameReaderFromIO()
+ *
+ * Same as openMpoFrameReader() for a file read through an I/O backend.
+ * The backend must outlive the reader and is not closed with it.
+ */
+void *openMpoFrameReaderFromIO(ExifIO *io, int *result)
+{
+    MPO_READER *reader;
+    int n;
+
+    n = getMpoEntriesFromIO(io, NULL, 0);
+    if (n <= 0) {
+        *result = n;
         return NULL;
     }
-    len = tag->numData[0];
-    if (len <= 0) {
-        if (pResult) {
-            *pResult = ERR_NOT_EXIST;
-        }
+    reader = (MPO_READER*)calloc(1, sizeof(MPO_READER));
+    if (!reader) {
+        *result = ERR_MEMALLOC;
         return NULL;
     }
-    retp= (uint8_t*)malloc(len);
-    if (!retp) {
-        if (pResult) {
-            *pResult = ERR_MEMALLOC;
-        }
+    reader->io = io;
+    reader->count = n;
+    reader->entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+    reader->ifdArrays = (void***)calloc(n, sizeof(void**));
+    reader->results = (int*)calloc(n, sizeof(int));
+    reader->parsed = (uint8_t*)calloc(n, 1);
+    if (!reader->entries || !reader->ifdArrays || !reader->results || !reader->parsed) {
+        closeMpoFrameReader(reader);
+        *result = ERR_MEMALLOC;
         return NULL;
     }
-    memcpy(retp, ifd->p, len);
-    *pLength = len;
-    if (pResult) {
-        *pResult = 0;
-    }
-    return retp;
+    getMpoEntriesFromIO(io, reader->entries, n);
+    *result = n;
+    return reader;
 }
 
 /**
- * setThumbnailDataOnIfdTableArray()
+ * getMpoFrameIfdTableArray()
  *
- * Set or update the thumbnail data to the 1st IFD table
+ * Get the IFD tables of one image of an MPO file. The first call for an
+ * image parses it; the later calls return the same tables.
  *
  * parameters
- *  [in] ifdTableArray : address of the IFD tables array
- *  [in] pData : thumbnail data
- *  [in] length : thumbnail data length
- *
- * note
- * This function creates the copy of the specified data.
- * The caller must free it after this function returns.
+ *  [in] reader : from openMpoFrameReader()
+ *  [in] index : image index, 0 for the first image
+ *  [out] result : result status value, same as createIfdTableArray(),
+ *                 ERR_INVALID_POINTER if the index is out of range
  *
  * return
- *   0: OK
- *  -n: error
- *      ERR_INVALID_POINTER
- *      ERR_MEMALLOC
- *      ERR_UNKNOWN
+ *   NULL: error or no Exif segment in the image
+ *  !NULL: pointer array of the IFD tables, owned by the reader and
+ *         released with closeMpoFrameReader()
  */
-int setThumbnailDataOnIfdTableArray(void **ifdTableArray,
-                                    uint8_t *pData,
-                                    unsigned int length)
+void **getMpoFrameIfdTableArray(void *reader, int index, int *result)
 {
-    IfdTable *ifd;
-    TagNode *tag;
-    unsigned int zero = 0;
-    if (!ifdTableArray || !pData || length <= 0) {
-        return ERR_INVALID_POINTER;
-    }
-    ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
-    if (!ifd) {
-        int count = countIfdTableOnIfdTableArray(ifdTableArray);
-        void* ifd1st = createIfdTable(IFD_1ST, 0, 0);
-        printf("count=%d ifd1st=%p\n", count, ifd1st);
-        ifdTableArray[count] = ifd1st;
-        ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
-        if (!ifd) {
-            return ERR_NOT_EXIST;
-        }
-    }
-    if (ifd->p) {
-        free(ifd->p);
-    }
-    // set thumbnail length;
-    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
-    if (tag) {
-        setSingleNumDataToTag(tag, length);
-    } else {
-        if (!addTagNodeToIfd(ifd, TAG_JPEGInterchangeFormatLength,
-                            TYPE_LONG, 1, &length, NULL)) {
-            return ERR_UNKNOWN;
-        }
-    }
-    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormat);
-    if (tag) {
-        setSingleNumDataToTag(tag, zero);
-    } else {
-        // add thumbnail offset tag if not exist
-        addTagNodeToIfd(ifd, TAG_JPEGInterchangeFormat,
-                            TYPE_LONG, 1, &zero, NULL);
-    }
-    ifd->p = (uint8_t*)malloc(length);
-    if (!ifd->p) {
-        return ERR_MEMALLOC;
+    MPO_READER *r = (MPO_READER*)reader;
+    const ExifMpoEntry *entry;
+    ExifRangeIO range;
+    ExifIO frame;
+
+    if (!r || index < 0 || index >= r->count) {
+        *result = ERR_INVALID_POINTER;
+        return NULL;
     }
-    memcpy(ifd->p, pData, length);
-    return 0;
+    if (!r->parsed[index]) {
+        // the image alone, so the scan never runs into the next one;
+        // the length of the first image is not always set
+        entry = &r->entries[index];
+        initExifRangeIO(&frame, &range, r->io, entry->offset,
+                        (index == 0 && entry->length == 0) ? -1 : (int64_t)entry->length);
+        r->ifdArrays[index] = createIfdTableArrayFromIO(&frame, &r->results[index]);
+        r->parsed[index] = 1;
+    }
+    *result = r->results[index];
+    return r->ifdArrays[index];
 }
 
 /**
- * updateExifSegmentInJPEGFile()
+ * getMpoFrameEntry()
  *
- * Update the Exif segment in a JPEG file
+ * Get the MP entry of one image of an MPO file
  *
  * parameters
- *  [in] inJPEGFileName : original JPEG file
- *  [in] outJPGEFileName : output JPEG file
- *  [in] ifdTableArray : address of the IFD tables array
+ *  [in] reader : from openMpoFrameReader()
+ *  [in] index : image index
  *
  * return
- *   1: OK
- *  -n: error
- *      ERR_READ_FILE
- *      ERR_WRITE_FILE
- *      ERR_INVALID_JPEG
- *      ERR_INVALID_APP1HEADER
- *      ERR_INVALID_POINTER
- *      ERROR_UNKNOWN:
+ *   NULL: the index is out of range
+ *  !NULL: entry, owned by the reader
  */
-int updateExifSegmentInJPEGFile(const char *inJPEGFileName,
-                                const char *outJPGEFileName,
-                                void **ifdTableArray)
+const ExifMpoEntry *getMpoFrameEntry(void *reader, int index)
 {
-    int ofs;
-    int i, sts = 1, hasExifSegment;
-    size_t readLen, writeLen;
-    uint8_t buf[8192], *p;
-    FILE *fpr = NULL, *fpw = NULL;
-
-    // refresh the length and offset variables in the IFD table
-    sts = fixLengthAndOffsetInIfdTables(ifdTableArray);
-    if (sts != 0) {
-        goto DONE;
-    }
-    fpr = fopen(inJPEGFileName, "rb");
-    if (!fpr) {
-        sts = ERR_READ_FILE;
-        goto DONE;
-    }
-    sts = init(fpr);
-    if (sts < 0) {
-        goto DONE;
+    MPO_READER *r = (MPO_READER*)reader;
+    if (!r || index < 0 || index >= r->count) {
+        return NULL;
     }
-    if (sts == 0) {
-        hasExifSegment = 0;
-        ofs = JpegDQTOffset;
-    } else {
-        hasExifSegment = 1;
-        ofs = App1StartOffset;
+    return &r->entries[index];
+}
+
+/**
+ * closeMpoFrameReader()
+ *
+ * Release a reader and the IFD tables it keeps
+ *
+ * parameters
+ *  [in] reader : from openMpoFrameReader()
+ */
+void closeMpoFrameReader(void *reader)
+{
+    MPO_READER *r = (MPO_READER*)reader;
+    int i;
+
+    if (!r) {
+        return;
     }
-    fpw = fopen(outJPGEFileName, "wb");
-    if (!fpw) {
-        sts = ERR_WRITE_FILE;
-        goto DONE;
+    if (r->ifdArrays) {
+        for (i = 0; i < r->count; i++) {
+            if (r->ifdArrays[i]) {
+                freeIfdTableArray(r->ifdArrays[i]);
+            }
+        }
     }
-    // copy the data in front of the Exif segment
-    rewind(fpr);
-    p = buf;
-    if (ofs > sizeof(buf)) {
-        // allocate new buffer if needed
-        p = (uint8_t*)malloc(ofs);
+    if (r->io == &r->file) {
+        closeExifIO(&r->file);
     }
-    if (!p) {
-        for (i = 0; i < ofs; i++) {
-            fread(buf, 1, sizeof(char), fpr);
-            fwrite(buf, 1, sizeof(char), fpw);
-        }
-    } else {
-        if (fread(p, 1, ofs, fpr) < (size_t)ofs) {
-            sts = ERR_READ_FILE;
-            goto DONE;
-        }
-        if (fwrite(p, 1, ofs, fpw) < (size_t)ofs) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
-        }
-        if (p != &buf[0]) {
-            free(p);
-        }
-    }
-    // write new Exif segment
-    sts = writeExifSegment(fpw, ifdTableArray);
-    if (sts != 0) {
-        goto DONE;
-    }
-    sts = 1;
-    if (hasExifSegment) {
-        // seek to the end of the Exif segment
-        ofs = App1StartOffset + sizeof(App1Header.marker) + App1Header.length;
-        if (fseek(fpr, ofs, SEEK_SET) != 0) {
-            sts = ERR_READ_FILE;
-            goto DONE;
-        }
-    }
-    // read & write
-    for (;;) {
-        readLen = fread(buf, 1, sizeof(buf), fpr);
-        if (readLen <= 0) {
-            break;
-        }
-        writeLen = fwrite(buf, 1, readLen, fpw);
-        if (writeLen != readLen) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
-        }
-    }
-DONE:
-    if (fpw) {
-        fclose(fpw);
-    }
-    if (fpr) {
-        fclose(fpr);
+    free(r->entries);
+    free(r->ifdArrays);
+    free(r->results);
+    free(r->parsed);
+    free(r);
+}
+
+/**
+ * freeIfdTables()
+ *
+ * Free the pointer array of the IFD tables
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ */
+void freeIfdTables(void* ifdArray[32])
+{
+    int i;
+    for (i = 0; ifdArray[i] != NULL; i++) {
+        freeIfdTable(ifdArray[i]);
     }
-    return sts;
 }
 
 /**
- * removeAdobeMetadataSegmentFromJPEGFile()
+ * freeIfdTableArray()
  *
- * Remove Adobe's XMP metadata segment from a JPEG file
+ * Free the pointer array of the IFD tables
  *
  * parameters
- *  [in] inJPEGFileName : original JPEG file
- *  [in] outJPGEFileName : output JPEG file
+ *  [in] ifdArray : address of the IFD array
+ */
+void freeIfdTableArray(void **ifdArray)
+{
+    freeIfdTables(ifdArray);
+    free(ifdArray);
+}
+
+/**
+ * getIfdType()
+ *
+ * Returns the type of the IFD
+ *
+ * parameters
+ *  [in] ifd: target IFD
  *
  * return
- *   1: OK
- *   0: Adobe's metadata segment is not found
- *  -n: error
- *      ERR_READ_FILE
- *      ERR_WRITE_FILE
- *      ERR_INVALID_JPEG
- *      ERR_INVALID_APP1HEADER
+ *  IFD TYPE value
  */
-int removeAdobeMetadataSegmentFromJPEGFile(const char *inJPEGFileName,
-                                           const char *outJPGEFileName)
+IFD_TYPE getIfdType(void *pIfd)
 {
-#define ADOBE_METADATA_ID     "http://ns.adobe.com/xap/"
-#define ADOBE_METADATA_ID_LEN 24
+    IfdTable *ifd = (IfdTable*)pIfd;
+    if (!ifd) {
+        return IFD_UNKNOWN;
+    }
+    return ifd->ifdType;
+}
 
-    typedef struct _SegmentHeader {
-        uint16_t marker;
-        uint16_t length;
-    } SEGMENT_HEADER;
+/**
+ * dumpIfdTable()
+ *
+ * Dump the IFD table
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [in] filename: not used, the dump never reads or writes files
+ */
 
-    SEGMENT_HEADER hdr;
-    int i, sts = 1;
-    size_t readLen, writeLen;
-    unsigned int ofs;
-    uint8_t buf[8192], *p;
-    FILE *fpr = NULL, *fpw = NULL;
+void dumpIfdTable(void *pIfd, const char* filename)
+{
+    STR_BUF sb;
+    memset(&sb, 0, sizeof(sb));
+    sb.writer = fileDumpWriter;
+    sb.context = stdout;
+    (void)filename;
+    _dumpIfdTable(pIfd, &sb);
+    strBufFlush(&sb);
+    free(sb.data);
+}
 
-    fpr = fopen(inJPEGFileName, "rb");
-    if (!fpr) {
-        sts = ERR_READ_FILE;
-        goto DONE;
-    }
-	sts = getAppNStartOffset(fpr, APP1_MARKER, ADOBE_METADATA_ID, ADOBE_METADATA_ID_LEN, NULL);
-    if (sts <= 0) { // target segment is not exist or something error
-        goto DONE;
-    }
-    ofs = sts;
-    sts = 1;
-    fpw = fopen(outJPGEFileName, "wb");
-    if (!fpw) {
-        sts = ERR_WRITE_FILE;
-        goto DONE;
-    }
-    // copy the data in front of the App1 segment
-    rewind(fpr);
-    p = buf;
-    if (ofs > sizeof(buf)) {
-        // allocate new buffer if needed
-        p = (uint8_t*)malloc(ofs);
-    }
-    if (!p) {
-        for (i = 0; i < (int)ofs; i++) {
-            fread(buf, 1, sizeof(char), fpr);
-            fwrite(buf, 1, sizeof(char), fpw);
-        }
-    } else {
-        if (fread(p, 1, ofs, fpr) < (size_t)ofs) {
-            sts = ERR_READ_FILE;
-            goto DONE;
-        }
-        if (fwrite(p, 1, ofs, fpw) < (size_t)ofs) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
-        }
-        if (p != &buf[0]) {
-            free(p);
-        }
-    }
-    if (fread(&hdr, 1, sizeof(SEGMENT_HEADER), fpr) != sizeof(SEGMENT_HEADER)) {
-        sts = ERR_READ_FILE;
-        goto DONE;
-    }
-    if (systemIsLittleEndian()) {
-        // the segment length value is always in big-endian order
-        hdr.length = swab16(hdr.length);
-    }
-    // seek to the end of the App1 segment
-    if (fseek(fpr, hdr.length - sizeof(hdr.length), SEEK_CUR) != 0) {
-        sts = ERR_READ_FILE;
-        goto DONE;
-    }
-    // read & write
-    for (;;) {
-        readLen = fread(buf, 1, sizeof(buf), fpr);
-        if (readLen <= 0) {
-            break;
-        }
-        writeLen = fwrite(buf, 1, readLen, fpw);
-        if (writeLen != readLen) {
-            sts = ERR_WRITE_FILE;
-            goto DONE;
-        }
-    }
-DONE:
-    if (fpw) {
-        fclose(fpw);
+/**
+ * getIfdTableDump()
+ *
+ * Get the dump of the IFD table as a string
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [out] pp: dump string, NULL if the IFD is NULL or memory ran out
+ *            The caller must free it after this function returns.
+ */
+void getIfdTableDump(void *pIfd, char **pp)
+{
+    STR_BUF sb;
+    if (!pp) {
+        return;
     }
-    if (fpr) {
-        fclose(fpr);
+    *pp = NULL;
+    memset(&sb, 0, sizeof(sb));
+    _dumpIfdTable(pIfd, &sb);
+    if (sb.error) {
+        free(sb.data);
+        return;
     }
-    return sts;
+    *pp = sb.data;
 }
-static int seekToRelativeOffset(FILE *fp, unsigned int baseOff, unsigned int ofs)
+
+/**
+ * writeIfdTableDump()
+ *
+ * Pass the dump of the IFD table to a caller-supplied writer.
+ * The text is delivered in chunks as it is generated, so the whole dump
+ * is never held in memory.
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [in] writer: function receiving each chunk of the dump
+ *  [in] context: passed through to the writer
+ */
+void writeIfdTableDump(void *pIfd, ExifDumpWriter writer, void *context)
 {
-    return fseek(fp, baseOff + ofs, SEEK_SET);
+    STR_BUF sb;
+    if (!writer) {
+        return;
+    }
+    memset(&sb, 0, sizeof(sb));
+    sb.writer = writer;
+    sb.context = context;
+    _dumpIfdTable(pIfd, &sb);
+    strBufFlush(&sb);
+    free(sb.data);
 }
 
-static const char *getTagName(int ifdType, uint16_t tagId)
+static void _dumpIfdTable(void *pIfd, STR_BUF *p)
 {
-    if (ifdType == IFD_0TH || ifdType == IFD_1ST || ifdType == IFD_EXIF) {
-        switch (tagId) {
-            case TAG_ImageWidth: return "ImageWidth";
-            case TAG_ImageLength: return "ImageLength";
-            case TAG_BitsPerSample: return "BitsPerSample";
-            case TAG_Compression: return "Compression";
-            case TAG_PhotometricInterpretation: return "PhotometricInterpretation";
-            case TAG_Orientation: return "Orientation";
-            case TAG_SamplesPerPixel: return "SamplesPerPixel";
-            case TAG_PlanarConfiguration: return "PlanarConfiguration";
-            case TAG_YCbCrSubSampling: return "YCbCrSubSampling";
-            case TAG_YCbCrPositioning: return "YCbCrPositioning";
-            case TAG_XResolution: return "XResolution";
-            case TAG_YResolution: return "YResolution";
-            case TAG_ResolutionUnit: return "ResolutionUnit";
-
-            case TAG_StripOffsets: return "StripOffsets";
-            case TAG_RowsPerStrip: return "RowsPerStrip";
-            case TAG_StripByteCounts: return "StripByteCounts";
-            case TAG_JPEGInterchangeFormat: return "JPEGInterchangeFormat";
-            case TAG_JPEGInterchangeFormatLength: return "JPEGInterchangeFormatLength";
-
-            case TAG_TransferFunction: return "TransferFunction";
-            case TAG_WhitePoint: return "WhitePoint";
-            case TAG_PrimaryChromaticities: return "PrimaryChromaticities";
-            case TAG_YCbCrCoefficients: return "YCbCrCoefficients";
-            case TAG_ReferenceBlackWhite: return "ReferenceBlackWhite";
+    int i;
+    IfdTable *ifd;
+    TagNode *tag;
+    char tagName[512];
+    int cnt = 0;
+    unsigned int count;
 
-            case TAG_DateTime: return "DateTime";
-            case TAG_ImageDescription: return "ImageDescription";
-            case TAG_Make: return "Make";
-            case TAG_Model: return "Model";
-            case TAG_Software: return "Software";
-            case TAG_Artist: return "Artist";
-            case TAG_Copyright: return "Copyright";
-            case TAG_ExifIFDPointer: return "ExifIFDPointer";
-			case TAG_GPSInfoIFDPointer: return "GPSInfoIFDPointer";
-            case TAG_InteroperabilityIFDPointer: return "InteroperabilityIFDPointer";
+    if (!pIfd) {
+        return;
+    }
+    ifd = (IfdTable*)pIfd;
 
-            case TAG_Rating: return "Rating";
+    PRINTF(p, "\n{%s IFD}",
+        (ifd->ifdType == IFD_0TH)  ? "0TH" :
+        (ifd->ifdType == IFD_1ST)  ? "1ST" :
+        (ifd->ifdType == IFD_EXIF) ? "EXIF" :
+        (ifd->ifdType == IFD_GPS)  ? "GPS" :
+        (ifd->ifdType == IFD_IO)   ? "Interoperability" :
+		(ifd->ifdType == IFD_MPF)  ? "MPF" : "");
 
-            case TAG_ExifVersion: return "ExifVersion";
-            case TAG_FlashPixVersion: return "FlashPixVersion";
+    if (Verbose) {
+        PRINTF(p, " tags=%u\n", ifd->tagCount);
+    } else {
+        PRINTF(p, "\n");
+    }
 
-            case TAG_ColorSpace: return "ColorSpace";
+    tag = ifd->tags;
+    while (tag) {
+        if (Verbose) {
+            PRINTF(p, "tag[%02d] 0x%04X %s\n",
+                cnt++, tag->tagId, getTagName(ifd->ifdType, tag->tagId));
+            PRINTF(p, "\ttype=%u count=%u ", tag->type, tag->count);
+            PRINTF(p, "val=");
+        } else {
+            strcpy(tagName, getTagName(ifd->ifdType, tag->tagId));
+            PRINTF(p, " - %s: ", (strlen(tagName) > 0) ? tagName : "(unknown)");
+        }
+        if (tag->error) {
+            PRINTF(p, "(error)");
+        } else {
+            switch (tag->type) {
+            case TYPE_BYTE:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%u ", (uint8_t)tag->numData[i]);
+                }
+                break;
 
-            case TAG_ComponentsConfiguration: return "ComponentsConfiguration";
-            case TAG_CompressedBitsPerPixel: return "CompressedBitsPerPixel";
-            case TAG_PixelXDimension: return "PixelXDimension";
-            case TAG_PixelYDimension: return "PixelYDimension";
+            case TYPE_ASCII:
+                PRINTF(p, "[%s]", (char*)tag->byteData);
+                break;
 
-            case TAG_MakerNote: return "MakerNote";
-            case TAG_UserComment: return "UserComment";
+            case TYPE_SHORT:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%hu ", (uint16_t)tag->numData[i]);
+                }
+                break;
 
-            case TAG_RelatedSoundFile: return "RelatedSoundFile";
+            case TYPE_LONG:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%u ", tag->numData[i]);
+                }
+                break;
 
-            case TAG_DateTimeOriginal: return "DateTimeOriginal";
+            case TYPE_RATIONAL:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%u/%u ", tag->numData[i*2], tag->numData[i*2+1]);
+                }
+                break;
+
+            case TYPE_SBYTE:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%d ", (char)tag->numData[i]);
+                }
+                break;
+
+            case TYPE_UNDEFINED:
+                count = tag->count;
+                // omit too long data if !Verbose
+                if (count > 16 && !Verbose) {
+                    count = 16;
+                }
+				if (Verbose && tag->tagId == TAG_MPImageList) {
+					// see getMpoEntries() to list or extract the images
+					for (i = 0; i + 16 <= count; i += 16) {
+						IMAGE_DIR_ENT* pDir = (IMAGE_DIR_ENT*) (tag->byteData + i);
+						PRINTF(p, "\n%08x ", fix_int((unsigned int)pDir->ImageFlags));
+						uint32_t length = fix_int((unsigned int)pDir->ImageLength);
+						PRINTF(p, "(%u bytes) ", length);
+                        uint32_t off = fix_int((unsigned int)pDir->ImageStart);
+						// the offsets are relative to the MPF TIFF header, the
+						// absolute position may be beyond 4 GB
+						uint64_t start = (off > 0) ? (uint64_t)(MPFStartOffset + 8 + off) : 0;
+						PRINTF(p, "@ %08x => %08llx ", off, (unsigned long long)start);
+						PRINTF(p, "%04x %04x", fix_short(pDir->Image1EntryNum), fix_short(pDir->Image2EntryNum));
+					}
+				}
+				else {
+					for (i = 0; i < (int)count; i++) {
+						if (Verbose) {
+							// Always show hex if Verbose
+							const char* fmt = ((i & 31) == 31) ? "%02X\n" : "%02X ";
+							PRINTF(p, fmt, tag->byteData[i]);
+						}
+						else if (isgraph(tag->byteData[i])) {
+							// if character is printable
+							PRINTF(p, "%c ", tag->byteData[i]);
+						}
+						else {
+							PRINTF(p, "0x%02x ", tag->byteData[i]);
+						}
+					}
+				}
+                if (count < tag->count) {
+                    PRINTF(p, "(omitted)");
+                }
+                break;
+
+            case TYPE_SSHORT:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%hd ", (short)tag->numData[i]);
+                }
+                break;
+
+            case TYPE_SLONG:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%d ", (int)tag->numData[i]);
+                }
+                break;
+
+            case TYPE_SRATIONAL:
+                for (i = 0; i < (int)tag->count; i++) {
+                    PRINTF(p, "%d/%d ", (int)tag->numData[i*2], (int)tag->numData[i*2+1]);
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+        PRINTF(p, "\n");
+
+        tag = tag->next;
+    }
+    return;
+}
+
+/**
+ * dumpIfdTableArray()
+ *
+ * Dump the array of the IFD tables
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] filename: not used, the dump never reads or writes files
+ */
+void dumpIfdTableArray(void **ifdArray, const char* filename)
+{
+    int i;
+    if (ifdArray) {
+        for (i = 0; ifdArray[i] != NULL; i++) {
+            dumpIfdTable(ifdArray[i], filename);
+        }
+    }
+}
+
+/**
+ * getIfdTableArrayJson()
+ *
+ * Get the IFD tables as a JSON object
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [out] pp : NUL terminated JSON text, NULL if memory ran out
+ *             The caller must free it after this function returns.
+ *
+ * return
+ *  length of the JSON text
+ */
+size_t getIfdTableArrayJson(void **ifdArray, int flags, char **pp)
+{
+    STR_BUF sb;
+    if (!pp) {
+        return 0;
+    }
+    *pp = NULL;
+    memset(&sb, 0, sizeof(sb));
+    _emitIfdTableArrayJson(ifdArray, flags, &sb);
+    if (sb.error) {
+        free(sb.data);
+        return 0;
+    }
+    *pp = sb.data;
+    return sb.length;
+}
+
+/**
+ * writeIfdTableArrayJson()
+ *
+ * Write the IFD tables as a JSON object to the stream
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [in] fp : output stream
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
+ */
+int writeIfdTableArrayJson(void **ifdArray, int flags, FILE *fp)
+{
+    if (!fp) {
+        return ERR_INVALID_POINTER;
+    }
+    return streamIfdTableArrayJson(ifdArray, flags, fileDumpWriter, fp) ?
+        ERR_MEMALLOC : (ferror(fp) ? ERR_WRITE_FILE : 0);
+}
+
+/**
+ * streamIfdTableArrayJson()
+ *
+ * Pass the IFD tables as a JSON object to a caller-supplied writer.
+ * The text is delivered in chunks as it is generated.
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [in] writer: function receiving each chunk of the JSON text
+ *  [in] context: passed through to the writer
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ */
+int streamIfdTableArrayJson(void **ifdArray, int flags,
+                            ExifDumpWriter writer, void *context)
+{
+    STR_BUF sb;
+    int error;
+    if (!writer) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(&sb, 0, sizeof(sb));
+    sb.writer = writer;
+    sb.context = context;
+    _emitIfdTableArrayJson(ifdArray, flags, &sb);
+    strBufFlush(&sb);
+    error = sb.error;
+    free(sb.data);
+    return error ? ERR_MEMALLOC : 0;
+}
+
+/**
+ * getExifSummary()
+ *
+ * Fill the ExifSummary of a JPEG file
+ *
+ * The Exif segment is read with a single read and the 0th, Exif and GPS
+ * IFD entries are scanned in place, without building the IFD tables.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] summary : the fields found
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int getExifSummary(const char *JPEGFileName, ExifSummary *summary)
+{
+    ExifIO io;
+    int sts;
+
+    if (!summary) {
+        return ERR_INVALID_POINTER;
+    }
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        memset(summary, 0, sizeof(ExifSummary));
+        return ERR_READ_FILE;
+    }
+    sts = getExifSummaryFromIO(&io, summary);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * getExifSummaryFromIO()
+ *
+ * Fill the ExifSummary from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] io : input backend
+ *  [out] summary : the fields found
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int getExifSummaryFromIO(ExifIO *io, ExifSummary *summary)
+{
+    uint8_t hdr[4], *buf = NULL;
+    ExifJpegInfo jpeg;
+    uint16_t len;
+    int64_t ofs;
+    int sts;
+
+    if (!summary) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(summary, 0, sizeof(ExifSummary));
+    if (!io) {
+        return ERR_READ_FILE;
+    }
+    // the segment walk also records the frame of the image
+    memset(&jpeg, 0, sizeof(jpeg));
+    ofs = getAppNStartOffset(io, APP1_MARKER, EXIF_ID_STR, EXIF_ID_STR_LEN, NULL, &jpeg);
+    if (ofs <= 0) {
+        sts = (int)ofs;
+        goto DONE;
+    }
+    if (!ioReadFull(io, ofs, hdr, 4)) {
+        sts = ERR_READ_FILE;
+        goto DONE;
+    }
+    len = (uint16_t)((hdr[2] << 8) | hdr[3]);
+    if (len < 2) {
+        sts = ERR_INVALID_APP1HEADER;
+        goto DONE;
+    }
+    len -= 2;
+    buf = (uint8_t*)malloc(len);
+    if (!buf) {
+        sts = ERR_MEMALLOC;
+        goto DONE;
+    }
+    if (!ioReadFull(io, ofs + 4, buf, len)) {
+        sts = ERR_READ_FILE;
+        goto DONE;
+    }
+    sts = getExifSummaryFromSegment(buf, len, summary);
+DONE:
+    summary->jpeg = jpeg;
+    if (jpeg.sofMarker != 0) {
+        summary->present |= EXIF_SUMMARY_JPEG_FRAME;
+    }
+    free(buf);
+    return sts;
+}
+
+/**
+ * getExifSummaryFromSegment()
+ *
+ * Fill the ExifSummary from an Exif segment already in memory
+ *
+ * parameters
+ *  [in] segment : contents of the APP1 segment following its length
+ *                 field, starting with "Exif\0\0"
+ *  [in] length : length of the segment data
+ *  [out] summary : the fields found
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ */
+int getExifSummaryFromSegment(const uint8_t *segment, size_t length,
+                              ExifSummary *summary)
+{
+    TIFF_VIEW v;
+    const uint8_t *entries;
+    uint32_t exifOffset = 0, gpsOffset = 0;
+    int count;
+
+    if (!segment || !summary) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(summary, 0, sizeof(ExifSummary));
+    if (!tiffInitView(&v, segment, length)) {
+        return ERR_INVALID_APP1HEADER;
+    }
+    count = tiffGetIfd(&v, tiffGet32(&v, v.tiff + 4), &entries);
+    if (count < 0) {
+        return ERR_INVALID_IFD;
+    }
+    summaryFillIfd(&v, entries, count, IFD_0TH, summary, &exifOffset, &gpsOffset);
+    if (exifOffset && (count = tiffGetIfd(&v, exifOffset, &entries)) >= 0) {
+        summaryFillIfd(&v, entries, count, IFD_EXIF, summary, NULL, NULL);
+    }
+    if (gpsOffset && (count = tiffGetIfd(&v, gpsOffset, &entries)) >= 0) {
+        summaryFillIfd(&v, entries, count, IFD_GPS, summary, NULL, NULL);
+    }
+    return 1;
+}
+
+/**
+ * getJpegInfo()
+ *
+ * Get the frame of the primary image of a JPEG file
+ *
+ * The segments are walked from the SOI marker to the first SOS marker,
+ * only their markers and lengths are read, plus the contents of the
+ * SOFn, DQT, DRI and SOS segments. The dimensions are those of the encoded
+ * image, which may differ from the PixelX/YDimension tags after an edit.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] info : the frame
+ *
+ * return
+ *   1: OK
+ *   0: no SOFn segment before the first SOS or EOI
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * getExifSummary() fills ExifSummary.jpeg in the same walk, except for
+ * the quality: comparing the DQT tables is left to this function.
+ */
+int getJpegInfo(const char *JPEGFileName, ExifJpegInfo *info)
+{
+    ExifIO io;
+    int sts;
+
+    if (!info) {
+        return ERR_INVALID_POINTER;
+    }
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        memset(info, 0, sizeof(ExifJpegInfo));
+        return ERR_READ_FILE;
+    }
+    sts = getJpegInfoFromIO(&io, info);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * getJpegInfoFromIO()
+ *
+ * Same as getJpegInfo() for a JPEG read through an I/O backend
+ */
+int getJpegInfoFromIO(ExifIO *io, ExifJpegInfo *info)
+{
+    uint8_t soi[2];
+
+    if (!info) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(info, 0, sizeof(ExifJpegInfo));
+    if (!io || !ioReadFull(io, 0, soi, 2)) {
+        return ERR_READ_FILE;
+    }
+    if (soi[0] != 0xFF || soi[1] != 0xD8) {
+        return ERR_INVALID_JPEG;
+    }
+    return jpegScanFrame(io, 2, -1, info, 1);
+}
+
+/**
+ * getJpegSubsamplingName()
+ *
+ * Get the name of an EXIF_JPEG_SUBSAMPLING_xxx value, e.g. "4:2:0"
+ */
+const char *getJpegSubsamplingName(int subsampling)
+{
+    static const char *names[] = {
+        "unknown", "gray", "4:4:4", "4:2:2", "4:2:0", "4:4:0", "4:1:1", "other"
+    };
+    if (subsampling < 0 || subsampling > EXIF_JPEG_SUBSAMPLING_OTHER) {
+        subsampling = EXIF_JPEG_SUBSAMPLING_UNKNOWN;
+    }
+    return names[subsampling];
+}
+
+/**
+ * verifyJPEGFile()
+ *
+ * Check that a JPEG file is complete without decoding it
+ *
+ * The segments are walked from the SOI marker to the first SOS marker,
+ * reading only their markers and lengths, and the last 2 bytes of the
+ * file must be the EOI marker. A file cut during an upload fails one of
+ * them. Only a few reads are made: the header is read in 4 KB blocks,
+ * and the MP entries checked by EXIF_VERIFY_CHECK_MPF come from the same
+ * blocks.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [in] flags : EXIF_VERIFY_CHECK_MPF or 0
+ *  [out] pProblems : EXIF_VERIFY_xxx bits of the problems found
+ *
+ * return
+ *   1: OK
+ *   0: a problem was found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * Data after the EOI marker (e.g. padding appended by some cameras) is
+ * reported as EXIF_VERIFY_NO_EOI, the scan data itself is not checked.
+ */
+int verifyJPEGFile(const char *JPEGFileName, int flags, unsigned int *pProblems)
+{
+    ExifIO io;
+    int sts;
+
+    if (!pProblems) {
+        return ERR_INVALID_POINTER;
+    }
+    *pProblems = 0;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        return ERR_READ_FILE;
+    }
+    sts = verifyJPEGFromIO(&io, flags, pProblems);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * verifyJPEGFromIO()
+ *
+ * Same as verifyJPEGFile() for a JPEG read through an I/O backend, the
+ * backend must report its size
+ */
+int verifyJPEGFromIO(ExifIO *io, int flags, unsigned int *pProblems)
+{
+    JPEG_SCAN *scan;
+    ExifMpoEntry *entries = NULL;
+    const uint8_t *p;
+    uint8_t tail[2], marker, *buf = NULL;
+    unsigned int problems = 0;
+    int64_t size, pos = 2, mpfOffset = 0;
+    int i, n, len, mpfLength = 0, sof = 0, sts = 1;
+
+    if (!pProblems) {
+        return ERR_INVALID_POINTER;
+    }
+    *pProblems = 0;
+    if (!io || !io->size || (size = io->size(io->context)) < 0) {
+        return ERR_READ_FILE;
+    }
+    scan = (JPEG_SCAN*)malloc(sizeof(JPEG_SCAN));
+    if (!scan) {
+        return ERR_MEMALLOC;
+    }
+    scan->io = io;
+    scan->end = size;
+    scan->start = 0;
+    scan->length = 0;
+    p = jpegScanFetch(scan, 0, 2);
+    if (!p || p[0] != 0xFF || p[1] != 0xD8) {
+        problems |= EXIF_VERIFY_NOT_JPEG;
+        goto DONE;
+    }
+
+    // the header segments, each one must be complete
+    for (;;) {
+        p = jpegScanFetch(scan, pos, 2);
+        if (!p) {
+            problems |= EXIF_VERIFY_TRUNCATED;
+            break;
+        }
+        marker = p[1];
+        if (p[0] != 0xFF || marker == 0x00 || marker == 0xD8) {
+            problems |= EXIF_VERIFY_BAD_MARKER;
+            break;
+        }
+        if (marker == 0xFF) {
+            pos++; // fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2; // no length
+            continue;
+        }
+        if (marker == 0xD9) {
+            problems |= EXIF_VERIFY_NO_SOS;
+            break;
+        }
+        p = jpegScanFetch(scan, pos + 2, 2);
+        if (!p) {
+            problems |= EXIF_VERIFY_TRUNCATED;
+            break;
+        }
+        len = (p[0] << 8) | p[1];
+        if (len < 2) {
+            problems |= EXIF_VERIFY_BAD_MARKER;
+            break;
+        }
+        if (pos + 2 + len > size) {
+            problems |= EXIF_VERIFY_TRUNCATED;
+            break;
+        }
+        if (marker >= 0xC0 && marker <= 0xCF &&
+            marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            sof = 1;
+        }
+        if (marker == 0xE2 && mpfOffset == 0 && len >= 2 + MPF_ID_STR_LEN &&
+            (p = jpegScanFetch(scan, pos + 4, MPF_ID_STR_LEN)) != NULL &&
+            memcmp(p, MPF_ID_STR, MPF_ID_STR_LEN) == 0) {
+            mpfOffset = pos;
+            mpfLength = len - 2;
+        }
+        if (marker == 0xDA) {
+            if (!sof) {
+                problems |= EXIF_VERIFY_NO_SOF;
+            }
+            break;
+        }
+        pos += 2 + len;
+    }
+
+    // the last bytes of the file
+    if (!(problems & EXIF_VERIFY_TRUNCATED)) {
+        if (size < 4 || !ioReadFull(io, size - 2, tail, 2)) {
+            sts = ERR_READ_FILE;
+            goto DONE;
+        }
+        if (tail[0] != 0xFF || tail[1] != 0xD9) {
+            problems |= EXIF_VERIFY_NO_EOI;
+        }
+    }
+
+    // the images of the MPF segment must lie within the file, the segment
+    // itself was found complete by the walk above
+    if ((flags & EXIF_VERIFY_CHECK_MPF) && mpfOffset > 0 && !(problems &
+        (EXIF_VERIFY_NOT_JPEG | EXIF_VERIFY_BAD_MARKER | EXIF_VERIFY_TRUNCATED))) {
+        p = jpegScanFetch(scan, mpfOffset + 4, mpfLength);
+        if (!p) {
+            buf = (uint8_t*)malloc(mpfLength);
+            if (!buf) {
+                sts = ERR_MEMALLOC;
+                goto DONE;
+            }
+            if (!ioReadFull(io, mpfOffset + 4, buf, mpfLength)) {
+                sts = ERR_READ_FILE;
+                goto DONE;
+            }
+            p = buf;
+        }
+        n = mpoParseSegment(p, mpfLength, mpfOffset, NULL, 0);
+        if (n > 0) {
+            entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+            if (!entries) {
+                sts = ERR_MEMALLOC;
+                goto DONE;
+            }
+            n = mpoParseSegment(p, mpfLength, mpfOffset, entries, n);
+        }
+        if (n <= 0) {
+            problems |= EXIF_VERIFY_BAD_MPF;
+        }
+        for (i = 0; i < n; i++) {
+            if (entries[i].offset < 0 ||
+                entries[i].offset + (int64_t)entries[i].length > size) {
+                problems |= EXIF_VERIFY_BAD_MPF;
+            }
+        }
+    }
+DONE:
+    free(buf);
+    free(entries);
+    free(scan);
+    *pProblems = problems;
+    if (sts < 0) {
+        return sts;
+    }
+    return (problems == 0) ? 1 : 0;
+}
+
+// load the block starting at 'pos', 0 at the end of the input
+static int pixelLoad(PIXEL_READER *r, int64_t pos)
+{
+    int64_t n = r->size - pos;
+    if (n <= 0) {
+        return 0;
+    }
+    n = ioRead(r->io, pos, r->data, (n < PIXEL_HASH_BLOCK) ? (size_t)n : PIXEL_HASH_BLOCK);
+    if (n <= 0) {
+        r->length = 0;
+        return 0;
+    }
+    r->start = pos;
+    r->length = (size_t)n;
+    return 1;
+}
+
+// bytes [pos, pos + length) of the input, NULL if they cannot be read
+static const uint8_t *pixelFetch(PIXEL_READER *r, int64_t pos, size_t length)
+{
+    if (pos < r->start || pos + (int64_t)length > r->start + (int64_t)r->length) {
+        if (!pixelLoad(r, pos) || r->length < length) {
+            return NULL;
+        }
+    }
+    return r->data + (pos - r->start);
+}
+
+// hash the bytes [from, to) of the input
+static int pixelHashRange(PIXEL_READER *r, int64_t from, int64_t to)
+{
+    int64_t n;
+    while (from < to) {
+        if (from < r->start || from >= r->start + (int64_t)r->length) {
+            if (!pixelLoad(r, from)) {
+                return 0;
+            }
+        }
+        n = r->start + (int64_t)r->length;
+        n = ((to < n) ? to : n) - from;
+        xxh3Update(&r->hash, r->data + (from - r->start), (size_t)n);
+        from += n;
+    }
+    return 1;
+}
+
+// hash the entropy-coded data from 'pos' up to the next marker (RSTn and
+// stuffed bytes are data, fill bytes are dropped), returns the offset of
+// the marker or the size of the input if none
+static int64_t pixelHashScan(PIXEL_READER *r, int64_t pos)
+{
+    const uint8_t *p, *end, *ff;
+
+    for (;;) {
+        if (pos < r->start || pos >= r->start + (int64_t)r->length) {
+            if (!pixelLoad(r, pos)) {
+                return r->size;
+            }
+        }
+        p = r->data + (pos - r->start);
+        end = r->data + r->length;
+        ff = (const uint8_t*)memchr(p, 0xFF, end - p);
+        if (!ff) {
+            xxh3Update(&r->hash, p, end - p);
+            pos += end - p;
+            continue;
+        }
+        xxh3Update(&r->hash, p, ff - p);
+        pos += ff - p;
+        if (ff + 1 == end) {
+            // the byte following 0xFF is in the next block
+            if (pos + 1 >= r->size || !pixelLoad(r, pos) || r->length < 2) {
+                return r->size;
+            }
+            continue;
+        }
+        if (ff[1] == 0x00 || (ff[1] >= 0xD0 && ff[1] <= 0xD7)) {
+            xxh3Update(&r->hash, ff, 2);
+            pos += 2;
+        } else if (ff[1] == 0xFF) {
+            pos++;
+        } else {
+            return pos;
+        }
+    }
+}
+
+// walk the image and hash everything but the APPn and COM segments
+static int pixelHashImage(PIXEL_READER *r, uint64_t *pHash)
+{
+    const uint8_t *p;
+    int64_t pos = 2;
+    uint8_t marker;
+    int len, scans = 0;
+
+    p = pixelFetch(r, 0, 2);
+    if (!p) {
+        return ERR_READ_FILE;
+    }
+    if (p[0] != 0xFF || p[1] != 0xD8) {
+        return ERR_INVALID_JPEG;
+    }
+    xxh3Reset(&r->hash);
+    for (;;) {
+        if (scans > 0) {
+            pos = pixelHashScan(r, pos);
+        }
+        p = pixelFetch(r, pos, 2);
+        if (!p) {
+            break; // the image ends without EOI
+        }
+        if (p[0] != 0xFF) {
+            return ERR_INVALID_JPEG;
+        }
+        marker = p[1];
+        if (marker == 0xFF) {
+            pos++; // fill byte
+            continue;
+        }
+        if (marker == 0xD9) {
+            xxh3Update(&r->hash, p, 2);
+            break;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2;
+            continue;
+        }
+        p = pixelFetch(r, pos + 2, 2);
+        if (!p || (len = (p[0] << 8) | p[1]) < 2) {
+            return ERR_INVALID_JPEG;
+        }
+        if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+            pos += 2 + len;
+            continue;
+        }
+        if (!pixelHashRange(r, pos, pos + 2 + len)) {
+            return ERR_INVALID_JPEG;
+        }
+        if (marker == 0xDA) {
+            scans++;
+        }
+        pos += 2 + len;
+    }
+    if (scans == 0) {
+        return ERR_INVALID_JPEG;
+    }
+    *pHash = xxh3Digest64(&r->hash);
+    return 1;
+}
+
+/**
+ * getJpegPixelHash()
+ *
+ * Hash the image data of a JPEG file regardless of its metadata
+ *
+ * The segments defining the pixels (DQT, DHT, SOFn, DRI, SOS, ...) and
+ * the entropy-coded data are hashed with XXH3 (64-bit), from SOI to the
+ * EOI of the primary image. The APPn and COM segments are skipped, so a
+ * copy with the Exif segment removed or edited has the same hash. The
+ * file is read in 1 MB blocks.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] pHash : hash of the image data
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG : no SOI or SOS, or a broken segment
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The hash is that of the bytes as encoded, the same pixels encoded with
+ * other tables or another order of the segments hash differently.
+ */
+int getJpegPixelHash(const char *JPEGFileName, uint64_t *pHash)
+{
+    ExifIO io;
+    int sts;
+
+    if (!pHash) {
+        return ERR_INVALID_POINTER;
+    }
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        return ERR_READ_FILE;
+    }
+    sts = getJpegPixelHashFromIO(&io, pHash);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * getJpegPixelHashFromIO()
+ *
+ * Same as getJpegPixelHash() for a JPEG read through an I/O backend, the
+ * backend must report its size
+ */
+int getJpegPixelHashFromIO(ExifIO *io, uint64_t *pHash)
+{
+    PIXEL_READER *r;
+    int sts;
+
+    if (!pHash) {
+        return ERR_INVALID_POINTER;
+    }
+    *pHash = 0;
+    if (!io || !io->size) {
+        return ERR_READ_FILE;
+    }
+    r = (PIXEL_READER*)malloc(sizeof(PIXEL_READER));
+    if (!r) {
+        return ERR_MEMALLOC;
+    }
+    memset(r, 0, sizeof(PIXEL_READER));
+    r->data = (uint8_t*)malloc(PIXEL_HASH_BLOCK);
+    if (!r->data) {
+        free(r);
+        return ERR_MEMALLOC;
+    }
+    r->io = io;
+    r->size = io->size(io->context);
+    sts = (r->size < 0) ? ERR_READ_FILE : pixelHashImage(r, pHash);
+    free(r->data);
+    free(r);
+    return sts;
+}
+
+/**
+ * getJpegPixelHashBatch()
+ *
+ * Hash the image data of many files on several threads
+ *
+ * parameters
+ *  [in/out] items : files to hash, the results are stored in place
+ *  [in] count : number of items
+ *  [in] threads : number of threads, 0 or less: one per CPU
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * Without POSIX threads the files are hashed one after another.
+ */
+#if defined(EXIF_HAVE_PREAD)
+
+static int pixelHashWork(void *context, int index)
+{
+    ExifPixelHashItem *item = (ExifPixelHashItem*)context + index;
+    item->result = getJpegPixelHash(item->fileName, &item->hash);
+    return 0;
+}
+
+int getJpegPixelHashBatch(ExifPixelHashItem *items, int count, int threads)
+{
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    runBatch(pixelHashWork, items, count, threads);
+    return 0;
+}
+
+#else
+
+int getJpegPixelHashBatch(ExifPixelHashItem *items, int count, int threads)
+{
+    int i;
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    for (i = 0; i < count; i++) {
+        items[i].result = getJpegPixelHash(items[i].fileName, &items[i].hash);
+    }
+    return 0;
+}
+
+#endif
+
+// the IFDs of the fingerprint in canonical order, the MPF IFD describes
+// the layout of the file and is left out
+static const IFD_TYPE FingerprintIfds[] = {
+    IFD_0TH, IFD_1ST, IFD_EXIF, IFD_GPS, IFD_IO
+};
+
+// the tags whose value depends only on where the writer put things
+static int fingerprintSkipTag(uint16_t tagId)
+{
+    switch (tagId) {
+    case TAG_ExifIFDPointer:
+    case TAG_GPSInfoIFDPointer:
+    case TAG_InteroperabilityIFDPointer:
+    case TAG_JPEGInterchangeFormat:
+    case TAG_StripOffsets:
+    case TAG_Padding:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int compareFingerprintTags(const void *a, const void *b)
+{
+    const TagNode *x = *(const TagNode* const*)a;
+    const TagNode *y = *(const TagNode* const*)b;
+    if (x->tagId != y->tagId) {
+        return (x->tagId < y->tagId) ? -1 : 1;
+    }
+    if (x->type != y->type) {
+        return (x->type < y->type) ? -1 : 1;
+    }
+    return (x->count < y->count) ? -1 : (x->count > y->count);
+}
+
+// one tag in canonical form, all little-endian:
+//   uint16 tag ID, uint8 class, uint8 error, uint32 count, values
+// the integer types become one class of 32-bit values (signed ones
+// sign-extended), the trailing NULs of an ASCII value are dropped
+static void fingerprintTag(XXH3_STATE *h, const TagNode *tag)
+{
+    uint8_t head[8], value[8];
+    unsigned int count = tag->count, i;
+    uint32_t v;
+    int kind;
+
+    switch (tag->type) {
+    case TYPE_BYTE: case TYPE_SHORT: case TYPE_LONG:   kind = 1; break;
+    case TYPE_SBYTE: case TYPE_SSHORT: case TYPE_SLONG: kind = 2; break;
+    case TYPE_RATIONAL:  kind = 3; break;
+    case TYPE_SRATIONAL: kind = 4; break;
+    case TYPE_ASCII:     kind = 5; break;
+    case TYPE_UNDEFINED: kind = 6; break;
+    default:             kind = 0; break;
+    }
+    if (tag->error || kind == 0 ||
+        (kind <= 4 && !tag->numData) || (kind >= 5 && !tag->byteData && count > 0)) {
+        count = 0;
+    } else if (kind == 5) {
+        while (count > 0 && tag->byteData[count - 1] == '\0') {
+            count--;
+        }
+    }
+    putLE16(head, tag->tagId);
+    head[2] = (uint8_t)kind;
+    head[3] = (tag->error) ? 1 : 0;
+    putLE32(head + 4, count);
+    xxh3Update(h, head, sizeof(head));
+    if (kind >= 5) {
+        if (count > 0) {
+            xxh3Update(h, tag->byteData, count);
+        }
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        if (kind >= 3) {
+            putLE32(value, tag->numData[i * 2]);
+            putLE32(value + 4, tag->numData[i * 2 + 1]);
+            xxh3Update(h, value, 8);
+            continue;
+        }
+        v = tag->numData[i];
+        if (tag->type == TYPE_SBYTE) {
+            v = (uint32_t)(int32_t)(int8_t)v;
+        } else if (tag->type == TYPE_SSHORT) {
+            v = (uint32_t)(int32_t)(int16_t)v;
+        }
+        putLE32(value, v);
+        xxh3Update(h, value, 4);
+    }
+}
+
+/**
+ * getExifFingerprintOnIfdTableArray()
+ *
+ * Compute a 128-bit fingerprint of the Exif metadata of parsed IFD tables
+ *
+ * The tables are hashed in a canonical form that does not depend on how
+ * the segment was written: the 0th, 1st, Exif, GPS and Interoperability
+ * IFDs in this order, the tags of each IFD sorted by ID, the values in
+ * host order whatever the byte order of the file, the BYTE, SHORT and
+ * LONG types (and the signed ones) as one integer type, and the trailing
+ * NULs of ASCII values dropped. The IFD pointers, the thumbnail and strip
+ * offsets and the Padding tag are left out, the thumbnail data is hashed.
+ * The hash is XXH3 (128-bit).
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] pFingerprint : fingerprint of the metadata
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The MPF IFD and the maker note internals are not normalized: a maker
+ * note is hashed as its bytes.
+ */
+int getExifFingerprintOnIfdTableArray(void **ifdTableArray, ExifFingerprint *pFingerprint)
+{
+    XXH3_STATE *h = NULL;
+    TagNode **tags = NULL, *tag;
+    IfdTable *ifd;
+    const uint8_t *thumb;
+    unsigned int thumbLength;
+    uint8_t head[4];
+    int sts = 1, i, n, t;
+
+    if (!ifdTableArray || !pFingerprint) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(pFingerprint, 0, sizeof(ExifFingerprint));
+    h = (XXH3_STATE*)malloc(sizeof(XXH3_STATE));
+    if (!h) {
+        sts = ERR_MEMALLOC;
+        goto DONE;
+    }
+    xxh3Reset(h);
+    for (t = 0; t < (int)(sizeof(FingerprintIfds) / sizeof(FingerprintIfds[0])); t++) {
+        ifd = getIfdTableFromIfdTableArray(ifdTableArray, FingerprintIfds[t]);
+        if (!ifd) {
+            continue;
+        }
+        for (n = 0, tag = ifd->tags; tag; tag = tag->next) {
+            n++;
+        }
+        free(tags);
+        tags = (TagNode**)malloc(sizeof(TagNode*) * (n + 1));
+        if (!tags) {
+            sts = ERR_MEMALLOC;
+            goto DONE;
+        }
+        n = 0;
+        for (tag = ifd->tags; tag; tag = tag->next) {
+            if (!fingerprintSkipTag(tag->tagId)) {
+                tags[n++] = tag;
+            }
+        }
+        qsort(tags, n, sizeof(TagNode*), compareFingerprintTags);
+        // uint16 IFD type, uint16 number of tags
+        putLE16(head, (uint16_t)ifd->ifdType);
+        putLE16(head + 2, (uint16_t)n);
+        xxh3Update(h, head, sizeof(head));
+        for (i = 0; i < n; i++) {
+            fingerprintTag(h, tags[i]);
+        }
+    }
+    // uint32 length and the thumbnail data
+    thumb = peekThumbnailDataOnIfdTableArray(ifdTableArray, &thumbLength, NULL);
+    if (thumb) {
+        putLE32(head, thumbLength);
+        xxh3Update(h, head, sizeof(head));
+        xxh3Update(h, thumb, thumbLength);
+    }
+    xxh3Digest128(h, &pFingerprint->low, &pFingerprint->high);
+DONE:
+    free(tags);
+    free(h);
+    return sts;
+}
+
+/**
+ * getExifFingerprint()
+ *
+ * Compute a 128-bit fingerprint of the Exif metadata of a JPEG file
+ *
+ * The file is parsed with createIfdTableArray() and the tables are hashed
+ * by getExifFingerprintOnIfdTableArray(). Two files have the same
+ * fingerprint when their Exif segments hold the same tags and values,
+ * even if one was rewritten in the other byte order, with the tags in
+ * another order or with other padding.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] pFingerprint : fingerprint of the metadata, zero without Exif
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int getExifFingerprint(const char *JPEGFileName, ExifFingerprint *pFingerprint)
+{
+    void **ifdArray;
+    int sts;
+
+    if (!pFingerprint) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(pFingerprint, 0, sizeof(ExifFingerprint));
+    ifdArray = createIfdTableArray(JPEGFileName, &sts);
+    if (!ifdArray) {
+        return (sts > 0) ? ERR_MEMALLOC : sts;
+    }
+    sts = getExifFingerprintOnIfdTableArray(ifdArray, pFingerprint);
+    freeIfdTableArray(ifdArray);
+    return sts;
+}
+
+/**
+ * getExifFingerprintFromIO()
+ *
+ * Same as getExifFingerprint() for a JPEG read through an I/O backend
+ */
+int getExifFingerprintFromIO(ExifIO *io, ExifFingerprint *pFingerprint)
+{
+    void **ifdArray;
+    int sts;
+
+    if (!pFingerprint) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(pFingerprint, 0, sizeof(ExifFingerprint));
+    ifdArray = createIfdTableArrayFromIO(io, &sts);
+    if (!ifdArray) {
+        return (sts > 0) ? ERR_MEMALLOC : sts;
+    }
+    sts = getExifFingerprintOnIfdTableArray(ifdArray, pFingerprint);
+    freeIfdTableArray(ifdArray);
+    return sts;
+}
+
+/**
+ * getExifFingerprintBatch()
+ *
+ * Compute the Exif fingerprints of many files on several threads
+ *
+ * parameters
+ *  [in/out] items : files to fingerprint, the results are stored in place
+ *  [in] count : number of items
+ *  [in] threads : number of threads, 0 or less: one per CPU
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * Without POSIX threads the files are parsed one after another.
+ */
+#if defined(EXIF_HAVE_PREAD)
+
+static int fingerprintWork(void *context, int index)
+{
+    ExifFingerprintItem *item = (ExifFingerprintItem*)context + index;
+    item->result = getExifFingerprint(item->fileName, &item->fingerprint);
+    return 0;
+}
+
+int getExifFingerprintBatch(ExifFingerprintItem *items, int count, int threads)
+{
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    runBatch(fingerprintWork, items, count, threads);
+    return 0;
+}
+
+#else
+
+int getExifFingerprintBatch(ExifFingerprintItem *items, int count, int threads)
+{
+    int i;
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    for (i = 0; i < count; i++) {
+        items[i].result = getExifFingerprint(items[i].fileName, &items[i].fingerprint);
+    }
+    return 0;
+}
+
+#endif
+
+/**
+ * convertRationalToDouble()
+ *
+ * Convert a RATIONAL value (e.g. TagNodeInfo.numData + 2 * i)
+ *
+ * parameters
+ *  [in] rational : numerator and denominator
+ *
+ * return
+ *  the value, NaN if the denominator is 0
+ */
+double convertRationalToDouble(const unsigned int *rational)
+{
+    return (rational[1] != 0) ? (double)rational[0] / rational[1] : NAN;
+}
+
+/**
+ * convertSRationalToDouble()
+ *
+ * Convert a SRATIONAL value
+ *
+ * parameters
+ *  [in] rational : signed numerator and denominator
+ *
+ * return
+ *  the value, NaN if the denominator is 0
+ */
+double convertSRationalToDouble(const unsigned int *rational)
+{
+    return (rational[1] != 0) ? (double)(int)rational[0] / (int)rational[1] : NAN;
+}
+
+/**
+ * convertGpsToDegrees()
+ *
+ * Convert a GPSLatitude or GPSLongitude value to decimal degrees
+ *
+ * parameters
+ *  [in] dms : degrees, minutes and seconds as 3 RATIONAL values
+ *  [in] ref : 'N', 'S', 'E' or 'W' from GPSLatitudeRef/GPSLongitudeRef
+ *  [out] pDegrees : degrees, negative for south and west
+ *
+ * return
+ *  1: OK
+ *  0: invalid value or reference
+ */
+int convertGpsToDegrees(const unsigned int *dms, char ref, double *pDegrees)
+{
+    double deg;
+    // minutes and seconds with a 0 denominator are taken as 0
+    // (some writers leave them 0/0), the degrees must be valid
+    if (!dms || !pDegrees || dms[1] == 0 ||
+        (ref != 'N' && ref != 'S' && ref != 'E' && ref != 'W')) {
+        return 0;
+    }
+    deg = (double)dms[0] / dms[1];
+    if (dms[3] != 0) {
+        deg += (double)dms[2] / dms[3] / 60.0;
+    }
+    if (dms[5] != 0) {
+        deg += (double)dms[4] / dms[5] / 3600.0;
+    }
+    *pDegrees = (ref == 'S' || ref == 'W') ? -deg : deg;
+    return 1;
+}
+
+/**
+ * convertDateTimeToEpoch()
+ *
+ * Convert an Exif date and time to microseconds since the Unix epoch
+ * without the C library time functions (no locale, no time zone lookup)
+ *
+ * parameters
+ *  [in] dateTime : "YYYY:MM:DD HH:MM:SS"
+ *  [in] subSec : SubSecTime digits (fraction of the second), or NULL
+ *  [in] offset : OffsetTime "+HH:MM" or "-HH:MM", or NULL
+ *  [out] pMicros : microseconds since 1970-01-01 00:00:00 UTC
+ *
+ * return
+ *  EXIF_TIME_UTC: OK, the offset was applied
+ *  EXIF_TIME_LOCAL: OK, no valid offset, the local time is taken as UTC
+ *  EXIF_TIME_INVALID: dateTime is not a valid date and time
+ */
+int convertDateTimeToEpoch(const char *dateTime, const char *subSec,
+                           const char *offset, int64_t *pMicros)
+{
+    static const uint8_t daysInMonth[13] = {
+        0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+    int year, month, day, hour, minute, second, i, leap, sts = EXIF_TIME_LOCAL;
+    int oh, om;
+    int64_t secs, micros = 0, scale = 100000;
+
+    if (!dateTime || !pMicros || strlen(dateTime) < 19 ||
+        dateTime[4] != ':' || dateTime[7] != ':' || dateTime[10] != ' ' ||
+        dateTime[13] != ':' || dateTime[16] != ':' ||
+        !parseDecimal(dateTime, 4, &year) || !parseDecimal(dateTime + 5, 2, &month) ||
+        !parseDecimal(dateTime + 8, 2, &day) || !parseDecimal(dateTime + 11, 2, &hour) ||
+        !parseDecimal(dateTime + 14, 2, &minute) || !parseDecimal(dateTime + 17, 2, &second)) {
+        return EXIF_TIME_INVALID;
+    }
+    leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (month < 1 || month > 12 || day < 1 || day > daysInMonth[month] ||
+        (month == 2 && day == 29 && !leap) || hour > 23 || minute > 59 || second > 60) {
+        return EXIF_TIME_INVALID;
+    }
+    secs = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+
+    // up to 6 digits of the fraction, the rest is ignored
+    for (i = 0; subSec && subSec[i] >= '0' && subSec[i] <= '9'; i++) {
+        if (i < 6) {
+            micros += (subSec[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (offset && strlen(offset) >= 6 && (offset[0] == '+' || offset[0] == '-') && offset[3] == ':' &&
+        parseDecimal(offset + 1, 2, &oh) && parseDecimal(offset + 4, 2, &om) &&
+        oh <= 23 && om <= 59) {
+        secs -= (offset[0] == '-' ? -1 : 1) * (oh * 3600 + om * 60);
+        sts = EXIF_TIME_UTC;
+    }
+    *pMicros = secs * 1000000 + micros;
+    return sts;
+}
+
+/**
+ * convertExifSummaryArray()
+ *
+ * Convert the rationals, GPS coordinates and date of ExifSummary records
+ * at once
+ *
+ * parameters
+ *  [in] summaries : records filled by getExifSummary()
+ *  [in] count : number of the records
+ *  [out] values : converted values, count records
+ *
+ * return
+ *  number of the records converted
+ */
+int convertExifSummaryArray(const ExifSummary *summaries, int count,
+                            ExifSummaryValues *values)
+{
+    int i, sts;
+    if (!summaries || !values || count < 0) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        const ExifSummary *s = &summaries[i];
+        ExifSummaryValues *v = &values[i];
+        uint32_t present = 0;
+
+        v->reserved = 0;
+        v->exposureTime = convertRationalToDouble(s->exposureTime);
+        v->fNumber = convertRationalToDouble(s->fNumber);
+        v->focalLength = convertRationalToDouble(s->focalLength);
+        v->gpsAltitude = convertRationalToDouble(s->gpsAltitude);
+        if (s->gpsAltitudeRef == 1) {
+            v->gpsAltitude = -v->gpsAltitude;
+        }
+        // keep the bits of the values that converted to a number
+        present |= (s->present & EXIF_SUMMARY_EXPOSURE_TIME) && !isnan(v->exposureTime) ?
+                   EXIF_SUMMARY_EXPOSURE_TIME : 0;
+        present |= (s->present & EXIF_SUMMARY_FNUMBER) && !isnan(v->fNumber) ?
+                   EXIF_SUMMARY_FNUMBER : 0;
+        present |= (s->present & EXIF_SUMMARY_FOCAL_LENGTH) && !isnan(v->focalLength) ?
+                   EXIF_SUMMARY_FOCAL_LENGTH : 0;
+        present |= (s->present & EXIF_SUMMARY_GPS_ALTITUDE) && !isnan(v->gpsAltitude) ?
+                   EXIF_SUMMARY_GPS_ALTITUDE : 0;
+        v->gpsLatitude = v->gpsLongitude = NAN;
+        if ((s->present & EXIF_SUMMARY_GPS_LATITUDE) &&
+            convertGpsToDegrees(s->gpsLatitude, s->gpsLatitudeRef, &v->gpsLatitude)) {
+            present |= EXIF_SUMMARY_GPS_LATITUDE;
+        }
+        if ((s->present & EXIF_SUMMARY_GPS_LONGITUDE) &&
+            convertGpsToDegrees(s->gpsLongitude, s->gpsLongitudeRef, &v->gpsLongitude)) {
+            present |= EXIF_SUMMARY_GPS_LONGITUDE;
+        }
+        v->dateTimeOriginal = 0;
+        if (s->present & EXIF_SUMMARY_DATETIME_ORIGINAL) {
+            sts = convertDateTimeToEpoch(s->dateTimeOriginal,
+                (s->present & EXIF_SUMMARY_SUBSEC_ORIGINAL) ? s->subSecTimeOriginal : NULL,
+                (s->present & EXIF_SUMMARY_OFFSET_ORIGINAL) ? s->offsetTimeOriginal : NULL,
+                &v->dateTimeOriginal);
+            if (sts != EXIF_TIME_INVALID) {
+                present |= EXIF_SUMMARY_DATETIME_ORIGINAL;
+            }
+            if (sts == EXIF_TIME_UTC) {
+                present |= EXIF_SUMMARY_OFFSET_ORIGINAL;
+            }
+        }
+        v->present = present;
+    }
+    return count;
+}
+
+/**
+ * getTagIdFromName()
+ *
+ * Look up the tag ID by its name
+ *
+ * parameters
+ *  [in] ifdType : IFD TYPE the tag belongs to
+ *  [in] name : tag name (e.g. "Model")
+ *
+ * return
+ *  >=0: tag ID
+ *  ERR_NOT_EXIST
+ */
+int getTagIdFromName(IFD_TYPE ifdType, const char *name)
+{
+    int tagId;
+    if (!name) {
+        return ERR_NOT_EXIST;
+    }
+    for (tagId = 0; tagId <= 0xFFFF; tagId++) {
+        if (strcmp(getTagName(ifdType, (uint16_t)tagId), name) == 0) {
+            return tagId;
+        }
+    }
+    return ERR_NOT_EXIST;
+}
+
+/**
+ * openExifColumnWriter()
+ *
+ * Start a columnar export of the selected tags, one row per file.
+ * The rows are collected into column buffers and written in batches.
+ *
+ * parameters
+ *  [in] fp : output stream, opened in binary mode for EXIF_EXPORT_ARROW
+ *  [in] format : EXIF_EXPORT_CSV, EXIF_EXPORT_TSV or EXIF_EXPORT_ARROW
+ *  [in] columns : tags to export
+ *  [in] columnCount : number of the tags
+ *
+ * return
+ *  NULL: error (invalid argument or memory allocation)
+ *  !NULL: handle for addExifColumnRow() and closeExifColumnWriter()
+ */
+void *openExifColumnWriter(FILE *fp, int format,
+                           const ExifColumnSpec *columns, int columnCount)
+{
+    COLUMN_WRITER *w;
+    char key[8];
+    const char *name;
+    int i, j;
+
+    if (!fp || (columnCount > 0 && !columns) || columnCount < 0 ||
+        (format != EXIF_EXPORT_CSV && format != EXIF_EXPORT_TSV &&
+         format != EXIF_EXPORT_ARROW)) {
+        return NULL;
+    }
+    w = (COLUMN_WRITER*)calloc(1, sizeof(COLUMN_WRITER));
+    if (!w) {
+        return NULL;
+    }
+    w->fp = fp;
+    w->format = format;
+    w->columnCount = columnCount + 1;
+    w->specs = (ExifColumnSpec*)malloc(sizeof(ExifColumnSpec) * (columnCount + 1));
+    w->columns = (COLUMN_BUF*)calloc(columnCount + 1, sizeof(COLUMN_BUF));
+    if (!w->specs || !w->columns) {
+        goto ERR;
+    }
+    memcpy(w->specs, columns, sizeof(ExifColumnSpec) * columnCount);
+    for (i = 0; i < w->columnCount; i++) {
+        COLUMN_BUF *col = &w->columns[i];
+        const char *ifdName = "";
+        if (i == 0) {
+            name = "file";
+        } else if (columns[i-1].ifdType == IFD_UNKNOWN) {
+            name = getTagKey(IFD_0TH, columns[i-1].tagId, key);
+            if (name == key) {
+                name = getTagKey(IFD_GPS, columns[i-1].tagId, key);
+            }
+        } else {
+            name = getTagKey(columns[i-1].ifdType, columns[i-1].tagId, key);
+            // qualify the name with the IFD if it is already taken
+            for (j = 0; j < i && strcmp(w->columns[j].name, name) != 0; j++);
+            if (j < i) {
+                ifdName = getIfdName(columns[i-1].ifdType);
+            }
+        }
+        col->name = (char*)malloc(strlen(ifdName) + strlen(name) + 2);
+        if (!col->name) {
+            goto ERR;
+        }
+        sprintf(col->name, "%s%s%s", ifdName, (ifdName[0]) ? "." : "", name);
+        col->type = ARROW_TYPE_UTF8;
+        if (i > 0 && format == EXIF_EXPORT_ARROW) {
+            col->type = columnTagType(columns[i-1].ifdType, columns[i-1].tagId);
+        }
+        strBufAppend(&col->offsets, "\0\0\0\0", 4);
+        if (col->offsets.error) {
+            goto ERR;
+        }
+    }
+    if (columnWriteSchema(w) != 0) {
+        goto ERR;
+    }
+    return w;
+ERR:
+    w->fp = NULL;
+    closeExifColumnWriter(w);
+    return NULL;
+}
+
+/**
+ * addExifColumnRow()
+ *
+ * Add the row of a file to the columnar export
+ *
+ * parameters
+ *  [in] writer : handle returned by openExifColumnWriter()
+ *  [in] fileName : value of the "file" column, NULL for null
+ *  [in] ifdArray : IFD tables of the file, NULL if it has none
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
+ */
+int addExifColumnRow(void *writer, const char *fileName, void **ifdArray)
+{
+    COLUMN_WRITER *w = (COLUMN_WRITER*)writer;
+    TagNode *tag;
+    int i;
+    uint8_t ofs[4];
+
+    if (!w) {
+        return ERR_INVALID_POINTER;
+    }
+    if (w->error) {
+        return w->error;
+    }
+    for (i = 0; i < w->columnCount; i++) {
+        COLUMN_BUF *col = &w->columns[i];
+        int valid = 1;
+        if ((w->rows & 7) == 0) {
+            strBufAppend(&col->validity, "\0", 1);
+        }
+        if (i == 0) {
+            if (fileName) {
+                strBufAppend(&col->data, fileName, strlen(fileName));
+            } else {
+                valid = 0;
+            }
+        } else {
+            tag = columnFindTag(ifdArray, &w->specs[i-1]);
+            if (!tag || tag->error) {
+                valid = 0;
+            } else if (col->type == ARROW_TYPE_UTF8) {
+                columnPutTagValue(&col->data, tag);
+            } else {
+                valid = columnPutTagNumber(&col->data, col->type, tag);
+            }
+        }
+        if (valid) {
+            col->validity.data[w->rows >> 3] |= (char)(1 << (w->rows & 7));
+        } else {
+            col->nullCount++;
+        }
+        if (col->type != ARROW_TYPE_UTF8) {
+            if (!valid) {
+                strBufAppend(&col->data, "\0\0\0\0\0\0\0\0", 8);
+            }
+        } else {
+            putLE32(ofs, (uint32_t)col->data.length);
+            strBufAppend(&col->offsets, (const char*)ofs, 4);
+        }
+        if (col->data.error || col->offsets.error || col->validity.error) {
+            w->error = ERR_MEMALLOC;
+            return w->error;
+        }
+    }
+    w->rows++;
+    for (i = 0; i < w->columnCount; i++) {
+        if (w->columns[i].data.length >= COLUMN_BATCH_BYTES) {
+            break;
+        }
+    }
+    if (w->rows >= COLUMN_BATCH_ROWS || i < w->columnCount) {
+        return columnFlushBatch(w);
+    }
+    return 0;
+}
+
+/**
+ * closeExifColumnWriter()
+ *
+ * Write the pending rows, finish the export and free the writer.
+ * The output stream is not closed.
+ *
+ * parameters
+ *  [in] writer : handle returned by openExifColumnWriter()
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
+ */
+int closeExifColumnWriter(void *writer)
+{
+    COLUMN_WRITER *w = (COLUMN_WRITER*)writer;
+    int i, sts;
+    static const uint8_t eos[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0 };
+
+    if (!w) {
+        return ERR_INVALID_POINTER;
+    }
+    sts = w->error;
+    if (w->fp && sts == 0) {
+        sts = columnFlushBatch(w);
+        if (sts == 0 && w->format == EXIF_EXPORT_ARROW) {
+            fwrite(eos, 1, sizeof(eos), w->fp);
+        }
+        if (sts == 0 && (fflush(w->fp) != 0 || ferror(w->fp))) {
+            sts = ERR_WRITE_FILE;
+        }
+    }
+    if (w->columns) {
+        for (i = 0; i < w->columnCount; i++) {
+            free(w->columns[i].data.data);
+            free(w->columns[i].offsets.data);
+            free(w->columns[i].validity.data);
+            free(w->columns[i].name);
+        }
+    }
+    free(w->columns);
+    free(w->specs);
+    free(w);
+    return sts;
+}
+
+/**
+ * exportIfdTableColumns()
+ *
+ * Parse the files and export the selected tags, one row per file
+ * (see openExifColumnWriter())
+ *
+ * parameters
+ *  [in] fp : output stream
+ *  [in] format : EXIF_EXPORT_CSV, EXIF_EXPORT_TSV or EXIF_EXPORT_ARROW
+ *  [in] columns : tags to export
+ *  [in] columnCount : number of the tags
+ *  [in] fileNames : JPEG files
+ *  [in] fileCount : number of the files
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
+ */
+int exportIfdTableColumns(FILE *fp, int format,
+                          const ExifColumnSpec *columns, int columnCount,
+                          const char **fileNames, int fileCount)
+{
+    void *w, **ifdArray;
+    int i, result, sts = 0;
+
+    if (!fileNames && fileCount > 0) {
+        return ERR_INVALID_POINTER;
+    }
+    w = openExifColumnWriter(fp, format, columns, columnCount);
+    if (!w) {
+        return ERR_INVALID_POINTER;
+    }
+    for (i = 0; i < fileCount && sts == 0; i++) {
+        ifdArray = createIfdTableArray(fileNames[i], &result);
+        sts = addExifColumnRow(w, fileNames[i], ifdArray);
+        if (ifdArray) {
+            freeIfdTableArray(ifdArray);
+        }
+    }
+    result = closeExifColumnWriter(w);
+    return (sts != 0) ? sts : result;
+}
+
+/**
+ * getTagInfo()
+ *
+ * Get the TagNodeInfo that matches the IFD_TYPE & TagId
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] ifdType : target IFD TYPE
+ *  [in] tagId : target tag ID
+ *
+ * return
+ *   NULL: tag is not found
+ *  !NULL: address of the TagNodeInfo structure
+ */
+TagNodeInfo *getTagInfo(void **ifdArray,
+                       IFD_TYPE ifdType,
+                       uint16_t tagId)
+{
+    int i;
+    if (!ifdArray) {
+        return NULL;
+    }
+    for (i = 0; ifdArray[i] != NULL; i++) {
+        if (getIfdType(ifdArray[i]) == ifdType) {
+            void *targetTag = getTagNodePtrFromIfd(ifdArray[i], tagId);
+            if (!targetTag) {
+                return NULL;
+            }
+            return (TagNodeInfo*)duplicateTagNode(targetTag);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * getTagInfoFromIfd()
+ *
+ * Get the TagNodeInfo that matches the TagId
+ *
+ * parameters
+ *  [in] ifd : target IFD table
+ *  [in] tagId : target tag ID
+ *
+ * return
+ *  NULL: tag is not found
+ *  !NULL: address of the TagNodeInfo structure
+ */
+TagNodeInfo *getTagInfoFromIfd(void *ifd,
+                               uint16_t tagId)
+{
+    if (!ifd) {
+        return NULL;
+    }
+    return (TagNodeInfo*)getTagNodePtrFromIfd(ifd, tagId);
+}
+
+/**
+ * freeTagInfo()
+ *
+ * Free the TagNodeInfo allocated by getTagInfo() or getTagInfoFromIfd()
+ *
+ * parameters
+ *  [in] tag : target TagNodeInfo
+ */
+void freeTagInfo(void *tag)
+{
+    freeTagNode(tag);
+}
+
+/**
+ * queryTagNodeIsExist()
+ *
+ * Query if the specified tag node is exist in the IFD tables
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] ifdType : target IFD type
+ *  [in] tagId : target tag ID
+ *
+ * return
+ *  0: not exist
+ *  1: exist
+ */
+int queryTagNodeIsExist(void **ifdTableArray,
+                        IFD_TYPE ifdType,
+                        uint16_t tagId)
+{
+    IfdTable *ifd;
+    if (!ifdTableArray) {
+        return 0;
+    }
+    ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
+    return testTagPresence(ifd, tagId);
+}
+
+/**
+ * initExifTagQuery()
+ *
+ * Set up a tag of the presence query, the bit of the tag in the presence
+ * bitmap is looked up here once instead of on every query
+ *
+ * parameters
+ *  [out] query : target ExifTagQuery
+ *  [in] ifdType : target IFD type, IFD_UNKNOWN matches the tag in any of
+ *                 the 0th, Exif and GPS IFDs
+ *  [in] tagId : target tag ID
+ */
+void initExifTagQuery(ExifTagQuery *query,
+                      IFD_TYPE ifdType,
+                      uint16_t tagId)
+{
+    if (!query) {
+        return;
+    }
+    query->ifdType = ifdType;
+    query->tagId = tagId;
+    query->bit = (int16_t)getKnownTagIndex(tagId);
+}
+
+/**
+ * queryTagNodesExist()
+ *
+ * Query the presence of the list of tags in a single call
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] tags : tags to query, each set up by initExifTagQuery()
+ *  [in] count : number of the tags
+ *  [out] mask : bit i (mask[i / 64] >> (i % 64)) is set when tags[i]
+ *               exists, needs (count + 63) / 64 words
+ *
+ * return
+ *  >=0: number of the existing tags
+ *  ERR_INVALID_POINTER
+ */
+int queryTagNodesExist(void **ifdTableArray,
+                       const ExifTagQuery *tags,
+                       int count,
+                       uint64_t *mask)
+{
+    IfdTable *ifds[IFD_MPF + 1];
+    int i, num = 0;
+    if (!ifdTableArray || !tags || !mask) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(ifds, 0, sizeof(ifds));
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        IfdTable *ifd = ifdTableArray[i];
+        if (ifd->ifdType > IFD_UNKNOWN && ifd->ifdType <= IFD_MPF &&
+            !ifds[ifd->ifdType]) {
+            ifds[ifd->ifdType] = ifd;
+        }
+    }
+    memset(mask, 0, sizeof(uint64_t) * ((count + 63) / 64));
+    for (i = 0; i < count; i++) {
+        int exist;
+        IFD_TYPE ifdType = tags[i].ifdType;
+        uint16_t tagId = tags[i].tagId;
+        int bit = tags[i].bit;
+        if (ifdType == IFD_UNKNOWN) {
+            exist = testTagPresenceAt(ifds[IFD_0TH], tagId, bit) ||
+                    testTagPresenceAt(ifds[IFD_EXIF], tagId, bit) ||
+                    testTagPresenceAt(ifds[IFD_GPS], tagId, bit);
+        } else if (ifdType > IFD_UNKNOWN && ifdType <= IFD_MPF) {
+            exist = testTagPresenceAt(ifds[ifdType], tagId, bit);
+        } else {
+            exist = 0;
+        }
+        if (exist) {
+            mask[i / 64] |= (uint64_t)1 << (i % 64);
+            num++;
+        }
+    }
+    return num;
+}
+
+/**
+ * createTagInfo()
+ *
+ * Create new TagNodeInfo block
+ *
+ * parameters
+ *  [in] tagId: id of the tag
+ *  [in] type: type of the tag
+ *  [in] count: data count of the tag
+ *  [out] pResult : error status
+ *   0: OK
+ *  -n: error
+ *      ERR_INVALID_TYPE
+ *      ERR_INVALID_COUNT
+ *      ERR_MEMALLOC
+ *
+ * return
+ *  NULL: error
+ * !NULL: address of the newly created TagNodeInfo
+ */
+TagNodeInfo *createTagInfo(uint16_t tagId,
+                           uint16_t type,
+                           unsigned int count,
+                           int *pResult)
+{
+    TagNode *tag;
+    if (type < TYPE_BYTE || type > TYPE_SRATIONAL) {
+        if (pResult) {
+            *pResult = ERR_INVALID_TYPE;
+        }
+        return NULL;
+    }
+    if (count <= 0) {
+        if (pResult) {
+            *pResult = ERR_INVALID_COUNT;
+        }
+        return NULL;
+    }
+    tag = (TagNode*)malloc(sizeof(TagNode));
+    if (!tag) {
+        if (pResult) {
+            *pResult = ERR_MEMALLOC;
+        }
+        return NULL;
+    }
+    memset(tag, 0, sizeof(TagNode));
+    tag->tagId = tagId;
+    tag->type = type;
+    tag->count = count;
+
+    if (type == TYPE_ASCII || type == TYPE_UNDEFINED) {
+        tag->byteData = (uint8_t*)malloc(count*sizeof(char));
+    }
+    else if (type == TYPE_BYTE   ||
+             type == TYPE_SBYTE  ||
+             type == TYPE_SHORT  ||
+             type == TYPE_LONG   ||
+             type == TYPE_SSHORT ||
+             type == TYPE_SLONG) {
+        tag->numData = (unsigned int*)malloc(count*sizeof(int));
+    }
+    else if (type == TYPE_RATIONAL ||
+             type == TYPE_SRATIONAL) {
+        tag->numData = (unsigned int*)malloc(count*sizeof(int)*2);
+    }
+    if (pResult) {
+        *pResult = 0;
+    }
+    return (TagNodeInfo*)tag;
+}
+
+/**
+ * removeIfdTableFromIfdTableArray()
+ *
+ * Remove the IFD table from the ifdTableArray
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] ifdType : target IFD type
+ *
+ * return
+ *  n: number of the removed IFD tables
+ */
+int removeIfdTableFromIfdTableArray(void **ifdTableArray, IFD_TYPE ifdType)
+{
+    int i, num = 0, ret = 0;
+    if (!ifdTableArray) {
+        return 0;
+    }
+    // count IFD tables
+    num = countIfdTableOnIfdTableArray(ifdTableArray);
+    for (;;) { // possibility of multiple entries
+        for (i = 0; i < num; i++) {
+            IfdTable *ifd = ifdTableArray[i];
+            if (ifd->ifdType == ifdType) {
+                freeIfdTable(ifd);
+                ifdTableArray[i] = NULL;
+                ret++;
+                break;
+            }
+        }
+        if (i == num) {
+            break; // no more found
+        }
+        // left justify the array
+        memcpy(&ifdTableArray[i], &ifdTableArray[i+1], (num-i) * sizeof(void*));
+        num--;
+    }
+    return ret;
+}
+
+/**
+ * insertIfdTableToIfdTableArray()
+ *
+ * Insert new IFD table to the ifdTableArray
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] ifdType : target IFD type
+ *  [out] pResult : error status
+ *   0: OK
+ *  -n: error
+ *      ERR_ALREADY_EXIST
+ *      ERR_MEMALLOC
+ *
+ * return
+ *  NULL: error
+ * !NULL: address of the newly created ifdTableArray
+ *
+ * note
+ * This function frees old ifdTableArray if is not NULL.
+ */
+void **insertIfdTableToIfdTableArray(void **ifdTableArray,
+                                     IFD_TYPE ifdType,
+                                     int *pResult)
+{
+    void *newIfd;
+    void **newIfdTableArray;
+    int num = 0;
+    if (!ifdTableArray) {
+        num = 0;
+    } else {
+        num = countIfdTableOnIfdTableArray(ifdTableArray);
+    }
+    if (num > 0 && getIfdTableFromIfdTableArray(ifdTableArray, ifdType) != NULL) {
+        if (pResult) {
+            *pResult = ERR_ALREADY_EXIST;
+        }
+        return NULL;
+    }
+    // create the new IFD table
+    newIfd = createIfdTable(ifdType, 0, 0);
+    if (!newIfd) {
+        if (pResult) {
+            *pResult = ERR_MEMALLOC;
+        }
+        return NULL;
+    }
+    // copy existing IFD tables to the new array
+    newIfdTableArray = (void**)malloc(sizeof(void*)*(num+2));
+    if (!newIfdTableArray) {
+        if (pResult) {
+            *pResult = ERR_MEMALLOC;
+        }
+        free(newIfd);
+        return NULL;
+    }
+    memset(newIfdTableArray, 0, sizeof(void*)*(num+2));
+    if (num > 0) {
+        memcpy(newIfdTableArray, ifdTableArray, num * sizeof(void*));
+    }
+    // add the new IFD table
+    newIfdTableArray[num] = newIfd;
+    if (ifdTableArray) {
+        free(ifdTableArray); // free the old array
+    }
+    if (pResult) {
+        *pResult = 0;
+    }
+    return newIfdTableArray;
+}
+
+/**
+ * removeTagNodeFromIfdTableArray()
+ *
+ * Remove the specified tag node from the IFD table
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] ifdType : target IFD type
+ *  [in] tagId : target tag ID
+ *
+ * return
+ *  n: number of the removed tags
+ */
+int removeTagNodeFromIfdTableArray(void **ifdTableArray,
+                             IFD_TYPE ifdType,
+                             uint16_t tagId)
+{
+    IfdTable *ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
+    if (!ifd) {
+        return 0;
+    }
+    return removeTagOnIfd(ifd, tagId);
+}
+
+/**
+ * insertTagNodeToIfdTableArray()
+ *
+ * Insert the specified tag node to the IFD table
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] ifdType : target IFD type
+ *  [in] tagNodeInfo: address of the TagNodeInfo
+ *
+ * note
+ * This function uses the copy of the specified tag data.
+ * The caller must free it after this function returns.
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER:
+ *  ERR_NOT_EXIST:
+ *  ERR_ALREADY_EXIST:
+ *  ERR_UNKNOWN:
+ */
+int insertTagNodeToIfdTableArray(void **ifdTableArray,
+                             IFD_TYPE ifdType,
+                             TagNodeInfo *tagNodeInfo)
+{
+    IfdTable *ifd;
+    if (!ifdTableArray) {
+        return ERR_INVALID_POINTER;
+    }
+    if (!tagNodeInfo) {
+        return ERR_INVALID_POINTER;
+    }
+    ifd = getIfdTableFromIfdTableArray(ifdTableArray, ifdType);
+    if (!ifd) {
+        return ERR_NOT_EXIST;
+    }
+    // already exists the same type entry
+    if (testTagPresence(ifd, tagNodeInfo->tagId)) {
+        return ERR_ALREADY_EXIST;
+    }
+    // add to the IFD table
+    if (!addTagNodeToIfd(ifd, 
+                    tagNodeInfo->tagId,
+                    tagNodeInfo->type,
+                    tagNodeInfo->count,
+                    tagNodeInfo->numData,
+                    tagNodeInfo->byteData)) {
+        return ERR_UNKNOWN;
+    }
+    ifd->tagCount++;
+    return 0;
+}
+
+/**
+ * getThumbnailDataOnIfdTableArray()
+ *
+ * Get a copy of the thumbnail data from the 1st IFD table
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : error status
+ *   0: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *      ERR_NOT_EXIST
+ *
+ * return
+ *  NULL: error
+ * !NULL: the thumbnail data
+ *
+ * note
+ * This function returns the copy of the thumbnail data.
+ * The caller must free it.
+ */
+uint8_t *getThumbnailDataOnIfdTableArray(void **ifdTableArray,
+                                               unsigned int *pLength,
+                                               int *pResult)
+{
+    IfdTable *ifd;
+    TagNode *tag;
+    unsigned int len;
+    uint8_t *retp;
+    if (!ifdTableArray || !pLength) {
+        if (pResult) {
+            *pResult = ERR_INVALID_POINTER;
+        }
+        return NULL;
+    }
+    ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+    if (!ifd || !ifd->p) {
+        if (pResult) {
+            *pResult = ERR_NOT_EXIST;
+        }
+        return NULL;
+    }
+    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+    if (!tag || tag->error) {
+        if (pResult) {
+            *pResult = ERR_NOT_EXIST;
+        }
+        return NULL;
+    }
+    len = tag->numData[0];
+    if (len <= 0) {
+        if (pResult) {
+            *pResult = ERR_NOT_EXIST;
+        }
+        return NULL;
+    }
+    retp= (uint8_t*)malloc(len);
+    if (!retp) {
+        if (pResult) {
+            *pResult = ERR_MEMALLOC;
+        }
+        return NULL;
+    }
+    memcpy(retp, ifd->p, len);
+    *pLength = len;
+    if (pResult) {
+        *pResult = 0;
+    }
+    return retp;
+}
+
+/**
+ * setThumbnailDataOnIfdTableArray()
+ *
+ * Set or update the thumbnail data to the 1st IFD table
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [in] pData : thumbnail data
+ *  [in] length : thumbnail data length
+ *
+ * note
+ * This function creates the copy of the specified data.
+ * The caller must free it after this function returns.
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *      ERR_UNKNOWN
+ */
+int setThumbnailDataOnIfdTableArray(void **ifdTableArray,
+                                    uint8_t *pData,
+                                    unsigned int length)
+{
+    IfdTable *ifd;
+    TagNode *tag;
+    unsigned int zero = 0;
+    if (!ifdTableArray || !pData || length <= 0) {
+        return ERR_INVALID_POINTER;
+    }
+    ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+    if (!ifd) {
+        int count = countIfdTableOnIfdTableArray(ifdTableArray);
+        void* ifd1st = createIfdTable(IFD_1ST, 0, 0);
+        ifdTableArray[count] = ifd1st;
+        ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+        if (!ifd) {
+            return ERR_NOT_EXIST;
+        }
+    }
+    if (ifd->p) {
+        free(ifd->p);
+    }
+    // set thumbnail length;
+    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+    if (tag) {
+        setSingleNumDataToTag(tag, length);
+    } else {
+        if (!addTagNodeToIfd(ifd, TAG_JPEGInterchangeFormatLength,
+                            TYPE_LONG, 1, &length, NULL)) {
+            return ERR_UNKNOWN;
+        }
+    }
+    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormat);
+    if (tag) {
+        setSingleNumDataToTag(tag, zero);
+    } else {
+        // add thumbnail offset tag if not exist
+        addTagNodeToIfd(ifd, TAG_JPEGInterchangeFormat,
+                            TYPE_LONG, 1, &zero, NULL);
+    }
+    ifd->p = (uint8_t*)malloc(length);
+    if (!ifd->p) {
+        return ERR_MEMALLOC;
+    }
+    memcpy(ifd->p, pData, length);
+    return 0;
+}
+
+/**
+ * peekThumbnailDataOnIfdTableArray()
+ *
+ * Get the thumbnail data of the 1st IFD table without copying it
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : error status, same as getThumbnailDataOnIfdTableArray()
+ *
+ * return
+ *  NULL: error
+ * !NULL: the thumbnail data, owned by the IFD tables and valid until
+ *        they are freed or the thumbnail is replaced
+ */
+const uint8_t *peekThumbnailDataOnIfdTableArray(void **ifdTableArray,
+                                                unsigned int *pLength,
+                                                int *pResult)
+{
+    IfdTable *ifd;
+    TagNode *tag;
+    int sts = ERR_NOT_EXIST;
+    const uint8_t *retp = NULL;
+
+    if (!ifdTableArray || !pLength) {
+        sts = ERR_INVALID_POINTER;
+        goto DONE;
+    }
+    ifd = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+    if (!ifd || !ifd->p) {
+        goto DONE;
+    }
+    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+    if (!tag || tag->error || tag->numData[0] == 0) {
+        goto DONE;
+    }
+    *pLength = tag->numData[0];
+    retp = ifd->p;
+    sts = 0;
+DONE:
+    if (pResult) {
+        *pResult = sts;
+    }
+    return retp;
+}
+
+/**
+ * getExifThumbnailRange()
+ *
+ * Locate the thumbnail of the 1st IFD in a JPEG file without parsing the
+ * tags. Only the Exif segment header, the entry count and the next IFD
+ * offset of the 0th IFD, and the entries of the 1st IFD are read.
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] pOffset : returns the file offset of the thumbnail data
+ *  [out] pLength : returns the length of the thumbnail data
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_NOT_EXIST : no thumbnail
+ */
+int getExifThumbnailRange(const char *JPEGFileName, int64_t *pOffset,
+                          uint32_t *pLength)
+{
+    ExifIO io;
+    int sts;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        return ERR_READ_FILE;
+    }
+    sts = getExifThumbnailRangeFromIO(&io, pOffset, pLength);
+    closeExifIO(&io);
+    return sts;
+}
+
+/**
+ * getExifThumbnailRangeFromIO()
+ *
+ * Same as getExifThumbnailRange() for a JPEG read through an I/O backend
+ */
+int getExifThumbnailRangeFromIO(ExifIO *io, int64_t *pOffset, uint32_t *pLength)
+{
+    TIFF_VIEW v;
+    uint8_t hdr[4 + 6 + 8], buf[4], *entries = NULL;
+    uint32_t tiffLength, ifdOffset, thumbOffset = 0, thumbLength = 0, value;
+    uint16_t count, type;
+    int64_t ofs, tiff;
+    int i, sts;
+
+    if (!io || !pOffset || !pLength) {
+        return ERR_INVALID_POINTER;
+    }
+    ofs = getAppNStartOffset(io, APP1_MARKER, EXIF_ID_STR, EXIF_ID_STR_LEN, NULL, NULL);
+    if (ofs <= 0) {
+        return (int)ofs;
+    }
+    // segment length, "Exif\0\0" and the TIFF header
+    if (!ioReadFull(io, ofs, hdr, sizeof(hdr))) {
+        return ERR_READ_FILE;
+    }
+    tiffLength = (uint32_t)((hdr[2] << 8) | hdr[3]);
+    if (tiffLength < 2 + 6 + 8 || !tiffInitHeader(&v, hdr + 10, sizeof(hdr) - 10)) {
+        return ERR_INVALID_APP1HEADER;
+    }
+    tiffLength -= 2 + 6;
+    tiff = ofs + 10;
+
+    // skip the 0th IFD by its entry count to the offset of the 1st IFD
+    ifdOffset = tiffGet32(&v, hdr + 14);
+    if (ifdOffset < 8 || (uint64_t)ifdOffset + 2 > tiffLength ||
+        !ioReadFull(io, tiff + ifdOffset, buf, 2)) {
+        return ERR_INVALID_IFD;
+    }
+    count = tiffGet16(&v, buf);
+    ifdOffset += 2 + 12 * (uint32_t)count;
+    if ((uint64_t)ifdOffset + 4 > tiffLength || !ioReadFull(io, tiff + ifdOffset, buf, 4)) {
+        return ERR_INVALID_IFD;
+    }
+    ifdOffset = tiffGet32(&v, buf);
+    if (ifdOffset == 0) {
+        return ERR_NOT_EXIST;
+    }
+    if (ifdOffset < 8 || (uint64_t)ifdOffset + 2 > tiffLength ||
+        !ioReadFull(io, tiff + ifdOffset, buf, 2)) {
+        return ERR_INVALID_IFD;
+    }
+    count = tiffGet16(&v, buf);
+    if ((uint64_t)ifdOffset + 2 + 12 * (uint64_t)count > tiffLength) {
+        return ERR_INVALID_IFD;
+    }
+    entries = (uint8_t*)malloc(12 * (size_t)count + 1);
+    if (!entries) {
+        return ERR_MEMALLOC;
+    }
+    if (!ioReadFull(io, tiff + ifdOffset + 2, entries, 12 * (size_t)count)) {
+        sts = ERR_READ_FILE;
+        goto DONE;
+    }
+    // the two entries hold a single LONG (or SHORT) value in place
+    for (i = 0; i < count; i++) {
+        const uint8_t *p = entries + 12 * i;
+        uint16_t tagId = tiffGet16(&v, p);
+        if (tagId != TAG_JPEGInterchangeFormat &&
+            tagId != TAG_JPEGInterchangeFormatLength) {
+            continue;
+        }
+        type = tiffGet16(&v, p + 2);
+        if (type == TYPE_LONG) {
+            value = tiffGet32(&v, p + 8);
+        } else if (type == TYPE_SHORT) {
+            value = tiffGet16(&v, p + 8);
+        } else {
+            continue;
+        }
+        if (tagId == TAG_JPEGInterchangeFormat) {
+            thumbOffset = value;
+        } else {
+            thumbLength = value;
+        }
+    }
+    if (thumbOffset == 0 || thumbLength == 0) {
+        sts = ERR_NOT_EXIST;
+        goto DONE;
+    }
+    if (thumbOffset < 8 || (uint64_t)thumbOffset + thumbLength > tiffLength) {
+        sts = ERR_INVALID_IFD;
+        goto DONE;
+    }
+    *pOffset = tiff + thumbOffset;
+    *pLength = thumbLength;
+    sts = 1;
+DONE:
+    free(entries);
+    return sts;
+}
+
+/**
+ * getExifThumbnailFromBuffer()
+ *
+ * Locate the thumbnail of the 1st IFD in a JPEG file in memory (read or
+ * mapped by the caller), same as getExifThumbnailRange()
+ *
+ * parameters
+ *  [in] jpeg : the whole JPEG file
+ *  [in] length : length of the file
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : result status, same as getExifThumbnailRange()
+ *
+ * return
+ *  NULL: error or no thumbnail
+ * !NULL: the thumbnail data, pointing into 'jpeg'
+ */
+const uint8_t *getExifThumbnailFromBuffer(const uint8_t *jpeg, size_t length,
+                                          uint32_t *pLength, int *pResult)
+{
+    ExifMemoryIO mem;
+    ExifIO io;
+    int64_t offset;
+    int sts;
+
+    initExifMemoryIO(&io, &mem, jpeg, length);
+    sts = getExifThumbnailRangeFromIO(&io, &offset, pLength);
+    if (pResult) {
+        *pResult = sts;
+    }
+    return (sts == 1) ? jpeg + offset : NULL;
+}
+
+/**
+ * createThumbnailFromJPEGFile()
+ *
+ * Make a thumbnail of a baseline JPEG image without decoding it fully.
+ * Only the DC coefficient of each 8x8 block is kept, which gives the
+ * image at 1/8 scale; it is reduced by averaging to fit maxWidth x
+ * maxHeight and encoded as a small baseline JPEG.
+ *
+ * parameters
+ *  [in] JPEGFileName : source image
+ *  [in] maxWidth, maxHeight : size to fit in keeping the aspect ratio,
+ *                             e.g. 160 x 120; never enlarged
+ *  [in] quality : 1-100 as in the IJG library
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : result status
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_UNSUPPORTED_JPEG : progressive, arithmetic, 12-bit or CMYK
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * return
+ *  NULL: error
+ * !NULL: the thumbnail data, the caller must free it
+ */
+uint8_t *createThumbnailFromJPEGFile(const char *JPEGFileName,
+                                     unsigned int maxWidth, unsigned int maxHeight,
+                                     int quality, unsigned int *pLength, int *pResult)
+{
+    ExifIO io;
+    uint8_t *data;
+    if (openExifFileIO(&io, JPEGFileName, 0) != 0) {
+        if (pResult) {
+            *pResult = ERR_READ_FILE;
+        }
+        return NULL;
+    }
+    data = createThumbnailFromJPEGIO(&io, maxWidth, maxHeight, quality, pLength, pResult);
+    closeExifIO(&io);
+    return data;
+}
+
+/**
+ * createThumbnailFromJPEGIO()
+ *
+ * Same as createThumbnailFromJPEGFile() for an image read through an
+ * I/O backend
+ */
+uint8_t *createThumbnailFromJPEGIO(ExifIO *io,
+                                   unsigned int maxWidth, unsigned int maxHeight,
+                                   int quality, unsigned int *pLength, int *pResult)
+{
+    JPEG_DECODER *d = NULL;
+    JPEG_ENCODER *e = NULL;
+    ExifMemoryIO mem;
+    uint8_t *planes[3] = { NULL, NULL, NULL }, *data = NULL;
+    int srcW, srcH, width, height, i, sts;
+
+    if (!io || !pLength || maxWidth == 0 || maxHeight == 0) {
+        sts = ERR_INVALID_POINTER;
+        goto DONE;
+    }
+    d = (JPEG_DECODER*)calloc(1, sizeof(JPEG_DECODER));
+    e = (JPEG_ENCODER*)calloc(1, sizeof(JPEG_ENCODER));
+    if (!d || !e) {
+        sts = ERR_MEMALLOC;
+        goto DONE;
+    }
+    d->io = io;
+    sts = jpegDecodeHeaders(d);
+    if (sts == 0) {
+        sts = jpegDecodeDc(d);
+    }
+    if (sts != 0) {
+        goto DONE;
+    }
+    // fit the 1/8 scale image in the box
+    srcW = (d->width + 7) / 8;
+    srcH = (d->height + 7) / 8;
+    width = srcW;
+    height = srcH;
+    if (width > (int)maxWidth || height > (int)maxHeight) {
+        if ((uint64_t)srcW * maxHeight > (uint64_t)srcH * maxWidth) {
+            width = (int)maxWidth;
+            height = (int)(((uint64_t)srcH * maxWidth + srcW / 2) / srcW);
+        } else {
+            height = (int)maxHeight;
+            width = (int)(((uint64_t)srcW * maxHeight + srcH / 2) / srcH);
+        }
+        width = (width < 1) ? 1 : width;
+        height = (height < 1) ? 1 : height;
+    }
+    for (i = 0; i < d->componentCount; i++) {
+        planes[i] = (uint8_t*)malloc((size_t)width * height);
+        if (!planes[i]) {
+            sts = ERR_MEMALLOC;
+            goto DONE;
+        }
+        jpegResample(d, i, planes[i], width, height);
+    }
+    initExifMemoryIO(&e->out, &mem, NULL, 0);
+    sts = jpegEncode(e, planes, d->componentCount, width, height, quality);
+    if (sts == 0) {
+        data = mem.out;
+        *pLength = (unsigned int)mem.outLength;
+    } else {
+        free(mem.out);
+    }
+DONE:
+    if (d) {
+        for (i = 0; i < 3; i++) {
+            free(d->components[i].dc);
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        free(planes[i]);
+    }
+    free(d);
+    free(e);
+    if (pResult) {
+        *pResult = sts;
+    }
+    return data;
+}
+
+/**
+ * addGeneratedThumbnailToJPEGFile()
+ *
+ * Write a copy of a JPEG file with a thumbnail made by
+ * createThumbnailFromJPEGFile() in its 1st IFD, unless it already has
+ * one. A file without the Exif segment gets a new one.
+ *
+ * parameters
+ *  [in] inJPEGFileName : source file
+ *  [in] outJPEGFileName : output file, written only when 1 is returned
+ *  [in] maxWidth, maxHeight, quality : same as createThumbnailFromJPEGFile()
+ *
+ * return
+ *   1: OK
+ *   0: the file already has a thumbnail
+ *  -n: error, same as createThumbnailFromJPEGFile() and
+ *      updateExifSegmentInJPEGFile()
+ */
+int addGeneratedThumbnailToJPEGFile(const char *inJPEGFileName,
+                                    const char *outJPEGFileName,
+                                    unsigned int maxWidth, unsigned int maxHeight,
+                                    int quality)
+{
+    void *ifdTable[32];
+    IfdTable *ifd;
+    uint8_t *thumb;
+    unsigned int length, compression = 6; // JPEG
+    int count, sts;
+
+    count = fillIfdTableArray(inJPEGFileName, ifdTable);
+    if (count < 0) {
+        return count;
+    }
+    if (count == 0) {
+        // no Exif segment, start with an empty 0th IFD
+        ifdTable[0] = createIfdTable(IFD_0TH, 0, 0);
+        if (!ifdTable[0]) {
+            return ERR_MEMALLOC;
+        }
+    } else if (peekThumbnailDataOnIfdTableArray(ifdTable, &length, &sts)) {
+        freeIfdTables(ifdTable);
+        return 0;
+    }
+    thumb = createThumbnailFromJPEGFile(inJPEGFileName, maxWidth, maxHeight,
+                                        quality, &length, &sts);
+    if (!thumb) {
+        freeIfdTables(ifdTable);
+        return sts;
+    }
+    sts = setThumbnailDataOnIfdTableArray(ifdTable, thumb, length);
+    free(thumb);
+    ifd = getIfdTableFromIfdTableArray(ifdTable, IFD_1ST);
+    if (sts == 0 && ifd && !getTagNodePtrFromIfd(ifd, TAG_Compression)) {
+        if (!addTagNodeToIfd(ifd, TAG_Compression, TYPE_SHORT, 1, &compression, NULL)) {
+            sts = ERR_MEMALLOC;
+        }
+    }
+    if (sts == 0) {
+        sts = updateExifSegmentInJPEGFile(inJPEGFileName, outJPEGFileName, ifdTable);
+    }
+    freeIfdTables(ifdTable);
+    return sts;
+}
+
+/**
+ * serializeIfdTableArray()
+ *
+ * Encode the IFD tables into the compact binary format
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] buf : output buffer, may be NULL to get the required size
+ *  [in] bufSize : size of the output buffer
+ *
+ * return
+ *   n: required size in bytes (nothing is written if larger than bufSize)
+ *   0: error
+ */
+size_t serializeIfdTableArray(void **ifdTableArray, uint8_t *buf, size_t bufSize)
+{
+    uint32_t ifdCount = 0, entryCount = 0, valueSize = 0;
+    uint32_t ifdPos, entryPos, valuePos, total;
+    int i;
+
+    if (!ifdTableArray) {
+        return 0;
+    }
+    // pass 1: get the size of each area
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        IfdTable *ifd = (IfdTable*)ifdTableArray[i];
+        TagNode *tag;
+        ifdCount++;
+        for (tag = ifd->tags; tag; tag = tag->next) {
+            entryCount++;
+            valueSize += (blobValueLength(tag) + 3) & ~3u;
+        }
+        valueSize += (blobThumbnailLength(ifd) + 3) & ~3u;
+    }
+    total = BLOB_HEADER_SIZE + ifdCount * BLOB_IFD_SIZE +
+            entryCount * BLOB_ENTRY_SIZE + valueSize;
+    if (!buf || bufSize < total) {
+        return total;
+    }
+
+    // pass 2: write the header, the IFD records, the entries and the values
+    memset(buf, 0, total);
+    memcpy(buf, BLOB_MAGIC, 4);
+    putLE16(buf + 4, BLOB_VERSION);
+    putLE16(buf + 6, (uint16_t)ifdCount);
+    putLE32(buf + 8, total);
+    putLE32(buf + 12, entryCount);
+    ifdPos = BLOB_HEADER_SIZE;
+    entryPos = ifdPos + ifdCount * BLOB_IFD_SIZE;
+    valuePos = entryPos + entryCount * BLOB_ENTRY_SIZE;
+    entryCount = 0;
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        IfdTable *ifd = (IfdTable*)ifdTableArray[i];
+        TagNode *tag;
+        uint32_t j, n = 0, thumbnailLen = blobThumbnailLength(ifd);
+        uint8_t *rec = buf + ifdPos;
+
+        putLE16(rec, (uint16_t)ifd->ifdType);
+        putLE16(rec + 2, ifd->tagCount);
+        putLE32(rec + 4, ifd->nextIfdOffset);
+        putLE32(rec + 8, entryCount);
+        for (tag = ifd->tags; tag; tag = tag->next) {
+            uint8_t *ent = buf + entryPos;
+            uint32_t len = blobValueLength(tag);
+            putLE16(ent, tag->tagId);
+            ent[2] = (uint8_t)tag->type;
+            // a tag without values (count 0) is valid in TIFF and is stored
+            // as an empty value, not as an error
+            ent[3] = (tag->count > 0 && (tag->error || len == 0)) ? BLOB_FLAG_ERROR : 0;
+            putLE32(ent + 4, tag->count);
+            if (len > 0) {
+                putLE32(ent + 8, valuePos);
+                if (tag->type == TYPE_ASCII || tag->type == TYPE_UNDEFINED) {
+                    memcpy(buf + valuePos, tag->byteData, len);
+                } else {
+                    for (j = 0; j < len / 4; j++) {
+                        putLE32(buf + valuePos + j * 4, tag->numData[j]);
+                    }
+                }
+                valuePos += (len + 3) & ~3u;
+            }
+            entryPos += BLOB_ENTRY_SIZE;
+            n++;
+        }
+        putLE32(rec + 12, n);
+        if (thumbnailLen > 0) {
+            putLE32(rec + 16, valuePos);
+            putLE32(rec + 20, thumbnailLen);
+            memcpy(buf + valuePos, ifd->p, thumbnailLen);
+            valuePos += (thumbnailLen + 3) & ~3u;
+        }
+        entryCount += n;
+        ifdPos += BLOB_IFD_SIZE;
+    }
+    return total;
+}
+
+/**
+ * deserializeIfdTableArray()
+ *
+ * Create the pointer array of the IFD tables from the binary format
+ *
+ * parameters
+ *  [in] buf : data written by serializeIfdTableArray()
+ *  [in] length : length of the data
+ *  [out] pResult : result status
+ *   n: number of IFD tables
+ *  -n: error
+ *      ERR_INVALID_DATA
+ *      ERR_MEMALLOC
+ *
+ * return
+ *   NULL: error
+ *  !NULL: pointer array of the IFD tables
+ */
+void **deserializeIfdTableArray(const uint8_t *buf, size_t length, int *pResult)
+{
+    ExifBlobView view;
+    ExifBlobTag bt;
+    void *ifdTable[32];
+    unsigned int i, j, k, n;
+    int sts;
+
+    memset(ifdTable, 0, sizeof(ifdTable));
+    sts = initExifBlobView(&view, buf, length);
+    if (sts == 0 && view.ifdCount >= 32) {
+        sts = ERR_INVALID_DATA;
+    }
+    if (sts != 0) {
+        if (pResult) {
+            *pResult = sts;
+        }
+        return NULL;
+    }
+    for (i = 0; i < view.ifdCount; i++) {
+        const uint8_t *rec = view.data + BLOB_HEADER_SIZE + i * BLOB_IFD_SIZE;
+        uint32_t thumbnailOfs = getLE32(rec + 16), thumbnailLen = getLE32(rec + 20);
+        IfdTable *ifd = (IfdTable*)createIfdTable((IFD_TYPE)getLE16(rec),
+                                                  getLE16(rec + 2), getLE32(rec + 4));
+        if (!ifd) {
+            goto ERR;
+        }
+        ifdTable[i] = ifd;
+        n = getLE32(rec + 12);
+        for (j = 0; j < n; j++) {
+            TagNode *tag;
+            getExifBlobTagAt(&view, i, j, &bt);
+            // create the node without data, then fill it
+            tag = (TagNode*)addTagNodeToIfd(ifd, bt.tagId, bt.type, bt.count, NULL, NULL);
+            if (!tag) {
+                goto ERR;
+            }
+            // addTagNodeToIfd() left an empty tag as the parser does
+            if (bt.error || bt.count == 0) {
+                continue;
+            }
+            if (bt.type == TYPE_ASCII || bt.type == TYPE_UNDEFINED) {
+                tag->byteData = (uint8_t*)malloc(bt.count);
+                if (!tag->byteData) {
+                    goto ERR;
+                }
+                memcpy(tag->byteData, bt.values, bt.count);
+            } else {
+                unsigned int num = bt.count;
+                if (bt.type == TYPE_RATIONAL || bt.type == TYPE_SRATIONAL) {
+                    num *= 2;
+                }
+                tag->numData = (unsigned int*)malloc(sizeof(int) * num);
+                if (!tag->numData) {
+                    goto ERR;
+                }
+                for (k = 0; k < num; k++) {
+                    tag->numData[k] = getLE32(bt.values + k * 4);
+                }
+            }
+            tag->error = 0;
+        }
+        if (thumbnailLen > 0) {
+            ifd->p = (uint8_t*)malloc(thumbnailLen);
+            if (!ifd->p) {
+                goto ERR;
+            }
+            memcpy(ifd->p, view.data + thumbnailOfs, thumbnailLen);
+        }
+    }
+    if (pResult) {
+        *pResult = (int)view.ifdCount;
+    }
+    return copyIfdTableArray(ifdTable, (int)view.ifdCount);
+ERR:
+    freeIfdTables(ifdTable);
+    if (pResult) {
+        *pResult = ERR_MEMALLOC;
+    }
+    return NULL;
+}
+
+/**
+ * initExifBlobView()
+ *
+ * Check the binary format once and set up a view over it.
+ * The data is neither copied nor modified and must outlive the view.
+ *
+ * parameters
+ *  [out] view : the view
+ *  [in] buf : data written by serializeIfdTableArray()
+ *  [in] length : length of the data
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_INVALID_DATA
+ */
+int initExifBlobView(ExifBlobView *view, const uint8_t *buf, size_t length)
+{
+    uint32_t total, ifdCount, entryCount, valueStart, i, j;
+
+    if (!view || !buf) {
+        return ERR_INVALID_POINTER;
+    }
+    memset(view, 0, sizeof(ExifBlobView));
+    if (length < BLOB_HEADER_SIZE || memcmp(buf, BLOB_MAGIC, 4) != 0 ||
+        getLE16(buf + 4) != BLOB_VERSION) {
+        return ERR_INVALID_DATA;
+    }
+    ifdCount = getLE16(buf + 6);
+    total = getLE32(buf + 8);
+    entryCount = getLE32(buf + 12);
+    valueStart = BLOB_HEADER_SIZE + ifdCount * BLOB_IFD_SIZE;
+    if (total > length || entryCount > (total - BLOB_HEADER_SIZE) / BLOB_ENTRY_SIZE ||
+        valueStart > total || entryCount * BLOB_ENTRY_SIZE > total - valueStart) {
+        return ERR_INVALID_DATA;
+    }
+    valueStart += entryCount * BLOB_ENTRY_SIZE;
+    for (i = 0; i < ifdCount; i++) {
+        const uint8_t *rec = buf + BLOB_HEADER_SIZE + i * BLOB_IFD_SIZE;
+        uint32_t first = getLE32(rec + 8), n = getLE32(rec + 12);
+        uint32_t thumbnailOfs = getLE32(rec + 16), thumbnailLen = getLE32(rec + 20);
+        if (first > entryCount || n > entryCount - first) {
+            return ERR_INVALID_DATA;
+        }
+        if (thumbnailLen > 0 &&
+            (thumbnailOfs < valueStart || thumbnailOfs > total ||
+             thumbnailLen > total - thumbnailOfs)) {
+            return ERR_INVALID_DATA;
+        }
+        for (j = first; j < first + n; j++) {
+            const uint8_t *ent = buf + BLOB_HEADER_SIZE + ifdCount * BLOB_IFD_SIZE +
+                                 j * BLOB_ENTRY_SIZE;
+            uint32_t count = getLE32(ent + 4), ofs = getLE32(ent + 8);
+            uint64_t len;
+            if ((ent[3] & BLOB_FLAG_ERROR) || count == 0) {
+                continue;
+            }
+            len = count;
+            if (ent[2] == TYPE_RATIONAL || ent[2] == TYPE_SRATIONAL) {
+                len *= 8;
+            } else if (ent[2] != TYPE_ASCII && ent[2] != TYPE_UNDEFINED) {
+                len *= 4;
+            }
+            if ((ofs & 3) != 0 || ofs < valueStart || ofs > total || len > total - ofs) {
+                return ERR_INVALID_DATA;
+            }
+        }
+    }
+    view->data = buf;
+    view->length = total;
+    view->ifdCount = ifdCount;
+    view->entryCount = entryCount;
+    return 0;
+}
+
+/**
+ * getExifBlobTagAt()
+ *
+ * Get the n-th tag of the n-th IFD in the view
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [in] ifdIndex : index of the IFD
+ *  [in] tagIndex : index of the tag in the IFD
+ *  [out] tag : the tag
+ *
+ * return
+ *  0: not exist
+ *  1: exist
+ */
+int getExifBlobTagAt(const ExifBlobView *view, unsigned int ifdIndex,
+                     unsigned int tagIndex, ExifBlobTag *tag)
+{
+    const uint8_t *rec, *ent;
+    if (!view || !view->data || ifdIndex >= view->ifdCount) {
+        return 0;
+    }
+    rec = view->data + BLOB_HEADER_SIZE + ifdIndex * BLOB_IFD_SIZE;
+    if (tagIndex >= getLE32(rec + 12)) {
+        return 0;
+    }
+    ent = view->data + BLOB_HEADER_SIZE + view->ifdCount * BLOB_IFD_SIZE +
+          (getLE32(rec + 8) + tagIndex) * BLOB_ENTRY_SIZE;
+    tag->tagId = getLE16(ent);
+    tag->type = ent[2];
+    tag->error = (ent[3] & BLOB_FLAG_ERROR) ? 1 : 0;
+    tag->count = getLE32(ent + 4);
+    tag->values = (tag->error || tag->count == 0) ? NULL : view->data + getLE32(ent + 8);
+    return 1;
+}
+
+/**
+ * findExifBlobTag()
+ *
+ * Get the tag that matches the IFD_TYPE & TagId in the view
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [in] ifdType : target IFD type
+ *  [in] tagId : target tag ID
+ *  [out] tag : the tag
+ *
+ * return
+ *  0: not exist
+ *  1: exist
+ */
+int findExifBlobTag(const ExifBlobView *view, IFD_TYPE ifdType,
+                    uint16_t tagId, ExifBlobTag *tag)
+{
+    unsigned int i, j, n;
+    if (!view || !view->data || !tag) {
+        return 0;
+    }
+    for (i = 0; i < view->ifdCount; i++) {
+        const uint8_t *rec = view->data + BLOB_HEADER_SIZE + i * BLOB_IFD_SIZE;
+        const uint8_t *ent;
+        if (getLE16(rec) != ifdType) {
+            continue;
+        }
+        n = getLE32(rec + 12);
+        ent = view->data + BLOB_HEADER_SIZE + view->ifdCount * BLOB_IFD_SIZE +
+              getLE32(rec + 8) * BLOB_ENTRY_SIZE;
+        for (j = 0; j < n; j++, ent += BLOB_ENTRY_SIZE) {
+            if (getLE16(ent) == tagId) {
+                return getExifBlobTagAt(view, i, j, tag);
+            }
+        }
+        return 0;
+    }
+    return 0;
+}
+
+/**
+ * getExifBlobNumData()
+ *
+ * Get the n-th numeric value of a tag in the view
+ * (rationals are stored as numerator, denominator pairs)
+ *
+ * parameters
+ *  [in] tag : numeric tag
+ *  [in] index : index of the value
+ *
+ * return
+ *  the value
+ */
+unsigned int getExifBlobNumData(const ExifBlobTag *tag, unsigned int index)
+{
+    return getLE32(tag->values + index * 4);
+}
+
+/**
+ * getExifBlobThumbnail()
+ *
+ * Get the thumbnail data of the 1st IFD in the view without copying it
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [out] pLength : returns the length of the thumbnail data
+ *
+ * return
+ *  NULL: not exist
+ * !NULL: the thumbnail data inside the view
+ */
+const uint8_t *getExifBlobThumbnail(const ExifBlobView *view, unsigned int *pLength)
+{
+    unsigned int i;
+    if (!view || !view->data || !pLength) {
+        return NULL;
+    }
+    for (i = 0; i < view->ifdCount; i++) {
+        const uint8_t *rec = view->data + BLOB_HEADER_SIZE + i * BLOB_IFD_SIZE;
+        if (getLE16(rec) == IFD_1ST && getLE32(rec + 20) > 0) {
+            *pLength = getLE32(rec + 20);
+            return view->data + getLE32(rec + 16);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * updateExifSegmentInJPEGFile()
+ *
+ * Update the Exif segment in a JPEG file
+ *
+ * parameters
+ *  [in] inJPEGFileName : original JPEG file
+ *  [in] outJPGEFileName : output JPEG file
+ *  [in] ifdTableArray : address of the IFD tables array
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_POINTER
+ *      ERROR_UNKNOWN:
+ */
+int updateExifSegmentInJPEGFile(const char *inJPEGFileName,
+                                const char *outJPGEFileName,
+                                void **ifdTableArray)
+{
+    ExifIO in, out;
+    int sts;
+
+    // refresh the length and offset variables in the IFD table
+    sts = fixLengthAndOffsetInIfdTables(ifdTableArray);
+    if (sts != 0) {
+        return sts;
+    }
+    sts = openExifFileIO(&in, inJPEGFileName, 0);
+    if (sts != 0) {
+        return sts;
+    }
+    sts = init(&in);
+    if (sts >= 0) {
+        int hasExifSegment = sts;
+        sts = openExifFileIO(&out, outJPGEFileName, 1);
+        if (sts == 0) {
+            sts = copyWithNewExifSegment(&in, &out, ifdTableArray, hasExifSegment);
+            closeExifIO(&out);
+        }
+    }
+    closeExifIO(&in);
+    return sts;
+}
+
+/**
+ * updateExifSegmentInJPEGIO()
+ *
+ * Update the Exif segment in a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *  [in] ifdTableArray : address of the IFD tables array
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *      ERROR_UNKNOWN:
+ */
+int updateExifSegmentInJPEGIO(ExifIO *in, ExifIO *out, void **ifdTableArray)
+{
+    int sts;
+
+    if (!in || !out || !out->write) {
+        return ERR_INVALID_POINTER;
+    }
+    // refresh the length and offset variables in the IFD table
+    sts = fixLengthAndOffsetInIfdTables(ifdTableArray);
+    if (sts != 0) {
+        return sts;
+    }
+    sts = init(in);
+    if (sts < 0) {
+        return sts;
+    }
+    return copyWithNewExifSegment(in, out, ifdTableArray, sts);
+}
+
+/**
+ * removeAdobeMetadataSegmentFromJPEGFile()
+ *
+ * Remove Adobe's XMP metadata segment from a JPEG file
+ *
+ * parameters
+ *  [in] inJPEGFileName : original JPEG file
+ *  [in] outJPGEFileName : output JPEG file
+ *
+ * return
+ *   1: OK
+ *   0: Adobe's metadata segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ */
+int removeAdobeMetadataSegmentFromJPEGFile(const char *inJPEGFileName,
+                                           const char *outJPGEFileName)
+{
+    ExifIO in, out;
+    int64_t ofs;
+    int sts;
+
+    sts = openExifFileIO(&in, inJPEGFileName, 0);
+    if (sts != 0) {
+        return sts;
+    }
+    ofs = getAppNStartOffset(&in, APP1_MARKER, ADOBE_METADATA_ID, ADOBE_METADATA_ID_LEN, NULL, NULL);
+    if (ofs <= 0) { // target segment does not exist or an error
+        sts = (int)ofs;
+    } else {
+        sts = openExifFileIO(&out, outJPGEFileName, 1);
+        if (sts == 0) {
+            sts = copyWithoutSegment(&in, &out, ofs);
+            closeExifIO(&out);
+        }
+    }
+    closeExifIO(&in);
+    return sts;
+}
+
+/**
+ * removeAdobeMetadataSegmentFromJPEGIO()
+ *
+ * Remove Adobe's XMP metadata segment from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *   1: OK
+ *   0: Adobe's metadata segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_POINTER
+ */
+int removeAdobeMetadataSegmentFromJPEGIO(ExifIO *in, ExifIO *out)
+{
+    int64_t ofs;
+
+    if (!in || !out || !out->write) {
+        return ERR_INVALID_POINTER;
+    }
+    ofs = getAppNStartOffset(in, APP1_MARKER, ADOBE_METADATA_ID, ADOBE_METADATA_ID_LEN, NULL, NULL);
+    if (ofs <= 0) { // target segment is not exist or something error
+        return (int)ofs;
+    }
+    return copyWithoutSegment(in, out, ofs);
+}
+
+/**
+ * createIfdTableArrayBatch()
+ *
+ * Parse the JPEG headers of many files at once
+ *
+ * parameters
+ *  [in/out] items : array of files to parse, results are stored in place
+ *  [in] count : number of items
+ *  [in] chunkSize : bytes read from the beginning of each file first
+ *  [in] depth : maximum number of files in flight
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+#if defined(__linux__)
+
+typedef struct _uring {
+    int fd;
+    unsigned int sqEntries;
+    unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqPtr, *cqPtr;
+    size_t sqLen, cqLen, sqesLen;
+    unsigned int toSubmit;
+} URING;
+_Static_assert(offsetof(URING, sqHead) % _Alignof(unsigned int*) == 0,
+               "URING must not be packed");
+
+// one file in flight
+typedef struct _batchSlot {
+    int item;       // index in the items array, -1: free
+    int fd;
+    int reading;    // 0: opening  1: reading
+    uint8_t *buf;
+    size_t cap;
+    size_t len;     // valid bytes in buf
+    size_t req;     // bytes requested by the pending read
+    int eof;
+    int useCache;   // key is set, store the result in the metadata cache
+    CACHE_KEY key;
+} BATCH_SLOT;
+_Static_assert(offsetof(BATCH_SLOT, buf) % _Alignof(uint8_t*) == 0,
+               "BATCH_SLOT must not be packed");
+
+// input backend over a partially read file
+typedef struct _prefixStream {
+    const uint8_t *buf;
+    size_t len;
+    int eof;        // buf holds the whole file
+    size_t want;    // end of the furthest access beyond buf
+} PREFIX_STREAM;
+
+static int64_t prefixStreamReadAt(void *context, int64_t offset, void *dst, size_t size)
+{
+    PREFIX_STREAM *ps = (PREFIX_STREAM*)context;
+    size_t avail = 0;
+    if (offset < 0) {
+        return -1;
+    }
+    if (!ps->eof && offset + size > ps->len && offset + size > ps->want) {
+        ps->want = (size_t)offset + size;
+    }
+    if (offset < (int64_t)ps->len) {
+        avail = ps->len - (size_t)offset;
+        if (avail > size) {
+            avail = size;
+        }
+        memcpy(dst, ps->buf + offset, avail);
+    }
+    return (int64_t)avail;
+}
+
+static int64_t prefixStreamSize(void *context)
+{
+    PREFIX_STREAM *ps = (PREFIX_STREAM*)context;
+    return ps->eof ? (int64_t)ps->len : -1; // not known until the end is read
+}
+
+/**
+ * parse the buffered head of a file
+ *
+ * return
+ *  1: done, the item holds the result
+ *  0: the Exif or MPF data lies beyond the buffer, *pWant is set
+ */
+static int parseBatchSlot(BATCH_SLOT *slot, ExifBatchItem *item, size_t *pWant)
+{
+    PREFIX_STREAM ps;
+    ExifIO io;
+    void *ifdTable[32];
+    int sts;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.buf = slot->buf;
+    ps.len = slot->len;
+    ps.eof = slot->eof;
+    memset(&io, 0, sizeof(io));
+    io.readAt = prefixStreamReadAt;
+    io.size = prefixStreamSize;
+    io.context = &ps;
+    sts = fillIfdTableArrayFromIO(&io, ifdTable);
+
+    if (ps.want > ps.len) {
+        freeIfdTables(ifdTable);
+        *pWant = ps.want;
+        return 0;
+    }
+    item->result = sts;
+    if (slot->useCache && sts != ERR_READ_FILE) {
+        storeIfdTableCache(&slot->key, ifdTable, sts);
+    }
+    if (sts > 0) {
+        item->ifdArray = copyIfdTableArray(ifdTable, sts);
+    } else {
+        freeIfdTables(ifdTable);
+    }
+    return 1;
+}
+
+static void uringExit(URING *ring)
+{
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqesLen);
+    }
+    if (ring->cqPtr && ring->cqPtr != ring->sqPtr) {
+        munmap(ring->cqPtr, ring->cqLen);
+    }
+    if (ring->sqPtr) {
+        munmap(ring->sqPtr, ring->sqLen);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+// the kernel must support the opcodes used here (5.6 and later);
+// older ones fail the probe itself, or every IORING_OP_OPENAT/READ
+// with -EINVAL
+static int uringProbe(int fd)
+{
+    struct io_uring_probe *probe;
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    int ok = 0;
+
+    probe = (struct io_uring_probe*)calloc(1, len);
+    if (!probe) {
+        return 0;
+    }
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_OPENAT && probe->last_op >= IORING_OP_READ &&
+        (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+        (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+        ok = 1;
+    }
+    free(probe);
+    return ok;
+}
+
+static int uringInit(URING *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+
+    memset(ring, 0, sizeof(URING));
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        return 0;
+    }
+    if (!uringProbe(ring->fd)) {
+        uringExit(ring);
+        return 0;
+    }
+    ring->sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cqLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqLen > ring->sqLen) {
+            ring->sqLen = ring->cqLen;
+        }
+        ring->cqLen = ring->sqLen;
+    }
+    ring->sqPtr = mmap(NULL, ring->sqLen, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqPtr == MAP_FAILED) {
+        ring->sqPtr = NULL;
+        uringExit(ring);
+        return 0;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqPtr = ring->sqPtr;
+    } else {
+        ring->cqPtr = mmap(NULL, ring->cqLen, PROT_READ|PROT_WRITE,
+                           MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqPtr == MAP_FAILED) {
+            ring->cqPtr = NULL;
+            uringExit(ring);
+            return 0;
+        }
+    }
+    ring->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesLen, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        uringExit(ring);
+        return 0;
+    }
+    sq = (uint8_t*)ring->sqPtr;
+    cq = (uint8_t*)ring->cqPtr;
+    ring->sqEntries = p.sq_entries;
+    ring->sqHead  = (unsigned int*)(sq + p.sq_off.head);
+    ring->sqTail  = (unsigned int*)(sq + p.sq_off.tail);
+    ring->sqMask  = (unsigned int*)(sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned int*)(sq + p.sq_off.array);
+    ring->cqHead  = (unsigned int*)(cq + p.cq_off.head);
+    ring->cqTail  = (unsigned int*)(cq + p.cq_off.tail);
+    ring->cqMask  = (unsigned int*)(cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 1;
+}
+
+// get a free submission entry, NULL if the ring is full
+static struct io_uring_sqe *uringGetSqe(URING *ring)
+{
+    unsigned int tail = *ring->sqTail;
+    unsigned int head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+    if (tail - head >= ring->sqEntries) {
+        return NULL;
+    }
+    idx = tail & *ring->sqMask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[idx] = idx;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->toSubmit++;
+    return sqe;
+}
+
+static int uringSubmitAndWait(URING *ring, unsigned int waitNr)
+{
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->toSubmit, waitNr,
+                           IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0) {
+        ring->toSubmit -= ret;
+    }
+    return ret;
+}
+
+// queue the read of the file up to 'want' bytes, returns 0 or ERR_xxx
+static int batchSubmitRead(URING *ring, BATCH_SLOT *slot, int slotIndex, size_t want)
+{
+    struct io_uring_sqe *sqe;
+    if (want > slot->cap) {
+        uint8_t *p = (uint8_t*)realloc(slot->buf, want);
+        if (!p) {
+            return ERR_MEMALLOC;
+        }
+        slot->buf = p;
+        slot->cap = want;
+    }
+    sqe = uringGetSqe(ring);
+    if (!sqe) {
+        // the ring is full, hand the pending entries to the kernel
+        if (uringSubmitAndWait(ring, 0) < 0 || (sqe = uringGetSqe(ring)) == NULL) {
+            return ERR_READ_FILE;
+        }
+    }
+    slot->reading = 1;
+    slot->req = want - slot->len;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buf + slot->len);
+    sqe->len = (unsigned int)slot->req;
+    sqe->off = slot->len;
+    sqe->user_data = (uint64_t)slotIndex;
+    return 0;
+}
+
+static void batchFinish(BATCH_SLOT *slot)
+{
+    if (slot->fd >= 0) {
+        close(slot->fd);
+    }
+    slot->fd = -1;
+    slot->item = -1;
+    slot->len = 0;
+    slot->eof = 0;
+    slot->useCache = 0;
+}
+
+int createIfdTableArrayBatch(ExifBatchItem *items, int count,
+                             unsigned int chunkSize, unsigned int depth)
+{
+    URING ring;
+    BATCH_SLOT *slots;
+    int i, next = 0, inflight = 0, sts = 0;
+
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    for (i = 0; i < count; i++) {
+        items[i].ifdArray = NULL;
+        items[i].result = ERR_READ_FILE;
+        items[i].reads = 0;
+    }
+    if (chunkSize < 64) {
+        chunkSize = 64;
+    }
+    if (depth < 1) {
+        depth = 1;
+    }
+    if ((int)depth > count) {
+        depth = (count > 0) ? count : 1;
+    }
+    if (!uringInit(&ring, depth)) {
+        // io_uring or its open/read opcodes are not available, parse one by one
+        for (i = 0; i < count; i++) {
+            items[i].ifdArray = createIfdTableArray(items[i].fileName, &items[i].result);
+            items[i].reads = 1;
+        }
+        return 0;
+    }
+    if (depth > ring.sqEntries) {
+        depth = ring.sqEntries;
+    }
+    slots = (BATCH_SLOT*)calloc(depth, sizeof(BATCH_SLOT));
+    if (!slots) {
+        uringExit(&ring);
+        return ERR_MEMALLOC;
+    }
+    for (i = 0; i < (int)depth; i++) {
+        slots[i].item = -1;
+        slots[i].fd = -1;
+    }
+
+    while (next < count || inflight > 0) {
+        struct io_uring_cqe *cqe;
+        unsigned int head;
+
+        // open the next files in the free slots
+        for (i = 0; i < (int)depth && next < count; i++) {
+            struct io_uring_sqe *sqe;
+            int hit;
+            if (slots[i].item >= 0) {
+                continue;
+            }
+            // consult the metadata cache first as createIfdTableArray() does
+            slots[i].useCache = cacheGetKey(items[next].fileName, &slots[i].key);
+            if (slots[i].useCache) {
+                items[next].ifdArray = lookupIfdTableCache(&slots[i].key,
+                                                           &items[next].result, &hit);
+                if (hit) {
+                    slots[i].useCache = 0;
+                    next++;
+                    i--;
+                    continue;
+                }
+            }
+            sqe = uringGetSqe(&ring);
+            if (!sqe) {
+                slots[i].useCache = 0;
+                break;
+            }
+            slots[i].item = next++;
+            slots[i].reading = 0;
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)items[slots[i].item].fileName;
+            sqe->open_flags = O_RDONLY|O_CLOEXEC;
+            sqe->user_data = (uint64_t)i;
+            inflight++;
+        }
+        if (inflight == 0) {
+            continue;   // the remaining files were all in the cache
+        }
+        if (uringSubmitAndWait(&ring, 1) < 0) {
+            sts = ERR_READ_FILE;
+            break;
+        }
+
+        // process the completions
+        head = *ring.cqHead;
+        while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+            int slotIndex, res;
+            BATCH_SLOT *slot;
+            ExifBatchItem *item;
+            size_t want;
+
+            cqe = &ring.cqes[head & *ring.cqMask];
+            slotIndex = (int)cqe->user_data;
+            res = cqe->res;
+            head++;
+            __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+            slot = &slots[slotIndex];
+            item = &items[slot->item];
+            if (res < 0) {
+                item->result = ERR_READ_FILE;
+                batchFinish(slot);
+                inflight--;
+                continue;
+            }
+            if (!slot->reading) {
+                slot->fd = res;
+                want = chunkSize;
+            } else {
+                item->reads++;
+                slot->len += res;
+                if ((size_t)res < slot->req) {
+                    slot->eof = 1;
+                }
+                if (parseBatchSlot(slot, item, &want)) {
+                    batchFinish(slot);
+                    inflight--;
+                    continue;
+                }
+                // read the rest of the segment, at least one more chunk
+                if (want < slot->len + chunkSize) {
+                    want = slot->len + chunkSize;
+                }
+            }
+            res = batchSubmitRead(&ring, slot, slotIndex, want);
+            if (res != 0) {
+                item->result = res;
+                batchFinish(slot);
+                inflight--;
+            }
+        }
+    }
+
+    for (i = 0; i < (int)depth; i++) {
+        if (slots[i].item >= 0) {
+            batchFinish(&slots[i]);
+        }
+        free(slots[i].buf);
+    }
+    free(slots);
+    uringExit(&ring);
+    return sts;
+}
+
+#else
+
+int createIfdTableArrayBatch(ExifBatchItem *items, int count,
+                             unsigned int chunkSize, unsigned int depth)
+{
+    int i;
+    if (!items || count < 0) {
+        return ERR_INVALID_POINTER;
+    }
+    for (i = 0; i < count; i++) {
+        items[i].ifdArray = createIfdTableArray(items[i].fileName, &items[i].result);
+        items[i].reads = 1;
+    }
+    return 0;
+}
+
+#endif
+
+/**
+ * openIfdTableCache()
+ *
+ * Open or create the metadata cache used by createIfdTableArray()
+ *
+ * parameters
+ *  [in] cacheFileName : cache file
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_BUSY
+ *      ERR_MEMALLOC
+ *      ERR_UNKNOWN
+ */
+#if defined(EXIF_HAVE_MMAP)
+
+#define CACHE_MAGIC          "EXIFCAC1"
+#define CACHE_VERSION        2
+#define CACHE_INITIAL_BUCKETS 65536
+#define CACHE_INITIAL_DATA   (1024 * 1024)
+#define CACHE_OPEN_TRIES     100     // 10 ms apart
+
+// cache file header, followed by the bucket array and the record data
+typedef struct _cacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bucketCount;   // power of two
+    uint64_t entryCount;
+    uint64_t dataEnd;       // end of the used record data
+} CACHE_HEADER;
+
+// one bucket per file (dev, inode); the size and mtime must match on lookup
+typedef struct _cacheBucket {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtimeNs;
+    uint64_t dataOffset;    // offset of the record from the beginning of the file
+    uint32_t dataLength;
+    uint32_t used;
+} CACHE_BUCKET;
+
+typedef struct _ifdCache {
+    char *fileName;
+    int fd;
+    uint8_t *map;
+    size_t mapLen;
+} IFD_CACHE;
+
+static IFD_CACHE *IfdCache = NULL;
+static pthread_mutex_t IfdCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+#if defined(__APPLE__)
+#define ST_MTIME_NSEC(st) ((uint64_t)(st).st_mtimespec.tv_sec * 1000000000ULL + (st).st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((uint64_t)(st).st_mtim.tv_sec * 1000000000ULL + (st).st_mtim.tv_nsec)
+#endif
+
+static CACHE_HEADER *cacheHeader(IFD_CACHE *cache)
+{
+    return (CACHE_HEADER*)cache->map;
+}
+
+static CACHE_BUCKET *cacheBuckets(IFD_CACHE *cache)
+{
+    return (CACHE_BUCKET*)(cache->map + sizeof(CACHE_HEADER));
+}
+
+static uint64_t cacheDataStart(uint32_t bucketCount)
+{
+    return sizeof(CACHE_HEADER) + (uint64_t)bucketCount * sizeof(CACHE_BUCKET);
+}
+
+static uint32_t cacheHash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = ino * 0x9E3779B97F4A7C15ULL ^ dev * 0xC2B2AE3D27D4EB4FULL;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+static void cacheUnmap(IFD_CACHE *cache)
+{
+    if (cache->map) {
+        munmap(cache->map, cache->mapLen);
+        cache->map = NULL;
+    }
+    if (cache->fd >= 0) {
+        close(cache->fd);
+        cache->fd = -1;
+    }
+}
+
+// map the whole cache file, resizing it to 'size' bytes first if larger
+static int cacheMap(IFD_CACHE *cache, int fd, uint64_t size)
+{
+    struct stat st;
+    uint8_t *map;
+    if (fstat(fd, &st) != 0) {
+        return ERR_READ_FILE;
+    }
+    if ((uint64_t)st.st_size < size) {
+        if (ftruncate(fd, (off_t)size) != 0) {
+            return ERR_WRITE_FILE;
+        }
+    } else {
+        size = (uint64_t)st.st_size;
+    }
+    map = (uint8_t*)mmap(NULL, (size_t)size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return ERR_MEMALLOC;
+    }
+    if (cache->map) {
+        munmap(cache->map, cache->mapLen);
+    }
+    if (cache->fd >= 0 && cache->fd != fd) {
+        close(cache->fd);
+    }
+    cache->fd = fd;
+    cache->map = map;
+    cache->mapLen = (size_t)size;
+    return 0;
+}
+
+// create an empty cache file
+static int cacheCreate(IFD_CACHE *cache, int fd, uint32_t bucketCount, uint64_t dataSize)
+{
+    CACHE_HEADER *hdr;
+    int sts = cacheMap(cache, fd, cacheDataStart(bucketCount) + dataSize);
+    if (sts != 0) {
+        return sts;
+    }
+    hdr = cacheHeader(cache);
+    memset(hdr, 0, sizeof(CACHE_HEADER));
+    memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = CACHE_VERSION;
+    hdr->bucketCount = bucketCount;
+    hdr->dataEnd = cacheDataStart(bucketCount);
+    return 0;
+}
+
+static CACHE_BUCKET *cacheFindBucket(IFD_CACHE *cache, uint64_t dev, uint64_t ino)
+{
+    CACHE_HEADER *hdr = cacheHeader(cache);
+    CACHE_BUCKET *buckets = cacheBuckets(cache);
+    uint32_t mask = hdr->bucketCount - 1;
+    uint32_t i = cacheHash(dev, ino) & mask;
+    for (;;) {
+        CACHE_BUCKET *b = &buckets[i];
+        if (!b->used || (b->dev == dev && b->ino == ino)) {
+            return b;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// the record of the bucket must lie within the record data of the file
+static int cacheRecordValid(IFD_CACHE *cache, const CACHE_BUCKET *b)
+{
+    CACHE_HEADER *hdr = cacheHeader(cache);
+    return b->dataLength >= sizeof(int32_t) &&
+           b->dataOffset >= cacheDataStart(hdr->bucketCount) &&
+           b->dataOffset <= hdr->dataEnd &&
+           b->dataLength <= hdr->dataEnd - b->dataOffset &&
+           hdr->dataEnd <= cache->mapLen;
+}
+
+// make room for 'length' more bytes of record data
+static int cacheReserve(IFD_CACHE *cache, size_t length)
+{
+    CACHE_HEADER *hdr = cacheHeader(cache);
+    uint64_t need = hdr->dataEnd + length;
+    uint64_t size = cache->mapLen;
+    if (need <= size) {
+        return 0;
+    }
+    while (size < need) {
+        size *= 2;
+    }
+    return cacheMap(cache, cache->fd, size);
+}
+
+// rebuild the cache with twice the buckets, dropping the stale records
+static int cacheRehash(IFD_CACHE *cache)
+{
+    IFD_CACHE newCache;
+    CACHE_HEADER *hdr = cacheHeader(cache), *newHdr;
+    CACHE_BUCKET *buckets = cacheBuckets(cache);
+    uint32_t i, bucketCount = hdr->bucketCount * 2;
+    char *tmpName;
+    int fd, sts;
+
+    tmpName = (char*)malloc(strlen(cache->fileName) + 5);
+    if (!tmpName) {
+        return ERR_MEMALLOC;
+    }
+    sprintf(tmpName, "%s.tmp", cache->fileName);
+    fd = open(tmpName, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(tmpName);
+        return ERR_WRITE_FILE;
+    }
+    newCache.fileName = cache->fileName;
+    newCache.fd = -1;
+    newCache.map = NULL;
+    newCache.mapLen = 0;
+    sts = cacheCreate(&newCache, fd, bucketCount,
+                      hdr->dataEnd - cacheDataStart(hdr->bucketCount));
+    if (sts != 0) {
+        close(fd);
+        unlink(tmpName);
+        free(tmpName);
+        return sts;
+    }
+    newHdr = cacheHeader(&newCache);
+    for (i = 0; i < hdr->bucketCount; i++) {
+        CACHE_BUCKET *b = &buckets[i], *nb;
+        if (!b->used || !cacheRecordValid(cache, b)) {
+            continue;
+        }
+        nb = cacheFindBucket(&newCache, b->dev, b->ino);
+        *nb = *b;
+        nb->dataOffset = newHdr->dataEnd;
+        memcpy(newCache.map + newHdr->dataEnd, cache->map + b->dataOffset, b->dataLength);
+        newHdr->dataEnd += (b->dataLength + 7) & ~7u;
+        newHdr->entryCount++;
+    }
+    if (flock(fd, LOCK_EX|LOCK_NB) != 0 || rename(tmpName, cache->fileName) != 0) {
+        cacheUnmap(&newCache);
+        unlink(tmpName);
+        free(tmpName);
+        return ERR_WRITE_FILE;
+    }
+    free(tmpName);
+    // tell the other processes still mapping the old file to reopen it
+    memset(cacheHeader(cache)->magic, 0, sizeof(cacheHeader(cache)->magic));
+    cacheUnmap(cache);
+    cache->fd = newCache.fd;
+    cache->map = newCache.map;
+    cache->mapLen = newCache.mapLen;
+    return 0;
+}
+
+// take the lock of the cache file, LOCK_SH for a lookup and LOCK_EX for an
+// update, and catch up with the other processes: reopen the file when a
+// rehash replaced it, remap it when it grew. Returns 0 without the lock if
+// another process holds it or the file cannot be used.
+static int cacheAcquire(IFD_CACHE *cache, int op)
+{
+    CACHE_HEADER *hdr;
+    int fd, tries;
+
+    for (tries = 0; tries < 4; tries++) {
+        if (flock(cache->fd, op|LOCK_NB) != 0) {
+            return 0;
+        }
+        hdr = cacheHeader(cache);
+        if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) == 0) {
+            if (hdr->dataEnd > cache->mapLen) {
+                cacheMap(cache, cache->fd, 0);
+                hdr = cacheHeader(cache);
+            }
+            if (hdr->dataEnd <= cache->mapLen) {
+                return 1;
+            }
+            flock(cache->fd, LOCK_UN);
+            return 0;
+        }
+        flock(cache->fd, LOCK_UN);
+        fd = open(cache->fileName, O_RDWR|O_CLOEXEC);
+        if (fd < 0) {
+            return 0;
+        }
+        if (cacheMap(cache, fd, 0) != 0) {
+            close(fd);
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void cacheRelease(IFD_CACHE *cache)
+{
+    flock(cache->fd, LOCK_UN);
+}
+
+// get the key of the file, 0 if the cache is not opened
+static int cacheGetKey(const char *fileName, CACHE_KEY *key)
+{
+    struct stat st;
+    int opened;
+    pthread_mutex_lock(&IfdCacheLock);
+    opened = (IfdCache != NULL);
+    pthread_mutex_unlock(&IfdCacheLock);
+    if (!opened || stat(fileName, &st) != 0) {
+        return 0;
+    }
+    key->dev = (uint64_t)st.st_dev;
+    key->ino = (uint64_t)st.st_ino;
+    key->size = (uint64_t)st.st_size;
+    key->mtimeNs = ST_MTIME_NSEC(st);
+    return 1;
+}
+
+// look up the parse result of the file, NULL if not cached
+// the record is copied under the lock and deserialized outside it
+static void **lookupIfdTableCache(const CACHE_KEY *key, int *result, int *pHit)
+{
+    void **ifdArray = NULL;
+    CACHE_BUCKET *b;
+    uint8_t *rec = NULL;
+    size_t len = 0;
+    int32_t sts = 0;
+    int found = 0;
+    int count;
+
+    *pHit = 0;
+    pthread_mutex_lock(&IfdCacheLock);
+    if (!IfdCache) {
+        pthread_mutex_unlock(&IfdCacheLock);
+        return NULL;
+    }
+    if (!cacheAcquire(IfdCache, LOCK_SH)) {
+        // another process is updating the cache, parse the file
+        pthread_mutex_unlock(&IfdCacheLock);
+        return NULL;
+    }
+    b = cacheFindBucket(IfdCache, key->dev, key->ino);
+    if (b->used && b->size == key->size && b->mtimeNs == key->mtimeNs &&
+        cacheRecordValid(IfdCache, b)) {
+        const uint8_t *src = IfdCache->map + b->dataOffset;
+        memcpy(&sts, src, sizeof(int32_t));
+        len = b->dataLength - sizeof(int32_t);
+        if (sts <= 0) {
+            found = 1;
+        } else if (len > 0 && (rec = (uint8_t*)malloc(len)) != NULL) {
+            memcpy(rec, src + sizeof(int32_t), len);
+            found = 1;
+        }
+    }
+    cacheRelease(IfdCache);
+    pthread_mutex_unlock(&IfdCacheLock);
+    if (!found) {
+        return NULL;
+    }
+    if (sts > 0) {
+        ifdArray = deserializeIfdTableArray(rec, len, &count);
+        free(rec);
+        if (!ifdArray) {
+            return NULL;
+        }
+    }
+    *result = sts;
+    *pHit = 1;
+    return ifdArray;
+}
+
+// store the parse result of the file
+static void storeIfdTableCache(const CACHE_KEY *key, void **ifdTable, int result)
+{
+    CACHE_HEADER *hdr;
+    CACHE_BUCKET *b;
+    size_t len = 0;
+    int32_t sts = result;
+
+    if (result > 0) {
+        len = serializeIfdTableArray(ifdTable, NULL, 0);
+    }
+    pthread_mutex_lock(&IfdCacheLock);
+    if (!IfdCache) {
+        pthread_mutex_unlock(&IfdCacheLock);
+        return;
+    }
+    if (!cacheAcquire(IfdCache, LOCK_EX)) {
+        // another process is using the cache, skip this record
+        pthread_mutex_unlock(&IfdCacheLock);
+        return;
+    }
+    hdr = cacheHeader(IfdCache);
+    if ((hdr->entryCount + 1) * 2 > hdr->bucketCount) {
+        if (cacheRehash(IfdCache) != 0) {
+            cacheRelease(IfdCache);
+            pthread_mutex_unlock(&IfdCacheLock);
+            return;
+        }
+    }
+    if (cacheReserve(IfdCache, sizeof(int32_t) + len + 8) != 0) {
+        cacheRelease(IfdCache);
+        pthread_mutex_unlock(&IfdCacheLock);
+        return;
+    }
+    hdr = cacheHeader(IfdCache);
+    b = cacheFindBucket(IfdCache, key->dev, key->ino);
+    if (!b->used) {
+        hdr->entryCount++;
+    }
+    memcpy(IfdCache->map + hdr->dataEnd, &sts, sizeof(int32_t));
+    if (len > 0) {
+        serializeIfdTableArray(ifdTable, IfdCache->map + hdr->dataEnd + sizeof(int32_t), len);
+    }
+    b->dev = key->dev;
+    b->ino = key->ino;
+    b->size = key->size;
+    b->mtimeNs = key->mtimeNs;
+    b->dataOffset = hdr->dataEnd;
+    b->dataLength = (uint32_t)(sizeof(int32_t) + len);
+    b->used = 1;
+    hdr->dataEnd += (b->dataLength + 7) & ~7u;
+    cacheRelease(IfdCache);
+    pthread_mutex_unlock(&IfdCacheLock);
+}
+
+int openIfdTableCache(const char *cacheFileName)
+{
+    IFD_CACHE *cache;
+    CACHE_HEADER *hdr;
+    struct stat st;
+    int fd, sts, tries;
+
+    if (!cacheFileName) {
+        return ERR_INVALID_POINTER;
+    }
+    closeIfdTableCache();
+    cache = (IFD_CACHE*)malloc(sizeof(IFD_CACHE));
+    if (!cache) {
+        return ERR_MEMALLOC;
+    }
+    memset(cache, 0, sizeof(IFD_CACHE));
+    cache->fd = -1;
+    cache->fileName = (char*)malloc(strlen(cacheFileName) + 1);
+    if (!cache->fileName) {
+        free(cache);
+        return ERR_MEMALLOC;
+    }
+    strcpy(cache->fileName, cacheFileName);
+
+    fd = open(cacheFileName, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        sts = ERR_WRITE_FILE;
+        goto ERR;
+    }
+    // check or create the file under the exclusive lock, the lookups and
+    // the stores lock it again each time
+    for (tries = 0; flock(fd, LOCK_EX|LOCK_NB) != 0; tries++) {
+        if (tries >= CACHE_OPEN_TRIES) {
+            close(fd);
+            sts = ERR_BUSY;
+            goto ERR;
+        }
+        usleep(10000);
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        sts = ERR_READ_FILE;
+        goto ERR;
+    }
+    if ((size_t)st.st_size < sizeof(CACHE_HEADER)) {
+        sts = cacheCreate(cache, fd, CACHE_INITIAL_BUCKETS, CACHE_INITIAL_DATA);
+    } else {
+        sts = cacheMap(cache, fd, 0);
+        if (sts == 0) {
+            hdr = cacheHeader(cache);
+            if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+                hdr->version != CACHE_VERSION ||
+                hdr->bucketCount == 0 ||
+                (hdr->bucketCount & (hdr->bucketCount - 1)) != 0 ||
+                hdr->dataEnd < cacheDataStart(hdr->bucketCount) ||
+                hdr->dataEnd > cache->mapLen) {
+                // unknown or broken cache, start over
+                munmap(cache->map, cache->mapLen);
+                cache->map = NULL;
+                if (ftruncate(fd, 0) != 0) {
+                    sts = ERR_WRITE_FILE;
+                } else {
+                    sts = cacheCreate(cache, fd, CACHE_INITIAL_BUCKETS, CACHE_INITIAL_DATA);
+                }
+            }
+        }
+    }
+    flock(fd, LOCK_UN);
+    if (sts != 0) {
+        if (cache->fd < 0) {
+            close(fd);
+        }
+        goto ERR;
+    }
+    pthread_mutex_lock(&IfdCacheLock);
+    IfdCache = cache;
+    pthread_mutex_unlock(&IfdCacheLock);
+    return 0;
+ERR:
+    cacheUnmap(cache);
+    free(cache->fileName);
+    free(cache);
+    return sts;
+}
+
+/**
+ * closeIfdTableCache()
+ *
+ * Close the metadata cache opened by openIfdTableCache()
+ */
+void closeIfdTableCache(void)
+{
+    pthread_mutex_lock(&IfdCacheLock);
+    if (IfdCache) {
+        msync(IfdCache->map, IfdCache->mapLen, MS_ASYNC);
+        cacheUnmap(IfdCache);
+        free(IfdCache->fileName);
+        free(IfdCache);
+        IfdCache = NULL;
+    }
+    pthread_mutex_unlock(&IfdCacheLock);
+}
+
+#else
+
+static int cacheGetKey(const char *fileName, CACHE_KEY *key)
+{
+    return 0;
+}
+
+static void **lookupIfdTableCache(const CACHE_KEY *key, int *result, int *pHit)
+{
+    *pHit = 0;
+    return NULL;
+}
+
+static void storeIfdTableCache(const CACHE_KEY *key, void **ifdTable, int result)
+{
+}
+
+int openIfdTableCache(const char *cacheFileName)
+{
+    return ERR_UNKNOWN; // not supported
+}
+
+void closeIfdTableCache(void)
+{
+}
+
+#endif
+
+static const char *getTagName(int ifdType, uint16_t tagId)
+{
+    if (ifdType == IFD_0TH || ifdType == IFD_1ST || ifdType == IFD_EXIF) {
+        switch (tagId) {
+            case TAG_ImageWidth: return "ImageWidth";
+            case TAG_ImageLength: return "ImageLength";
+            case TAG_BitsPerSample: return "BitsPerSample";
+            case TAG_Compression: return "Compression";
+            case TAG_PhotometricInterpretation: return "PhotometricInterpretation";
+            case TAG_Orientation: return "Orientation";
+            case TAG_SamplesPerPixel: return "SamplesPerPixel";
+            case TAG_PlanarConfiguration: return "PlanarConfiguration";
+            case TAG_YCbCrSubSampling: return "YCbCrSubSampling";
+            case TAG_YCbCrPositioning: return "YCbCrPositioning";
+            case TAG_XResolution: return "XResolution";
+            case TAG_YResolution: return "YResolution";
+            case TAG_ResolutionUnit: return "ResolutionUnit";
+
+            case TAG_StripOffsets: return "StripOffsets";
+            case TAG_RowsPerStrip: return "RowsPerStrip";
+            case TAG_StripByteCounts: return "StripByteCounts";
+            case TAG_JPEGInterchangeFormat: return "JPEGInterchangeFormat";
+            case TAG_JPEGInterchangeFormatLength: return "JPEGInterchangeFormatLength";
+
+            case TAG_TransferFunction: return "TransferFunction";
+            case TAG_WhitePoint: return "WhitePoint";
+            case TAG_PrimaryChromaticities: return "PrimaryChromaticities";
+            case TAG_YCbCrCoefficients: return "YCbCrCoefficients";
+            case TAG_ReferenceBlackWhite: return "ReferenceBlackWhite";
+
+            case TAG_DateTime: return "DateTime";
+            case TAG_ImageDescription: return "ImageDescription";
+            case TAG_Make: return "Make";
+            case TAG_Model: return "Model";
+            case TAG_Software: return "Software";
+            case TAG_Artist: return "Artist";
+            case TAG_Copyright: return "Copyright";
+            case TAG_ExifIFDPointer: return "ExifIFDPointer";
+			case TAG_GPSInfoIFDPointer: return "GPSInfoIFDPointer";
+            case TAG_InteroperabilityIFDPointer: return "InteroperabilityIFDPointer";
+
+            case TAG_Rating: return "Rating";
+
+            case TAG_ExifVersion: return "ExifVersion";
+            case TAG_FlashPixVersion: return "FlashPixVersion";
+
+            case TAG_ColorSpace: return "ColorSpace";
+
+            case TAG_ComponentsConfiguration: return "ComponentsConfiguration";
+            case TAG_CompressedBitsPerPixel: return "CompressedBitsPerPixel";
+            case TAG_PixelXDimension: return "PixelXDimension";
+            case TAG_PixelYDimension: return "PixelYDimension";
+
+            case TAG_MakerNote: return "MakerNote";
+            case TAG_UserComment: return "UserComment";
+
+            case TAG_RelatedSoundFile: return "RelatedSoundFile";
+
+            case TAG_DateTimeOriginal: return "DateTimeOriginal";
             case TAG_DateTimeDigitized: return "DateTimeDigitized";
             case TAG_SubSecTime: return "SubSecTime";
             case TAG_SubSecTimeOriginal: return "SubSecTimeOriginal";
             case TAG_SubSecTimeDigitized: return "SubSecTimeDigitized";
+            case TAG_OffsetTime: return "OffsetTime";
+            case TAG_OffsetTimeOriginal: return "OffsetTimeOriginal";
+            case TAG_OffsetTimeDigitized: return "OffsetTimeDigitized";
+
+            case TAG_ExposureTime: return "ExposureTime";
+            case TAG_FNumber: return "FNumber";
+            case TAG_ExposureProgram: return "ExposureProgram";
+            case TAG_SpectralSensitivity: return "SpectralSensitivity";
+            case TAG_PhotographicSensitivity: return "PhotographicSensitivity";
+            case TAG_OECF: return "OECF";
+            case TAG_SensitivityType: return "SensitivityType";
+            case TAG_StandardOutputSensitivity: return "StandardOutputSensitivity";
+            case TAG_RecommendedExposureIndex: return "RecommendedExposureIndex";
+            case TAG_ISOSpeed: return "ISOSpeed";
+            case TAG_ISOSpeedLatitudeyyy: return "ISOSpeedLatitudeyyy";
+            case TAG_ISOSpeedLatitudezzz: return "ISOSpeedLatitudezzz";
+
+            case TAG_ShutterSpeedValue: return "ShutterSpeedValue";
+            case TAG_ApertureValue: return "ApertureValue";
+            case TAG_BrightnessValue: return "BrightnessValue";
+            case TAG_ExposureBiasValue: return "ExposureBiasValue";
+            case TAG_MaxApertureValue: return "MaxApertureValue";
+            case TAG_SubjectDistance: return "SubjectDistance";
+            case TAG_MeteringMode: return "MeteringMode";
+            case TAG_LightSource: return "LightSource";
+            case TAG_Flash: return "Flash";
+            case TAG_FocalLength: return "FocalLength";
+            case TAG_SubjectArea: return "SubjectArea";
+            case TAG_FlashEnergy: return "FlashEnergy";
+            case TAG_SpatialFrequencyResponse: return "SpatialFrequencyResponse";
+            case TAG_FocalPlaneXResolution: return "FocalPlaneXResolution";
+            case TAG_FocalPlaneYResolution: return "FocalPlaneYResolution";
+            case TAG_FocalPlaneResolutionUnit: return "FocalPlaneResolutionUnit";
+            case TAG_SubjectLocation: return "SubjectLocation";
+            case TAG_ExposureIndex: return "ExposureIndex";
+            case TAG_SensingMethod: return "SensingMethod";
+            case TAG_FileSource: return "FileSource";
+            case TAG_SceneType: return "SceneType";
+            case TAG_CFAPattern: return "CFAPattern";
+
+            case TAG_CustomRendered: return "CustomRendered";
+            case TAG_ExposureMode: return "ExposureMode";
+            case TAG_WhiteBalance: return "WhiteBalance";
+            case TAG_DigitalZoomRatio: return "DigitalZoomRatio";
+            case TAG_FocalLengthIn35mmFormat: return "FocalLengthIn35mmFormat";
+            case TAG_SceneCaptureType: return "SceneCaptureType";
+            case TAG_GainControl: return "GainControl";
+            case TAG_Contrast: return "Contrast";
+            case TAG_Saturation: return "Saturation";
+            case TAG_Sharpness: return "Sharpness";
+            case TAG_DeviceSettingDescription: return "DeviceSettingDescription";
+            case TAG_SubjectDistanceRange: return "SubjectDistanceRange";
+
+            case TAG_ImageUniqueID: return "ImageUniqueID";
+            case TAG_CameraOwnerName: return "CameraOwnerName";
+            case TAG_BodySerialNumber: return "BodySerialNumber";
+            case TAG_LensSpecification: return "LensSpecification";
+            case TAG_LensMake: return "LensMake";
+            case TAG_LensModel: return "LensModel";
+            case TAG_LensSerialNumber: return "LensSerialNumber";
+            case TAG_Gamma: return "Gamma";
+            case TAG_PrintIM: return "PrintIM";
+            case TAG_Padding: return "Padding";
+            default: ;
+        }
+    } else if (ifdType == IFD_GPS) {
+        switch (tagId) {
+            case TAG_GPSVersionID: return "GPSVersionID";
+            case TAG_GPSLatitudeRef: return "GPSLatitudeRef";
+            case TAG_GPSLatitude: return "GPSLatitude";
+            case TAG_GPSLongitudeRef: return "GPSLongitudeRef";
+            case TAG_GPSLongitude: return "GPSLongitude";
+            case TAG_GPSAltitudeRef: return "GPSAltitudeRef";
+            case TAG_GPSAltitude: return "GPSAltitude";
+            case TAG_GPSTimeStamp: return "GPSTimeStamp";
+            case TAG_GPSSatellites: return "GPSSatellites";
+            case TAG_GPSStatus: return "GPSStatus";
+            case TAG_GPSMeasureMode: return "GPSMeasureMode";
+            case TAG_GPSDOP: return "GPSDOP";
+            case TAG_GPSSpeedRef: return "GPSSpeedRef";
+            case TAG_GPSSpeed: return "GPSSpeed";
+            case TAG_GPSTrackRef: return "GPSTrackRef";
+            case TAG_GPSTrack: return "GPSTrack";
+            case TAG_GPSImgDirectionRef: return "GPSImgDirectionRef";
+            case TAG_GPSImgDirection: return "GPSImgDirection";
+            case TAG_GPSMapDatum: return "GPSMapDatum";
+            case TAG_GPSDestLatitudeRef: return "GPSDestLatitudeRef";
+            case TAG_GPSDestLatitude: return "GPSDestLatitude";
+            case TAG_GPSDestLongitudeRef: return "GPSDestLongitudeRef";
+            case TAG_GPSDestLongitude: return "GPSDestLongitude";
+            case TAG_GPSBearingRef: return "GPSBearingRef";
+            case TAG_GPSBearing: return "GPSBearing";
+            case TAG_GPSDestDistanceRef: return "GPSDestDistanceRef";
+            case TAG_GPSDestDistance: return "GPSDestDistance";
+            case TAG_GPSProcessingMethod: return "GPSProcessingMethod";
+            case TAG_GPSAreaInformation: return "GPSAreaInformation";
+            case TAG_GPSDateStamp: return "GPSDateStamp";
+            case TAG_GPSDifferential: return "GPSDifferential";
+            case TAG_GPSHPositioningError: return "GPSHPositioningError";
+            default: ;
+        }
+    } else if (ifdType == IFD_IO) {
+        switch (tagId) {
+            case TAG_InteroperabilityIndex: return "InteroperabilityIndex";
+            case TAG_InteroperabilityVersion: return "InteroperabilityVersion";
+            case TAG_RelatedImageFileFormat: return "RelatedImageFileFormat";
+            case TAG_RelatedImageWidth: return "RelatedImageWidth";
+            case TAG_RelatedImageHeight: return "RelatedImageHeight";
+            default: ;
+        }
+	} else if (ifdType == IFD_MPF) {
+		switch (tagId) {
+			case TAG_MPFVersion: return "MPFVersion";
+			case TAG_NumberOfImage: return "NumberOfImage";
+			case TAG_MPImageList: return "MPImageList";
+			case TAG_ImageUIDList: return "ImageUIDList";
+			case TAG_TotalFrames: return "TotalFrames";
+
+			case TAG_MPIndividualNum: return "MPIndividualNum";
+			case TAG_PanOrientation: return "PanOrientation";
+			case TAG_PanOverlapH: return "PanOverlapH";
+			case TAG_PanOverlapV: return "PanOverlapV";
+			case TAG_BaseViewpointNum: return "BaseViewpointNum";
+			case TAG_ConvergenceAngle: return "ConvergenceAngle";
+			case TAG_BaselineLength: return "BaseLineLength";
+			case TAG_VerticalDivergence: return "VerticalDivergence";
+			case TAG_AxisDistanceX: return "AxisDistanceX";
+			case TAG_AxisDistanceY: return "AxisDistanceY";
+			case TAG_AxisDistanceZ: return "AxisDistanceZ";
+			case TAG_YawAngle: return "YawAngle";
+			case TAG_PitchAngle: return "PitchAngle";
+			case TAG_RollAngle: return "RollAngle";
+			default:;
+		}
+		return "(Unknown)";
+	}
+    return "(Unknown)";
+}
+
+// move the filled IFD tables into a NULL terminated pointer array
+static void **copyIfdTableArray(void* ifdTable[32], int count)
+{
+    void** ppIfdArray = NULL;
+    int i;
+    if (count > 0) {
+        // +1 extra NULL element to the array 
+        ppIfdArray = (void**)malloc(sizeof(void*)*(count+1));
+        memset(ppIfdArray, 0, sizeof(void*)*(count+1));
+        for (i = 0; ifdTable[i] != NULL; i++) {
+            ppIfdArray[i] = ifdTable[i];
+        }
+    } else {
+        // the tables parsed before an error are not returned
+        freeIfdTables(ifdTable);
+    }
+    return ppIfdArray;
+}
+
+static uint16_t getLE16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void putLE16(uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void putLE32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+// length of the tag values in the binary format, 0 if not available
+static uint32_t blobValueLength(TagNode *tag)
+{
+    if (tag->error) {
+        return 0;
+    }
+    switch (tag->type) {
+    case TYPE_ASCII:
+    case TYPE_UNDEFINED:
+        return tag->byteData ? tag->count : 0;
+    case TYPE_RATIONAL:
+    case TYPE_SRATIONAL:
+        return tag->numData ? tag->count * 8 : 0;
+    case TYPE_BYTE:
+    case TYPE_SHORT:
+    case TYPE_LONG:
+    case TYPE_SBYTE:
+    case TYPE_SSHORT:
+    case TYPE_SLONG:
+        return tag->numData ? tag->count * 4 : 0;
+    default:
+        return 0;
+    }
+}
+
+// length of the thumbnail data held by the 1st IFD
+static uint32_t blobThumbnailLength(IfdTable *ifd)
+{
+    TagNode *tag;
+    if (!ifd->p) {
+        return 0;
+    }
+    tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+    if (!tag || tag->error || !tag->numData) {
+        return 0;
+    }
+    return tag->numData[0];
+}
+
+// create the IFD table
+static void *createIfdTable(IFD_TYPE IfdType, uint16_t tagCount, unsigned int nextOfs)
+{
+    IfdTable *ifd = (IfdTable*)malloc(sizeof(IfdTable));
+    if (!ifd) {
+        return NULL;
+    }
+    memset(ifd, 0, sizeof(IfdTable));
+    ifd->ifdType = IfdType;
+    ifd->tagCount = tagCount;
+    ifd->nextIfdOffset = nextOfs;
+    return ifd;
+}
+
+// add the TagNode enrtry to the IFD table
+static void *addTagNodeToIfd(void *pIfd,
+                      uint16_t tagId,
+                      uint16_t type,
+                      unsigned int count,
+                      unsigned int *numData,
+                      uint8_t *byteData)
+{
+    int i;
+    IfdTable *ifd = (IfdTable*)pIfd;
+    TagNode *tag;
+    if (!ifd) {
+        return NULL;
+    }
+    tag = (TagNode*)malloc(sizeof(TagNode));
+    memset(tag, 0, sizeof(TagNode));
+    tag->tagId = tagId;
+    tag->type = type;
+    tag->count = count;
+
+    if (count > 0) {
+        if (numData != NULL) {
+            int num = count;
+            if (type == TYPE_RATIONAL ||
+                type == TYPE_SRATIONAL) {
+                num *= 2;
+            }
+            tag->numData = (unsigned int*)malloc(sizeof(int)*num);
+            for (i = 0; i < num; i++) {
+                tag->numData[i] = numData[i];
+            }
+        } else if (byteData != NULL) {
+            tag->byteData = (uint8_t*)malloc(count);
+            memcpy(tag->byteData, byteData, count);
+        } else {
+            tag->error = 1;
+        }
+    } else {
+        tag->error = 1;
+    }
+    
+    // first tag
+    if (!ifd->tags) {
+        ifd->tags = tag;
+    } else {
+        TagNode *tagWk = ifd->tags;
+        while (tagWk->next) {
+            tagWk = tagWk->next;
+        }
+        tagWk->next = tag;
+        tag->prev = tagWk;
+    }
+    setTagPresence(ifd, tagId);
+
+    return tag;
+}
+
+// create a copy of TagNode
+static TagNode *duplicateTagNode(TagNode *src)
+{
+    TagNode *dup;
+    size_t len;
+    if (!src || src->count <= 0) {
+        return NULL;
+    }
+    dup = (TagNode*)malloc(sizeof(TagNode));
+    memset(dup, 0, sizeof(TagNode));
+    dup->tagId = src->tagId;
+    dup->type = src->type;
+    dup->count = src->count;
+    dup->error = src->error;
+    if (src->numData) {
+        len = sizeof(int) * src->count;
+        if (src->type == TYPE_RATIONAL ||
+            src->type == TYPE_SRATIONAL) {
+            len *= 2;
+        }
+        dup->numData = (unsigned int*)malloc(len);
+        memcpy(dup->numData, src->numData, len);
+    } else if (src->byteData) {
+        len = sizeof(char) * src->count;
+        dup->byteData = (uint8_t*)malloc(len);
+        memcpy(dup->byteData, src->byteData, len);
+    }
+    return dup;
+}
+
+// free TagNode
+static void freeTagNode(void *pTag)
+{
+    TagNode *tag = (TagNode*)pTag;
+    if (!tag) {
+        return;
+    }
+    if (tag->numData) {
+        free(tag->numData);
+    }
+    if (tag->byteData) {
+        free(tag->byteData);
+    }
+    free(tag);
+}
+
+// free entire IFD table
+static void freeIfdTable(void *pIfd)
+{
+    IfdTable *ifd = (IfdTable*)pIfd;
+    TagNode *tag;
+    if (!ifd) {
+        return;
+    }
+    tag = ifd->tags;
+    if (ifd->p) {
+        free(ifd->p);
+    }
+    free(ifd);
+
+    if (tag) {
+        while (tag->next) {
+            tag = tag->next;
+        }
+        while (tag) {
+            TagNode *tagWk = tag->prev;
+            freeTagNode(tag);
+            tag = tagWk;
+        }
+    }
+    return;
+}
+
+// search the specified tag's node from the IFD table
+static TagNode *getTagNodePtrFromIfd(IfdTable *ifd, uint16_t tagId)
+{
+    TagNode *tag;
+    if (!ifd) {
+        return NULL;
+    }
+    tag = ifd->tags;
+    while (tag) {
+        if (tag->tagId == tagId) {
+            return tag;
+        }
+        tag = tag->next;
+    }
+    return NULL;
+}
+
+// index of the tag in KnownTagIds, -1 if it is not a known tag
+static int getKnownTagIndex(uint16_t tagId)
+{
+    int lo = 0, hi = KNOWN_TAG_COUNT - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (KnownTagIds[mid] == tagId) {
+            return mid;
+        }
+        if (KnownTagIds[mid] < tagId) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+// bit of the unknown tag in the otherTags filter
+static uint64_t getOtherTagBit(uint16_t tagId)
+{
+    return (uint64_t)1 << (((unsigned int)tagId * 40503u >> 10) & 63);
+}
+
+// mark the tag as present in the IFD table
+static void setTagPresence(IfdTable *ifd, uint16_t tagId)
+{
+    int idx = getKnownTagIndex(tagId);
+    if (idx >= 0) {
+        ifd->knownTags[idx / 64] |= (uint64_t)1 << (idx % 64);
+    } else {
+        ifd->otherTags |= getOtherTagBit(tagId);
+    }
+}
+
+// query if the tag is present in the IFD table, the known tags are
+// answered by the bitmap, the other tags fall back to the tag list
+// only when their hashed bit is set
+static int testTagPresence(IfdTable *ifd, uint16_t tagId)
+{
+    return testTagPresenceAt(ifd, tagId, getKnownTagIndex(tagId));
+}
+
+// same as testTagPresence() with the index of the tag in KnownTagIds
+// already looked up by the caller
+static int testTagPresenceAt(IfdTable *ifd, uint16_t tagId, int idx)
+{
+    if (!ifd) {
+        return 0;
+    }
+    if (idx >= 0) {
+        return (ifd->knownTags[idx / 64] >> (idx % 64)) & 1;
+    }
+    if (!(ifd->otherTags & getOtherTagBit(tagId))) {
+        return 0;
+    }
+    return getTagNodePtrFromIfd(ifd, tagId) != NULL;
+}
+
+// recalculate the presence bitmap from the tag list
+static void rebuildTagPresence(IfdTable *ifd)
+{
+    TagNode *tag;
+    memset(ifd->knownTags, 0, sizeof(ifd->knownTags));
+    ifd->otherTags = 0;
+    for (tag = ifd->tags; tag; tag = tag->next) {
+        setTagPresence(ifd, tag->tagId);
+    }
+}
+
+// remove the TagNode entry from the IFD table
+static int removeTagOnIfd(void *pIfd, uint16_t tagId)
+{
+    int num = 0;
+    IfdTable *ifd = (IfdTable*)pIfd;
+    TagNode *tag;
+    if (!ifd) {
+        return 0;
+    }
+    for (;;) { // possibility of multiple entries
+        tag = getTagNodePtrFromIfd(ifd, tagId);
+        if (!tag) {
+            break; // no more found
+        }
+        num++;
+        if (tag->prev) {
+            tag->prev->next = tag->next;
+        } else {
+            ifd->tags = tag->next;
+        }
+        if (tag->next) {
+            tag->next->prev = tag->prev;
+        }
+        freeTagNode(tag);
+        ifd->tagCount--;
+    }
+    if (num > 0) {
+        rebuildTagPresence(ifd);
+    }
+    return num;
+}
+
+// get the IFD table address of the specified type
+static IfdTable *getIfdTableFromIfdTableArray(void **ifdTableArray, IFD_TYPE ifdType)
+{
+    int i;
+    if (!ifdTableArray) {
+        return NULL;
+    }
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        IfdTable *ifd = ifdTableArray[i];
+        if (ifd->ifdType == ifdType) {
+            return ifd;
+        }
+    }
+    return NULL;
+}
+
+// count IFD tables
+static int countIfdTableOnIfdTableArray(void **ifdTableArray)
+{
+    int i, num = 0;
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        num++;
+    }
+    return num;
+}
+
+// set single numeric value to the existing TagNode entry
+static int setSingleNumDataToTag(TagNode *tag, unsigned int value)
+{
+    if (!tag) {
+        return 0;
+    }
+    if (tag->type != TYPE_BYTE   &&
+        tag->type != TYPE_SHORT  &&
+        tag->type != TYPE_LONG   &&
+        tag->type != TYPE_SBYTE  &&
+        tag->type != TYPE_SSHORT &&
+        tag->type != TYPE_SLONG) {
+        return 0;
+    }
+    if (!tag->numData) {
+        tag->numData = (unsigned int*)malloc(sizeof(int));
+    }
+    tag->count = 1;
+    tag->numData[0] = value;
+    tag->error = 0;
+    return 1;
+}
+
+/**
+ * write the Exif segment to the output, the segment is built in memory
+ * and handed to the backend in a single write
+ *
+ * parameters
+ *  [in] out: the output backend
+ *  [in] ifdTableArray: address of the IFD tables array
+ *
+ * return
+ *  0: OK
+ *  ERR_WRITE_FILE
+ *  ERR_MEMALLOC
+ */
+static int writeExifSegment(ExifIO *out, void **ifdTableArray)
+{
+#define IFDMAX 5
+
+    union _packed {
+        unsigned int ui;
+        uint16_t us[2];
+        uint8_t uc[4];
+    };
+
+    IfdTable *ifds[IFDMAX], *ifd0th;
+    TagNode *tag;
+    IFD_TAG tagField;
+    uint16_t num, us;
+    unsigned int ui;
+    int zero = 0;
+    int i, x;
+    unsigned int ofs;
+    union _packed packed;
+    APP_HEADER dupApp1Header = App1Header;
+    STR_BUF sb;
+    int sts = 0;
+
+    ifds[0] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_0TH);
+    ifds[1] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_EXIF);
+    ifds[2] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_IO);
+    ifds[3] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_GPS);
+    ifds[4] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+    ifd0th = ifds[0];
+
+    // return if 0th IFD is not exist
+    if (!ifd0th) {
+        return 0;
+    }
+    // get total length of the segment
+    us = sizeof(APP_HEADER) - sizeof(short);
+    for (x = 0; x < IFDMAX; x++) {
+        if (ifds[x]) {
+            us = us + ifds[x]->length;
+        }
+    }
+    // segment length must be written in big-endian
+    if (systemIsLittleEndian()) {
+        us = swab16(us);
+    }
+    dupApp1Header.length = us;
+    dupApp1Header.tiff.reserved = fix_short(dupApp1Header.tiff.reserved);
+    dupApp1Header.tiff.Ifd0thOffset = fix_int(dupApp1Header.tiff.Ifd0thOffset);
+    memset(&sb, 0, sizeof(sb));
+    // write Exif segment Header
+    strBufAppend(&sb, (const char*)&dupApp1Header, sizeof(APP_HEADER));
+
+    // base offset of the Exif segment
+    ofs = sizeof(TIFF_HEADER);
+    for (x = 0; x < IFDMAX; x++) {
+        IfdTable *ifd = ifds[x];
+        if (ifd == NULL) {
+            continue;
+        }
+        // calculate the start offset to write the tag's data of this IFD
+        ofs += sizeof(short) + // sizeof the tag number area
+               sizeof(IFD_TAG) * ifd->tagCount + // sizeof the tag fields
+               sizeof(int);    // sizeof the NextOffset area
+
+        // write actual tag number of the current IFD
+        num = 0;
+        tag = ifd->tags;
+        while (tag) {
+            if (!tag->error) {
+                num++;
+            }
+            tag = tag->next;
+        }
+        us = fix_short(num);
+        strBufAppend(&sb, (const char*)&us, sizeof(short));
+
+        // write the each tag fields
+        tag = ifd->tags;
+        while (tag) {
+            if (tag->error) {
+                tag = tag->next; // ignore
+                continue;
+            }
+            tagField.tag = fix_short(tag->tagId);
+            tagField.type = fix_short(tag->type);
+            tagField.count = fix_int(tag->count);
+            packed.ui = 0;
+
+            switch (tag->type) {
+            case TYPE_ASCII:
+            case TYPE_UNDEFINED:
+                if (tag->count <= 4) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        packed.uc[i] = tag->byteData[i];
+                    }
+                } else {
+                    packed.ui = fix_int(ofs);
+                    ofs += tag->count;
+                    if (tag->count % 2 != 0) {
+                        ofs++;
+                    }
+                }
+                break;
+            case TYPE_BYTE:
+            case TYPE_SBYTE:
+                if (tag->count <= 4) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        packed.uc[i] = (uint8_t)tag->numData[i];
+                    }
+                } else {
+                    packed.ui = fix_int(ofs);
+                    ofs += tag->count;
+                    if (tag->count % 2 != 0) {
+                        ofs++;
+                    }
+                }
+                break;
+            case TYPE_SHORT:
+            case TYPE_SSHORT:
+                if (tag->count <= 2) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        packed.us[i] = fix_short((uint16_t)tag->numData[i]);
+                    }
+                } else {
+                    packed.ui = fix_int(ofs);
+                    ofs += tag->count * sizeof(short);
+                }
+                break;
+            case TYPE_LONG:
+            case TYPE_SLONG:
+                if (tag->count <= 1) {
+                    packed.ui = fix_int((unsigned int)tag->numData[0]);
+                } else {
+                    packed.ui = fix_int(ofs);
+                    ofs += tag->count * sizeof(short);
+                }
+                break;
+            case TYPE_RATIONAL:
+            case TYPE_SRATIONAL:
+                packed.ui = fix_int(ofs);
+                ofs += tag->count * sizeof(int) * 2;
+                break;
+            }
+            tagField.offset = packed.ui;
+            strBufAppend(&sb, (const char*)&tagField, sizeof(tagField));
+            tag = tag->next;
+        }
+        ui = fix_int(ifd->nextIfdOffset);
+        strBufAppend(&sb, (const char*)&ui, sizeof(int));
+
+        // write the tag values over 4 bytes 
+        tag = ifd->tags;
+        while (tag) {
+            if (tag->error) {
+                tag = tag->next;
+                continue;
+            }
+            switch (tag->type) {
+            case TYPE_ASCII:
+            case TYPE_UNDEFINED:
+                if (tag->count > 4) {
+                    strBufAppend(&sb, (const char*)tag->byteData, tag->count);
+                    if (tag->count % 2 != 0) { // for even boundary
+                        strBufAppend(&sb, (const char*)&zero, sizeof(char));
+                    }
+                }
+                break;
+            case TYPE_BYTE:
+            case TYPE_SBYTE:
+                if (tag->count > 4) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        uint8_t n = (uint8_t)tag->numData[i];
+                        strBufAppend(&sb, (const char*)&n, sizeof(char));
+                    }
+                    if (tag->count % 2 != 0) {
+                        strBufAppend(&sb, (const char*)&zero, sizeof(char));
+                    }
+                }
+                break;
+            case TYPE_SHORT:
+            case TYPE_SSHORT:
+                if (tag->count > 2) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        uint16_t n = fix_short((uint16_t)tag->numData[i]);
+                        strBufAppend(&sb, (const char*)&n, sizeof(short));
+                    }
+                }
+                break;
+            case TYPE_LONG:
+            case TYPE_SLONG:
+                if (tag->count > 1) {
+                    for (i = 0; i < (int)tag->count; i++) {
+                        unsigned int n = fix_int((unsigned int)tag->numData[i]);
+                        strBufAppend(&sb, (const char*)&n, sizeof(int));
+                    }
+                }
+                break;
+            case TYPE_RATIONAL:
+            case TYPE_SRATIONAL:
+                for (i = 0; i < (int)tag->count*2; i++) {
+                    unsigned int n = fix_int((unsigned int)tag->numData[i]);
+                    strBufAppend(&sb, (const char*)&n, sizeof(int));
+                }
+                break;
+            }
+            tag = tag->next;
+        }
+        // write the thumbnail data in the 1st IFD
+        if (ifd->ifdType == IFD_1ST && ifd->p != NULL) {
+            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+            if (tag) {
+                if (tag->numData[0] > 0) {
+                    strBufAppend(&sb, (const char*)ifd->p, tag->numData[0]);
+                }
+            }
+        }
+    }
+    if (sb.error) {
+        sts = ERR_MEMALLOC;
+    } else if (!ioWriteFull(out, sb.data, sb.length)) {
+        sts = ERR_WRITE_FILE;
+    }
+    free(sb.data);
+    return sts;
+}
+
+// calculate the actual length of the IFD
+static uint16_t calcIfdSize(void *pIfd)
+{
+    unsigned int size, num = 0;
+    TagNode *tag;
+    IfdTable *ifd = (IfdTable*)pIfd;
+    if (!ifd) {
+        return 0;
+    }
+    // count the actual tag number
+    tag = ifd->tags;
+    while (tag) {
+        if (!tag->error) {
+            num++;
+        }
+        tag = tag->next;
+    }
+
+    size = sizeof(short) + // sizeof the tag number area
+           sizeof(IFD_TAG) * num + // sizeof tag fields
+           sizeof(int); // sizeof the NextOffset area
+
+    // add thumbnail data length
+    if (ifd->ifdType == IFD_1ST) {
+        if (ifd->p) {
+            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+            if (tag) {
+                size += tag->numData[0];
+            }
+        }
+    }
+    tag = ifd->tags;
+    while (tag) {
+        if (tag->error) {
+            // ignore
+            tag = tag->next;
+            continue;
+        }
+        switch (tag->type) {
+        case TYPE_ASCII:
+        case TYPE_UNDEFINED:
+        case TYPE_BYTE:
+        case TYPE_SBYTE:
+            if (tag->count > 4) {
+                size += tag->count;
+                if (tag->count % 2 != 0) {
+                    // padding for even byte boundary
+                    size += 1;
+                }
+            }
+            break;
+        case TYPE_SHORT:
+        case TYPE_SSHORT:
+            if (tag->count > 2) {
+                size += tag->count * sizeof(short);
+            }
+            break;
+        case TYPE_LONG:
+        case TYPE_SLONG:
+            if (tag->count > 1) {
+                size += tag->count * sizeof(int);
+            }
+            break;
+        case TYPE_RATIONAL:
+        case TYPE_SRATIONAL:
+            if (tag->count > 0) {
+                size += tag->count * sizeof(int) * 2;
+            }
+            break;
+        }
+        tag = tag->next;
+    }
+    return (uint16_t)size;
+}
+
+/**
+ * refresh the length and offset variables in the IFD tables
+ *
+ * parameters
+ *  [in/out] ifdTableArray: address of the IFD tables array
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERROR_UNKNOWN
+ */
+static int fixLengthAndOffsetInIfdTables(void **ifdTableArray)
+{
+    int i;
+    TagNode *tag, *tagwk;
+    uint16_t num;
+    uint16_t ofsBase = sizeof(TIFF_HEADER);
+    unsigned int len, dummy = 0, again = 0;
+    IfdTable *ifd0th, *ifdExif, *ifdIo, *ifdGps, *ifd1st; 
+    if (!ifdTableArray) {
+        return ERR_INVALID_POINTER;
+    }
+
+AGAIN:
+    // calculate the length of the each IFD tables.
+    for (i = 0; ifdTableArray[i] != NULL; i++) {
+        IfdTable *ifd = ifdTableArray[i];
+        // count the actual tag number
+        tag = ifd->tags;
+        num = 0;
+        while (tag) {
+            // ignore and dispose the error tag
+            if (tag->error) {
+                tagwk = tag->next;
+                if (tag->prev) {
+                    tag->prev->next = tag->next;
+                } else {
+                    ifd->tags = tag->next;
+                }
+                if (tag->next) {
+                    tag->next->prev = tag->prev;
+                }
+                freeTagNode(tag);
+                tag = tagwk;
+                continue;
+            }
+            num++;
+            tag = tag->next;
+        }
+        ifd->tagCount = num;
+        rebuildTagPresence(ifd);
+        ifd->length = calcIfdSize(ifd);
+        ifd->nextIfdOffset = 0;
+    }
+    ifd0th  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_0TH);
+    ifdExif = getIfdTableFromIfdTableArray(ifdTableArray, IFD_EXIF);
+    ifdIo   = getIfdTableFromIfdTableArray(ifdTableArray, IFD_IO);
+    ifdGps  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_GPS);
+    ifd1st  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+
+    if (!ifd0th) {
+        return 0; // not error
+    }
+    ifd0th->offset = ofsBase;
+
+    // set "NextOffset" variable in the 0th IFD if the 1st IFD is exist
+    if (ifd1st) {
+        ifd0th->nextIfdOffset =
+                ofsBase +
+                ifd0th->length + 
+                ((ifdExif)? ifdExif->length : 0) +
+                ((ifdIo)? ifdIo->length : 0) +
+                ((ifdGps)? ifdGps->length : 0);
+        ifd1st->offset = (uint16_t)ifd0th->nextIfdOffset;
+
+        // set the offset value of the thumbnail data
+        if (ifd1st->p) {
+            tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormatLength);
+            if (tag) {
+                len = tag->numData[0]; // thumbnail length;
+                tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormat);
+                if (tag) {
+                    // set the offset value
+                    setSingleNumDataToTag(tag, ifd1st->offset + ifd1st->length - len);
+                } else {
+                    // create the JPEGInterchangeFormat tag if not exist
+                    if (!addTagNodeToIfd(ifd1st, TAG_JPEGInterchangeFormat, 
+                        TYPE_LONG, 1, &dummy, NULL)) {
+                        return ERR_UNKNOWN;
+                    }
+                    again = 1;
+                }
+            } else {
+                tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormat);
+                if (tag) {
+                    setSingleNumDataToTag(tag, 0);
+                }
+            }
+        }
+    } else {
+        ifd0th->nextIfdOffset = 0; // 1st IFD is not exist
+    }
+
+    // set "ExifIFDPointer" tag value in the 0th IFD if the Exif IFD is exist
+    if (ifdExif) {
+        tag = getTagNodePtrFromIfd(ifd0th, TAG_ExifIFDPointer);
+        if (tag) {
+            setSingleNumDataToTag(tag, ofsBase + ifd0th->length);
+            ifdExif->offset = (uint16_t)tag->numData[0];
+        } else {
+            // create the tag if not exist
+            if (!addTagNodeToIfd(ifd0th, TAG_ExifIFDPointer, TYPE_LONG, 1,
+                                    &dummy, NULL)) {
+                return ERR_UNKNOWN;
+            }
+            again = 1;
+        }
+        // set "InteroperabilityIFDPointer" tag value in the Exif IFD
+        // if the Interoperability IFD is exist
+        if (ifdIo) {
+            tag = getTagNodePtrFromIfd(ifdExif, TAG_InteroperabilityIFDPointer);
+            if (tag) {
+                setSingleNumDataToTag(tag, ofsBase + ifd0th->length + ifdExif->length);
+                ifdIo->offset = (uint16_t)tag->numData[0];
+            } else {
+                // create the tag if not exist
+                if (!addTagNodeToIfd(ifdExif, TAG_InteroperabilityIFDPointer,
+                                        TYPE_LONG, 1, &dummy, NULL)) {
+                    return ERR_UNKNOWN;
+                }
+                again = 1;
+            }
+        } else {
+            tag = getTagNodePtrFromIfd(ifdExif, TAG_InteroperabilityIFDPointer);
+            if (tag) {
+                setSingleNumDataToTag(tag, 0);
+            }
+        }
+    } else { // Exif 
+        tag = getTagNodePtrFromIfd(ifd0th, TAG_ExifIFDPointer);
+        if (tag) {
+            setSingleNumDataToTag(tag, 0);
+        }
+    }
+
+    // set "GPSInfoIFDPointer" tag value in the 0th IFD if the GPS IFD is exist
+    if (ifdGps) {
+        tag = getTagNodePtrFromIfd(ifd0th, TAG_GPSInfoIFDPointer);
+        if (tag) {
+            setSingleNumDataToTag(tag, ofsBase +
+                                        ifd0th->length + 
+                                        ((ifdExif)? ifdExif->length : 0) +
+                                        ((ifdIo)? ifdIo->length : 0));
+            ifdGps->offset = (uint16_t)tag->numData[0];
+        } else {
+            // create the tag if not exist
+            if (!addTagNodeToIfd(ifd0th, TAG_GPSInfoIFDPointer, TYPE_LONG,
+                                1, &dummy, NULL)) {
+                return ERR_UNKNOWN;
+            }
+            again = 1;
+        }
+    } else { // GPS IFD is not exist
+        tag = getTagNodePtrFromIfd(ifd0th, TAG_GPSInfoIFDPointer);
+        if (tag) {
+            setSingleNumDataToTag(tag, 0);
+        }
+    }
+    // repeat again if needed
+    if (again) {
+        again = 0;
+        goto AGAIN;
+    }
+    return 0;
+}
+
+/**
+ * Set the data of the IFD to the internal table
+ *
+ * parameters
+ *  [in] fp: file pointer of opened file
+ *  [in] startOffset : offset of target IFD
+ *  [in] ifdType : type of the IFD
+ *
+ * return
+ *   NULL: critical error occurred
+ *  !NULL: the address of the IFD table
+ */
+static void *parseIFD(ExifIO *io,
+					  int64_t baseOffset,
+                      unsigned int startOffset,
+                      IFD_TYPE ifdType)
+{
+    void *ifd;
+    uint8_t buf[8192];
+    uint16_t tagCount, us;
+    unsigned int nextOffset = 0;
+    unsigned int *array, val, allocSize;
+    int size, cnt, i;
+    size_t len;
+    int64_t pos;
+    
+    // get the count of the tags
+    pos = baseOffset + startOffset;
+    if (!ioReadFull(io, pos, &tagCount, sizeof(short))) {
+        return NULL;
+    }
+    tagCount = fix_short(tagCount);
+    pos += sizeof(short);
+
+    // in case of the 0th IFD, check the offset of the 1st IFD
+    if (ifdType == IFD_0TH || ifdType == IFD_MPF) {
+        // next IFD's offset is at the tail of the segment
+        if (!ioReadFull(io, baseOffset + sizeof(TIFF_HEADER) +
+                    sizeof(short) + sizeof(IFD_TAG) * tagCount,
+                    &nextOffset, sizeof(int))) {
+            return NULL;
+        }
+        nextOffset = fix_int(nextOffset);
+    }
+    // create new IFD table
+    ifd = createIfdTable(ifdType, tagCount, nextOffset);
+
+    // parse all tags
+    for (cnt = 0; cnt < tagCount; cnt++) {
+        IFD_TAG tag;
+        uint8_t data[4];
+        if (!ioReadFull(io, pos, &tag, sizeof(tag))) {
+            goto ERR;
+        }
+        memcpy(data, &tag.offset, 4); // keep raw data temporary
+        tag.tag = fix_short(tag.tag);
+        tag.type = fix_short(tag.type);
+        tag.count = fix_int(tag.count);
+        tag.offset = fix_int(tag.offset);
+        pos += sizeof(tag);
+
+        //printf("tag=0x%04X type=%u count=%u offset=%u name=[%s]\n",
+        //  tag.tag, tag.type, tag.count, tag.offset, getTagName(ifdType, tag.tag));
+
+        if (tag.type == TYPE_ASCII ||     // ascii = the null-terminated string
+            tag.type == TYPE_UNDEFINED) { // undefined = the chunk data bytes
+            if (tag.count <= 4)  {
+                // 4 bytes or less data is placed in the 'offset' area directly
+                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, data);
+            } else {
+                // 5 bytes or more data is placed in the value area of the IFD
+                uint8_t *p = buf;
+                if (tag.count > sizeof(buf)) {
+                    // allocate new buffer if needed
+                    if (tag.count >= App1Header.length) { // illegal
+                        p = NULL;
+                    } else {
+                        p = (uint8_t*)malloc(tag.count);
+                    }
+                    if (!p) {
+                        // treat as an error
+                        addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
+                        continue;
+                    }
+                    memset(p, 0, tag.count);
+                }
+                if (!ioReadFull(io, baseOffset + tag.offset, p, tag.count)) {
+                    if (p != &buf[0]) {
+                        free(p);
+                    }
+                    addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
+                    continue;
+                }
+                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, p);
+                if (p != &buf[0]) {
+                    free(p);
+                }
+            }
+        }
+        else if (tag.type == TYPE_RATIONAL || tag.type == TYPE_SRATIONAL) {
+            unsigned int realCount = tag.count * 2; // need double the space
+            size_t len = realCount * sizeof(int);
+            if (tag.count >= App1Header.length || len >= App1Header.length) { // illegal
+                array = NULL;
+            } else {
+                array = (unsigned int*)malloc(len);
+                if (array) {
+                    if (!ioReadFull(io, baseOffset + tag.offset, array, len)) {
+                        free(array);
+                        array = NULL;
+                    } else {
+                        for (i = 0; i < (int)realCount; i++) {
+                            array[i] = fix_int(array[i]);
+                        }
+                    }
+                }
+            }
+            addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, array, NULL);
+            if (array) {
+                free(array);
+            }
+        }
+        else if (tag.type == TYPE_BYTE   ||
+                 tag.type == TYPE_SHORT  ||
+                 tag.type == TYPE_LONG   ||
+                 tag.type == TYPE_SBYTE  ||
+                 tag.type == TYPE_SSHORT ||
+                 tag.type == TYPE_SLONG ) {
+
+            // the single value is always stored in tag.offset area directly
+            // # the data is Left-justified if less than 4 bytes
+            if (tag.count <= 1) {
+                val = tag.offset;
+                if (tag.type == TYPE_BYTE || tag.type == TYPE_SBYTE) {
+                    uint8_t uc = data[0];
+                    val = uc;
+                } else if (tag.type == TYPE_SHORT || tag.type == TYPE_SSHORT) {
+                    memcpy(&us, data, sizeof(short));
+                    us = fix_short(us);
+                    val = us;
+                }
+                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, &val, NULL);
+             }
+             // multiple value
+             else {
+                size = sizeof(int);
+                if (tag.type == TYPE_BYTE || tag.type == TYPE_SBYTE) {
+                    size = sizeof(char);
+                } else if (tag.type == TYPE_SHORT || tag.type == TYPE_SSHORT) {
+                    size = sizeof(short);
+                }
+                // for the sake of simplicity, using the 4bytes area for
+                // each numeric data type 
+                allocSize = sizeof(int) * tag.count;
+                if (tag.count >= App1Header.length || allocSize >= App1Header.length) { // illegal
+                    array = NULL;
+                } else {
+                    array = (unsigned int*)malloc(allocSize);
+                }
+                if (!array) {
+                    addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
+                    continue;
+                }
+                len = size * tag.count;
+                // if the total length of the value is less than or equal to 4bytes, 
+                // they have been stored in the tag.offset area
+                if (len <= 4) {
+                    if (size == 1) { // byte
+                        for (i = 0; i < (int)tag.count; i++) {
+                            array[i] = (unsigned int)data[i];
+                        }
+                    } else if (size == 2) { // short
+                        for (i = 0; i < 2; i++) {
+                            memcpy(&us, &data[i*2], sizeof(short));
+                            us = fix_short(us);
+                            array[i] = (unsigned int)us;
+                        }
+                    }
+                } else {
+                    // the values larger than the buffer are read in place
+                    uint8_t *src = (len > sizeof(buf)) ? (uint8_t*)array : buf;
+                    if (!ioReadFull(io, baseOffset + tag.offset, src, len)) {
+                        free(array);
+                        addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
+                        continue;
+                    }
+                    // backwards so that the in-place widening does not
+                    // overwrite the values not read yet
+                    for (i = (int)tag.count - 1; i >= 0; i--) {
+                        val = 0;
+                        memcpy(&val, &src[i*size], size);
+                        if (size == sizeof(int)) {
+                            val = fix_int(val);
+                        } else if (size == sizeof(short)) {
+                            val = fix_short((uint16_t)val);
+                        }
+                        array[i] = (unsigned int)val;
+                    }
+                }
+                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, array, NULL);
+                free(array);
+             }
+         }
+    }
+    if (ifdType == IFD_1ST) {
+        // get thumbnail data
+        unsigned int thumbnail_ofs = 0, thumbnail_len;
+        IfdTable *ifdTable = (IfdTable*)ifd;
+        TagNode *tag  = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormat);
+        if (tag && tag->numData) {
+            thumbnail_ofs = tag->numData[0];
+        }
+        if (thumbnail_ofs > 0) {
+            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
+            if (tag && tag->numData) {
+                thumbnail_len = tag->numData[0];
+                if (thumbnail_len > 0) {
+                    ifdTable->p = (uint8_t*)malloc(thumbnail_len);
+                    if (ifdTable->p) {
+                        if (!ioReadFull(io, baseOffset + thumbnail_ofs,
+                                        ifdTable->p, thumbnail_len)) {
+                            free(ifdTable->p);
+                            ifdTable->p = NULL;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return ifd;
+ERR:
+    if (ifd) {
+        freeIfdTable(ifd);
+    }
+    return NULL;
+}
+
+
+void setDefaultAppNSegmentHeader(APP_HEADER* appHeader, const char* strId, uint16_t marker)
+{
+    memset(appHeader, 0, sizeof(APP_HEADER));
+	appHeader->marker = systemIsLittleEndian() ? swab16(marker) : marker;
+    appHeader->length = 0;
+    strncpy(appHeader->id, strId, sizeof(appHeader->id));
+    appHeader->tiff.byteOrder = 0x4949; // means little-endian
+    appHeader->tiff.reserved = 0x002A;
+    appHeader->tiff.Ifd0thOffset = 0x00000008;
+}
+
+void setDefaultMPFSegmentHeader(MPF_HEADER* appHeader, const char* strId, uint16_t marker)
+{
+	memset(appHeader, 0, sizeof(MPF_HEADER));
+	appHeader->marker = systemIsLittleEndian() ? swab16(marker) : marker;
+	appHeader->length = 0;
+	strncpy(appHeader->id, strId, sizeof(appHeader->id));
+	appHeader->tiff.byteOrder = 0x4949; // means little-endian
+	appHeader->tiff.reserved = 0x002A;
+	appHeader->tiff.Ifd0thOffset = 0x00000008;
+}
+
+/**
+ * Load the APP1 segment header
+ *
+ * return
+ *  1: success
+ *  0: error
+ */
+static int readAppNSegmentHeader(ExifIO *io, APP_HEADER* appHeader, int64_t startOffset)
+{
+    // read the APP1 header
+    if (!ioReadFull(io, startOffset, appHeader, sizeof(APP_HEADER))) {
+        return 0;
+    }
+    if (systemIsLittleEndian()) {
+        // the segment length value is always in big-endian order
+		appHeader->length = swab16(appHeader->length);
+    }
+    // byte-order identifier
+    if (appHeader->tiff.byteOrder != 0x4D4D && // big-endian
+        appHeader->tiff.byteOrder != 0x4949) { // little-endian
+        return 0;
+    }
+    // TIFF version number (always 0x002A)
+    appHeader->tiff.reserved = fix_short(appHeader->tiff.reserved);
+    if (appHeader->tiff.reserved != 0x002A) {
+        return 0;
+    }
+    // offset of the 0TH IFD
+    appHeader->tiff.Ifd0thOffset = fix_int(appHeader->tiff.Ifd0thOffset);
+    return 1;
+}
+
+/**
+* Load the MPF segment header
+*
+* return
+*  1: success
+*  0: error
+*/
+static int readMPFSegmentHeader(ExifIO *io, MPF_HEADER* appHeader, int64_t startOffset)
+{
+	// read the MPF header
+	if (!ioReadFull(io, startOffset, appHeader, sizeof(MPF_HEADER))) {
+		return 0;
+	}
+	if (systemIsLittleEndian()) {
+		// the segment length value is always in big-endian order
+		appHeader->length = swab16(appHeader->length);
+	}
+	// byte-order identifier
+	if (appHeader->tiff.byteOrder != 0x4D4D && // big-endian
+		appHeader->tiff.byteOrder != 0x4949) { // little-endian
+		return 0;
+	}
+	MPFByteOrder = appHeader->tiff.byteOrder;
+	// TIFF version number (always 0x002A)
+	appHeader->tiff.reserved = fix_short(appHeader->tiff.reserved);
+	// offset of the 0TH IFD
+	appHeader->tiff.Ifd0thOffset = fix_int(appHeader->tiff.Ifd0thOffset);
+	MPFByteOrder = 0;
+	if (appHeader->tiff.reserved != 0x002A) {
+		return 0;
+	}
+	return 1;
+}
+/**
+ * Get the offset of the Exif segment in the current opened JPEG file
+ * If pInfo is not NULL, the walk goes on to the first SOS marker and the
+ * frame of the image is recorded in it.
+ *
+ * return
+ *   n: the offset from the beginning of the file
+ *   0: the Exif segment is not found
+ *  -n: error
+ */
+static int64_t getAppNStartOffset(ExifIO *io,
+								  uint16_t appMarkerN,
+                                  const char *App1IDString,
+                                  size_t App1IDStringLength,
+                                  int64_t *pDQTOffset,
+                                  ExifJpegInfo *pInfo)
+{
+    int64_t pos, bytesread;
+    uint8_t buf[64];
+    uint16_t len, marker;
+	int64_t appn_pos = 0;
+    if (!io) {
+        return ERR_READ_FILE;
+    }
+
+    // check JPEG SOI Marker (0xFFD8)
+    if (!ioReadFull(io, 0, &marker, sizeof(short))) {
+        return ERR_READ_FILE;
+    }
+    if (systemIsLittleEndian()) {
+        marker = swab16(marker);
+    }
+    if (marker != 0xFFD8) {
+        return ERR_INVALID_JPEG;
+    }
+    // check for next 2 bytes
+    if (!ioReadFull(io, 2, &marker, sizeof(short))) {
+        return ERR_READ_FILE;
+    }
+    if (systemIsLittleEndian()) {
+        marker = swab16(marker);
+    }
+    // if DQT marker (0xFFDB) is appeared, the application segment
+    // doesn't exist
+    if (marker == 0xFFDB) {
+        if (pDQTOffset != NULL) {
+            *pDQTOffset = 2;
+        }
+        if (pInfo != NULL) {
+            jpegScanFrame(io, 2, -1, pInfo, 0);
+        }
+        return 0; // not found the Exif segment
+    }
+
+    // pos is the offset following the marker
+    pos = 4;
+    for (;;) {
+        // unexpected value. is not a APP[0-14] marker
+        if (!(marker >= 0xFFE0 && marker <= 0xFFEF)) {
+            // found DQT
+            if (marker == 0xFFDB) {
+                if (pDQTOffset != NULL) {
+                    *pDQTOffset = pos - sizeof(short);
+                }
+                break;
+            }
+            // no application segment follows SOS or EOI
+            if (marker == 0xFFDA || marker == 0xFFD9) {
+                break;
+            }
+        }
+        // read the length of the segment
+        if (!ioReadFull(io, pos, &len, sizeof(short))) {
+            return ERR_READ_FILE;
+        }
+        if (systemIsLittleEndian()) {
+            len = swab16(len);
+        }
+        // if is not a APPn segment, move to next segment
+		if (marker != appMarkerN) {
+			if (appn_pos != 0) {
+				break;
+			}
+        } else {
+            // check if it is the Exif segment
+            bytesread = ioRead(io, pos + sizeof(short), buf, App1IDStringLength + 4);
+            if (bytesread < (int64_t)App1IDStringLength) {
+                return ERR_READ_FILE;
+            }
+            if (memcmp(buf, App1IDString, App1IDStringLength) == 0) {
+                // return the start offset of the Exif segment
+				if (appn_pos == 0) {
+					appn_pos = pos - sizeof(short);
+				}
+			}
+			if (Verbose) {
+				unsigned char c1 = buf[0];
+				unsigned char c2 = buf[1];
+				unsigned char c3 = buf[2];
+				unsigned char c4 = buf[3];
+				if (c4 < ' ') {
+					c4 = '?';
+				}
+				printf("APP%u %c%c%c%c len=%u\n", appMarkerN - APP0_MARKER, c1, c2, c3, c4, len - 2);
+			}
+        }
+        // read next marker, the length counts its own 2 bytes
+        pos += len;
+        if (!ioReadFull(io, pos, &marker, sizeof(short))) {
+            return ERR_READ_FILE;
+        }
+        if (systemIsLittleEndian()) {
+            marker = swab16(marker);
+        }
+        pos += sizeof(short);
+    }
+    // continue from the current marker to the frame of the image
+    if (pInfo != NULL) {
+        jpegScanFrame(io, pos - sizeof(short), -1, pInfo, 0);
+    }
+    return appn_pos; // return Exif segment if found
+}
+
+/**
+ * Initialize
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ */
+static int init(ExifIO *io)
+{
+    int64_t sts, dqtOffset = -1;
+    setDefaultAppNSegmentHeader(&App1Header, "Exif", 0xFFE1);
+	setDefaultAppNSegmentHeader(&App2Header, "FPXR", 0xFFE2);
+	setDefaultMPFSegmentHeader(&MPFHeader, "MPF", 0xFFE2);
+	// get the offset of the Exif segment
+	sts = getAppNStartOffset(io, APP1_MARKER, EXIF_ID_STR, EXIF_ID_STR_LEN, &dqtOffset, NULL);
+    if (sts < 0) { // error
+        return (int)sts;
+    }
+	JpegDQTOffset = dqtOffset;
+	App1StartOffset = sts;
+	if (sts == 0) {
+		return 0;
+	}
+
+	App2StartOffset = getAppNStartOffset(io, APP2_MARKER, FPXR_ID_STR, FPXR_ID_STR_LEN, NULL, NULL);
+
+	MPFStartOffset = getAppNStartOffset(io, APP2_MARKER, MPF_ID_STR, MPF_ID_STR_LEN, NULL, NULL);
+
+	// Load the App1 segment header
+    if (!readAppNSegmentHeader(io, &App1Header, App1StartOffset)) {
+        return ERR_INVALID_APP1HEADER;
+    }
+
+	if (MPFStartOffset > 0) {
+		if (!readMPFSegmentHeader(io, &MPFHeader, MPFStartOffset)) {
+			return ERR_INVALID_APP1HEADER;
+		}
+	}
+    return 1;
+}
+
+// read at the offset until 'length' bytes or the end of the data
+static int64_t ioRead(ExifIO *io, int64_t offset, void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        int64_t n = io->readAt(io->context, offset + done,
+                               (uint8_t*)buf + done, length - done);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (int64_t)done;
+}
+
+static int ioReadFull(ExifIO *io, int64_t offset, void *buf, size_t length)
+{
+    return ioRead(io, offset, buf, length) == (int64_t)length;
+}
+
+static int ioWriteFull(ExifIO *io, const void *buf, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        int64_t n = io->write(io->context, (const uint8_t*)buf + done, length - done);
+        if (n <= 0) {
+            return 0;
+        }
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+/**
+ * copy the input data in [start, end) to the output
+ *
+ * parameters
+ *  [in] end : -1 copies up to the end of the input
+ *
+ * return
+ *  0: OK
+ *  ERR_READ_FILE
+ *  ERR_WRITE_FILE
+ *  ERR_MEMALLOC
+ */
+static int ioCopyRange(ExifIO *in, int64_t start, int64_t end, ExifIO *out)
+{
+    #define IO_COPY_SIZE (64 * 1024)
+
+    uint8_t *buf;
+    int64_t pos = start, n;
+    size_t want;
+    int sts = 0;
+
+    buf = (uint8_t*)malloc(IO_COPY_SIZE);
+    if (!buf) {
+        return ERR_MEMALLOC;
+    }
+    while (end < 0 || pos < end) {
+        want = IO_COPY_SIZE;
+        if (end >= 0 && end - pos < (int64_t)want) {
+            want = (size_t)(end - pos);
+        }
+        n = ioRead(in, pos, buf, want);
+        if (n < 0 || (end >= 0 && n < (int64_t)want)) {
+            sts = ERR_READ_FILE;
+            break;
+        }
+        if (n > 0 && !ioWriteFull(out, buf, (size_t)n)) {
+            sts = ERR_WRITE_FILE;
+            break;
+        }
+        if (n < (int64_t)want) {
+            break; // end of the input
+        }
+        pos += n;
+    }
+    free(buf);
+    return sts;
+}
+
+/**
+ * copy the input to the output leaving out the segment at segmentOffset
+ *
+ * return
+ *  1: OK
+ *  ERR_READ_FILE
+ *  ERR_WRITE_FILE
+ *  ERR_MEMALLOC
+ */
+static int copyWithoutSegment(ExifIO *in, ExifIO *out, int64_t segmentOffset)
+{
+    uint8_t hdr[4];
+    int sts;
+
+    // marker and the segment length, always in big-endian order
+    if (!ioReadFull(in, segmentOffset, hdr, sizeof(hdr))) {
+        return ERR_READ_FILE;
+    }
+    sts = ioCopyRange(in, 0, segmentOffset, out);
+    if (sts != 0) {
+        return sts;
+    }
+    sts = ioCopyRange(in, segmentOffset + 2 + ((hdr[2] << 8) | hdr[3]), -1, out);
+    return (sts != 0) ? sts : 1;
+}
+
+/**
+ * copy the input to the output replacing the Exif segment, init() must
+ * have been called on the input
+ *
+ * return
+ *  1: OK
+ *  ERR_READ_FILE
+ *  ERR_WRITE_FILE
+ *  ERR_MEMALLOC
+ */
+static int copyWithNewExifSegment(ExifIO *in, ExifIO *out, void **ifdTableArray,
+                                  int hasExifSegment)
+{
+    int64_t ofs;
+    int sts;
+
+    if (hasExifSegment) {
+        ofs = App1StartOffset;
+    } else if (JpegDQTOffset > 0) {
+        ofs = JpegDQTOffset;
+    } else {
+        ofs = 2; // no DQT in front of the image data, right after SOI
+    }
+    // copy the data in front of the Exif segment
+    sts = ioCopyRange(in, 0, ofs, out);
+    if (sts != 0) {
+        return sts;
+    }
+    // write new Exif segment
+    sts = writeExifSegment(out, ifdTableArray);
+    if (sts != 0) {
+        return sts;
+    }
+    if (hasExifSegment) {
+        // skip the old Exif segment
+        ofs = App1StartOffset + sizeof(App1Header.marker) + App1Header.length;
+    }
+    sts = ioCopyRange(in, ofs, -1, out);
+    return (sts != 0) ? sts : 1;
+}
+
+// stdio backend, the context is the FILE pointer
+static int64_t stdioReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    FILE *fp = (FILE*)context;
+    size_t n;
+    if (offset < 0 || fseeko(fp, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    n = fread(buf, 1, length, fp);
+    if (n < length && ferror(fp)) {
+        return -1;
+    }
+    return (int64_t)n;
+}
+
+static int64_t stdioSize(void *context)
+{
+    FILE *fp = (FILE*)context;
+    if (fseeko(fp, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    return (int64_t)ftello(fp);
+}
+
+static int64_t stdioWrite(void *context, const void *buf, size_t length)
+{
+    size_t n = fwrite(buf, 1, length, (FILE*)context);
+    return (n < length) ? -1 : (int64_t)n;
+}
+
+static void stdioClose(void *context)
+{
+    fclose((FILE*)context);
+}
+
+// read-only backend over an opened stream, the stream is not closed
+static void initStdioIO(ExifIO *io, FILE *fp)
+{
+    memset(io, 0, sizeof(ExifIO));
+    io->readAt = stdioReadAt;
+    io->size = stdioSize;
+    io->context = fp;
+}
+
+// open a file for the positional reads, -1 on error
+static int fdOpenRead(const char *fileName)
+{
+#if defined(_MSC_VER)
+    return _open(fileName, _O_RDONLY|_O_BINARY);
+#elif defined(EXIF_HAVE_PREAD) && defined(O_CLOEXEC)
+    return open(fileName, O_RDONLY|O_CLOEXEC);
+#elif defined(EXIF_HAVE_PREAD)
+    return open(fileName, O_RDONLY);
+#else
+    (void)fileName;
+    return -1;
+#endif
+}
+
+// create a file for writing, -1 on error
+static int fdCreate(const char *fileName)
+{
+#if defined(_MSC_VER)
+    return _open(fileName, _O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY, _S_IREAD|_S_IWRITE);
+#elif defined(EXIF_HAVE_PREAD) && defined(O_CLOEXEC)
+    return open(fileName, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+#elif defined(EXIF_HAVE_PREAD)
+    return open(fileName, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+#else
+    (void)fileName;
+    return -1;
+#endif
+}
+
+// write all the data at the current position of the descriptor
+static int fdWriteAll(int fd, const uint8_t *buf, size_t length)
+{
+    while (length > 0) {
+#if defined(_MSC_VER)
+        int n = _write(fd, buf, (unsigned int)((length > 0x40000000) ? 0x40000000 : length));
+#elif defined(EXIF_HAVE_PREAD)
+        ssize_t n = write(fd, buf, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+#else
+        int n = -1;
+        (void)fd;
+#endif
+        if (n <= 0) {
+            return 0;
+        }
+        buf += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+
+// file descriptor backend, the context is the descriptor itself so that
+// the backend keeps no state of its own
+static int64_t fdReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    int fd = (int)(intptr_t)context;
+#if defined(EXIF_HAVE_PREAD)
+    ssize_t n;
+    if (offset < 0) {
+        return -1;
+    }
+    do {
+        n = pread(fd, buf, length, (off_t)offset);
+    } while (n < 0 && errno == EINTR);
+    return (n < 0) ? -1 : (int64_t)n;
+#elif defined(_MSC_VER)
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED ov;
+    DWORD n = 0;
+    if (offset < 0 || h == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if (length > 0x40000000) {
+        length = 0x40000000;
+    }
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    if (!ReadFile(h, buf, (DWORD)length, &n, &ov)) {
+        return (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+    }
+    return (int64_t)n;
+#else
+    (void)fd; (void)offset; (void)buf; (void)length;
+    return -1;
+#endif
+}
+
+static int64_t fdSize(void *context)
+{
+    int fd = (int)(intptr_t)context;
+#if defined(EXIF_HAVE_PREAD)
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    return (int64_t)st.st_size;
+#elif defined(_MSC_VER)
+    return (int64_t)_filelengthi64(fd);
+#else
+    (void)fd;
+    return -1;
+#endif
+}
+
+static void fdClose(void *context)
+{
+#if defined(_MSC_VER)
+    _close((int)(intptr_t)context);
+#elif defined(EXIF_HAVE_PREAD)
+    close((int)(intptr_t)context);
+#else
+    (void)context;
+#endif
+}
+
+// memory backend, the context is ExifMemoryIO
+static int64_t memoryReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    ExifMemoryIO *mem = (ExifMemoryIO*)context;
+    if (offset < 0) {
+        return -1;
+    }
+    if ((uint64_t)offset >= mem->length) {
+        return 0;
+    }
+    if (length > mem->length - (size_t)offset) {
+        length = mem->length - (size_t)offset;
+    }
+    memcpy(buf, mem->data + offset, length);
+    return (int64_t)length;
+}
+
+static int64_t memorySize(void *context)
+{
+    return (int64_t)((ExifMemoryIO*)context)->length;
+}
+
+static int64_t memoryWrite(void *context, const void *buf, size_t length)
+{
+    ExifMemoryIO *mem = (ExifMemoryIO*)context;
+    if (mem->outLength + length > mem->outCapacity) {
+        size_t cap = (mem->outCapacity > 0) ? mem->outCapacity : 4096;
+        uint8_t *p;
+        while (cap < mem->outLength + length) {
+            cap *= 2;
+        }
+        p = (uint8_t*)realloc(mem->out, cap);
+        if (!p) {
+            return -1;
+        }
+        mem->out = p;
+        mem->outCapacity = cap;
+    }
+    memcpy(mem->out + mem->outLength, buf, length);
+    mem->outLength += length;
+    return (int64_t)length;
+}
+
+// range backend, the context is ExifRangeIO
+static int64_t rangeReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    ExifRangeIO *range = (ExifRangeIO*)context;
+    if (offset < 0) {
+        return -1;
+    }
+    if (range->length >= 0) {
+        if (offset >= range->length) {
+            return 0;
+        }
+        if ((uint64_t)length > (uint64_t)(range->length - offset)) {
+            length = (size_t)(range->length - offset);
+        }
+    }
+    return range->base->readAt(range->base->context, range->offset + offset, buf, length);
+}
+
+static int64_t rangeSize(void *context)
+{
+    ExifRangeIO *range = (ExifRangeIO*)context;
+    int64_t size = range->base->size ? range->base->size(range->base->context) : -1;
+    if (size >= 0) {
+        size = (size > range->offset) ? size - range->offset : 0;
+        if (range->length >= 0 && size > range->length) {
+            size = range->length;
+        }
+        return size;
+    }
+    return range->length;
+}
+
+// read planner, the context is READ_PLANNER
+
+// fetch [offset, offset + length) from the underlying backend in one
+// round trip and keep it, returns the number of bytes fetched or -1
+static int64_t plannerFetch(READ_PLANNER *p, int64_t offset, size_t length)
+{
+    PLAN_RANGE *r;
+    uint8_t *data;
+    int64_t n;
+
+    if (p->end >= 0 && offset + (int64_t)length > p->end) {
+        if (offset >= p->end) {
+            return 0;
+        }
+        length = (size_t)(p->end - offset);
+    }
+    if (p->rangeCount == p->rangeCapacity) {
+        int cap = (p->rangeCapacity > 0) ? p->rangeCapacity * 2 : 8;
+        r = (PLAN_RANGE*)realloc(p->ranges, sizeof(PLAN_RANGE) * cap);
+        if (!r) {
+            return -1;
+        }
+        p->ranges = r;
+        p->rangeCapacity = cap;
+    }
+    data = (uint8_t*)malloc(length);
+    if (!data) {
+        return -1;
+    }
+    // one request unless the backend returns less than asked
+    n = 0;
+    while ((size_t)n < length) {
+        int64_t got = p->base->readAt(p->base->context, offset + n,
+                                      data + n, length - (size_t)n);
+        p->stats.roundTrips++;
+        if (got < 0) {
+            free(data);
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        n += got;
+    }
+    p->stats.bytesFetched += (uint64_t)n;
+    if ((size_t)n < length && (p->end < 0 || offset + n < p->end)) {
+        p->end = offset + n;
+    }
+    if (n == 0) {
+        free(data);
+        return 0;
+    }
+    r = &p->ranges[p->rangeCount++];
+    r->offset = offset;
+    r->length = (size_t)n;
+    r->data = data;
+    return n;
+}
+
+// get the fetched range containing the offset, NULL if not fetched
+static PLAN_RANGE *plannerFind(READ_PLANNER *p, int64_t offset)
+{
+    int i;
+    for (i = 0; i < p->rangeCount; i++) {
+        PLAN_RANGE *r = &p->ranges[i];
+        if (offset >= r->offset && offset < r->offset + (int64_t)r->length) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// get the start of the first fetched range after the offset, -1 if none
+static int64_t plannerNextStart(READ_PLANNER *p, int64_t offset)
+{
+    int64_t next = -1;
+    int i;
+    for (i = 0; i < p->rangeCount; i++) {
+        int64_t start = p->ranges[i].offset;
+        if (start > offset && (next < 0 || start < next)) {
+            next = start;
+        }
+    }
+    return next;
+}
+
+// copy from the fetched ranges, fetching at least 'fetchSize' bytes at
+// each gap. returns the number of bytes copied or -1
+static int64_t plannerCopy(READ_PLANNER *p, int64_t offset, uint8_t *buf,
+                           size_t length, size_t fetchSize, int *pMiss)
+{
+    size_t done = 0, n;
+    int64_t pos, fetched;
+    PLAN_RANGE *r;
+
+    while (done < length) {
+        pos = offset + (int64_t)done;
+        if (p->end >= 0 && pos >= p->end) {
+            break;
+        }
+        r = plannerFind(p, pos);
+        if (!r) {
+            // up to the next fetched range at most
+            int64_t next = plannerNextStart(p, pos);
+            n = length - done;
+            if (n < fetchSize) {
+                n = fetchSize;
+            }
+            if (next >= 0 && next - pos < (int64_t)n) {
+                n = (size_t)(next - pos);
+            }
+            fetched = plannerFetch(p, pos, n);
+            if (fetched < 0) {
+                return -1;
+            }
+            if (pMiss) {
+                *pMiss = 1;
+            }
+            if (fetched == 0) {
+                break;
+            }
+            continue;
+        }
+        n = (size_t)(r->offset + (int64_t)r->length - pos);
+        if (n > length - done) {
+            n = length - done;
+        }
+        memcpy(buf + done, r->data + (pos - r->offset), n);
+        done += n;
+    }
+    return (int64_t)done;
+}
+
+/**
+ * Build the read plan: read the prefix, walk the segment chain in the
+ * same way as getAppNStartOffset(), and fetch the parts of the Exif and
+ * MPF segments that are not in memory yet, merging the ranges that are
+ * less than a prefix apart
+ *
+ * return
+ *  0: OK
+ *  ERR_READ_FILE
+ *  ERR_MEMALLOC
+ */
+static int plannerBuild(READ_PLANNER *p)
+{
+    int64_t need[2][2], gaps[PLAN_MAX_GAPS][2];
+    int64_t pos, next, end;
+    uint8_t hdr[16];
+    uint16_t marker, len;
+    int i, needCount = 0, gapCount = 0, exifFound = 0, mpfFound = 0;
+
+    // speculative read of the prefix
+    if (plannerFetch(p, 0, p->prefixSize) < 0) {
+        return ERR_READ_FILE;
+    }
+    pos = 2;
+    for (i = 0; i < PLAN_MAX_SEGMENTS; i++) {
+        // marker, length and the identifier of the segment
+        int64_t n = plannerCopy(p, pos, hdr, sizeof(hdr), p->prefixSize, NULL);
+        if (n < 0) {
+            return ERR_READ_FILE;
+        }
+        if (n < 4) {
+            break;
+        }
+        marker = (hdr[0] << 8) | hdr[1];
+        len = (hdr[2] << 8) | hdr[3];
+        if (marker == 0xFFDB || marker == 0xFFDA || marker == 0xFFD9 || len < 2) {
+            break;
+        }
+        if (marker == APP1_MARKER && !exifFound && n >= 4 + EXIF_ID_STR_LEN &&
+            memcmp(hdr + 4, EXIF_ID_STR, EXIF_ID_STR_LEN) == 0) {
+            need[needCount][0] = pos;
+            need[needCount++][1] = pos + 2 + len;
+            exifFound = 1;
+        } else if (marker == APP2_MARKER && !mpfFound && n >= 4 + MPF_ID_STR_LEN &&
+                   memcmp(hdr + 4, MPF_ID_STR, MPF_ID_STR_LEN) == 0) {
+            need[needCount][0] = pos;
+            need[needCount++][1] = pos + 2 + len;
+            mpfFound = 1;
+        }
+        pos += 2 + len;
+    }
+
+    // the parts of the segments not in memory, in ascending order
+    for (i = 0; i < needCount; i++) {
+        pos = need[i][0];
+        end = need[i][1];
+        while (pos < end && gapCount < PLAN_MAX_GAPS) {
+            PLAN_RANGE *r = plannerFind(p, pos);
+            if (r) {
+                pos = r->offset + (int64_t)r->length;
+                continue;
+            }
+            next = plannerNextStart(p, pos);
+            gaps[gapCount][0] = pos;
+            gaps[gapCount][1] = (next >= 0 && next < end) ? next : end;
+            pos = gaps[gapCount++][1];
+        }
+    }
+    // merge the gaps close to each other and fetch each run at once
+    for (i = 0; i < gapCount; ) {
+        int64_t start = gaps[i][0];
+        end = gaps[i][1];
+        for (i++; i < gapCount && gaps[i][0] >= end &&
+                  gaps[i][0] - end <= (int64_t)p->prefixSize; i++) {
+            end = gaps[i][1];
+        }
+        if (p->end >= 0 && start >= p->end) {
+            break;
+        }
+        p->stats.ranges++;
+        if (plannerFetch(p, start, (size_t)(end - start)) < 0) {
+            return ERR_READ_FILE;
+        }
+    }
+    return 0;
+}
+
+static int64_t plannerReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    READ_PLANNER *p = (READ_PLANNER*)context;
+    int64_t n;
+    int miss = 0;
+
+    if (offset < 0) {
+        return -1;
+    }
+    p->stats.reads++;
+    n = plannerCopy(p, offset, (uint8_t*)buf, length, PLAN_MISS_SIZE, &miss);
+    if (miss) {
+        p->stats.misses++;
+    }
+    return n;
+}
+
+static int64_t plannerSize(void *context)
+{
+    READ_PLANNER *p = (READ_PLANNER*)context;
+    if (p->end >= 0) {
+        return p->end;
+    }
+    return p->base->size ? p->base->size(p->base->context) : -1;
+}
+
+static void plannerClose(void *context)
+{
+    READ_PLANNER *p = (READ_PLANNER*)context;
+    int i;
+    for (i = 0; i < p->rangeCount; i++) {
+        free(p->ranges[i].data);
+    }
+    free(p->ranges);
+    free(p);
+}
+
+static void fileDumpWriter(void *context, const char *text, size_t length)
+{
+    fwrite(text, 1, length, (FILE*)context);
+}
+
+// make room for extra more characters plus the terminating NUL,
+// growing the buffer geometrically
+static int strBufReserve(STR_BUF *sb, size_t extra)
+{
+    size_t need = sb->length + extra + 1;
+    size_t cap;
+    char *p;
+    if (need <= sb->capacity) {
+        return 1;
+    }
+    cap = (sb->capacity > 0) ? sb->capacity : 256;
+    while (cap < need) {
+        cap *= 2;
+    }
+    p = (char*)realloc(sb->data, cap);
+    if (!p) {
+        sb->error = 1;
+        return 0;
+    }
+    sb->data = p;
+    sb->capacity = cap;
+    return 1;
+}
+
+static void strBufFlush(STR_BUF *sb)
+{
+    if (sb->writer && sb->length > 0) {
+        sb->writer(sb->context, sb->data, sb->length);
+        sb->length = 0;
+        sb->data[0] = 0;
+    }
+}
+
+static void PRINTF(STR_BUF *sb, const char *fmt, ...)
+{
+    size_t avail;
+    int cnt;
+    va_list args;
+
+    if (sb->error) {
+        return;
+    }
+    avail = sb->capacity - sb->length;
+    va_start(args, fmt);
+    cnt = vsnprintf((avail > 0) ? sb->data + sb->length : NULL, avail, fmt, args);
+    va_end(args);
+    if (cnt < 0) {
+        sb->error = 1;
+        return;
+    }
+    if ((size_t)cnt >= avail) {
+        // did not fit, grow and format again
+        if (!strBufReserve(sb, (size_t)cnt)) {
+            return;
+        }
+        va_start(args, fmt);
+        vsnprintf(sb->data + sb->length, sb->capacity - sb->length, fmt, args);
+        va_end(args);
+    }
+    sb->length += cnt;
+    if (sb->writer && sb->length >= STR_BUF_FLUSH_SIZE) {
+        strBufFlush(sb);
+    }
+}
+
+static void strBufAppend(STR_BUF *sb, const char *str, size_t length)
+{
+    if (length == 0 || sb->error || !strBufReserve(sb, length)) {
+        return;
+    }
+    memcpy(sb->data + sb->length, str, length);
+    sb->length += length;
+    sb->data[sb->length] = 0;
+    if (sb->writer && sb->length >= STR_BUF_FLUSH_SIZE) {
+        strBufFlush(sb);
+    }
+}
+
+static void strBufPutUint(STR_BUF *sb, unsigned int v, int negative)
+{
+    char buf[16], *p = buf + sizeof(buf);
+    do {
+        *--p = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (negative) {
+        *--p = '-';
+    }
+    strBufAppend(sb, p, buf + sizeof(buf) - p);
+}
+
+static void strBufPutInt(STR_BUF *sb, int v)
+{
+    if (v < 0) {
+        strBufPutUint(sb, 0u - (unsigned int)v, 1);
+    } else {
+        strBufPutUint(sb, (unsigned int)v, 0);
+    }
+}
+
+// length of the valid UTF-8 sequence at p, 0 if it is not valid
+static int utf8SequenceLength(const uint8_t *p, size_t avail)
+{
+    int n, i;
+    if (p[0] < 0x80) {
+        return 1;
+    } else if (p[0] >= 0xC2 && p[0] <= 0xDF) {
+        n = 2;
+    } else if (p[0] >= 0xE0 && p[0] <= 0xEF) {
+        n = 3;
+    } else if (p[0] >= 0xF0 && p[0] <= 0xF4) {
+        n = 4;
+    } else {
+        return 0;
+    }
+    if ((size_t)n > avail) {
+        return 0;
+    }
+    for (i = 1; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    // reject overlong forms, surrogates and code points above U+10FFFF
+    if ((p[0] == 0xE0 && p[1] < 0xA0) || (p[0] == 0xED && p[1] >= 0xA0) ||
+        (p[0] == 0xF0 && p[1] < 0x90) || (p[0] == 0xF4 && p[1] >= 0x90)) {
+        return 0;
+    }
+    return n;
+}
+
+// quoted JSON string, bytes that are not valid UTF-8 are taken as Latin-1
+static void jsonPutString(STR_BUF *sb, const uint8_t *str, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+    size_t i, run = 0;
+    int n;
+
+    strBufAppend(sb, "\"", 1);
+    for (i = 0; i < length; i += n) {
+        uint8_t c = str[i];
+        n = utf8SequenceLength(str + i, length - i);
+        if (n > 1 || (n == 1 && c >= 0x20 && c != '"' && c != '\\')) {
+            run += n;
+            continue;
+        }
+        strBufAppend(sb, (const char*)str + i - run, run);
+        run = 0;
+        if (n == 0) {
+            // Latin-1 byte as a 2 byte UTF-8 sequence
+            char u[2];
+            u[0] = (char)(0xC0 | (c >> 6));
+            u[1] = (char)(0x80 | (c & 0x3F));
+            strBufAppend(sb, u, 2);
+            n = 1;
+        } else if (c == '"' || c == '\\') {
+            esc[1] = (char)c;
+            strBufAppend(sb, esc, 2);
+            esc[1] = 'u';
+        } else {
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 15];
+            strBufAppend(sb, esc, 6);
+        }
+    }
+    strBufAppend(sb, (const char*)str + i - run, run);
+    strBufAppend(sb, "\"", 1);
+}
+
+static void strBufPutHex(STR_BUF *sb, const uint8_t *data, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t i;
+    char *p;
+    if (sb->error || !strBufReserve(sb, length * 2)) {
+        return;
+    }
+    p = sb->data + sb->length;
+    for (i = 0; i < length; i++) {
+        *p++ = hex[data[i] >> 4];
+        *p++ = hex[data[i] & 15];
+    }
+    *p = 0;
+    sb->length += length * 2;
+}
+
+// numData[index] of a numeric tag with the sign of its type
+static void strBufPutTagNum(STR_BUF *sb, TagNode *tag, unsigned int index)
+{
+    switch (tag->type) {
+    case TYPE_SBYTE:
+        strBufPutInt(sb, (signed char)tag->numData[index]);
+        break;
+    case TYPE_SSHORT:
+        strBufPutInt(sb, (short)tag->numData[index]);
+        break;
+    case TYPE_SLONG:
+    case TYPE_SRATIONAL:
+        strBufPutInt(sb, (int)tag->numData[index]);
+        break;
+    default:
+        strBufPutUint(sb, tag->numData[index], 0);
+        break;
+    }
+}
+
+// name of the IFD used in the JSON and column output
+static const char *getIfdName(IFD_TYPE ifdType)
+{
+    return (ifdType == IFD_0TH)  ? "0TH" :
+           (ifdType == IFD_1ST)  ? "1ST" :
+           (ifdType == IFD_EXIF) ? "EXIF" :
+           (ifdType == IFD_GPS)  ? "GPS" :
+           (ifdType == IFD_IO)   ? "Interoperability" :
+           (ifdType == IFD_MPF)  ? "MPF" : "UNKNOWN";
+}
+
+// name of the tag, or "0xXXXX" written to buf if it is unknown
+static const char *getTagKey(IFD_TYPE ifdType, uint16_t tagId, char buf[8])
+{
+    const char *name = getTagName(ifdType, tagId);
+    if (name[0] == 0 || strcmp(name, "(Unknown)") == 0) {
+        sprintf(buf, "0x%04X", tagId);
+        return buf;
+    }
+    return name;
+}
+
+// quoted base64 or hex string of the binary data
+static void jsonPutBinary(STR_BUF *sb, const uint8_t *data, size_t length, int hexOutput)
+{
+    static const char b64[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, outLen = (length + 2) / 3 * 4;
+    char *p;
+
+    strBufAppend(sb, "\"", 1);
+    if (hexOutput) {
+        strBufPutHex(sb, data, length);
+        strBufAppend(sb, "\"", 1);
+        return;
+    }
+    if (sb->error || !strBufReserve(sb, outLen)) {
+        return;
+    }
+    p = sb->data + sb->length;
+    for (i = 0; i + 2 < length; i += 3) {
+        uint32_t v = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+        *p++ = b64[v >> 18];
+        *p++ = b64[(v >> 12) & 63];
+        *p++ = b64[(v >> 6) & 63];
+        *p++ = b64[v & 63];
+    }
+    if (i < length) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < length) {
+            v |= data[i+1] << 8;
+        }
+        *p++ = b64[v >> 18];
+        *p++ = b64[(v >> 12) & 63];
+        *p++ = (i + 1 < length) ? b64[(v >> 6) & 63] : '=';
+        *p++ = '=';
+    }
+    sb->length += outLen;
+    strBufAppend(sb, "\"", 1);
+}
+
+static void jsonPutTagValue(STR_BUF *sb, TagNode *tag, int flags)
+{
+    unsigned int i, n;
+    int pairs = (tag->type == TYPE_RATIONAL || tag->type == TYPE_SRATIONAL);
+
+    if (tag->error) {
+        strBufAppend(sb, "null", 4);
+        return;
+    }
+    switch (tag->type) {
+    case TYPE_ASCII:
+        // up to the first NUL
+        for (n = 0; n < tag->count && tag->byteData[n]; n++);
+        jsonPutString(sb, tag->byteData, n);
+        return;
+    case TYPE_UNDEFINED:
+        jsonPutBinary(sb, tag->byteData, tag->count, flags & EXIF_JSON_HEX);
+        return;
+    case TYPE_BYTE:
+    case TYPE_SHORT:
+    case TYPE_LONG:
+    case TYPE_RATIONAL:
+    case TYPE_SBYTE:
+    case TYPE_SSHORT:
+    case TYPE_SLONG:
+    case TYPE_SRATIONAL:
+        break;
+    default:
+        strBufAppend(sb, "null", 4);
+        return;
+    }
+    // a single value as a scalar (or [num,den]), otherwise an array
+    if (tag->count != 1) {
+        strBufAppend(sb, "[", 1);
+    }
+    for (i = 0; i < tag->count; i++) {
+        if (i > 0) {
+            strBufAppend(sb, ",", 1);
+        }
+        if (pairs) {
+            strBufAppend(sb, "[", 1);
+            strBufPutTagNum(sb, tag, i * 2);
+            strBufAppend(sb, ",", 1);
+            strBufPutTagNum(sb, tag, i * 2 + 1);
+            strBufAppend(sb, "]", 1);
+        } else {
+            strBufPutTagNum(sb, tag, i);
+        }
+    }
+    if (tag->count != 1) {
+        strBufAppend(sb, "]", 1);
+    }
+}
+
+static void _emitIfdTableArrayJson(void **ifdArray, int flags, STR_BUF *sb)
+{
+    int i, j, repeat;
+    IfdTable *ifd;
+    TagNode *tag;
+    const char *name;
+    char key[8];
+    uint8_t seen[65536 / 8];    // tag IDs already written in the IFD
+
+    memset(seen, 0, sizeof(seen));
+    strBufAppend(sb, "{", 1);
+    for (i = 0; ifdArray && ifdArray[i] != NULL; i++) {
+        ifd = (IfdTable*)ifdArray[i];
+        name = getIfdName(ifd->ifdType);
+        if (i > 0) {
+            strBufAppend(sb, ",", 1);
+        }
+        strBufAppend(sb, "\"", 1);
+        strBufAppend(sb, name, strlen(name));
+        // a repeated IFD type is keyed "NAME_2", "NAME_3", ...
+        for (j = 0, repeat = 1; j < i; j++) {
+            if (((IfdTable*)ifdArray[j])->ifdType == ifd->ifdType) {
+                repeat++;
+            }
+        }
+        if (repeat > 1) {
+            strBufAppend(sb, "_", 1);
+            strBufPutUint(sb, repeat, 0);
+        }
+        strBufAppend(sb, "\":{", 3);
+        for (tag = ifd->tags; tag; tag = tag->next) {
+            // a broken file may repeat a tag, keep only the first one
+            if (seen[tag->tagId >> 3] & (1 << (tag->tagId & 7))) {
+                continue;
+            }
+            seen[tag->tagId >> 3] |= (uint8_t)(1 << (tag->tagId & 7));
+            if (tag != ifd->tags) {
+                strBufAppend(sb, ",", 1);
+            }
+            name = getTagKey(ifd->ifdType, tag->tagId, key);
+            strBufAppend(sb, "\"", 1);
+            strBufAppend(sb, name, strlen(name));
+            strBufAppend(sb, "\":", 2);
+            jsonPutTagValue(sb, tag, flags);
+        }
+        // clear the bits of this IFD for the next one
+        for (tag = ifd->tags; tag; tag = tag->next) {
+            seen[tag->tagId >> 3] = 0;
+        }
+        if ((flags & EXIF_JSON_THUMBNAIL) && ifd->ifdType == IFD_1ST && ifd->p) {
+            strBufAppend(sb, (ifd->tags) ? ",\"thumbnail\":" : "\"thumbnail\":", (ifd->tags) ? 13 : 12);
+            jsonPutBinary(sb, ifd->p, blobThumbnailLength(ifd), flags & EXIF_JSON_HEX);
+        }
+        strBufAppend(sb, "}", 1);
+    }
+    strBufAppend(sb, "}", 1);
+}
 
-            case TAG_ExposureTime: return "ExposureTime";
-            case TAG_FNumber: return "FNumber";
-            case TAG_ExposureProgram: return "ExposureProgram";
-            case TAG_SpectralSensitivity: return "SpectralSensitivity";
-            case TAG_PhotographicSensitivity: return "PhotographicSensitivity";
-            case TAG_OECF: return "OECF";
-            case TAG_SensitivityType: return "SensitivityType";
-            case TAG_StandardOutputSensitivity: return "StandardOutputSensitivity";
-            case TAG_RecommendedExposureIndex: return "RecommendedExposureIndex";
-            case TAG_ISOSpeed: return "ISOSpeed";
-            case TAG_ISOSpeedLatitudeyyy: return "ISOSpeedLatitudeyyy";
-            case TAG_ISOSpeedLatitudezzz: return "ISOSpeedLatitudezzz";
+// tag of the column, IFD_UNKNOWN looks in the 0th, Exif and GPS IFDs
+static TagNode *columnFindTag(void **ifdArray, const ExifColumnSpec *spec)
+{
+    static const IFD_TYPE anyIfd[3] = { IFD_0TH, IFD_EXIF, IFD_GPS };
+    IfdTable *ifd;
+    TagNode *tag = NULL;
+    int i;
+    if (spec->ifdType != IFD_UNKNOWN) {
+        ifd = getIfdTableFromIfdTableArray(ifdArray, spec->ifdType);
+        return ifd ? getTagNodePtrFromIfd(ifd, spec->tagId) : NULL;
+    }
+    for (i = 0; i < 3 && !tag; i++) {
+        ifd = getIfdTableFromIfdTableArray(ifdArray, anyIfd[i]);
+        tag = ifd ? getTagNodePtrFromIfd(ifd, spec->tagId) : NULL;
+    }
+    return tag;
+}
 
-            case TAG_ShutterSpeedValue: return "ShutterSpeedValue";
-            case TAG_ApertureValue: return "ApertureValue";
-            case TAG_BrightnessValue: return "BrightnessValue";
-            case TAG_ExposureBiasValue: return "ExposureBiasValue";
-            case TAG_MaxApertureValue: return "MaxApertureValue";
-            case TAG_SubjectDistance: return "SubjectDistance";
-            case TAG_MeteringMode: return "MeteringMode";
-            case TAG_LightSource: return "LightSource";
-            case TAG_Flash: return "Flash";
-            case TAG_FocalLength: return "FocalLength";
-            case TAG_SubjectArea: return "SubjectArea";
-            case TAG_FlashEnergy: return "FlashEnergy";
-            case TAG_SpatialFrequencyResponse: return "SpatialFrequencyResponse";
-            case TAG_FocalPlaneXResolution: return "FocalPlaneXResolution";
-            case TAG_FocalPlaneYResolution: return "FocalPlaneYResolution";
-            case TAG_FocalPlaneResolutionUnit: return "FocalPlaneResolutionUnit";
-            case TAG_SubjectLocation: return "SubjectLocation";
-            case TAG_ExposureIndex: return "ExposureIndex";
-            case TAG_SensingMethod: return "SensingMethod";
-            case TAG_FileSource: return "FileSource";
-            case TAG_SceneType: return "SceneType";
-            case TAG_CFAPattern: return "CFAPattern";
+// text of the tag in the column output: numbers separated by spaces,
+// rationals as n/d and UNDEFINED data as hex
+static void columnPutTagValue(STR_BUF *sb, TagNode *tag)
+{
+    unsigned int i, n;
+    switch (tag->type) {
+    case TYPE_ASCII:
+        for (n = 0; n < tag->count && tag->byteData[n]; n++);
+        strBufAppend(sb, (const char*)tag->byteData, n);
+        break;
+    case TYPE_UNDEFINED:
+        strBufPutHex(sb, tag->byteData, tag->count);
+        break;
+    case TYPE_RATIONAL:
+    case TYPE_SRATIONAL:
+        for (i = 0; i < tag->count; i++) {
+            if (i > 0) {
+                strBufAppend(sb, " ", 1);
+            }
+            strBufPutTagNum(sb, tag, i * 2);
+            strBufAppend(sb, "/", 1);
+            strBufPutTagNum(sb, tag, i * 2 + 1);
+        }
+        break;
+    case TYPE_BYTE:
+    case TYPE_SHORT:
+    case TYPE_LONG:
+    case TYPE_SBYTE:
+    case TYPE_SSHORT:
+    case TYPE_SLONG:
+        for (i = 0; i < tag->count; i++) {
+            if (i > 0) {
+                strBufAppend(sb, " ", 1);
+            }
+            strBufPutTagNum(sb, tag, i);
+        }
+        break;
+    default:
+        break;
+    }
+}
 
-            case TAG_CustomRendered: return "CustomRendered";
-            case TAG_ExposureMode: return "ExposureMode";
-            case TAG_WhiteBalance: return "WhiteBalance";
-            case TAG_DigitalZoomRatio: return "DigitalZoomRatio";
-            case TAG_FocalLengthIn35mmFormat: return "FocalLengthIn35mmFormat";
-            case TAG_SceneCaptureType: return "SceneCaptureType";
-            case TAG_GainControl: return "GainControl";
-            case TAG_Contrast: return "Contrast";
-            case TAG_Saturation: return "Saturation";
-            case TAG_Sharpness: return "Sharpness";
-            case TAG_DeviceSettingDescription: return "DeviceSettingDescription";
-            case TAG_SubjectDistanceRange: return "SubjectDistanceRange";
+// first value of a numeric tag as a little-endian int64 or double,
+// returns 0 (nothing appended) if the tag has no such value
+static int columnPutTagNumber(STR_BUF *sb, int type, TagNode *tag)
+{
+    uint8_t value[8];
+    int64_t n = 0;
+    double d;
+    uint64_t bits;
 
-            case TAG_ImageUniqueID: return "ImageUniqueID";
-            case TAG_CameraOwnerName: return "CameraOwnerName";
-            case TAG_BodySerialNumber: return "BodySerialNumber";
-            case TAG_LensSpecification: return "LensSpecification";
-            case TAG_LensMake: return "LensMake";
-            case TAG_LensModel: return "LensModel";
-            case TAG_LensSerialNumber: return "LensSerialNumber";
-            case TAG_Gamma: return "Gamma";
-            case TAG_PrintIM: return "PrintIM";
-            case TAG_Padding: return "Padding";
-            default: ;
+    if (tag->count < 1 || !tag->numData) {
+        return 0;
+    }
+    switch (tag->type) {
+    case TYPE_BYTE:
+    case TYPE_SHORT:
+    case TYPE_LONG:
+        n = tag->numData[0];
+        d = (double)n;
+        break;
+    case TYPE_SBYTE:
+        n = (signed char)tag->numData[0];
+        d = (double)n;
+        break;
+    case TYPE_SSHORT:
+        n = (short)tag->numData[0];
+        d = (double)n;
+        break;
+    case TYPE_SLONG:
+        n = (int)tag->numData[0];
+        d = (double)n;
+        break;
+    case TYPE_RATIONAL:
+        if (type != ARROW_TYPE_FLOAT || tag->numData[1] == 0) {
+            return 0;
         }
-    } else if (ifdType == IFD_GPS) {
-        switch (tagId) {
-            case TAG_GPSVersionID: return "GPSVersionID";
-            case TAG_GPSLatitudeRef: return "GPSLatitudeRef";
-            case TAG_GPSLatitude: return "GPSLatitude";
-            case TAG_GPSLongitudeRef: return "GPSLongitudeRef";
-            case TAG_GPSLongitude: return "GPSLongitude";
-            case TAG_GPSAltitudeRef: return "GPSAltitudeRef";
-            case TAG_GPSAltitude: return "GPSAltitude";
-            case TAG_GPSTimeStamp: return "GPSTimeStamp";
-            case TAG_GPSSatellites: return "GPSSatellites";
-            case TAG_GPSStatus: return "GPSStatus";
-            case TAG_GPSMeasureMode: return "GPSMeasureMode";
-            case TAG_GPSDOP: return "GPSDOP";
-            case TAG_GPSSpeedRef: return "GPSSpeedRef";
-            case TAG_GPSSpeed: return "GPSSpeed";
-            case TAG_GPSTrackRef: return "GPSTrackRef";
-            case TAG_GPSTrack: return "GPSTrack";
-            case TAG_GPSImgDirectionRef: return "GPSImgDirectionRef";
-            case TAG_GPSImgDirection: return "GPSImgDirection";
-            case TAG_GPSMapDatum: return "GPSMapDatum";
-            case TAG_GPSDestLatitudeRef: return "GPSDestLatitudeRef";
-            case TAG_GPSDestLatitude: return "GPSDestLatitude";
-            case TAG_GPSDestLongitudeRef: return "GPSDestLongitudeRef";
-            case TAG_GPSDestLongitude: return "GPSDestLongitude";
-            case TAG_GPSBearingRef: return "GPSBearingRef";
-            case TAG_GPSBearing: return "GPSBearing";
-            case TAG_GPSDestDistanceRef: return "GPSDestDistanceRef";
-            case TAG_GPSDestDistance: return "GPSDestDistance";
-            case TAG_GPSProcessingMethod: return "GPSProcessingMethod";
-            case TAG_GPSAreaInformation: return "GPSAreaInformation";
-            case TAG_GPSDateStamp: return "GPSDateStamp";
-            case TAG_GPSDifferential: return "GPSDifferential";
-            case TAG_GPSHPositioningError: return "GPSHPositioningError";
-            default: ;
+        d = (double)tag->numData[0] / tag->numData[1];
+        break;
+    case TYPE_SRATIONAL:
+        if (type != ARROW_TYPE_FLOAT || tag->numData[1] == 0) {
+            return 0;
         }
-    } else if (ifdType == IFD_IO) {
+        d = (double)(int)tag->numData[0] / (int)tag->numData[1];
+        break;
+    default:
+        return 0;
+    }
+    if (type == ARROW_TYPE_INT) {
+        putLE64(value, (uint64_t)n);
+    } else {
+        memcpy(&bits, &d, sizeof(bits));
+        putLE64(value, bits);
+    }
+    strBufAppend(sb, (const char*)value, sizeof(value));
+    return 1;
+}
+
+// Arrow type of the column of a tag: int64 for the tags having a single
+// integer value, double for those having a single rational value, utf8
+// for the others (text, several values, undefined data)
+static int columnTagType(IFD_TYPE ifdType, uint16_t tagId)
+{
+    // the GPS tag IDs are below 0x100, the tags of the other IFDs above
+    if (ifdType == IFD_GPS || (ifdType == IFD_UNKNOWN && tagId < 0x100)) {
         switch (tagId) {
-            case TAG_InteroperabilityIndex: return "InteroperabilityIndex";
-            case TAG_InteroperabilityVersion: return "InteroperabilityVersion";
-            case TAG_RelatedImageFileFormat: return "RelatedImageFileFormat";
-            case TAG_RelatedImageWidth: return "RelatedImageWidth";
-            case TAG_RelatedImageHeight: return "RelatedImageHeight";
-            default: ;
+        case TAG_GPSAltitudeRef:
+        case TAG_GPSDifferential:
+            return ARROW_TYPE_INT;
+        case TAG_GPSAltitude:
+        case TAG_GPSDOP:
+        case TAG_GPSSpeed:
+        case TAG_GPSTrack:
+        case TAG_GPSImgDirection:
+        case TAG_GPSBearing:
+        case TAG_GPSDestDistance:
+        case TAG_GPSHPositioningError:
+            return ARROW_TYPE_FLOAT;
+        default:
+            return ARROW_TYPE_UTF8;
         }
-	} else if (ifdType == IFD_MPF) {
-		switch (tagId) {
-			case TAG_MPFVersion: return "MPFVersion";
-			case TAG_NumberOfImage: return "NumberOfImage";
-			case TAG_MPImageList: return "MPImageList";
-			case TAG_ImageUIDList: return "ImageUIDList";
-			case TAG_TotalFrames: return "TotalFrames";
+    }
+    if (ifdType != IFD_UNKNOWN && ifdType != IFD_0TH &&
+        ifdType != IFD_1ST && ifdType != IFD_EXIF) {
+        return ARROW_TYPE_UTF8;
+    }
+    switch (tagId) {
+    case TAG_ImageWidth:
+    case TAG_ImageLength:
+    case TAG_Compression:
+    case TAG_PhotometricInterpretation:
+    case TAG_Orientation:
+    case TAG_SamplesPerPixel:
+    case TAG_PlanarConfiguration:
+    case TAG_YCbCrPositioning:
+    case TAG_ResolutionUnit:
+    case TAG_RowsPerStrip:
+    case TAG_JPEGInterchangeFormat:
+    case TAG_JPEGInterchangeFormatLength:
+    case TAG_Rating:
+    case TAG_ColorSpace:
+    case TAG_PixelXDimension:
+    case TAG_PixelYDimension:
+    case TAG_ExposureProgram:
+    case TAG_PhotographicSensitivity:
+    case TAG_SensitivityType:
+    case TAG_StandardOutputSensitivity:
+    case TAG_RecommendedExposureIndex:
+    case TAG_ISOSpeed:
+    case TAG_ISOSpeedLatitudeyyy:
+    case TAG_ISOSpeedLatitudezzz:
+    case TAG_MeteringMode:
+    case TAG_LightSource:
+    case TAG_Flash:
+    case TAG_FocalPlaneResolutionUnit:
+    case TAG_SensingMethod:
+    case TAG_CustomRendered:
+    case TAG_ExposureMode:
+    case TAG_WhiteBalance:
+    case TAG_FocalLengthIn35mmFormat:
+    case TAG_SceneCaptureType:
+    case TAG_GainControl:
+    case TAG_Contrast:
+    case TAG_Saturation:
+    case TAG_Sharpness:
+    case TAG_SubjectDistanceRange:
+        return ARROW_TYPE_INT;
+    case TAG_XResolution:
+    case TAG_YResolution:
+    case TAG_CompressedBitsPerPixel:
+    case TAG_ExposureTime:
+    case TAG_FNumber:
+    case TAG_ShutterSpeedValue:
+    case TAG_ApertureValue:
+    case TAG_BrightnessValue:
+    case TAG_ExposureBiasValue:
+    case TAG_MaxApertureValue:
+    case TAG_SubjectDistance:
+    case TAG_FocalLength:
+    case TAG_FlashEnergy:
+    case TAG_FocalPlaneXResolution:
+    case TAG_FocalPlaneYResolution:
+    case TAG_ExposureIndex:
+    case TAG_DigitalZoomRatio:
+    case TAG_Gamma:
+        return ARROW_TYPE_FLOAT;
+    default:
+        return ARROW_TYPE_UTF8;
+    }
+}
 
-			case TAG_MPIndividualNum: return "MPIndividualNum";
-			case TAG_PanOrientation: return "PanOrientation";
-			case TAG_PanOverlapH: return "PanOverlapH";
-			case TAG_PanOverlapV: return "PanOverlapV";
-			case TAG_BaseViewpointNum: return "BaseViewpointNum";
-			case TAG_ConvergenceAngle: return "ConvergenceAngle";
-			case TAG_BaselineLength: return "BaseLineLength";
-			case TAG_VerticalDivergence: return "VerticalDivergence";
-			case TAG_AxisDistanceX: return "AxisDistanceX";
-			case TAG_AxisDistanceY: return "AxisDistanceY";
-			case TAG_AxisDistanceZ: return "AxisDistanceZ";
-			case TAG_YawAngle: return "YawAngle";
-			case TAG_PitchAngle: return "PitchAngle";
-			case TAG_RollAngle: return "RollAngle";
-			default:;
-		}
-		return "(Unknown)";
-	}
-    return "(Unknown)";
+// one CSV or TSV field, CSV fields are quoted as needed (RFC 4180) and
+// the separators in TSV fields are replaced with spaces
+static void columnPutTextField(STR_BUF *sb, int format, const char *str, size_t length)
+{
+    size_t i, start;
+    if (format == EXIF_EXPORT_TSV) {
+        for (i = start = 0; i < length; i++) {
+            if (str[i] == '\t' || str[i] == '\n' || str[i] == '\r') {
+                strBufAppend(sb, str + start, i - start);
+                strBufAppend(sb, " ", 1);
+                start = i + 1;
+            }
+        }
+        strBufAppend(sb, str + start, length - start);
+        return;
+    }
+    for (i = 0; i < length; i++) {
+        if (str[i] == ',' || str[i] == '"' || str[i] == '\n' || str[i] == '\r') {
+            break;
+        }
+    }
+    if (i == length) {
+        strBufAppend(sb, str, length);
+        return;
+    }
+    strBufAppend(sb, "\"", 1);
+    for (i = start = 0; i < length; i++) {
+        if (str[i] == '"') {
+            strBufAppend(sb, str + start, i + 1 - start);
+            strBufAppend(sb, "\"", 1);
+            start = i + 1;
+        }
+    }
+    strBufAppend(sb, str + start, length - start);
+    strBufAppend(sb, "\"", 1);
+}
+
+/*
+ * Arrow IPC stream output
+ *
+ * Each message is 0xFFFFFFFF, the int32 length of the metadata, the
+ * metadata as a flatbuffer (Message.fbs) padded to 8 bytes, and the body.
+ * The flatbuffers are written front to back: a table is preceded by its
+ * vtable and every table, vector or string it refers to comes after it,
+ * so all the uoffset_t values are positive. All the columns are nullable,
+ * Int64 and Float64 columns have a validity and a data buffer and Utf8
+ * columns a validity, an offsets and a data buffer. The stream ends with
+ * 0xFFFFFFFF 0x00000000.
+ */
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_PRECISION_DOUBLE  2
+
+static void putLE64(uint8_t *p, uint64_t v)
+{
+    putLE32(p, (uint32_t)v);
+    putLE32(p + 4, (uint32_t)(v >> 32));
+}
+
+// append n zero bytes, returns their position
+static size_t fbZeros(STR_BUF *fb, size_t n)
+{
+    size_t pos = fb->length;
+    if (!fb->error && strBufReserve(fb, n)) {
+        memset(fb->data + pos, 0, n + 1);
+        fb->length += n;
+    }
+    return pos;
+}
+
+// pad with zeros until the position is 'phase' modulo 'align'
+static size_t fbPad(STR_BUF *fb, size_t align, size_t phase)
+{
+    fbZeros(fb, (align + phase - fb->length % align) % align);
+    return fb->length;
+}
+
+// set the uoffset_t at pos to refer to target
+static void fbSetOffset(STR_BUF *fb, size_t pos, size_t target)
+{
+    if (!fb->error) {
+        putLE32((uint8_t*)fb->data + pos, (uint32_t)(target - pos));
+    }
+}
+
+// write the vtable and an empty table with the fields of the given sizes
+// (0: absent), the positions of the fields are returned in pos
+static size_t fbTable(STR_BUF *fb, int count, const uint8_t *sizes, size_t *pos)
+{
+    size_t vt, table, ofs = 4;
+    int i, size;
+
+    vt = fbPad(fb, 2, 0);
+    fbZeros(fb, 4 + 2 * count);
+    // the table starts at 4 mod 8 so that the largest-first fields after
+    // its soffset_t are naturally aligned
+    table = fbPad(fb, 8, 4);
+    for (size = 8; size >= 1; size /= 2) {
+        for (i = 0; i < count; i++) {
+            if (sizes[i] == size) {
+                pos[i] = table + ofs;
+                ofs += size;
+            }
+        }
+    }
+    ofs = (ofs + 3) & ~(size_t)3;
+    fbZeros(fb, ofs);
+    if (fb->error) {
+        return 0;
+    }
+    putLE16((uint8_t*)fb->data + vt, (uint16_t)(4 + 2 * count));
+    putLE16((uint8_t*)fb->data + vt + 2, (uint16_t)ofs);
+    for (i = 0; i < count; i++) {
+        putLE16((uint8_t*)fb->data + vt + 4 + 2 * i, (uint16_t)(sizes[i] ? pos[i] - table : 0));
+    }
+    putLE32((uint8_t*)fb->data + table, (uint32_t)(table - vt));
+    return table;
+}
+
+static size_t fbString(STR_BUF *fb, const char *str)
+{
+    size_t pos = fbPad(fb, 4, 0), length = strlen(str);
+    fbZeros(fb, 4);
+    strBufAppend(fb, str, length + 1);
+    if (!fb->error) {
+        putLE32((uint8_t*)fb->data + pos, (uint32_t)length);
+    }
+    return pos;
+}
+
+// vector of count elements, 8-byte aligned for the structs, returns the
+// position of its length
+static size_t fbVector(STR_BUF *fb, size_t count, size_t elementSize)
+{
+    size_t pos = fbPad(fb, 8, 4);
+    fbZeros(fb, 4 + count * elementSize);
+    if (!fb->error) {
+        putLE32((uint8_t*)fb->data + pos, (uint32_t)count);
+    }
+    return pos;
+}
+
+// write the Message table, returns the position of its header field
+static size_t arrowMessage(STR_BUF *fb, uint8_t headerType, uint64_t bodyLength)
+{
+    // version, header_type, header, bodyLength
+    static const uint8_t sizes[4] = { 2, 1, 4, 8 };
+    size_t pos[4], root = fbZeros(fb, 4);
+    size_t table = fbTable(fb, 4, sizes, pos);
+    if (fb->error) {
+        return 0;
+    }
+    fbSetOffset(fb, root, table);
+    putLE16((uint8_t*)fb->data + pos[0], ARROW_METADATA_V5);
+    fb->data[pos[1]] = (char)headerType;
+    putLE64((uint8_t*)fb->data + pos[3], bodyLength);
+    return pos[2];
+}
+
+// write the encapsulated message and the body
+static int arrowWriteMessage(COLUMN_WRITER *w, STR_BUF *fb)
+{
+    uint8_t prefix[8];
+    int i;
+    fbPad(fb, 8, 0);
+    if (fb->error) {
+        return ERR_MEMALLOC;
+    }
+    putLE32(prefix, 0xFFFFFFFF);
+    putLE32(prefix + 4, (uint32_t)fb->length);
+    fwrite(prefix, 1, sizeof(prefix), w->fp);
+    fwrite(fb->data, 1, fb->length, w->fp);
+    if (w->rows > 0) {
+        static const uint8_t zeros[8] = { 0 };
+        for (i = 0; i < w->columnCount; i++) {
+            COLUMN_BUF *col = &w->columns[i];
+            fwrite(col->validity.data, 1, col->validity.length, w->fp);
+            fwrite(zeros, 1, (8 - col->validity.length % 8) % 8, w->fp);
+            if (col->type == ARROW_TYPE_UTF8) {
+                fwrite(col->offsets.data, 1, col->offsets.length, w->fp);
+                fwrite(zeros, 1, (8 - col->offsets.length % 8) % 8, w->fp);
+            }
+            if (col->data.length > 0) {
+                fwrite(col->data.data, 1, col->data.length, w->fp);
+            }
+            fwrite(zeros, 1, (8 - col->data.length % 8) % 8, w->fp);
+        }
+    }
+    return ferror(w->fp) ? ERR_WRITE_FILE : 0;
+}
+
+static int columnWriteSchema(COLUMN_WRITER *w)
+{
+    // Schema: endianness (Little, the default), fields
+    static const uint8_t schemaSizes[2] = { 0, 4 };
+    // Field: name, nullable, type_type, type, dictionary, children
+    static const uint8_t fieldSizes[6] = { 4, 1, 1, 4, 0, 4 };
+    // Int: bitWidth, is_signed
+    static const uint8_t intSizes[2] = { 4, 1 };
+    // FloatingPoint: precision
+    static const uint8_t floatSizes[1] = { 2 };
+    STR_BUF fb, sb;
+    size_t header, schema, fields, field, type, pos[6], typePos[2];
+    int i, sts;
+
+    if (w->format != EXIF_EXPORT_ARROW) {
+        // header line
+        memset(&sb, 0, sizeof(sb));
+        sb.writer = fileDumpWriter;
+        sb.context = w->fp;
+        for (i = 0; i < w->columnCount; i++) {
+            if (i > 0) {
+                strBufAppend(&sb, (w->format == EXIF_EXPORT_CSV) ? "," : "\t", 1);
+            }
+            columnPutTextField(&sb, w->format, w->columns[i].name, strlen(w->columns[i].name));
+        }
+        strBufAppend(&sb, "\n", 1);
+        strBufFlush(&sb);
+        free(sb.data);
+        return sb.error ? ERR_MEMALLOC : 0;
+    }
+
+    memset(&fb, 0, sizeof(fb));
+    header = arrowMessage(&fb, ARROW_HEADER_SCHEMA, 0);
+    schema = fbTable(&fb, 2, schemaSizes, pos);
+    fbSetOffset(&fb, header, schema);
+    fields = fbVector(&fb, w->columnCount, 4);
+    fbSetOffset(&fb, pos[1], fields);
+    for (i = 0; i < w->columnCount && !fb.error; i++) {
+        field = fbTable(&fb, 6, fieldSizes, pos);
+        fbSetOffset(&fb, fields + 4 + 4 * i, field);
+        fbSetOffset(&fb, pos[0], fbString(&fb, w->columns[i].name));
+        if (w->columns[i].type == ARROW_TYPE_INT) {
+            type = fbTable(&fb, 2, intSizes, typePos);
+            if (!fb.error) {
+                putLE32((uint8_t*)fb.data + typePos[0], 64);
+                fb.data[typePos[1]] = 1;
+            }
+        } else if (w->columns[i].type == ARROW_TYPE_FLOAT) {
+            type = fbTable(&fb, 1, floatSizes, typePos);
+            if (!fb.error) {
+                putLE16((uint8_t*)fb.data + typePos[0], ARROW_PRECISION_DOUBLE);
+            }
+        } else {
+            type = fbTable(&fb, 0, NULL, NULL); // Utf8 has no fields
+        }
+        fbSetOffset(&fb, pos[3], type);
+        fbSetOffset(&fb, pos[5], fbVector(&fb, 0, 4));
+        if (!fb.error) {
+            fb.data[pos[1]] = 1;
+            fb.data[pos[2]] = (char)w->columns[i].type;
+        }
+    }
+    sts = arrowWriteMessage(w, &fb);
+    free(fb.data);
+    return sts;
+}
+
+// write the rows collected so far and empty the column buffers
+static int columnFlushBatch(COLUMN_WRITER *w)
+{
+    // RecordBatch: length, nodes, buffers
+    static const uint8_t batchSizes[3] = { 8, 4, 4 };
+    STR_BUF fb, sb;
+    size_t header, batch, nodes, buffers, pos[3];
+    uint64_t bodyLength = 0;
+    unsigned int r;
+    int i, bufferCount = 0, sts = 0;
+
+    if (w->rows == 0) {
+        return 0;
+    }
+    if (w->format == EXIF_EXPORT_ARROW) {
+        memset(&fb, 0, sizeof(fb));
+        for (i = 0; i < w->columnCount; i++) {
+            bodyLength += (w->columns[i].validity.length + 7) & ~(size_t)7;
+            if (w->columns[i].type == ARROW_TYPE_UTF8) {
+                bodyLength += (w->columns[i].offsets.length + 7) & ~(size_t)7;
+                bufferCount++;
+            }
+            bodyLength += (w->columns[i].data.length + 7) & ~(size_t)7;
+            bufferCount += 2;
+        }
+        header = arrowMessage(&fb, ARROW_HEADER_BATCH, bodyLength);
+        batch = fbTable(&fb, 3, batchSizes, pos);
+        fbSetOffset(&fb, header, batch);
+        nodes = fbVector(&fb, w->columnCount, 16);
+        fbSetOffset(&fb, pos[1], nodes);
+        buffers = fbVector(&fb, bufferCount, 16);
+        fbSetOffset(&fb, pos[2], buffers);
+        if (!fb.error) {
+            uint8_t *p = (uint8_t*)fb.data;
+            uint64_t ofs = 0;
+            size_t lengths[3];
+            int b, n, k = 0;
+            putLE64(p + pos[0], w->rows);
+            for (i = 0; i < w->columnCount; i++) {
+                COLUMN_BUF *col = &w->columns[i];
+                putLE64(p + nodes + 4 + 16 * i, w->rows);
+                putLE64(p + nodes + 12 + 16 * i, col->nullCount);
+                n = 0;
+                lengths[n++] = col->validity.length;
+                if (col->type == ARROW_TYPE_UTF8) {
+                    lengths[n++] = col->offsets.length;
+                }
+                lengths[n++] = col->data.length;
+                for (b = 0; b < n; b++, k++) {
+                    putLE64(p + buffers + 4 + 16 * k, ofs);
+                    putLE64(p + buffers + 12 + 16 * k, lengths[b]);
+                    ofs += (lengths[b] + 7) & ~(size_t)7;
+                }
+            }
+        }
+        sts = arrowWriteMessage(w, &fb);
+        free(fb.data);
+    } else {
+        memset(&sb, 0, sizeof(sb));
+        sb.writer = fileDumpWriter;
+        sb.context = w->fp;
+        for (r = 0; r < w->rows; r++) {
+            for (i = 0; i < w->columnCount; i++) {
+                COLUMN_BUF *col = &w->columns[i];
+                if (i > 0) {
+                    strBufAppend(&sb, (w->format == EXIF_EXPORT_CSV) ? "," : "\t", 1);
+                }
+                if (col->validity.data[r >> 3] & (1 << (r & 7))) {
+                    uint32_t start = getLE32((uint8_t*)col->offsets.data + 4 * r);
+                    uint32_t end = getLE32((uint8_t*)col->offsets.data + 4 * (r + 1));
+                    columnPutTextField(&sb, w->format, col->data.data + start, end - start);
+                }
+            }
+            strBufAppend(&sb, "\n", 1);
+        }
+        strBufFlush(&sb);
+        free(sb.data);
+        sts = sb.error ? ERR_MEMALLOC : (ferror(w->fp) ? ERR_WRITE_FILE : 0);
+    }
+
+    for (i = 0; i < w->columnCount; i++) {
+        COLUMN_BUF *col = &w->columns[i];
+        col->data.length = 0;
+        col->offsets.length = 4;  // keep the first offset 0
+        col->validity.length = 0;
+        col->nullCount = 0;
+    }
+    w->rows = 0;
+    if (sts != 0) {
+        w->error = sts;
+    }
+    return sts;
 }
 
-// create the IFD table
-static void *createIfdTable(IFD_TYPE IfdType, uint16_t tagCount, unsigned int nextOfs)
+// set up the view over the segment data following "Exif\0\0"
+static int tiffInitView(TIFF_VIEW *v, const uint8_t *segment, size_t length)
 {
-    IfdTable *ifd = (IfdTable*)malloc(sizeof(IfdTable));
-    if (!ifd) {
-        return NULL;
+    if (length < 6 + 8 || memcmp(segment, "Exif\0", 5) != 0) {
+        return 0;
     }
-    memset(ifd, 0, sizeof(IfdTable));
-    ifd->ifdType = IfdType;
-    ifd->tagCount = tagCount;
-    ifd->nextIfdOffset = nextOfs;
-    return ifd;
+    return tiffInitHeader(v, segment + 6, length - 6);
 }
 
-// add the TagNode enrtry to the IFD table
-static void *addTagNodeToIfd(void *pIfd,
-                      uint16_t tagId,
-                      uint16_t type,
-                      unsigned int count,
-                      unsigned int *numData,
-                      uint8_t *byteData)
+// set up the view over the data starting with the TIFF header
+static int tiffInitHeader(TIFF_VIEW *v, const uint8_t *tiff, size_t length)
 {
-    int i;
-    IfdTable *ifd = (IfdTable*)pIfd;
-    TagNode *tag;
-    if (!ifd) {
-        return NULL;
+    if (length < 8) {
+        return 0;
     }
-    tag = (TagNode*)malloc(sizeof(TagNode));
-    memset(tag, 0, sizeof(TagNode));
-    tag->tagId = tagId;
-    tag->type = type;
-    tag->count = count;
-
-    if (count > 0) {
-        if (numData != NULL) {
-            int num = count;
-            if (type == TYPE_RATIONAL ||
-                type == TYPE_SRATIONAL) {
-                num *= 2;
-            }
-            tag->numData = (unsigned int*)malloc(sizeof(int)*num);
-            for (i = 0; i < num; i++) {
-                tag->numData[i] = numData[i];
-            }
-        } else if (byteData != NULL) {
-            tag->byteData = (uint8_t*)malloc(count);
-            memcpy(tag->byteData, byteData, count);
-        } else {
-            tag->error = 1;
-        }
+    v->tiff = tiff;
+    v->length = (uint32_t)length;
+    if (v->tiff[0] == 'I' && v->tiff[1] == 'I') {
+        v->bigEndian = 0;
+    } else if (v->tiff[0] == 'M' && v->tiff[1] == 'M') {
+        v->bigEndian = 1;
     } else {
-        tag->error = 1;
+        return 0;
     }
-    
-    // first tag
-    if (!ifd->tags) {
-        ifd->tags = tag;
-    } else {
-        TagNode *tagWk = ifd->tags;
-        while (tagWk->next) {
-            tagWk = tagWk->next;
-        }
-        tagWk->next = tag;
-        tag->prev = tagWk;
+    return tiffGet16(v, v->tiff + 2) == 0x002A;
+}
+
+static uint16_t tiffGet16(const TIFF_VIEW *v, const uint8_t *p)
+{
+    return v->bigEndian ? (uint16_t)((p[0] << 8) | p[1]) : getLE16(p);
+}
+
+static uint32_t tiffGet32(const TIFF_VIEW *v, const uint8_t *p)
+{
+    return v->bigEndian ?
+        ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3] :
+        getLE32(p);
+}
+
+// entries of the IFD at the offset, returns their count or -1 if the
+// IFD does not fit in the segment
+static int tiffGetIfd(const TIFF_VIEW *v, uint32_t offset, const uint8_t **pEntries)
+{
+    uint16_t count;
+    if (offset < 8 || offset > v->length - 2) {
+        return -1;
+    }
+    count = tiffGet16(v, v->tiff + offset);
+    if ((uint64_t)offset + 2 + (uint64_t)count * 12 > v->length) {
+        return -1;
     }
+    *pEntries = v->tiff + offset + 2;
+    return count;
+}
 
-    return tag;
+// value of the IFD entry, NULL if it does not fit in the segment
+static const uint8_t *tiffGetValue(const TIFF_VIEW *v, const uint8_t *entry,
+                                   uint16_t *pType, uint32_t *pCount)
+{
+    static const uint8_t typeSize[11] = { 0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8 };
+    uint16_t type = tiffGet16(v, entry + 2);
+    uint32_t count = tiffGet32(v, entry + 4), offset;
+    uint64_t size;
+
+    if (type == 0 || type > TYPE_SRATIONAL || count == 0) {
+        return NULL;
+    }
+    *pType = type;
+    *pCount = count;
+    size = (uint64_t)count * typeSize[type];
+    if (size <= 4) {
+        return entry + 8;
+    }
+    offset = tiffGet32(v, entry + 8);
+    if (offset + size > v->length) {
+        return NULL;
+    }
+    return v->tiff + offset;
 }
 
-// create a copy of TagNode
-static TagNode *duplicateTagNode(TagNode *src)
+// bytes [pos, pos + length) of the image, read in blocks; NULL if they
+// are out of the image or cannot be read
+static const uint8_t *jpegScanFetch(JPEG_SCAN *scan, int64_t pos, size_t length)
 {
-    TagNode *dup;
-    size_t len;
-    if (!src || src->count <= 0) {
+    int64_t n;
+    if (pos < 0 || length > JPEG_SCAN_BLOCK || pos + (int64_t)length > scan->end) {
         return NULL;
     }
-    dup = (TagNode*)malloc(sizeof(TagNode));
-    memset(dup, 0, sizeof(TagNode));
-    dup->tagId = src->tagId;
-    dup->type = src->type;
-    dup->count = src->count;
-    dup->error = src->error;
-    if (src->numData) {
-        len = sizeof(int) * src->count;
-        if (src->type == TYPE_RATIONAL ||
-            src->type == TYPE_SRATIONAL) {
-            len *= 2;
+    if (pos < scan->start || pos + (int64_t)length > scan->start + (int64_t)scan->length) {
+        n = scan->end - pos;
+        n = ioRead(scan->io, pos, scan->data, (n < JPEG_SCAN_BLOCK) ? (size_t)n : JPEG_SCAN_BLOCK);
+        if (n < (int64_t)length) {
+            scan->length = 0;
+            return NULL;
         }
-        dup->numData = (unsigned int*)malloc(len);
-        memcpy(dup->numData, src->numData, len);
-    } else if (src->byteData) {
-        len = sizeof(char) * src->count;
-        dup->byteData = (uint8_t*)malloc(len);
-        memcpy(dup->byteData, src->byteData, len);
+        scan->start = pos;
+        scan->length = (size_t)n;
     }
-    return dup;
+    return scan->data + (pos - scan->start);
 }
 
-// free TagNode
-static void freeTagNode(void *pTag)
+// chroma subsampling of the frame from the sampling factors
+static int jpegSubsampling(const ExifJpegInfo *info)
 {
-    TagNode *tag = (TagNode*)pTag;
-    if (!tag) {
-        return;
+    int h0, v0, h, v;
+
+    if (info->components == 1) {
+        return EXIF_JPEG_SUBSAMPLING_GRAY;
     }
-    if (tag->numData) {
-        free(tag->numData);
+    if (info->components != 3 || info->sampling[1] != info->sampling[2]) {
+        return EXIF_JPEG_SUBSAMPLING_OTHER;
     }
-    if (tag->byteData) {
-        free(tag->byteData);
+    h0 = info->sampling[0] >> 4;
+    v0 = info->sampling[0] & 0x0F;
+    h = info->sampling[1] >> 4;
+    v = info->sampling[1] & 0x0F;
+    if (h == 0 || v == 0) {
+        return EXIF_JPEG_SUBSAMPLING_UNKNOWN;
     }
-    free(tag);
+    if (h0 == h && v0 == v) {
+        return EXIF_JPEG_SUBSAMPLING_444;
+    }
+    if (h0 == 2 * h && v0 == v) {
+        return EXIF_JPEG_SUBSAMPLING_422;
+    }
+    if (h0 == 2 * h && v0 == 2 * v) {
+        return EXIF_JPEG_SUBSAMPLING_420;
+    }
+    if (h0 == h && v0 == 2 * v) {
+        return EXIF_JPEG_SUBSAMPLING_440;
+    }
+    if (h0 == 4 * h && v0 == v) {
+        return EXIF_JPEG_SUBSAMPLING_411;
+    }
+    return EXIF_JPEG_SUBSAMPLING_OTHER;
 }
 
-// free entire IFD table
-static void freeIfdTable(void *pIfd)
+// walk the segments from the marker at 'pos' to the first SOS marker and
+// record the frame, end < 0 means up to the end of the input; the quality
+// is estimated from the DQT tables only if estimateQuality is set
+// returns 1 if the SOFn segment was found, 0 if the walk ended without it
+static int jpegScanFrame(ExifIO *io, int64_t pos, int64_t end, ExifJpegInfo *info,
+                         int estimateQuality)
 {
-    IfdTable *ifd = (IfdTable*)pIfd;
-    TagNode *tag;
-    if (!ifd) {
-        return;
+    JPEG_SCAN scanBuffer, *scan = &scanBuffer;
+    const uint8_t *p;
+    uint16_t quant[4][64];
+    uint8_t marker;
+    int i, n, len, tq, tc, exact, defined = 0;
+
+    memset(info, 0, sizeof(ExifJpegInfo));
+    if (end < 0) {
+        end = io->size ? io->size(io->context) : -1;
+        if (end < 0) {
+            end = INT64_MAX;
+        }
     }
-    tag = ifd->tags;
-    if (ifd->p) {
-        free(ifd->p);
+    scan->io = io;
+    scan->end = end;
+    scan->start = 0;
+    scan->length = 0;
+    while ((p = jpegScanFetch(scan, pos, 2)) != NULL && p[0] == 0xFF) {
+        marker = p[1];
+        if (marker == 0xFF) {
+            pos++; // fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            pos += 2; // no length
+            continue;
+        }
+        if (marker == 0xD9) {
+            break; // EOI
+        }
+        p = jpegScanFetch(scan, pos + 2, 2);
+        if (!p || (len = (p[0] << 8) | p[1]) < 2) {
+            break;
+        }
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+            marker != 0xC8 && marker != 0xCC && info->sofMarker == 0) {
+            // P, Y, X, Nf and 3 bytes for each component
+            p = jpegScanFetch(scan, pos + 2, 8);
+            if (!p) {
+                break;
+            }
+            n = (p[7] < 4) ? p[7] : 4;
+            if (len < 8 + 3 * n || !(p = jpegScanFetch(scan, pos + 2, 8 + 3 * n))) {
+                break;
+            }
+            info->sofMarker = marker;
+            info->precision = p[2];
+            info->height = (uint16_t)((p[3] << 8) | p[4]);
+            info->width = (uint16_t)((p[5] << 8) | p[6]);
+            info->components = p[7];
+            info->progressive = ((marker & 0x03) == 0x02) ? 1 : 0;
+            info->arithmetic = (marker >= 0xC9) ? 1 : 0;
+            info->sofOffset = pos;
+            for (i = 0; i < n; i++) {
+                info->componentId[i] = p[8 + 3 * i];
+                info->sampling[i] = p[9 + 3 * i];
+                info->quantTable[i] = p[10 + 3 * i] & 0x03;
+            }
+            info->subsampling = (uint8_t)jpegSubsampling(info);
+        } else if (marker == 0xDB && len - 2 <= JPEG_SCAN_BLOCK) {
+            // one or more tables of Pq/Tq and 64 values in zigzag order
+            p = jpegScanFetch(scan, pos + 4, len - 2);
+            if (!p) {
+                break;
+            }
+            for (i = 0; i + 65 <= len - 2; ) {
+                tq = p[i] & 0x03;
+                if ((p[i] >> 4) != 0) {
+                    if (i + 129 > len - 2) {
+                        break;
+                    }
+                    for (n = 0; n < 64 && estimateQuality; n++) {
+                        quant[tq][n] = (uint16_t)((p[i + 1 + 2 * n] << 8) | p[i + 2 + 2 * n]);
+                    }
+                    i += 129;
+                } else {
+                    for (n = 0; n < 64 && estimateQuality; n++) {
+                        quant[tq][n] = p[i + 1 + n];
+                    }
+                    i += 65;
+                }
+                defined |= 1 << tq;
+                info->quantTables++;
+            }
+        } else if (marker == 0xDD && len >= 4) {
+            p = jpegScanFetch(scan, pos + 4, 2);
+            if (!p) {
+                break;
+            }
+            info->restartInterval = (uint16_t)((p[0] << 8) | p[1]);
+        } else if (marker == 0xDA) {
+            p = jpegScanFetch(scan, pos + 4, 1);
+            if (p) {
+                info->scanComponents = p[0];
+                info->sosOffset = pos;
+            }
+            break;
+        }
+        pos += 2 + len;
     }
-    free(ifd);
 
-    if (tag) {
-        while (tag->next) {
-            tag = tag->next;
-        }
-        while (tag) {
-            TagNode *tagWk = tag->prev;
-            freeTagNode(tag);
-            tag = tagWk;
+    // the luminance table and the one of the first chrominance component
+    tq = (info->sofMarker != 0) ? info->quantTable[0] : 0;
+    tc = (info->sofMarker != 0) ? info->quantTable[1] : 1;
+    if (estimateQuality && (defined & (1 << tq))) {
+        info->quality = (uint8_t)jpegEstimateQuality(quant[tq],
+            (info->components != 1 && tc != tq && (defined & (1 << tc))) ? quant[tc] : NULL,
+            &exact);
+        info->qualityExact = (uint8_t)exact;
+    }
+    return (info->sofMarker != 0) ? 1 : 0;
+}
+
+// frame header of the JPEG image in [start, end)
+// returns 1 if found, ERR_INVALID_JPEG if the scan or the image ends first
+static int jpegScanSof(ExifIO *io, int64_t start, int64_t end, JPEG_SOF *sof)
+{
+    ExifJpegInfo info;
+    uint8_t soi[2];
+    int sts;
+
+    if (end - start < 4 || !ioReadFull(io, start, soi, 2) ||
+        soi[0] != 0xFF || soi[1] != 0xD8) {
+        return ERR_INVALID_JPEG;
+    }
+    sts = jpegScanFrame(io, start + 2, end, &info, 0);
+    if (sts != 1) {
+        return (sts < 0) ? sts : ERR_INVALID_JPEG;
+    }
+    sof->marker = info.sofMarker;
+    sof->components = info.components;
+    sof->width = info.width;
+    sof->height = info.height;
+    return 1;
+}
+
+// DC-only decoding of baseline JPEG images for createThumbnailFromJPEGIO()
+
+// zigzag order of the coefficients
+static const uint8_t JpegZigzag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// quantization and Huffman tables of ITU-T T.81 Annex K, natural order
+static const uint8_t JpegStdLuminanceQuant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,  12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,  14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,  24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,  72, 92, 95, 98, 112, 100, 103,  99
+};
+static const uint8_t JpegStdChrominanceQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,  18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,  47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// scale factor of the Annex K tables for an IJG quality of 1-100
+static int jpegQualityScale(int quality)
+{
+    quality = (quality < 1) ? 1 : (quality > 100) ? 100 : quality;
+    return (quality < 50) ? 5000 / quality : 200 - quality * 2;
+}
+
+// value at 'index' (natural order) of a table scaled as by the IJG library,
+// limited to 255 for baseline
+static int jpegScaledQuant(const uint8_t std[64], int index, int scale)
+{
+    long q = ((long)std[index] * scale + 50) / 100;
+    return (q < 1) ? 1 : (q > 255) ? 255 : (int)q;
+}
+
+// sum of the absolute differences between the given tables (zigzag order,
+// chroma may be NULL) and the Annex K tables scaled for an IJG quality
+static long jpegQualityError(const uint16_t *luma, const uint16_t *chroma, int quality)
+{
+    long err = 0;
+    int i, scale = jpegQualityScale(quality);
+
+    for (i = 0; i < 64; i++) {
+        err += labs((long)luma[i] -
+            jpegScaledQuant(JpegStdLuminanceQuant, JpegZigzag[i], scale));
+        if (chroma) {
+            err += labs((long)chroma[i] -
+                jpegScaledQuant(JpegStdChrominanceQuant, JpegZigzag[i], scale));
         }
     }
-    return;
+    return err;
 }
 
-// search the specified tag's node from the IFD table
-static TagNode *getTagNodePtrFromIfd(IfdTable *ifd, uint16_t tagId)
+// IJG quality whose scaled tables are the closest to the given ones by
+// jpegQualityError(), the higher one on a tie. The scale is taken from the
+// ratio of the tables to the Annex K ones, then the quality walks up and
+// down from there while the error keeps decreasing within a few steps.
+#define JPEG_QUALITY_WINDOW 3
+static int jpegEstimateQuality(const uint16_t *luma, const uint16_t *chroma, int *pExact)
 {
-    TagNode *tag;
-    if (!ifd) {
-        return NULL;
+    long err, best, scale, sum = 0, stdSum = 0;
+    int i, q, step, misses, bestQuality;
+
+    // the entries the encoder clamped to 1 or 255 say little of the scale
+    for (i = 0; i < 64; i++) {
+        if (luma[i] > 1 && luma[i] < 255) {
+            sum += luma[i];
+            stdSum += JpegStdLuminanceQuant[JpegZigzag[i]];
+        }
+        if (chroma && chroma[i] > 1 && chroma[i] < 255) {
+            sum += chroma[i];
+            stdSum += JpegStdChrominanceQuant[JpegZigzag[i]];
+        }
     }
-    tag = ifd->tags;
-    while (tag) {
-        if (tag->tagId == tagId) {
-            return tag;
+    if (stdSum > 0) {
+        scale = (sum * 100 + stdSum / 2) / stdSum;
+    } else {
+        scale = (luma[0] <= 1) ? 0 : 5000;
+    }
+    // inverse of jpegQualityScale()
+    q = (scale <= 100) ? (int)((201 - scale) / 2) : (int)((5000 + scale / 2) / scale);
+    bestQuality = (q < 1) ? 1 : (q > 100) ? 100 : q;
+    best = jpegQualityError(luma, chroma, bestQuality);
+
+    for (step = 1; step >= -1; step -= 2) {
+        misses = 0;
+        for (q = bestQuality + step; q >= 1 && q <= 100 && best != 0 &&
+             misses < JPEG_QUALITY_WINDOW; q += step) {
+            err = jpegQualityError(luma, chroma, q);
+            if (err < best || (err == best && q > bestQuality)) {
+                best = err;
+                bestQuality = q;
+                misses = 0;
+            } else {
+                misses++;
+            }
         }
-        tag = tag->next;
     }
-    return NULL;
+    *pExact = (best == 0) ? 1 : 0;
+    return bestQuality;
 }
 
-// remove the TagNode entry from the IFD table
-static int removeTagOnIfd(void *pIfd, uint16_t tagId)
+static const uint8_t JpegStdDcLuminanceBits[16] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0
+};
+static const uint8_t JpegStdDcChrominanceBits[16] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0
+};
+static const uint8_t JpegStdDcValues[12] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11
+};
+static const uint8_t JpegStdAcLuminanceBits[16] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d
+};
+static const uint8_t JpegStdAcLuminanceValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+static const uint8_t JpegStdAcChrominanceBits[16] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77
+};
+static const uint8_t JpegStdAcChrominanceValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+// set up a decoding table from the code lengths and the values
+static int jpegHuffBuild(JPEG_HUFF *h, const uint8_t bits[16], const uint8_t *vals, int count)
 {
-    int num = 0;
-    IfdTable *ifd = (IfdTable*)pIfd;
-    TagNode *tag;
-    if (!ifd) {
+    int len, i, k = 0;
+    int32_t code = 0;
+
+    memset(h, 0, sizeof(JPEG_HUFF));
+    if (count > 256) {
         return 0;
     }
-    for (;;) { // possibility of multiple entries
-        tag = getTagNodePtrFromIfd(ifd, tagId);
-        if (!tag) {
-            break; // no more found
-        }
-        num++;
-        if (tag->prev) {
-            tag->prev->next = tag->next;
-        } else {
-            ifd->tags = tag->next;
+    memcpy(h->vals, vals, count);
+    for (len = 1; len <= 16; len++) {
+        h->valptr[len] = k;
+        h->mincode[len] = code;
+        code += bits[len - 1];
+        k += bits[len - 1];
+        h->maxcode[len] = bits[len - 1] ? code - 1 : -1;
+        if (k > count || (len < 16 && code > (1 << len))) {
+            return 0;
         }
-        if (tag->next) {
-            tag->next->prev = tag->prev;
+        code <<= 1;
+    }
+    // codes of up to 8 bits are looked up at once
+    code = 0;
+    k = 0;
+    for (len = 1; len <= 8; len++) {
+        for (i = 0; i < bits[len - 1]; i++, k++, code++) {
+            int shift = 8 - len, j;
+            for (j = 0; j < (1 << shift); j++) {
+                h->fastLen[(code << shift) | j] = (uint8_t)len;
+                h->fastVal[(code << shift) | j] = h->vals[k];
+            }
         }
-        freeTagNode(tag);
-        ifd->tagCount--;
+        code <<= 1;
     }
-    return num;
+    h->defined = 1;
+    return 1;
 }
 
-// get the IFD table address of the specified type
-static IfdTable *getIfdTableFromIfdTableArray(void **ifdTableArray, IFD_TYPE ifdType)
+// next byte of the entropy-coded data, -1 at the end of the data
+static int jpegBitsByte(JPEG_BITS *b)
 {
-    int i;
-    if (!ifdTableArray) {
-        return NULL;
+    int64_t n;
+    if (b->bufPos == b->bufLength) {
+        n = ioRead(b->io, b->pos, b->buf, sizeof(b->buf));
+        if (n <= 0) {
+            return -1;
+        }
+        b->pos += n;
+        b->bufPos = 0;
+        b->bufLength = (size_t)n;
     }
-    for (i = 0; ifdTableArray[i] != NULL; i++) {
-        IfdTable *ifd = ifdTableArray[i];
-        if (ifd->ifdType == ifdType) {
-            return ifd;
+    return b->buf[b->bufPos++];
+}
+
+// keep at least 25 bits in the accumulator; zeros are fed after a marker
+static void jpegBitsFill(JPEG_BITS *b)
+{
+    int c, c2;
+    while (b->count <= 24) {
+        c = 0;
+        if (!b->marker) {
+            c = jpegBitsByte(b);
+            if (c < 0) {
+                b->marker = JPEG_END_OF_DATA;
+                c = 0;
+            } else if (c == 0xFF) {
+                do {
+                    c2 = jpegBitsByte(b);
+                } while (c2 == 0xFF);
+                if (c2 != 0) {
+                    b->marker = (c2 < 0) ? JPEG_END_OF_DATA : c2;
+                    c = 0;
+                }
+            }
         }
+        b->acc |= (uint32_t)c << (24 - b->count);
+        b->count += 8;
+    }
+}
+
+static int jpegBitsGet(JPEG_BITS *b, int n)
+{
+    int v;
+    if (n == 0) {
+        return 0;
     }
-    return NULL;
+    jpegBitsFill(b);
+    v = (int)(b->acc >> (32 - n));
+    b->acc <<= n;
+    b->count -= n;
+    return v;
 }
 
-// count IFD tables
-static int countIfdTableOnIfdTableArray(void **ifdTableArray)
+// decode one Huffman symbol, -1 if the code is invalid
+static int jpegBitsDecode(JPEG_BITS *b, const JPEG_HUFF *h)
 {
-    int i, num = 0;
-    for (i = 0; ifdTableArray[i] != NULL; i++) {
-        num++;
+    int len, look;
+    int32_t code;
+
+    jpegBitsFill(b);
+    look = (int)(b->acc >> 24);
+    if (h->fastLen[look]) {
+        len = h->fastLen[look];
+        b->acc <<= len;
+        b->count -= len;
+        return h->fastVal[look];
+    }
+    for (len = 9; len <= 16; len++) {
+        code = (int32_t)(b->acc >> (32 - len));
+        if (code <= h->maxcode[len]) {
+            b->acc <<= len;
+            b->count -= len;
+            return h->vals[(h->valptr[len] + code - h->mincode[len]) & 0xFF];
+        }
     }
-    return num;
+    return -1;
 }
 
-// set single numeric value to the existing TagNode entry
-static int setSingleNumDataToTag(TagNode *tag, unsigned int value)
+// value of 's' bits with the sign extension of F.2.2.1
+static int jpegBitsExtend(JPEG_BITS *b, int s)
 {
-    if (!tag) {
-        return 0;
-    }
-    if (tag->type != TYPE_BYTE   &&
-        tag->type != TYPE_SHORT  &&
-        tag->type != TYPE_LONG   &&
-        tag->type != TYPE_SBYTE  &&
-        tag->type != TYPE_SSHORT &&
-        tag->type != TYPE_SLONG) {
-        return 0;
+    int v = jpegBitsGet(b, s);
+    if (s > 0 && v < (1 << (s - 1))) {
+        v -= (1 << s) - 1;
     }
-    if (!tag->numData) {
-        tag->numData = (unsigned int*)malloc(sizeof(int));
-    }
-    tag->count = 1;
-    tag->numData[0] = value;
-    tag->error = 0;
-    return 1;
+    return v;
 }
 
-/**
- * write the Exif segment to the file
- *
- * parameters
- *  [in] fp: the output file pointer
- *  [in] ifdTableArray: address of the IFD tables array
- *
- * return
- *  0: OK
- *  ERR_WRITE_FILE
- */
-static int writeExifSegment(FILE *fp, void **ifdTableArray)
+// skip to the data following the next restart marker
+static void jpegBitsRestart(JPEG_BITS *b)
 {
-#define IFDMAX 5
-
-    union _packed {
-        unsigned int ui;
-        uint16_t us[2];
-        uint8_t uc[4];
-    };
-
-    IfdTable *ifds[IFDMAX], *ifd0th;
-    TagNode *tag;
-    IFD_TAG tagField;
-    uint16_t num, us;
-    unsigned int ui;
-    int zero = 0;
-    int i, x;
-    unsigned int ofs;
-    union _packed packed;
-    APP_HEADER dupApp1Header = App1Header;
+    int c;
+    b->acc = 0;
+    b->count = 0;
+    while (!(b->marker >= 0xD0 && b->marker <= 0xD7)) {
+        if (b->marker) {
+            return; // another marker, the rest of the image is missing
+        }
+        c = jpegBitsByte(b);
+        if (c < 0) {
+            b->marker = JPEG_END_OF_DATA;
+        } else if (c == 0xFF) {
+            do {
+                c = jpegBitsByte(b);
+            } while (c == 0xFF);
+            b->marker = (c < 0) ? JPEG_END_OF_DATA : c;
+        }
+    }
+    b->marker = 0;
+}
 
-    ifds[0] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_0TH);
-    ifds[1] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_EXIF);
-    ifds[2] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_IO);
-    ifds[3] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_GPS);
-    ifds[4] = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
-    ifd0th = ifds[0];
+// read the tables and the frame header up to SOS, fill the decoder
+static int jpegDecodeHeaders(JPEG_DECODER *d)
+{
+    uint8_t hdr[4], *seg = NULL;
+    uint32_t len;
+    int64_t pos = 2;
+    int i, j, k, n, sts = ERR_INVALID_JPEG;
 
-    // return if 0th IFD is not exist
-    if (!ifd0th) {
-        return 0;
-    }
-    // get total length of the segment
-    us = sizeof(APP_HEADER) - sizeof(short);
-    for (x = 0; x < IFDMAX; x++) {
-        if (ifds[x]) {
-            us = us + ifds[x]->length;
-        }
+    if (!ioReadFull(d->io, 0, hdr, 2)) {
+        return ERR_READ_FILE;
     }
-    // segment length must be written in big-endian
-    if (systemIsLittleEndian()) {
-        us = swab16(us);
+    if (hdr[0] != 0xFF || hdr[1] != 0xD8) {
+        return ERR_INVALID_JPEG;
     }
-    dupApp1Header.length = us;
-    dupApp1Header.tiff.reserved = fix_short(dupApp1Header.tiff.reserved);
-    dupApp1Header.tiff.Ifd0thOffset = fix_int(dupApp1Header.tiff.Ifd0thOffset);
-    // write Exif segment Header
-    if (fwrite(&dupApp1Header, 1, sizeof(APP_HEADER), fp) != sizeof(APP_HEADER)) {
-        return ERR_WRITE_FILE;
+    seg = (uint8_t*)malloc(65536);
+    if (!seg) {
+        return ERR_MEMALLOC;
     }
-
-    // base offset of the Exif segment
-    ofs = sizeof(TIFF_HEADER);
-    for (x = 0; x < IFDMAX; x++) {
-        IfdTable *ifd = ifds[x];
-        if (ifd == NULL) {
+    for (;;) {
+        if (!ioReadFull(d->io, pos, hdr, 2) || hdr[0] != 0xFF) {
+            goto DONE;
+        }
+        if (hdr[1] == 0xFF) {
+            pos++;
             continue;
         }
-        // calculate the start offset to write the tag's data of this IFD
-        ofs += sizeof(short) + // sizeof the tag number area
-               sizeof(IFD_TAG) * ifd->tagCount + // sizeof the tag fields
-               sizeof(int);    // sizeof the NextOffset area
-
-        // write actual tag number of the current IFD
-        num = 0;
-        tag = ifd->tags;
-        while (tag) {
-            if (!tag->error) {
-                num++;
-            }
-            tag = tag->next;
+        if (hdr[1] == 0xD8 || hdr[1] == 0xD9 || (hdr[1] >= 0xD0 && hdr[1] <= 0xD7)) {
+            goto DONE;
         }
-        us = fix_short(num);
-        if (fwrite(&us, 1, sizeof(short), fp) != sizeof(short)) {
-            return ERR_WRITE_FILE;
+        if (!ioReadFull(d->io, pos + 2, hdr + 2, 2)) {
+            goto DONE;
         }
-
-        // write the each tag fields
-        tag = ifd->tags;
-        while (tag) {
-            if (tag->error) {
-                tag = tag->next; // ignore
-                continue;
-            }
-            tagField.tag = fix_short(tag->tagId);
-            tagField.type = fix_short(tag->type);
-            tagField.count = fix_int(tag->count);
-            packed.ui = 0;
-
-            switch (tag->type) {
-            case TYPE_ASCII:
-            case TYPE_UNDEFINED:
-                if (tag->count <= 4) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        packed.uc[i] = tag->byteData[i];
-                    }
-                } else {
-                    packed.ui = fix_int(ofs);
-                    ofs += tag->count;
-                    if (tag->count % 2 != 0) {
-                        ofs++;
-                    }
+        len = (uint32_t)((hdr[2] << 8) | hdr[3]);
+        if (len < 2) {
+            goto DONE;
+        }
+        len -= 2;
+        // the application segments are skipped without reading them
+        if ((hdr[1] >= 0xE0 && hdr[1] <= 0xEF) || hdr[1] == 0xFE) {
+            pos += 4 + len;
+            continue;
+        }
+        if (!ioReadFull(d->io, pos + 4, seg, len)) {
+            sts = ERR_READ_FILE;
+            goto DONE;
+        }
+        pos += 4 + len;
+
+        switch (hdr[1]) {
+        case 0xDB: // DQT, only the DC value is used
+            for (i = 0; i < (int)len; ) {
+                int precision = seg[i] >> 4, id = seg[i] & 3;
+                if (i + 1 + 64 * (precision + 1) > (int)len) {
+                    goto DONE;
                 }
-                break;
-            case TYPE_BYTE:
-            case TYPE_SBYTE:
-                if (tag->count <= 4) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        packed.uc[i] = (uint8_t)tag->numData[i];
-                    }
-                } else {
-                    packed.ui = fix_int(ofs);
-                    ofs += tag->count;
-                    if (tag->count % 2 != 0) {
-                        ofs++;
-                    }
+                d->dcQuant[id] = precision ? (seg[i + 1] << 8) | seg[i + 2] : seg[i + 1];
+                i += 1 + 64 * (precision + 1);
+            }
+            break;
+        case 0xC4: // DHT
+            for (i = 0; i < (int)len; ) {
+                int cls = seg[i] >> 4, id = seg[i] & 3;
+                if (i + 17 > (int)len || cls > 1) {
+                    goto DONE;
                 }
-                break;
-            case TYPE_SHORT:
-            case TYPE_SSHORT:
-                if (tag->count <= 2) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        packed.us[i] = fix_short((uint16_t)tag->numData[i]);
-                    }
-                } else {
-                    packed.ui = fix_int(ofs);
-                    ofs += tag->count * sizeof(short);
+                for (n = 0, j = 0; j < 16; j++) {
+                    n += seg[i + 1 + j];
                 }
-                break;
-            case TYPE_LONG:
-            case TYPE_SLONG:
-                if (tag->count <= 1) {
-                    packed.ui = fix_int((unsigned int)tag->numData[0]);
-                } else {
-                    packed.ui = fix_int(ofs);
-                    ofs += tag->count * sizeof(short);
+                if (i + 17 + n > (int)len ||
+                    !jpegHuffBuild(cls ? &d->ac[id] : &d->dc[id], seg + i + 1, seg + i + 17, n)) {
+                    goto DONE;
                 }
-                break;
-            case TYPE_RATIONAL:
-            case TYPE_SRATIONAL:
-                packed.ui = fix_int(ofs);
-                ofs += tag->count * sizeof(int) * 2;
-                break;
+                i += 17 + n;
             }
-            tagField.offset = packed.ui;
-            if (fwrite(&tagField, 1, sizeof(tagField), fp) != sizeof(tagField)) {
-                return ERR_WRITE_FILE;
+            break;
+        case 0xDD: // DRI
+            if (len < 2) {
+                goto DONE;
             }
-            tag = tag->next;
-        }
-        ui = fix_int(ifd->nextIfdOffset);
-        if (fwrite(&ui, 1, sizeof(int), fp) != sizeof(int)) {
-            return ERR_WRITE_FILE;
-        }
-
-        // write the tag values over 4 bytes 
-        tag = ifd->tags;
-        while (tag) {
-            if (tag->error) {
-                tag = tag->next;
-                continue;
+            d->restartInterval = (seg[0] << 8) | seg[1];
+            break;
+        case 0xC0: // baseline
+        case 0xC1: // extended sequential, Huffman
+            if (len < 6 || seg[0] != 8) {
+                sts = ERR_UNSUPPORTED_JPEG;
+                goto DONE;
             }
-            switch (tag->type) {
-            case TYPE_ASCII:
-            case TYPE_UNDEFINED:
-                if (tag->count > 4) {
-                    if (fwrite(tag->byteData, 1, tag->count, fp) != tag->count) {
-                        return ERR_WRITE_FILE;
-                    }
-                    if (tag->count % 2 != 0) { // for even boundary
-                        if (fwrite(&zero, 1, sizeof(char), fp) != sizeof(char)) {
-                            return ERR_WRITE_FILE;
-                        }
-                    }
-                }
-                break;
-            case TYPE_BYTE:
-            case TYPE_SBYTE:
-                if (tag->count > 4) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        uint8_t n = (uint8_t)tag->numData[i];
-                        if (fwrite(&n, 1, sizeof(char), fp) != sizeof(char)) {
-                            return ERR_WRITE_FILE;
-                        }
-
-                    }
-                    if (tag->count % 2 != 0) {
-                        if (fwrite(&zero, 1, sizeof(char), fp) != sizeof(char)) {
-                            return ERR_WRITE_FILE;
-                        }
-                    }
-                }
-                break;
-            case TYPE_SHORT:
-            case TYPE_SSHORT:
-                if (tag->count > 2) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        uint16_t n = fix_short((uint16_t)tag->numData[i]);
-                        if (fwrite(&n, 1, sizeof(short), fp) != sizeof(short)) {
-                            return ERR_WRITE_FILE;
-                        }
-                    }
-                }
-                break;
-            case TYPE_LONG:
-            case TYPE_SLONG:
-                if (tag->count > 1) {
-                    for (i = 0; i < (int)tag->count; i++) {
-                        unsigned int n = fix_int((unsigned int)tag->numData[i]);
-                        if (fwrite(&n, 1, sizeof(int), fp) != sizeof(int)) {
-                            return ERR_WRITE_FILE;
-                        }
-                    }
-                }
-                break;
-            case TYPE_RATIONAL:
-            case TYPE_SRATIONAL:
-                for (i = 0; i < (int)tag->count*2; i++) {
-                    unsigned int n = fix_int((unsigned int)tag->numData[i]);
-                    if (fwrite(&n, 1, sizeof(int), fp) != sizeof(int)) {
-                        return ERR_WRITE_FILE;
-                    }
+            d->height = (seg[1] << 8) | seg[2];
+            d->width = (seg[3] << 8) | seg[4];
+            d->componentCount = seg[5];
+            if ((d->componentCount != 1 && d->componentCount != 3) ||
+                len < 6 + 3 * (uint32_t)d->componentCount) {
+                sts = ERR_UNSUPPORTED_JPEG;
+                goto DONE;
+            }
+            if (d->width == 0 || d->height == 0) {
+                goto DONE;
+            }
+            d->maxH = d->maxV = 1;
+            for (i = 0; i < d->componentCount; i++) {
+                JPEG_COMPONENT *c = &d->components[i];
+                c->id = seg[6 + i * 3];
+                c->h = seg[7 + i * 3] >> 4;
+                c->v = seg[7 + i * 3] & 15;
+                c->tq = seg[8 + i * 3] & 3;
+                if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4) {
+                    goto DONE;
                 }
-                break;
+                d->maxH = (c->h > d->maxH) ? c->h : d->maxH;
+                d->maxV = (c->v > d->maxV) ? c->v : d->maxV;
             }
-            tag = tag->next;
-        }
-        // write the thumbnail data in the 1st IFD
-        if (ifd->ifdType == IFD_1ST && ifd->p != NULL) {
-            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
-            if (tag) {
-                if (tag->numData[0] > 0) {
-                    if (fwrite(ifd->p, 1, tag->numData[0], fp) != tag->numData[0]) {
-                        return ERR_WRITE_FILE;
+            break;
+        case 0xDA: // SOS
+            if (d->componentCount == 0 || len < 1 || seg[0] != d->componentCount ||
+                len < 1 + 2 * (uint32_t)seg[0]) {
+                // progressive or split into several scans
+                sts = (d->componentCount == 0) ? ERR_INVALID_JPEG : ERR_UNSUPPORTED_JPEG;
+                goto DONE;
+            }
+            for (i = 0; i < seg[0]; i++) {
+                for (k = 0; k < d->componentCount; k++) {
+                    if (d->components[k].id == seg[1 + i * 2]) {
+                        break;
                     }
                 }
+                if (k != i) {
+                    sts = ERR_UNSUPPORTED_JPEG;
+                    goto DONE;
+                }
+                d->components[i].td = seg[2 + i * 2] >> 4 & 3;
+                d->components[i].ta = seg[2 + i * 2] & 3;
+                if (!d->dc[d->components[i].td].defined || !d->ac[d->components[i].ta].defined) {
+                    goto DONE;
+                }
             }
+            d->scanOffset = pos;
+            sts = 0;
+            goto DONE;
+        default:
+            if (hdr[1] >= 0xC2 && hdr[1] <= 0xCF && hdr[1] != 0xC8 && hdr[1] != 0xCC) {
+                // progressive, lossless or arithmetic coding
+                sts = ERR_UNSUPPORTED_JPEG;
+                goto DONE;
+            }
+            break;
         }
     }
-    return 0;
+DONE:
+    free(seg);
+    return sts;
 }
 
-// calculate the actual length of the IFD
-static uint16_t calcIfdSize(void *pIfd)
+// decode the scan keeping only the DC value of each block, as the
+// average of its 8x8 pixels
+static int jpegDecodeDc(JPEG_DECODER *d)
 {
-    unsigned int size, num = 0;
-    TagNode *tag;
-    IfdTable *ifd = (IfdTable*)pIfd;
-    if (!ifd) {
-        return 0;
-    }
-    // count the actual tag number
-    tag = ifd->tags;
-    while (tag) {
-        if (!tag->error) {
-            num++;
+    JPEG_BITS *b;
+    int pred[4] = { 0, 0, 0, 0 };
+    int mcusX, mcusY, mx, my, i, h, v, k, s, rs, restarts = 0, sts = 0;
+
+    if (d->componentCount == 1) {
+        // a single component is not interleaved, one block per MCU
+        d->maxH = d->maxV = d->components[0].h = d->components[0].v = 1;
+    }
+    mcusX = (d->width + 8 * d->maxH - 1) / (8 * d->maxH);
+    mcusY = (d->height + 8 * d->maxV - 1) / (8 * d->maxV);
+    for (i = 0; i < d->componentCount; i++) {
+        JPEG_COMPONENT *c = &d->components[i];
+        c->blocksX = mcusX * c->h;
+        c->blocksY = mcusY * c->v;
+        c->dc = (uint8_t*)malloc((size_t)c->blocksX * c->blocksY);
+        if (!c->dc) {
+            return ERR_MEMALLOC;
         }
-        tag = tag->next;
     }
+    b = (JPEG_BITS*)calloc(1, sizeof(JPEG_BITS));
+    if (!b) {
+        return ERR_MEMALLOC;
+    }
+    b->io = d->io;
+    b->pos = d->scanOffset;
 
-    size = sizeof(short) + // sizeof the tag number area
-           sizeof(IFD_TAG) * num + // sizeof tag fields
-           sizeof(int); // sizeof the NextOffset area
-
-    // add thumbnail data length
-    if (ifd->ifdType == IFD_1ST) {
-        if (ifd->p) {
-            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
-            if (tag) {
-                size += tag->numData[0];
+    for (my = 0; my < mcusY && sts == 0; my++) {
+        for (mx = 0; mx < mcusX && sts == 0; mx++) {
+            if (d->restartInterval > 0 && restarts == d->restartInterval) {
+                jpegBitsRestart(b);
+                memset(pred, 0, sizeof(pred));
+                restarts = 0;
             }
-        }
-    }
-    tag = ifd->tags;
-    while (tag) {
-        if (tag->error) {
-            // ignore
-            tag = tag->next;
-            continue;
-        }
-        switch (tag->type) {
-        case TYPE_ASCII:
-        case TYPE_UNDEFINED:
-        case TYPE_BYTE:
-        case TYPE_SBYTE:
-            if (tag->count > 4) {
-                size += tag->count;
-                if (tag->count % 2 != 0) {
-                    // padding for even byte boundary
-                    size += 1;
+            restarts++;
+            for (i = 0; i < d->componentCount && sts == 0; i++) {
+                JPEG_COMPONENT *c = &d->components[i];
+                for (v = 0; v < c->v && sts == 0; v++) {
+                    for (h = 0; h < c->h; h++) {
+                        int value;
+                        s = jpegBitsDecode(b, &d->dc[c->td]);
+                        if (s < 0 || s > 11) {
+                            sts = ERR_INVALID_JPEG;
+                            break;
+                        }
+                        pred[i] += jpegBitsExtend(b, s);
+                        // skip the AC coefficients
+                        for (k = 1; k < 64; k++) {
+                            rs = jpegBitsDecode(b, &d->ac[c->ta]);
+                            if (rs < 0) {
+                                sts = ERR_INVALID_JPEG;
+                                break;
+                            }
+                            if ((rs & 15) == 0) {
+                                if (rs != 0xF0) {
+                                    break; // end of block
+                                }
+                                k += 15;
+                            } else {
+                                k += rs >> 4;
+                                jpegBitsGet(b, rs & 15);
+                            }
+                        }
+                        value = pred[i] * d->dcQuant[c->tq] / 8 + 128;
+                        c->dc[(size_t)(my * c->v + v) * c->blocksX + mx * c->h + h] =
+                            (uint8_t)((value < 0) ? 0 : (value > 255) ? 255 : value);
+                    }
                 }
             }
-            break;
-        case TYPE_SHORT:
-        case TYPE_SSHORT:
-            if (tag->count > 2) {
-                size += tag->count * sizeof(short);
+            if (b->marker == JPEG_END_OF_DATA && my < mcusY - 1 && sts == 0) {
+                sts = ERR_INVALID_JPEG; // truncated
             }
-            break;
-        case TYPE_LONG:
-        case TYPE_SLONG:
-            if (tag->count > 1) {
-                size += tag->count * sizeof(int);
+        }
+    }
+    free(b);
+    return sts;
+}
+
+// 1/8 scale image resampled to width x height by averaging, one plane
+// per component at full resolution
+static void jpegResample(const JPEG_DECODER *d, int comp, uint8_t *out,
+                         int width, int height)
+{
+    const JPEG_COMPONENT *c = &d->components[comp];
+    int srcW = (d->width + 7) / 8, srcH = (d->height + 7) / 8;
+    int x, y, sx, sy, sx0, sx1, sy0, sy1;
+
+    for (y = 0; y < height; y++) {
+        sy0 = y * srcH / height;
+        sy1 = (y + 1) * srcH / height;
+        if (sy1 <= sy0) {
+            sy1 = sy0 + 1;
+        }
+        for (x = 0; x < width; x++) {
+            uint32_t sum = 0, n = 0;
+            sx0 = x * srcW / width;
+            sx1 = (x + 1) * srcW / width;
+            if (sx1 <= sx0) {
+                sx1 = sx0 + 1;
             }
-            break;
-        case TYPE_RATIONAL:
-        case TYPE_SRATIONAL:
-            if (tag->count > 0) {
-                size += tag->count * sizeof(int) * 2;
+            for (sy = sy0; sy < sy1; sy++) {
+                // subsampled planes are read at their own resolution
+                int by = sy * c->v / d->maxV;
+                for (sx = sx0; sx < sx1; sx++) {
+                    int bx = sx * c->h / d->maxH;
+                    sum += c->dc[(size_t)by * c->blocksX + bx];
+                    n++;
+                }
             }
-            break;
+            out[y * width + x] = (uint8_t)((sum + n / 2) / n);
         }
-        tag = tag->next;
     }
-    return (uint16_t)size;
 }
 
-/**
- * refresh the length and offset variables in the IFD tables
- *
- * parameters
- *  [in/out] ifdTableArray: address of the IFD tables array
- *
- * return
- *  0: OK
- *  ERR_INVALID_POINTER
- *  ERROR_UNKNOWN
- */
-static int fixLengthAndOffsetInIfdTables(void **ifdTableArray)
+// baseline encoder of createThumbnailFromJPEGIO()
+
+static void jpegEncodeFlushBytes(JPEG_ENCODER *e)
 {
-    int i;
-    TagNode *tag, *tagwk;
-    uint16_t num;
-    uint16_t ofsBase = sizeof(TIFF_HEADER);
-    unsigned int len, dummy = 0, again = 0;
-    IfdTable *ifd0th, *ifdExif, *ifdIo, *ifdGps, *ifd1st; 
-    if (!ifdTableArray) {
-        return ERR_INVALID_POINTER;
+    if (e->length > 0 && !ioWriteFull(&e->out, e->buf, e->length)) {
+        e->error = 1;
     }
+    e->length = 0;
+}
 
-AGAIN:
-    // calculate the length of the each IFD tables.
-    for (i = 0; ifdTableArray[i] != NULL; i++) {
-        IfdTable *ifd = ifdTableArray[i];
-        // count the actual tag number
-        tag = ifd->tags;
-        num = 0;
-        while (tag) {
-            // ignore and dispose the error tag
-            if (tag->error) {
-                tagwk = tag->next;
-                if (tag->prev) {
-                    tag->prev->next = tag->next;
-                } else {
-                    ifd->tags = tag->next;
-                }
-                if (tag->next) {
-                    tag->next->prev = tag->prev;
-                }
-                freeTagNode(tag);
-                tag = tagwk;
-                continue;
-            }
-            num++;
-            tag = tag->next;
+static void jpegEncodeByte(JPEG_ENCODER *e, uint8_t c)
+{
+    if (e->length == sizeof(e->buf)) {
+        jpegEncodeFlushBytes(e);
+    }
+    e->buf[e->length++] = c;
+}
+
+static void jpegEncodeBits(JPEG_ENCODER *e, uint32_t code, int size)
+{
+    e->acc |= (code & ((1u << size) - 1)) << (24 - size - e->count);
+    e->count += size;
+    while (e->count >= 8) {
+        uint8_t c = (uint8_t)(e->acc >> 16);
+        jpegEncodeByte(e, c);
+        if (c == 0xFF) {
+            jpegEncodeByte(e, 0); // byte stuffing
         }
-        ifd->tagCount = num;
-        ifd->length = calcIfdSize(ifd);
-        ifd->nextIfdOffset = 0;
+        e->acc <<= 8;
+        e->acc &= 0xFFFFFF;
+        e->count -= 8;
     }
-    ifd0th  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_0TH);
-    ifdExif = getIfdTableFromIfdTableArray(ifdTableArray, IFD_EXIF);
-    ifdIo   = getIfdTableFromIfdTableArray(ifdTableArray, IFD_IO);
-    ifdGps  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_GPS);
-    ifd1st  = getIfdTableFromIfdTableArray(ifdTableArray, IFD_1ST);
+}
 
-    if (!ifd0th) {
-        return 0; // not error
+// code and size of each symbol from the code lengths, C.2
+static void jpegEncodeHuffBuild(JPEG_EHUFF *h, const uint8_t bits[16], const uint8_t *vals)
+{
+    int len, i, k = 0;
+    uint16_t code = 0;
+
+    memset(h, 0, sizeof(JPEG_EHUFF));
+    for (len = 1; len <= 16; len++) {
+        for (i = 0; i < bits[len - 1]; i++, k++) {
+            h->code[vals[k]] = code++;
+            h->size[vals[k]] = (uint8_t)len;
+        }
+        code <<= 1;
     }
-    ifd0th->offset = ofsBase;
+}
 
-    // set "NextOffset" variable in the 0th IFD if the 1st IFD is exist
-    if (ifd1st) {
-        ifd0th->nextIfdOffset =
-                ofsBase +
-                ifd0th->length + 
-                ((ifdExif)? ifdExif->length : 0) +
-                ((ifdIo)? ifdIo->length : 0) +
-                ((ifdGps)? ifdGps->length : 0);
-        ifd1st->offset = (uint16_t)ifd0th->nextIfdOffset;
+static void jpegEncodeSegment(JPEG_ENCODER *e, uint8_t marker, const uint8_t *data, int length)
+{
+    int i;
+    jpegEncodeByte(e, 0xFF);
+    jpegEncodeByte(e, marker);
+    jpegEncodeByte(e, (uint8_t)((length + 2) >> 8));
+    jpegEncodeByte(e, (uint8_t)(length + 2));
+    for (i = 0; i < length; i++) {
+        jpegEncodeByte(e, data[i]);
+    }
+}
 
-        // set the offset value of the thumbnail data
-        if (ifd1st->p) {
-            tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormatLength);
-            if (tag) {
-                len = tag->numData[0]; // thumbnail length;
-                tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormat);
-                if (tag) {
-                    // set the offset value
-                    setSingleNumDataToTag(tag, ifd1st->offset + ifd1st->length - len);
-                } else {
-                    // create the JPEGInterchangeFormat tag if not exist
-                    if (!addTagNodeToIfd(ifd1st, TAG_JPEGInterchangeFormat, 
-                        TYPE_LONG, 1, &dummy, NULL)) {
-                        return ERR_UNKNOWN;
-                    }
-                    again = 1;
-                }
-            } else {
-                tag = getTagNodePtrFromIfd(ifd1st, TAG_JPEGInterchangeFormat);
-                if (tag) {
-                    setSingleNumDataToTag(tag, 0);
-                }
-            }
+static void jpegEncodeDht(JPEG_ENCODER *e, uint8_t tableClass, const uint8_t bits[16],
+                          const uint8_t *vals, int count)
+{
+    uint8_t seg[17 + 162];
+    seg[0] = tableClass;
+    memcpy(seg + 1, bits, 16);
+    memcpy(seg + 17, vals, count);
+    jpegEncodeSegment(e, 0xC4, seg, 17 + count);
+}
+
+// forward DCT, quantization and Huffman coding of one 8x8 block
+static void jpegEncodeBlock(JPEG_ENCODER *e, const uint8_t *pixels, int stride,
+                            const uint16_t *quant, int *pred,
+                            const JPEG_EHUFF *dc, const JPEG_EHUFF *ac)
+{
+    // cos(k * pi / 16)
+    static const double cosK[9] = {
+        1.0, 0.98078528040323043, 0.92387953251128674, 0.83146961230254524,
+        0.70710678118654752, 0.55557023301960218, 0.38268343236508977,
+        0.19509032201612826, 0.0
+    };
+    double cosTable[8][8], tmp[64], sum, q;
+    int coef[64], x, y, u, v, k, m, run, value, mag, size;
+
+    // cos((2x + 1) * u * pi / 16) with the normalization of the DCT
+    for (x = 0; x < 8; x++) {
+        for (u = 0; u < 8; u++) {
+            m = ((2 * x + 1) * u) % 32;
+            m = (m > 16) ? 32 - m : m;
+            cosTable[x][u] = ((m > 8) ? -cosK[16 - m] : cosK[m]) *
+                             ((u == 0) ? 0.35355339059327373 : 0.5);
         }
-    } else {
-        ifd0th->nextIfdOffset = 0; // 1st IFD is not exist
     }
-
-    // set "ExifIFDPointer" tag value in the 0th IFD if the Exif IFD is exist
-    if (ifdExif) {
-        tag = getTagNodePtrFromIfd(ifd0th, TAG_ExifIFDPointer);
-        if (tag) {
-            setSingleNumDataToTag(tag, ofsBase + ifd0th->length);
-            ifdExif->offset = (uint16_t)tag->numData[0];
-        } else {
-            // create the tag if not exist
-            if (!addTagNodeToIfd(ifd0th, TAG_ExifIFDPointer, TYPE_LONG, 1,
-                                    &dummy, NULL)) {
-                return ERR_UNKNOWN;
+    // rows, then columns
+    for (y = 0; y < 8; y++) {
+        for (u = 0; u < 8; u++) {
+            sum = 0;
+            for (x = 0; x < 8; x++) {
+                sum += (pixels[y * stride + x] - 128) * cosTable[x][u];
             }
-            again = 1;
+            tmp[y * 8 + u] = sum;
         }
-        // set "InteroperabilityIFDPointer" tag value in the Exif IFD
-        // if the Interoperability IFD is exist
-        if (ifdIo) {
-            tag = getTagNodePtrFromIfd(ifdExif, TAG_InteroperabilityIFDPointer);
-            if (tag) {
-                setSingleNumDataToTag(tag, ofsBase + ifd0th->length + ifdExif->length);
-                ifdIo->offset = (uint16_t)tag->numData[0];
-            } else {
-                // create the tag if not exist
-                if (!addTagNodeToIfd(ifdExif, TAG_InteroperabilityIFDPointer,
-                                        TYPE_LONG, 1, &dummy, NULL)) {
-                    return ERR_UNKNOWN;
-                }
-                again = 1;
-            }
-        } else {
-            tag = getTagNodePtrFromIfd(ifdExif, TAG_InteroperabilityIFDPointer);
-            if (tag) {
-                setSingleNumDataToTag(tag, 0);
+    }
+    for (u = 0; u < 8; u++) {
+        for (v = 0; v < 8; v++) {
+            sum = 0;
+            for (y = 0; y < 8; y++) {
+                sum += tmp[y * 8 + u] * cosTable[y][v];
             }
-        }
-    } else { // Exif 
-        tag = getTagNodePtrFromIfd(ifd0th, TAG_ExifIFDPointer);
-        if (tag) {
-            setSingleNumDataToTag(tag, 0);
+            q = sum / quant[v * 8 + u];
+            coef[v * 8 + u] = (int)((q < 0) ? q - 0.5 : q + 0.5);
         }
     }
 
-    // set "GPSInfoIFDPointer" tag value in the 0th IFD if the GPS IFD is exist
-    if (ifdGps) {
-        tag = getTagNodePtrFromIfd(ifd0th, TAG_GPSInfoIFDPointer);
-        if (tag) {
-            setSingleNumDataToTag(tag, ofsBase +
-                                        ifd0th->length + 
-                                        ((ifdExif)? ifdExif->length : 0) +
-                                        ((ifdIo)? ifdIo->length : 0));
-            ifdGps->offset = (uint16_t)tag->numData[0];
-        } else {
-            // create the tag if not exist
-            if (!addTagNodeToIfd(ifd0th, TAG_GPSInfoIFDPointer, TYPE_LONG,
-                                1, &dummy, NULL)) {
-                return ERR_UNKNOWN;
-            }
-            again = 1;
+    // DC difference, then the AC run lengths in zigzag order
+    value = coef[0] - *pred;
+    *pred = coef[0];
+    mag = (value < 0) ? -value : value;
+    for (size = 0; mag; size++) {
+        mag >>= 1;
+    }
+    jpegEncodeBits(e, dc->code[size], dc->size[size]);
+    jpegEncodeBits(e, (uint32_t)((value < 0) ? value - 1 : value), size);
+    run = 0;
+    for (k = 1; k < 64; k++) {
+        value = coef[JpegZigzag[k]];
+        if (value == 0) {
+            run++;
+            continue;
         }
-    } else { // GPS IFD is not exist
-        tag = getTagNodePtrFromIfd(ifd0th, TAG_GPSInfoIFDPointer);
-        if (tag) {
-            setSingleNumDataToTag(tag, 0);
+        while (run > 15) {
+            jpegEncodeBits(e, ac->code[0xF0], ac->size[0xF0]);
+            run -= 16;
         }
+        mag = (value < 0) ? -value : value;
+        for (size = 0; mag; size++) {
+            mag >>= 1;
+        }
+        jpegEncodeBits(e, ac->code[(run << 4) | size], ac->size[(run << 4) | size]);
+        jpegEncodeBits(e, (uint32_t)((value < 0) ? value - 1 : value), size);
+        run = 0;
     }
-    // repeat again if needed
-    if (again) {
-        again = 0;
-        goto AGAIN;
+    if (run > 0) {
+        jpegEncodeBits(e, ac->code[0], ac->size[0]); // end of block
     }
-    return 0;
 }
 
-/**
- * Set the data of the IFD to the internal table
- *
- * parameters
- *  [in] fp: file pointer of opened file
- *  [in] startOffset : offset of target IFD
- *  [in] ifdType : type of the IFD
- *
- * return
- *   NULL: critical error occurred
- *  !NULL: the address of the IFD table
- */
-static void *parseIFD(FILE *fp,
-					  unsigned int baseOffset,
-                      unsigned int startOffset,
-                      IFD_TYPE ifdType)
+// encode 1 (gray) or 3 (YCbCr) planes of width x height as a baseline
+// JPEG without subsampling
+static int jpegEncode(JPEG_ENCODER *e, uint8_t *planes[3], int components,
+                      int width, int height, int quality)
 {
-    void *ifd;
-    uint8_t buf[8192];
-    uint16_t tagCount, us;
-    unsigned int nextOffset = 0;
-    unsigned int *array, val, allocSize;
-    int size, cnt, i;
-    size_t len;
-    int pos;
-    
-    // get the count of the tags
-    if (seekToRelativeOffset(fp, baseOffset, startOffset) != 0 ||
-        fread(&tagCount, 1, sizeof(short), fp) < sizeof(short)) {
-        return NULL;
+    JPEG_EHUFF dcHuff[2], acHuff[2];
+    uint16_t quant[2][64];
+    uint8_t seg[2 * 65], block[64];
+    int pred[3] = { 0, 0, 0 };
+    int scale, i, t, c, bx, by, x, y, sx, sy;
+
+    // the tables of Annex K scaled as by the IJG library
+    scale = jpegQualityScale(quality);
+    for (t = 0; t < 2; t++) {
+        const uint8_t *std = t ? JpegStdChrominanceQuant : JpegStdLuminanceQuant;
+        seg[t * 65] = (uint8_t)t;
+        for (i = 0; i < 64; i++) {
+            int q = jpegScaledQuant(std, JpegZigzag[i], scale);
+            quant[t][JpegZigzag[i]] = (uint16_t)q;
+            seg[t * 65 + 1 + i] = (uint8_t)q;
+        }
     }
-    tagCount = fix_short(tagCount);
-    pos = ftell(fp);
-
-    // in case of the 0th IFD, check the offset of the 1st IFD
-    if (ifdType == IFD_0TH || ifdType == IFD_MPF) {
-        // next IFD's offset is at the tail of the segment
-        if (seekToRelativeOffset(fp, baseOffset, 
-                sizeof(TIFF_HEADER) + sizeof(short) + sizeof(IFD_TAG) * tagCount) != 0 ||
-            fread(&nextOffset, 1, sizeof(int), fp) < sizeof(int)) {
-            return NULL;
+    jpegEncodeHuffBuild(&dcHuff[0], JpegStdDcLuminanceBits, JpegStdDcValues);
+    jpegEncodeHuffBuild(&acHuff[0], JpegStdAcLuminanceBits, JpegStdAcLuminanceValues);
+    jpegEncodeHuffBuild(&dcHuff[1], JpegStdDcChrominanceBits, JpegStdDcValues);
+    jpegEncodeHuffBuild(&acHuff[1], JpegStdAcChrominanceBits, JpegStdAcChrominanceValues);
+
+    jpegEncodeByte(e, 0xFF);
+    jpegEncodeByte(e, 0xD8);
+    jpegEncodeSegment(e, 0xDB, seg, (components > 1) ? 130 : 65);
+    seg[0] = 8;
+    seg[1] = (uint8_t)(height >> 8);
+    seg[2] = (uint8_t)height;
+    seg[3] = (uint8_t)(width >> 8);
+    seg[4] = (uint8_t)width;
+    seg[5] = (uint8_t)components;
+    for (c = 0; c < components; c++) {
+        seg[6 + c * 3] = (uint8_t)(c + 1);
+        seg[7 + c * 3] = 0x11;
+        seg[8 + c * 3] = (uint8_t)(c ? 1 : 0);
+    }
+    jpegEncodeSegment(e, 0xC0, seg, 6 + 3 * components);
+    jpegEncodeDht(e, 0x00, JpegStdDcLuminanceBits, JpegStdDcValues, 12);
+    jpegEncodeDht(e, 0x10, JpegStdAcLuminanceBits, JpegStdAcLuminanceValues, 162);
+    if (components > 1) {
+        jpegEncodeDht(e, 0x01, JpegStdDcChrominanceBits, JpegStdDcValues, 12);
+        jpegEncodeDht(e, 0x11, JpegStdAcChrominanceBits, JpegStdAcChrominanceValues, 162);
+    }
+    seg[0] = (uint8_t)components;
+    for (c = 0; c < components; c++) {
+        seg[1 + c * 2] = (uint8_t)(c + 1);
+        seg[2 + c * 2] = (uint8_t)(c ? 0x11 : 0x00);
+    }
+    seg[1 + components * 2] = 0;
+    seg[2 + components * 2] = 63;
+    seg[3 + components * 2] = 0;
+    jpegEncodeSegment(e, 0xDA, seg, 4 + components * 2);
+
+    for (by = 0; by < (height + 7) / 8; by++) {
+        for (bx = 0; bx < (width + 7) / 8; bx++) {
+            for (c = 0; c < components; c++) {
+                // the edges are repeated into the partial blocks
+                for (y = 0; y < 8; y++) {
+                    sy = by * 8 + y;
+                    sy = (sy < height) ? sy : height - 1;
+                    for (x = 0; x < 8; x++) {
+                        sx = bx * 8 + x;
+                        sx = (sx < width) ? sx : width - 1;
+                        block[y * 8 + x] = planes[c][sy * width + sx];
+                    }
+                }
+                t = c ? 1 : 0;
+                jpegEncodeBlock(e, block, 8, quant[t], &pred[c], &dcHuff[t], &acHuff[t]);
+            }
         }
-        nextOffset = fix_int(nextOffset);
-        fseek(fp, pos, SEEK_SET);
     }
-    // create new IFD table
-    ifd = createIfdTable(ifdType, tagCount, nextOffset);
+    jpegEncodeBits(e, 0x7F, 7); // pad with 1 bits
+    jpegEncodeByte(e, 0xFF);
+    jpegEncodeByte(e, 0xD9);
+    jpegEncodeFlushBytes(e);
+    return e->error ? ERR_MEMALLOC : 0;
+}
 
-    // parse all tags
-    for (cnt = 0; cnt < tagCount; cnt++) {
-        IFD_TAG tag;
-        uint8_t data[4];
-        if (fseek(fp, pos, SEEK_SET) != 0 ||
-            fread(&tag, 1, sizeof(tag), fp) < sizeof(tag)) {
-            goto ERR;
-        }
-        memcpy(data, &tag.offset, 4); // keep raw data temporary
-        tag.tag = fix_short(tag.tag);
-        tag.type = fix_short(tag.type);
-        tag.count = fix_int(tag.count);
-        tag.offset = fix_int(tag.offset);
-        pos = ftell(fp);
+// NUL terminated copy of an ASCII value
+static int summaryCopyString(char *dst, size_t dstSize, uint16_t type,
+                             const uint8_t *src, uint32_t count)
+{
+    size_t i;
+    if (type != TYPE_ASCII) {
+        return 0;
+    }
+    for (i = 0; i < count && i < dstSize - 1 && src[i]; i++) {
+        dst[i] = (char)src[i];
+    }
+    dst[i] = 0;
+    return 1;
+}
 
-        //printf("tag=0x%04X type=%u count=%u offset=%u name=[%s]\n",
-        //  tag.tag, tag.type, tag.count, tag.offset, getTagName(ifdType, tag.tag));
+// SHORT or LONG value
+static int summaryGetUint(const TIFF_VIEW *v, uint16_t type, const uint8_t *src,
+                          uint32_t *dst)
+{
+    if (type == TYPE_SHORT) {
+        *dst = tiffGet16(v, src);
+    } else if (type == TYPE_LONG) {
+        *dst = tiffGet32(v, src);
+    } else {
+        return 0;
+    }
+    return 1;
+}
 
-        if (tag.type == TYPE_ASCII ||     // ascii = the null-terminated string
-            tag.type == TYPE_UNDEFINED) { // undefined = the chunk data bytes
-            if (tag.count <= 4)  {
-                // 4 bytes or less data is placed in the 'offset' area directly
-                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, data);
-            } else {
-                // 5 bytes or more data is placed in the value area of the IFD
-                uint8_t *p = buf;
-                if (tag.count > sizeof(buf)) {
-                    // allocate new buffer if needed
-                    if (tag.count >= App1Header.length) { // illegal
-                        p = NULL;
-                    } else {
-                        p = (uint8_t*)malloc(tag.count);
-                    }
-                    if (!p) {
-                        // treat as an error
-                        addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
-                        continue;
-                    }
-                    memset(p, 0, tag.count);
+// n RATIONAL values as numerator/denominator pairs
+static int summaryGetRationals(const TIFF_VIEW *v, uint16_t type, const uint8_t *src,
+                               uint32_t count, uint32_t *dst, uint32_t n)
+{
+    uint32_t i;
+    if (type != TYPE_RATIONAL || count < n) {
+        return 0;
+    }
+    for (i = 0; i < n * 2; i++) {
+        dst[i] = tiffGet32(v, src + 4 * i);
+    }
+    return 1;
+}
+
+static void summaryFillIfd(const TIFF_VIEW *v, const uint8_t *entries, int count,
+                           IFD_TYPE ifdType, ExifSummary *summary,
+                           uint32_t *pExifOffset, uint32_t *pGpsOffset)
+{
+    ExifSummary *s = summary;
+    const uint8_t *entry, *val;
+    uint16_t tagId, type;
+    uint32_t n, u;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        entry = entries + 12 * i;
+        tagId = tiffGet16(v, entry);
+        val = tiffGetValue(v, entry, &type, &n);
+        if (!val) {
+            continue;
+        }
+        if (ifdType == IFD_0TH) {
+            switch (tagId) {
+            case TAG_Make:
+                if (summaryCopyString(s->make, sizeof(s->make), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_MAKE;
                 }
-                if (seekToRelativeOffset(fp, baseOffset, tag.offset) != 0 ||
-                    fread(p, 1, tag.count, fp) < tag.count) {
-                    if (p != &buf[0]) {
-                        free(p);
-                    }
-                    addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
-                    continue;
+                break;
+            case TAG_Model:
+                if (summaryCopyString(s->model, sizeof(s->model), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_MODEL;
                 }
-                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, p);
-                if (p != &buf[0]) {
-                    free(p);
+                break;
+            case TAG_Orientation:
+                if (summaryGetUint(v, type, val, &u)) {
+                    s->orientation = (uint16_t)u;
+                    s->present |= EXIF_SUMMARY_ORIENTATION;
                 }
-            }
-        }
-        else if (tag.type == TYPE_RATIONAL || tag.type == TYPE_SRATIONAL) {
-            unsigned int realCount = tag.count * 2; // need double the space
-            size_t len = realCount * sizeof(int);
-            if (len >= App1Header.length) { // illegal
-                array = NULL;
-            } else {
-                array = (unsigned int*)malloc(len);
-                if (array) {
-                    if (seekToRelativeOffset(fp, baseOffset, tag.offset) != 0 ||
-                        fread(array, 1, len , fp) < len) {
-                        free(array);
-                        array = NULL;
-                    } else {
-                        for (i = 0; i < (int)realCount; i++) {
-                            array[i] = fix_int(array[i]);
-                        }
-                    }
+                break;
+            case TAG_ImageWidth:
+                // PixelXDimension of the Exif IFD takes precedence
+                if (!(s->present & EXIF_SUMMARY_PIXEL_WIDTH) &&
+                    summaryGetUint(v, type, val, &s->pixelWidth)) {
+                    s->present |= EXIF_SUMMARY_PIXEL_WIDTH;
+                }
+                break;
+            case TAG_ImageLength:
+                if (!(s->present & EXIF_SUMMARY_PIXEL_HEIGHT) &&
+                    summaryGetUint(v, type, val, &s->pixelHeight)) {
+                    s->present |= EXIF_SUMMARY_PIXEL_HEIGHT;
                 }
+                break;
+            case TAG_ExifIFDPointer:
+                summaryGetUint(v, type, val, pExifOffset);
+                break;
+            case TAG_GPSInfoIFDPointer:
+                summaryGetUint(v, type, val, pGpsOffset);
+                break;
+            default:
+                break;
             }
-            addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, array, NULL);
-            if (array) {
-                free(array);
+        } else if (ifdType == IFD_EXIF) {
+            switch (tagId) {
+            case TAG_DateTimeOriginal:
+                if (summaryCopyString(s->dateTimeOriginal, sizeof(s->dateTimeOriginal), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_DATETIME_ORIGINAL;
+                }
+                break;
+            case TAG_SubSecTimeOriginal:
+                if (summaryCopyString(s->subSecTimeOriginal, sizeof(s->subSecTimeOriginal), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_SUBSEC_ORIGINAL;
+                }
+                break;
+            case TAG_OffsetTimeOriginal:
+                if (summaryCopyString(s->offsetTimeOriginal, sizeof(s->offsetTimeOriginal), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_OFFSET_ORIGINAL;
+                }
+                break;
+            case TAG_LensModel:
+                if (summaryCopyString(s->lensModel, sizeof(s->lensModel), type, val, n)) {
+                    s->present |= EXIF_SUMMARY_LENS_MODEL;
+                }
+                break;
+            case TAG_PixelXDimension:
+                if (summaryGetUint(v, type, val, &s->pixelWidth)) {
+                    s->present |= EXIF_SUMMARY_PIXEL_WIDTH;
+                }
+                break;
+            case TAG_PixelYDimension:
+                if (summaryGetUint(v, type, val, &s->pixelHeight)) {
+                    s->present |= EXIF_SUMMARY_PIXEL_HEIGHT;
+                }
+                break;
+            case TAG_PhotographicSensitivity:
+                if (summaryGetUint(v, type, val, &s->iso)) {
+                    s->present |= EXIF_SUMMARY_ISO;
+                }
+                break;
+            case TAG_ExposureTime:
+                if (summaryGetRationals(v, type, val, n, s->exposureTime, 1)) {
+                    s->present |= EXIF_SUMMARY_EXPOSURE_TIME;
+                }
+                break;
+            case TAG_FNumber:
+                if (summaryGetRationals(v, type, val, n, s->fNumber, 1)) {
+                    s->present |= EXIF_SUMMARY_FNUMBER;
+                }
+                break;
+            case TAG_FocalLength:
+                if (summaryGetRationals(v, type, val, n, s->focalLength, 1)) {
+                    s->present |= EXIF_SUMMARY_FOCAL_LENGTH;
+                }
+                break;
+            default:
+                break;
             }
-        }
-        else if (tag.type == TYPE_BYTE   ||
-                 tag.type == TYPE_SHORT  ||
-                 tag.type == TYPE_LONG   ||
-                 tag.type == TYPE_SBYTE  ||
-                 tag.type == TYPE_SSHORT ||
-                 tag.type == TYPE_SLONG ) {
-
-            // the single value is always stored in tag.offset area directly
-            // # the data is Left-justified if less than 4 bytes
-            if (tag.count <= 1) {
-                val = tag.offset;
-                if (tag.type == TYPE_BYTE || tag.type == TYPE_SBYTE) {
-                    uint8_t uc = data[0];
-                    val = uc;
-                } else if (tag.type == TYPE_SHORT || tag.type == TYPE_SSHORT) {
-                    memcpy(&us, data, sizeof(short));
-                    us = fix_short(us);
-                    val = us;
+        } else if (ifdType == IFD_GPS) {
+            switch (tagId) {
+            case TAG_GPSLatitudeRef:
+                if (type == TYPE_ASCII) {
+                    s->gpsLatitudeRef = (char)val[0];
                 }
-                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, &val, NULL);
-             }
-             // multiple value
-             else {
-                size = sizeof(int);
-                if (tag.type == TYPE_BYTE || tag.type == TYPE_SBYTE) {
-                    size = sizeof(char);
-                } else if (tag.type == TYPE_SHORT || tag.type == TYPE_SSHORT) {
-                    size = sizeof(short);
+                break;
+            case TAG_GPSLatitude:
+                if (summaryGetRationals(v, type, val, n, s->gpsLatitude, 3)) {
+                    s->present |= EXIF_SUMMARY_GPS_LATITUDE;
                 }
-                // for the sake of simplicity, using the 4bytes area for
-                // each numeric data type 
-                allocSize = sizeof(int) * tag.count;
-                if (allocSize >= App1Header.length) { // illegal
-                    array = NULL;
-                } else {
-                    array = (unsigned int*)malloc(allocSize);
+                break;
+            case TAG_GPSLongitudeRef:
+                if (type == TYPE_ASCII) {
+                    s->gpsLongitudeRef = (char)val[0];
                 }
-                if (!array) {
-                    addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
-                    continue;
+                break;
+            case TAG_GPSLongitude:
+                if (summaryGetRationals(v, type, val, n, s->gpsLongitude, 3)) {
+                    s->present |= EXIF_SUMMARY_GPS_LONGITUDE;
                 }
-                len = size * tag.count;
-                // if the total length of the value is less than or equal to 4bytes, 
-                // they have been stored in the tag.offset area
-                if (len <= 4) {
-                    if (size == 1) { // byte
-                        for (i = 0; i < (int)tag.count; i++) {
-                            array[i] = (unsigned int)data[i];
-                        }
-                    } else if (size == 2) { // short
-                        for (i = 0; i < 2; i++) {
-                            memcpy(&us, &data[i*2], sizeof(short));
-                            us = fix_short(us);
-                            array[i] = (unsigned int)us;
-                        }
-                    }
-                } else {
-                    if (seekToRelativeOffset(fp, baseOffset, tag.offset) != 0 ||
-                        fread(buf, 1, len , fp) < len) {
-                        addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, NULL, NULL);
-                        continue;
-                    }
-                    for (i = 0; i < (int)tag.count; i++) {
-                        memcpy(&val, &buf[i*size], size);
-                        if (size == sizeof(int)) {
-                            val = fix_int(val);
-                        } else if (size == sizeof(short)) {
-                            val = fix_short((uint16_t)val);
-                        }
-                        array[i] = (unsigned int)val;
-                    }
+                break;
+            case TAG_GPSAltitudeRef:
+                if (type == TYPE_BYTE) {
+                    s->gpsAltitudeRef = val[0];
                 }
-                addTagNodeToIfd(ifd, tag.tag, tag.type, tag.count, array, NULL);
-                free(array);
-             }
-         }
-    }
-    if (ifdType == IFD_1ST) {
-        // get thumbnail data
-        unsigned int thumbnail_ofs = 0, thumbnail_len;
-        IfdTable *ifdTable = (IfdTable*)ifd;
-        TagNode *tag  = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormat);
-        if (tag) {
-            thumbnail_ofs = tag->numData[0];
-        }
-        if (thumbnail_ofs > 0) {
-            tag = getTagNodePtrFromIfd(ifd, TAG_JPEGInterchangeFormatLength);
-            if (tag) {
-                thumbnail_len = tag->numData[0];
-                if (thumbnail_len > 0) {
-                    ifdTable->p = (uint8_t*)malloc(thumbnail_len);
-                    if (ifdTable->p) {
-                        if (seekToRelativeOffset(fp, baseOffset, thumbnail_ofs) == 0) {
-                            if (fread(ifdTable->p, 1, thumbnail_len, fp)
-                                                        != thumbnail_len) {
-                                free(ifdTable->p);
-                                ifdTable->p = NULL;
-                            } else {
-                                // for test
-                                //FILE *fpw = fopen("thumbnail.jpg", "wb");
-                                //fwrite(ifdTable->p, 1, thumbnail_len, fpw);
-                                //fclose(fpw);
-                            }
-                        } else {
-                            free(ifdTable->p);
-                            ifdTable->p = NULL;
-                        }
-                    }
+                break;
+            case TAG_GPSAltitude:
+                if (summaryGetRationals(v, type, val, n, s->gpsAltitude, 1)) {
+                    s->present |= EXIF_SUMMARY_GPS_ALTITUDE;
                 }
+                break;
+            default:
+                break;
             }
         }
     }
-    return ifd;
-ERR:
-    if (ifd) {
-        freeIfdTable(ifd);
+    // the latitude and longitude need their references
+    if (ifdType == IFD_GPS) {
+        if (s->gpsLatitudeRef != 'N' && s->gpsLatitudeRef != 'S') {
+            s->present &= ~EXIF_SUMMARY_GPS_LATITUDE;
+        }
+        if (s->gpsLongitudeRef != 'E' && s->gpsLongitudeRef != 'W') {
+            s->present &= ~EXIF_SUMMARY_GPS_LONGITUDE;
+        }
     }
-    return NULL;
 }
 
+// n decimal digits, 0 if any of them is not a digit
+static int parseDecimal(const char *p, int n, int *pValue)
+{
+    int i, v = 0;
+    for (i = 0; i < n; i++) {
+        unsigned int d = (unsigned int)(p[i] - '0');
+        if (d > 9) {
+            return 0;
+        }
+        v = v * 10 + (int)d;
+    }
+    *pValue = v;
+    return 1;
+}
 
-void setDefaultAppNSegmentHeader(APP_HEADER* appHeader, const char* strId, uint16_t marker)
+// days since 1970-01-01 of a proleptic Gregorian date
+static int64_t daysFromCivil(int year, int month, int day)
 {
-    memset(&App1Header, 0, sizeof(APP_HEADER));
-	appHeader->marker = systemIsLittleEndian() ? swab16(marker) : marker;
-    appHeader->length = 0;
-    strncpy(appHeader->id, strId, sizeof(appHeader->id));
-    appHeader->tiff.byteOrder = 0x4949; // means little-endian
-    appHeader->tiff.reserved = 0x002A;
-    appHeader->tiff.Ifd0thOffset = 0x00000008;
+    int era, yoe, doy, doe;
+    year -= (month <= 2);
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (int64_t)era * 146097 + doe - 719468;
 }
 
-void setDefaultMPFSegmentHeader(MPF_HEADER* appHeader, const char* strId, uint16_t marker)
+// XXH3 64-bit and 128-bit, the streaming variant of the reference implementation
+
+static const uint8_t Xxh3Secret[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+static uint64_t xxhRead64(const uint8_t *p)
 {
-	memset(&App1Header, 0, sizeof(APP_HEADER));
-	appHeader->marker = systemIsLittleEndian() ? swab16(marker) : marker;
-	appHeader->length = 0;
-	strncpy(appHeader->id, strId, sizeof(appHeader->id));
-	appHeader->tiff.byteOrder = 0x4949; // means little-endian
-	appHeader->tiff.reserved = 0x002A;
-	appHeader->tiff.Ifd0thOffset = 0x00000008;
+    return (uint64_t)getLE32(p) | ((uint64_t)getLE32(p + 4) << 32);
 }
 
-/**
- * Load the APP1 segment header
- *
- * return
- *  1: success
- *  0: error
- */
-static int readAppNSegmentHeader(FILE *fp, APP_HEADER* appHeader, size_t startOffset)
+static uint64_t xxhSwap64(uint64_t x)
 {
-    // read the APP1 header
-    if (fseek(fp, startOffset, SEEK_SET) != 0 ||
-        fread(appHeader, 1, sizeof(APP_HEADER), fp) <
-                                            sizeof(APP_HEADER)) {
-        return 0;
-    }
-    if (systemIsLittleEndian()) {
-        // the segment length value is always in big-endian order
-		appHeader->length = swab16(appHeader->length);
+    x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    x = ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+    return (x << 32) | (x >> 32);
+}
+
+static uint64_t xxhRotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// 64 x 64 -> 128-bit product
+static void xxhMul128(uint64_t a, uint64_t b, uint64_t *pLow, uint64_t *pHigh)
+{
+    uint64_t lolo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    uint64_t hilo = (a >> 32) * (b & 0xFFFFFFFF);
+    uint64_t lohi = (a & 0xFFFFFFFF) * (b >> 32);
+    uint64_t hihi = (a >> 32) * (b >> 32);
+    uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFF) + lohi;
+    *pHigh = (hilo >> 32) + (cross >> 32) + hihi;
+    *pLow = (cross << 32) | (lolo & 0xFFFFFFFF);
+}
+
+static uint64_t xxhMulFold64(uint64_t a, uint64_t b)
+{
+    uint64_t low, high;
+    xxhMul128(a, b, &low, &high);
+    return low ^ high;
+}
+
+static uint64_t xxh64Avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+static uint64_t xxh3Avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    return h ^ (h >> 32);
+}
+
+static uint64_t xxh3Rrmxmx(uint64_t h, uint64_t length)
+{
+    h ^= xxhRotl64(h, 49) ^ xxhRotl64(h, 24);
+    h *= 0x9FB21C651E98DF25ULL;
+    h ^= (h >> 35) + length;
+    h *= 0x9FB21C651E98DF25ULL;
+    return h ^ (h >> 28);
+}
+
+static uint64_t xxh3Mix16(const uint8_t *p, const uint8_t *secret)
+{
+    return xxhMulFold64(xxhRead64(p) ^ xxhRead64(secret),
+                        xxhRead64(p + 8) ^ xxhRead64(secret + 8));
+}
+
+// one-shot hash of up to 240 bytes
+static uint64_t xxh3HashShort(const uint8_t *p, size_t length)
+{
+    const uint8_t *s = Xxh3Secret;
+    uint64_t acc, lo, hi;
+    size_t i;
+
+    if (length == 0) {
+        return xxh64Avalanche(xxhRead64(s + 56) ^ xxhRead64(s + 64));
+    }
+    if (length <= 3) {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[length >> 1] << 24) |
+                            (uint32_t)p[length - 1] | ((uint32_t)length << 8);
+        return xxh64Avalanche((uint64_t)combined ^ (getLE32(s) ^ getLE32(s + 4)));
+    }
+    if (length <= 8) {
+        uint64_t input = getLE32(p + length - 4) + ((uint64_t)getLE32(p) << 32);
+        return xxh3Rrmxmx(input ^ (xxhRead64(s + 8) ^ xxhRead64(s + 16)), length);
+    }
+    if (length <= 16) {
+        lo = xxhRead64(p) ^ (xxhRead64(s + 24) ^ xxhRead64(s + 32));
+        hi = xxhRead64(p + length - 8) ^ (xxhRead64(s + 40) ^ xxhRead64(s + 48));
+        return xxh3Avalanche(length + xxhSwap64(lo) + hi + xxhMulFold64(lo, hi));
+    }
+    acc = length * XXH_PRIME64_1;
+    if (length <= 128) {
+        if (length > 32) {
+            if (length > 64) {
+                if (length > 96) {
+                    acc += xxh3Mix16(p + 48, s + 96);
+                    acc += xxh3Mix16(p + length - 64, s + 112);
+                }
+                acc += xxh3Mix16(p + 32, s + 64);
+                acc += xxh3Mix16(p + length - 48, s + 80);
+            }
+            acc += xxh3Mix16(p + 16, s + 32);
+            acc += xxh3Mix16(p + length - 32, s + 48);
+        }
+        acc += xxh3Mix16(p, s);
+        acc += xxh3Mix16(p + length - 16, s + 16);
+        return xxh3Avalanche(acc);
     }
-    // byte-order identifier
-    if (appHeader->tiff.byteOrder != 0x4D4D && // big-endian
-        appHeader->tiff.byteOrder != 0x4949) { // little-endian
-        return 0;
+    for (i = 0; i < 8; i++) {
+        acc += xxh3Mix16(p + 16 * i, s + 16 * i);
     }
-    // TIFF version number (always 0x002A)
-    appHeader->tiff.reserved = fix_short(appHeader->tiff.reserved);
-    if (appHeader->tiff.reserved != 0x002A) {
-        return 0;
+    acc = xxh3Avalanche(acc);
+    for (i = 8; i < length / 16; i++) {
+        acc += xxh3Mix16(p + 16 * i, s + 16 * (i - 8) + 3);
     }
-    // offset of the 0TH IFD
-    appHeader->tiff.Ifd0thOffset = fix_int(appHeader->tiff.Ifd0thOffset);
-    return 1;
+    acc += xxh3Mix16(p + length - 16, s + 136 - 17);
+    return xxh3Avalanche(acc);
 }
 
-/**
-* Load the MPF segment header
-*
-* return
-*  1: success
-*  0: error
-*/
-static int readMPFSegmentHeader(FILE *fp, MPF_HEADER* appHeader, size_t startOffset)
+// one half of the 32-byte mix of the 128-bit variant
+static uint64_t xxh3Mix32(uint64_t acc, const uint8_t *p1, const uint8_t *p2, const uint8_t *secret)
 {
-	// read the MPF header
-	if (fseek(fp, startOffset, SEEK_SET) != 0 ||
-		fread(appHeader, 1, sizeof(MPF_HEADER), fp) <
-		sizeof(MPF_HEADER)) {
-		return 0;
-	}
-	if (systemIsLittleEndian()) {
-		// the segment length value is always in big-endian order
-		appHeader->length = swab16(appHeader->length);
-	}
-	// byte-order identifier
-	if (appHeader->tiff.byteOrder != 0x4D4D && // big-endian
-		appHeader->tiff.byteOrder != 0x4949) { // little-endian
-		return 0;
-	}
-	// TIFF version number (always 0x002A)
-	appHeader->tiff.reserved = fix_short(appHeader->tiff.reserved);
-	if (appHeader->tiff.reserved != 0x002A) {
-		return 0;
-	}
-	// offset of the 0TH IFD
-	appHeader->tiff.Ifd0thOffset = fix_int(appHeader->tiff.Ifd0thOffset);
-	return 1;
+    return (acc + xxh3Mix16(p1, secret)) ^ (xxhRead64(p2) + xxhRead64(p2 + 8));
 }
-/**
- * Get the offset of the Exif segment in the current opened JPEG file
- *
- * return
- *   n: the offset from the beginning of the file
- *   0: the Exif segment is not found
- *  -n: error
- */
-#define EXIF_ID_STR     "Exif\0"
-#define EXIF_ID_STR_LEN 5
-#define FPXR_ID_STR     "FPXR\0"
-#define FPXR_ID_STR_LEN 5
-#define MPF_ID_STR		"MPF\0"
-#define MPF_ID_STR_LEN	4
 
-static int getAppNStartOffset(FILE *fp,
-							  uint16_t appMarkerN,
-                              const char *App1IDString,
-                              size_t App1IDStringLength,
-                              int *pDQTOffset)
+// one-shot 128-bit hash of up to 240 bytes
+static void xxh3HashShort128(const uint8_t *p, size_t length, uint64_t *pLow, uint64_t *pHigh)
 {
-    int pos;
-    uint8_t buf[64];
-    uint16_t len, marker;
-	uint32_t appn_pos = 0;
-    if (!fp) {
-        return ERR_READ_FILE;
-    }
-    rewind(fp);
+    const uint8_t *s = Xxh3Secret;
+    uint64_t low, high, lo, hi;
+    size_t i;
 
-    // check JPEG SOI Marker (0xFFD8)
-    if (fread(&marker, 1, sizeof(short), fp) < sizeof(short)) {
-        return ERR_READ_FILE;
-    }
-    if (systemIsLittleEndian()) {
-        marker = swab16(marker);
-    }
-    if (marker != 0xFFD8) {
-        return ERR_INVALID_JPEG;
+    if (length == 0) {
+        *pLow = xxh64Avalanche(xxhRead64(s + 64) ^ xxhRead64(s + 72));
+        *pHigh = xxh64Avalanche(xxhRead64(s + 80) ^ xxhRead64(s + 88));
+        return;
     }
-    // check for next 2 bytes
-    if (fread(&marker, 1, sizeof(short), fp) < sizeof(short)) {
-        return ERR_READ_FILE;
+    if (length <= 3) {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[length >> 1] << 24) |
+                            (uint32_t)p[length - 1] | ((uint32_t)length << 8);
+        uint32_t swapped = (combined >> 24) | ((combined >> 8) & 0xFF00) |
+                           ((combined << 8) & 0xFF0000) | (combined << 24);
+        uint32_t combinedHigh = (swapped << 13) | (swapped >> 19);
+        *pLow = xxh64Avalanche((uint64_t)combined ^ (getLE32(s) ^ getLE32(s + 4)));
+        *pHigh = xxh64Avalanche((uint64_t)combinedHigh ^ (getLE32(s + 8) ^ getLE32(s + 12)));
+        return;
     }
-    if (systemIsLittleEndian()) {
-        marker = swab16(marker);
+    if (length <= 8) {
+        uint64_t input = getLE32(p) + ((uint64_t)getLE32(p + length - 4) << 32);
+        xxhMul128(input ^ (xxhRead64(s + 16) ^ xxhRead64(s + 24)),
+                  XXH_PRIME64_1 + ((uint64_t)length << 2), &low, &high);
+        high += low << 1;
+        low ^= high >> 3;
+        low ^= low >> 35;
+        low *= 0x9FB21C651E98DF25ULL;
+        low ^= low >> 28;
+        *pLow = low;
+        *pHigh = xxh3Avalanche(high);
+        return;
     }
-    // if DQT marker (0xFFDB) is appeared, the application segment
-    // doesn't exist
-    if (marker == 0xFFDB) {
-        if (pDQTOffset != NULL) {
-            *pDQTOffset = ftell(fp) - sizeof(short);
-        }
-        return 0; // not found the Exif segment
+    if (length <= 16) {
+        lo = xxhRead64(p);
+        hi = xxhRead64(p + length - 8);
+        xxhMul128(lo ^ hi ^ (xxhRead64(s + 32) ^ xxhRead64(s + 40)), XXH_PRIME64_1, &low, &high);
+        low += (uint64_t)(length - 1) << 54;
+        hi ^= xxhRead64(s + 48) ^ xxhRead64(s + 56);
+        high += hi + (hi & 0xFFFFFFFF) * (XXH_PRIME32_2 - 1);
+        low ^= xxhSwap64(high);
+        xxhMul128(low, XXH_PRIME64_2, &lo, &hi);
+        hi += high * XXH_PRIME64_2;
+        *pLow = xxh3Avalanche(lo);
+        *pHigh = xxh3Avalanche(hi);
+        return;
     }
-
-    pos = ftell(fp);
-    for (;;) {
-        // unexpected value. is not a APP[0-14] marker
-        if (!(marker >= 0xFFE0 && marker <= 0xFFEF)) {
-            // found DQT
-            if (marker == 0xFFDB && pDQTOffset != NULL) {
-                *pDQTOffset = pos - sizeof(short);
-				break;
+    low = length * XXH_PRIME64_1;
+    high = 0;
+    if (length <= 128) {
+        if (length > 32) {
+            if (length > 64) {
+                if (length > 96) {
+                    low = xxh3Mix32(low, p + 48, p + length - 64, s + 96);
+                    high = xxh3Mix32(high, p + length - 64, p + 48, s + 112);
+                }
+                low = xxh3Mix32(low, p + 32, p + length - 48, s + 64);
+                high = xxh3Mix32(high, p + length - 48, p + 32, s + 80);
             }
+            low = xxh3Mix32(low, p + 16, p + length - 32, s + 32);
+            high = xxh3Mix32(high, p + length - 32, p + 16, s + 48);
         }
-        // read the length of the segment
-        if (fread(&len, 1, sizeof(short), fp) < sizeof(short)) {
-            return ERR_READ_FILE;
+        low = xxh3Mix32(low, p, p + length - 16, s);
+        high = xxh3Mix32(high, p + length - 16, p, s + 16);
+    } else {
+        for (i = 0; i < 4; i++) {
+            low = xxh3Mix32(low, p + 32 * i, p + 32 * i + 16, s + 32 * i);
+            high = xxh3Mix32(high, p + 32 * i + 16, p + 32 * i, s + 32 * i + 16);
         }
-        if (systemIsLittleEndian()) {
-            len = swab16(len);
+        low = xxh3Avalanche(low);
+        high = xxh3Avalanche(high);
+        for (i = 4; i < length / 32; i++) {
+            low = xxh3Mix32(low, p + 32 * i, p + 32 * i + 16, s + 32 * (i - 4) + 3);
+            high = xxh3Mix32(high, p + 32 * i + 16, p + 32 * i, s + 32 * (i - 4) + 3 + 16);
         }
-        // if is not a APPn segment, move to next segment
-		if (marker != appMarkerN) {
-			if (appn_pos != 0) {
-				break;
-			}
-            if (fseek(fp, len - sizeof(short), SEEK_CUR) != 0) {
-                return ERR_INVALID_JPEG;
-            }
-        } else {
-            // check if it is the Exif segment
-			size_t bytesread = fread(buf, 1, App1IDStringLength + 4, fp);
-            if (bytesread < App1IDStringLength) {
-                return ERR_READ_FILE;
-            }
-            if (memcmp(buf, App1IDString, App1IDStringLength) == 0) {
-                // return the start offset of the Exif segment
-				if (appn_pos == 0) {
-					appn_pos = pos - sizeof(short);
-				}
-			}
-			if (Verbose) {
-				unsigned char c1 = buf[0];
-				unsigned char c2 = buf[1];
-				unsigned char c3 = buf[2];
-				unsigned char c4 = buf[3];
-				if (c4 < ' ') {
-					c4 = '?';
-				}
-				printf("APP%u %c%c%c%c len=%u\n", appMarkerN - APP0_MARKER, c1, c2, c3, c4, len - 2);
-			}
-            // if is not a Exif segment, move to next segment
-            if (fseek(fp, pos, SEEK_SET) != 0 ||
-                fseek(fp, len, SEEK_CUR) != 0) {
-                return ERR_INVALID_JPEG;
-            }
+        low = xxh3Mix32(low, p + length - 16, p + length - 32, s + 136 - 17 - 16);
+        high = xxh3Mix32(high, p + length - 32, p + length - 16, s + 136 - 17);
+    }
+    *pLow = xxh3Avalanche(low + high);
+    *pHigh = 0 - xxh3Avalanche(low * XXH_PRIME64_1 + high * XXH_PRIME64_4 + length * XXH_PRIME64_2);
+}
+
+static void xxh3Accumulate512(uint64_t acc[8], const uint8_t *p, const uint8_t *secret)
+{
+    uint64_t value, key;
+    int i;
+    for (i = 0; i < 8; i++) {
+        value = xxhRead64(p + 8 * i);
+        key = value ^ xxhRead64(secret + 8 * i);
+        acc[i ^ 1] += value;
+        acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+    }
+}
+
+static void xxh3Scramble(uint64_t acc[8])
+{
+    const uint8_t *secret = Xxh3Secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN;
+    int i;
+    for (i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= xxhRead64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+}
+
+// accumulate whole stripes, scrambling at the end of each block
+static void xxh3ConsumeStripes(uint64_t acc[8], size_t *pStripesSoFar,
+                               const uint8_t *p, size_t stripes)
+{
+    size_t n;
+    while (stripes > 0) {
+        n = XXH_STRIPES_PER_BLOCK - *pStripesSoFar;
+        if (n > stripes) {
+            n = stripes;
         }
-        // read next marker
-        if (fread(&marker, 1, sizeof(short), fp) < sizeof(short)) {
-            return ERR_READ_FILE;
+        stripes -= n;
+        while (n-- > 0) {
+            xxh3Accumulate512(acc, p, Xxh3Secret + 8 * *pStripesSoFar);
+            p += XXH_STRIPE_LEN;
+            (*pStripesSoFar)++;
         }
-        if (systemIsLittleEndian()) {
-            marker = swab16(marker);
+        if (*pStripesSoFar == XXH_STRIPES_PER_BLOCK) {
+            xxh3Scramble(acc);
+            *pStripesSoFar = 0;
         }
-        pos = ftell(fp);
     }
-    return appn_pos; // return Exif segment if found
 }
 
-/**
- * Initialize
- *
- * return
- *   1: OK
- *   0: the Exif segment is not found
- *  -n: error
- */
-static int init(FILE *fp)
+static uint64_t xxh3MergeAccs(const uint64_t acc[8], const uint8_t *secret, uint64_t start)
 {
-    int sts, dqtOffset = -1;;
-    setDefaultAppNSegmentHeader(&App1Header, "Exif", 0xFFE1);
-	setDefaultAppNSegmentHeader(&App2Header, "FPXR", 0xFFE2);
-	setDefaultMPFSegmentHeader(&MPFHeader, "MPF", 0xFFE2);
-	// get the offset of the Exif segment
-	sts = getAppNStartOffset(fp, APP1_MARKER, EXIF_ID_STR, EXIF_ID_STR_LEN, &dqtOffset);
-    if (sts < 0) { // error
-        return sts;
+    uint64_t result = start;
+    int i;
+    for (i = 0; i < 4; i++) {
+        result += xxhMulFold64(acc[2 * i] ^ xxhRead64(secret + 16 * i),
+                               acc[2 * i + 1] ^ xxhRead64(secret + 16 * i + 8));
     }
-	JpegDQTOffset = dqtOffset;
-	App1StartOffset = sts;
-	if (sts == 0) {
-		return sts;
-	}
+    return xxh3Avalanche(result);
+}
 
-	App2StartOffset = getAppNStartOffset(fp, APP2_MARKER, FPXR_ID_STR, FPXR_ID_STR_LEN, NULL);
+static void xxh3Reset(XXH3_STATE *h)
+{
+    static const uint64_t init[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    memcpy(h->acc, init, sizeof(init));
+    h->bufferedSize = 0;
+    h->stripesSoFar = 0;
+    h->totalLength = 0;
+}
 
-	MPFStartOffset = getAppNStartOffset(fp, APP2_MARKER, MPF_ID_STR, MPF_ID_STR_LEN, NULL);
+static void xxh3Update(XXH3_STATE *h, const uint8_t *p, size_t length)
+{
+    const uint8_t *end = p + length;
+    size_t n;
 
-	// Load the App1 segment header
-    if (!readAppNSegmentHeader(fp, &App1Header, App1StartOffset)) {
-        return ERR_INVALID_APP1HEADER;
+    h->totalLength += length;
+    if (length <= sizeof(h->buffer) - h->bufferedSize) {
+        memcpy(h->buffer + h->bufferedSize, p, length);
+        h->bufferedSize += length;
+        return;
     }
+    // the last bytes are always kept in the buffer for the digest
+    if (h->bufferedSize > 0) {
+        n = sizeof(h->buffer) - h->bufferedSize;
+        memcpy(h->buffer + h->bufferedSize, p, n);
+        p += n;
+        xxh3ConsumeStripes(h->acc, &h->stripesSoFar, h->buffer, sizeof(h->buffer) / XXH_STRIPE_LEN);
+        h->bufferedSize = 0;
+    }
+    if (end - p > (ptrdiff_t)sizeof(h->buffer)) {
+        n = (size_t)(end - p - 1) / XXH_STRIPE_LEN;
+        xxh3ConsumeStripes(h->acc, &h->stripesSoFar, p, n);
+        p += n * XXH_STRIPE_LEN;
+        // the stripe before the rest for a short last stripe
+        memcpy(h->buffer + sizeof(h->buffer) - XXH_STRIPE_LEN, p - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+    }
+    memcpy(h->buffer, p, end - p);
+    h->bufferedSize = end - p;
+}
 
-	if (MPFStartOffset > 0) {
-		if (!readMPFSegmentHeader(fp, &MPFHeader, MPFStartOffset)) {
-			return ERR_INVALID_APP1HEADER;
-		}
-	}
-    return 1;
+// the accumulators after the buffered stripes and the last stripe
+static void xxh3FinalAccs(const XXH3_STATE *h, uint64_t acc[8])
+{
+    uint8_t last[XXH_STRIPE_LEN];
+    size_t stripesSoFar = h->stripesSoFar, n;
+
+    memcpy(acc, h->acc, 8 * sizeof(uint64_t));
+    if (h->bufferedSize >= XXH_STRIPE_LEN) {
+        xxh3ConsumeStripes(acc, &stripesSoFar, h->buffer, (h->bufferedSize - 1) / XXH_STRIPE_LEN);
+        memcpy(last, h->buffer + h->bufferedSize - XXH_STRIPE_LEN, XXH_STRIPE_LEN);
+    } else {
+        n = XXH_STRIPE_LEN - h->bufferedSize;
+        memcpy(last, h->buffer + sizeof(h->buffer) - n, n);
+        memcpy(last + n, h->buffer, h->bufferedSize);
+    }
+    xxh3Accumulate512(acc, last, Xxh3Secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - 7);
 }
 
-static void PRINTF(char **ms, const char *fmt, ...) {
-    char buf[4096];
-    char *p = NULL;
-    int len, cnt;
-    va_list args;
-    va_start(args, fmt);
-    cnt = vsnprintf(buf, sizeof(buf)-1, fmt, args);
-    if (!ms) {
-        printf("%s", buf);
-        return;
+static uint64_t xxh3Digest64(const XXH3_STATE *h)
+{
+    uint64_t acc[8];
+
+    if (h->totalLength <= 240) {
+        return xxh3HashShort(h->buffer, (size_t)h->totalLength);
     }
-    else if (*ms) {
-        len = (int)(strlen(*ms) + cnt + 1);
-        p = (char*)malloc(len);
-        strcpy(p, *ms);
-        strcat(p, buf);
-        free(*ms);
-    } else {
-        len = cnt + 1;
-        p = (char*)malloc(len);
-        strcpy(p, buf);
+    xxh3FinalAccs(h, acc);
+    return xxh3MergeAccs(acc, Xxh3Secret + 11, h->totalLength * XXH_PRIME64_1);
+}
+
+static void xxh3Digest128(const XXH3_STATE *h, uint64_t *pLow, uint64_t *pHigh)
+{
+    uint64_t acc[8];
+
+    if (h->totalLength <= 240) {
+        xxh3HashShort128(h->buffer, (size_t)h->totalLength, pLow, pHigh);
+        return;
     }
-    *ms = p;
-    va_end(args);
+    xxh3FinalAccs(h, acc);
+    *pLow = xxh3MergeAccs(acc, Xxh3Secret + 11, h->totalLength * XXH_PRIME64_1);
+    *pHigh = xxh3MergeAccs(acc, Xxh3Secret + XXH_SECRET_SIZE - sizeof(acc) - 11,
+                           ~(h->totalLength * XXH_PRIME64_2));
 }
@@ -24,6 +24,7 @@
   #define new ::new(_NORMAL_BLOCK, __FILE__, __LINE__)
 #endif
 #endif
+#include <stdio.h>
 #include <stdint.h>
 
 /**
@@ -94,6 +95,75 @@ struct _tagNodeInfo {
     uint16_t error;    // 0: no error 1: parse error
 };
 
+// one file of createIfdTableArrayBatch()
+typedef struct _exifBatchItem {
+    const char *fileName;  // [in] target JPEG file
+    void **ifdArray;       // [out] same as the return value of createIfdTableArray()
+    int result;            // [out] same as the result of createIfdTableArray()
+    unsigned int reads;    // [out] number of read requests issued for the file
+} ExifBatchItem;
+
+// zero-copy view over the data written by serializeIfdTableArray()
+typedef struct _exifBlobView {
+    const uint8_t *data;
+    size_t length;
+    unsigned int ifdCount;
+    unsigned int entryCount;
+} ExifBlobView;
+
+// tag inside an ExifBlobView
+typedef struct _exifBlobTag {
+    uint16_t tagId;
+    uint16_t type;
+    unsigned int count;
+    uint16_t error;
+    const uint8_t *values; // points into the view, little-endian,
+                           // NULL on error or when count is 0
+} ExifBlobTag;
+
+// I/O backend of the *IO() functions
+//  readAt : reads up to 'length' bytes at 'offset', returns the number of
+//           bytes read, 0 at the end of the data or -1 on error
+//  size   : returns the total length of the data or -1 if it is not known
+//  write  : appends 'length' bytes to the output, returns the number of
+//           bytes written or -1 on error. NULL for the input-only backends
+//  close  : releases the context, may be NULL
+typedef struct _exifIO {
+    int64_t (*readAt)(void *context, int64_t offset, void *buf, size_t length);
+    int64_t (*size)(void *context);
+    int64_t (*write)(void *context, const void *buf, size_t length);
+    void (*close)(void *context);
+    void *context;
+} ExifIO;
+
+// context of the memory backend, see initExifMemoryIO()
+typedef struct _exifMemoryIO {
+    const uint8_t *data;   // data read by readAt
+    size_t length;
+    uint8_t *out;          // data appended by write, release with free()
+    size_t outLength;
+    size_t outCapacity;
+} ExifMemoryIO;
+
+// context of the range backend, see initExifRangeIO()
+typedef struct _exifRangeIO {
+    ExifIO *base;          // backend the range is read from
+    int64_t offset;        // start of the range in the base
+    int64_t length;        // length of the range, -1 up to the end
+} ExifRangeIO;
+
+// statistics of the planned backend, see openExifPlannedIO()
+typedef struct _exifReadStats {
+    unsigned int roundTrips;   // reads issued to the underlying backend
+    unsigned int ranges;       // coalesced ranges fetched after the prefix
+    unsigned int reads;        // reads served to the parser
+    unsigned int misses;       // reads that were not covered by the plan
+    uint64_t bytesFetched;     // bytes read from the underlying backend
+} ExifReadStats;
+
+// default size of the speculative prefix read of openExifPlannedIO()
+#define EXIF_PLAN_PREFIX_SIZE   (64 * 1024)
+
 typedef struct _image_dir_ent
 {
 	uint32_t ImageFlags;
@@ -102,6 +172,28 @@ typedef struct _image_dir_ent
 	uint16_t Image1EntryNum;
 	uint16_t Image2EntryNum;
 } IMAGE_DIR_ENT;
+
+// one image of an MPO file, see getMpoEntries()
+typedef struct _exifMpoEntry {
+    uint32_t flags;         // individual image attribute (flags and type)
+    uint32_t length;        // size of the image in bytes
+    int64_t offset;         // start of the image from the beginning of the file
+    uint16_t dependent1;    // dependent image 1 entry number
+    uint16_t dependent2;    // dependent image 2 entry number
+} ExifMpoEntry;
+
+// embedded JPEG preview, see getExifPreviews()
+typedef struct _exifPreview {
+    int source;             // EXIF_PREVIEW_IFD1 or EXIF_PREVIEW_MPF
+    int index;              // MP entry index of an MPF image
+    int64_t offset;         // start of the JPEG data from the beginning of the file
+    uint32_t length;        // size of the JPEG data in bytes
+    uint16_t width;         // dimensions in its frame header (SOF)
+    uint16_t height;
+} ExifPreview;
+
+#define EXIF_PREVIEW_IFD1   1   // thumbnail of the 1st IFD
+#define EXIF_PREVIEW_MPF    2   // image of the MPF segment
 /**
  * Note:
  *
@@ -141,6 +233,9 @@ typedef struct _image_dir_ent
 #define ERR_ALREADY_EXIST       -11
 #define ERR_UNKNOWN             -12
 #define ERR_MEMALLOC            -13
+#define ERR_INVALID_DATA        -14
+#define ERR_UNSUPPORTED_JPEG    -15
+#define ERR_BUSY                -16
 
 // public funtions
 
@@ -176,99 +271,1294 @@ int removeExifSegmentFromJPEGFile(const char *inJPEGFileName,
                                   const char *outJPGEFileName);
 
 /**
- * fillIfdTableArray()
+ * removeExifSegmentFromJPEGIO()
+ *
+ * Remove the Exif segment from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *  same as removeExifSegmentFromJPEGFile()
+ */
+int removeExifSegmentFromJPEGIO(ExifIO *in, ExifIO *out);
+
+/**
+ * fillIfdTableArray()
+ *
+ * Parse the JPEG header and fill in the IFD table
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] ifdArray[32] : array of IfdTable pointers
+ *
+ * return
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ */
+int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32]);
+
+/**
+ * fillIfdTableArrayFromStream()
+ *
+ * Parse the JPEG header read from an opened stream and fill in the IFD table
+ *
+ * parameters
+ *  [in] fp : stream opened in binary mode
+ *  [out] ifdArray[32] : array of IfdTable pointers
+ *
+ * return
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ */
+int fillIfdTableArrayFromStream(FILE *fp, void* ifdArray[32]);
+
+/**
+ * fillIfdTableArrayFromIO()
+ *
+ * Parse the JPEG header read through an I/O backend and fill in the IFD table
+ *
+ * parameters
+ *  [in] io : input backend
+ *  [out] ifdArray[32] : array of IfdTable pointers
+ *
+ * return
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ */
+int fillIfdTableArrayFromIO(ExifIO *io, void* ifdArray[32]);
+
+/**
+ * createIfdTableArrayFromIO()
+ *
+ * Parse the JPEG header read through an I/O backend and create the
+ * pointer array of the IFD tables
+ *
+ * parameters
+ *  [in] io : input backend
+ *  [out] result : result status value, same as createIfdTableArray()
+ *
+ * return
+ *   NULL: error or no Exif segment
+ *  !NULL: pointer array of the IFD tables
+ */
+void **createIfdTableArrayFromIO(ExifIO *io, int *result);
+
+/**
+ * openExifFileIO()
+ *
+ * Open a file as an I/O backend
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [in] fileName : target file
+ *  [in] forWrite : 0: open for reading  1: create for writing
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *
+ * note
+ * The backend must be released with closeExifIO(). A file opened for
+ * reading is read with positional reads, see openExifFdIO().
+ */
+int openExifFileIO(ExifIO *io, const char *fileName, int forWrite);
+
+/**
+ * openExifFdIO()
+ *
+ * Set up a read-only I/O backend over an opened file descriptor. The
+ * reads are positional (pread), the file position is neither used nor
+ * moved, so one descriptor can be shared by the backends of several
+ * threads parsing the same file at the same time.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [in] fd : file descriptor opened for reading
+ *
+ * return
+ *   0: OK
+ *  ERR_READ_FILE : invalid descriptor or not supported on the platform
+ *
+ * note
+ * closeExifIO() does not close the descriptor.
+ */
+int openExifFdIO(ExifIO *io, int fd);
+
+/**
+ * initExifMemoryIO()
+ *
+ * Set up an I/O backend over memory. Reads are served from 'data' and
+ * writes are appended to mem->out.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [out] mem : context of the backend, must outlive the backend
+ *  [in] data : data to read, may be NULL for an output-only backend
+ *  [in] length : length of the data
+ */
+void initExifMemoryIO(ExifIO *io, ExifMemoryIO *mem,
+                      const void *data, size_t length);
+
+/**
+ * initExifRangeIO()
+ *
+ * Set up a read-only I/O backend over a range of another backend, e.g.
+ * one image of an MPO file. Offset 0 of the backend is 'offset' of the
+ * base, and nothing beyond the range is read.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [out] range : context of the backend, must outlive the backend
+ *  [in] base : backend the range is read from, must outlive the backend
+ *  [in] offset : start of the range
+ *  [in] length : length of the range, -1 up to the end of the base
+ */
+void initExifRangeIO(ExifIO *io, ExifRangeIO *range, ExifIO *base,
+                     int64_t offset, int64_t length);
+
+/**
+ * closeExifIO()
+ *
+ * Release an I/O backend
+ *
+ * parameters
+ *  [in] io : backend to release
+ */
+void closeExifIO(ExifIO *io);
+
+/**
+ * openExifPlannedIO()
+ *
+ * Set up a read planner over a backend with expensive range reads
+ * (network file systems, object storage). The first 'prefixSize' bytes
+ * are read speculatively, the JPEG segment chain is walked to find the
+ * Exif and MPF segments, and the parts of them beyond the prefix are
+ * fetched as a few coalesced range reads. The reads of the parser are
+ * then served from memory; a read outside of the plan is fetched on
+ * demand and counted as a miss.
+ *
+ * parameters
+ *  [out] io : backend to initialize
+ *  [in] base : underlying backend, must outlive the planned backend
+ *  [in] prefixSize : size of the speculative read, 0 for
+ *                    EXIF_PLAN_PREFIX_SIZE
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The backend is read-only and must be released with closeExifIO(),
+ * which does not close 'base'.
+ */
+int openExifPlannedIO(ExifIO *io, ExifIO *base, size_t prefixSize);
+
+/**
+ * getExifReadStats()
+ *
+ * Get the read statistics of a backend opened by openExifPlannedIO()
+ *
+ * parameters
+ *  [in] io : planned backend
+ *  [out] stats : statistics
+ *
+ * return
+ *   0: OK
+ *  ERR_INVALID_POINTER : 'io' is not a planned backend
+ */
+int getExifReadStats(const ExifIO *io, ExifReadStats *stats);
+
+/**
+ * getMpoEntries()
+ *
+ * List the images of an MPO file from the MP entries of its MPF segment
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] entries : array of the entries, may be NULL when maxEntries is 0
+ *  [in] maxEntries : size of the array
+ *
+ * return
+ *   n: number of the images, may be larger than maxEntries
+ *   0: the MPF segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
+ *      ERR_MEMALLOC
+ */
+int getMpoEntries(const char *JPEGFileName, ExifMpoEntry *entries, int maxEntries);
+
+/**
+ * getMpoEntriesFromIO()
+ *
+ * List the images of an MPO file read through an I/O backend, same as
+ * getMpoEntries()
+ */
+int getMpoEntriesFromIO(ExifIO *io, ExifMpoEntry *entries, int maxEntries);
+
+/**
+ * extractMpoFrameIO()
+ *
+ * Copy one image of an MPO file to the output in large blocks. Use the
+ * memory backend (initExifMemoryIO()) to get the image in a buffer.
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE : the image is out of the input
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int extractMpoFrameIO(ExifIO *in, const ExifMpoEntry *entry, ExifIO *out);
+
+/**
+ * extractMpoFrameToFd()
+ *
+ * Copy one image of an MPO file between file descriptors. The input is
+ * read at the offset of the image without moving its file position; the
+ * output is written at its current position. On Linux the data is copied
+ * in the kernel (copy_file_range) when the file systems allow it.
+ *
+ * parameters
+ *  [in] inFd : input file descriptor
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] outFd : output file descriptor
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE : the image is out of the input
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int extractMpoFrameToFd(int inFd, const ExifMpoEntry *entry, int outFd);
+
+/**
+ * extractMpoFrameToFile()
+ *
+ * Write one image of an MPO file to a new file, see extractMpoFrameToFd()
+ *
+ * parameters
+ *  [in] JPEGFileName : input MPO file
+ *  [in] entry : image to copy, from getMpoEntries()
+ *  [in] outFileName : file to create
+ *
+ * return
+ *   same as extractMpoFrameToFd()
+ */
+int extractMpoFrameToFile(const char *JPEGFileName, const ExifMpoEntry *entry,
+                          const char *outFileName);
+
+// progress of extractMpoFrames(), the calls are serialized
+//  framesDone / frameCount : images written completely so far / in total
+//  bytesDone / bytesTotal  : bytes copied so far / in total
+typedef void (*ExifMpoProgress)(void *context, int framesDone, int frameCount,
+                                uint64_t bytesDone, uint64_t bytesTotal);
+
+/**
+ * extractMpoFrames()
+ *
+ * Write every image of an MPO file to its own file on several threads.
+ * The images are split into chunks that the threads copy with positional
+ * reads and writes (copy_file_range on Linux) from one shared descriptor,
+ * so a few large images are spread over the threads too.
+ *
+ * parameters
+ *  [in] JPEGFileName : input MPO file
+ *  [in] outFormat : printf format of the output file names with one %d
+ *                   for the image index, e.g. "frame%d.jpg"
+ *  [in] threads : number of threads, 0 for the number of CPUs
+ *  [in] progress : called after each chunk, may be NULL
+ *  [in] context : passed to progress
+ *
+ * return
+ *   n: number of the images written
+ *   0: the MPF segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
+ *      ERR_MEMALLOC
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * Without POSIX threads the images are written one after another.
+ */
+int extractMpoFrames(const char *JPEGFileName, const char *outFormat, int threads,
+                     ExifMpoProgress progress, void *context);
+
+/**
+ * getExifPreviews()
+ *
+ * List the JPEG previews embedded in a JPEG file: the thumbnail of the
+ * 1st IFD and the images of the MPF segment other than the primary one.
+ * The dimensions are read from the frame header of each preview, which
+ * is found by walking its segments; nothing is copied or decoded.
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] previews : array of the previews, may be NULL when maxPreviews is 0
+ *  [in] maxPreviews : size of the array
+ *
+ * return
+ *   n: number of the previews, may be larger than maxPreviews
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_MEMALLOC
+ *
+ * note
+ * A preview whose frame header cannot be read, or whose data runs past
+ * the end of the file, is left out.
+ */
+int getExifPreviews(const char *JPEGFileName, ExifPreview *previews, int maxPreviews);
+
+/**
+ * getExifPreviewsFromIO()
+ *
+ * Same as getExifPreviews() for a JPEG read through an I/O backend
+ */
+int getExifPreviewsFromIO(ExifIO *io, ExifPreview *previews, int maxPreviews);
+
+/**
+ * selectExifPreview()
+ *
+ * Choose the smallest preview that is at least minWidth x minHeight
+ *
+ * parameters
+ *  [in] previews : from getExifPreviews()
+ *  [in] count : number of the previews
+ *  [in] minWidth : required width
+ *  [in] minHeight : required height
+ *
+ * return
+ *   n: index of the preview
+ *  -1: no preview is large enough, the primary image has to be used
+ */
+int selectExifPreview(const ExifPreview *previews, int count,
+                      unsigned int minWidth, unsigned int minHeight);
+
+/**
+ * openMpoFrameReader()
+ *
+ * Open an MPO file to read the Exif data of each image on demand. Only
+ * the MP entries are read here; getMpoFrameIfdTableArray() parses the
+ * segments of one image within its byte range when it is first asked
+ * for, and keeps the result.
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] result : result status
+ *   n: number of the images
+ *   0: the MPF segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_IFD
+ *      ERR_MEMALLOC
+ *
+ * return
+ *   NULL: error or no MPF segment
+ *  !NULL: reader, release with closeMpoFrameReader()
+ *
+ * note
+ * A reader must not be used by several threads at the same time.
+ */
+void *openMpoFrameReader(const char *JPEGFileName, int *result);
+
+/**
+ * openMpoFrameReaderFromIO()
+ *
+ * Same as openMpoFrameReader() for a file read through an I/O backend.
+ * The backend must outlive the reader and is not closed with it.
+ */
+void *openMpoFrameReaderFromIO(ExifIO *io, int *result);
+
+/**
+ * getMpoFrameIfdTableArray()
+ *
+ * Get the IFD tables of one image of an MPO file. The first call for an
+ * image parses it; the later calls return the same tables.
+ *
+ * parameters
+ *  [in] reader : from openMpoFrameReader()
+ *  [in] index : image index, 0 for the first image
+ *  [out] result : result status value, same as createIfdTableArray(),
+ *                 ERR_INVALID_POINTER if the index is out of range
+ *
+ * return
+ *   NULL: error or no Exif segment in the image
+ *  !NULL: pointer array of the IFD tables, owned by the reader and
+ *         released with closeMpoFrameReader()
+ */
+void **getMpoFrameIfdTableArray(void *reader, int index, int *result);
+
+/**
+ * getMpoFrameEntry()
+ *
+ * Get the MP entry of one image of an MPO file
+ *
+ * parameters
+ *  [in] reader : from openMpoFrameReader()
+ *  [in] index : image index
+ *
+ * return
+ *   NULL: the index is out of range
+ *  !NULL: entry, owned by the reader
+ */
+const ExifMpoEntry *getMpoFrameEntry(void *reader, int index);
+
+/**
+ * closeMpoFrameReader()
+ *
+ * Release a reader and the IFD tables it keeps
+ *
+ * parameters
+ *  [in] reader : from openMpoFrameReader()
+ */
+void closeMpoFrameReader(void *reader);
+
+/**
+ * createIfdTableArray()
+ *
+ * Parse the JPEG header and create the pointer array of the IFD tables
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] result : result status value 
+ *   n: number of IFD tables
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *
+ * return
+ *   NULL: error or no Exif segment
+ *  !NULL: pointer array of the IFD tables
+ */
+void **createIfdTableArray(const char *JPEGFileName, int *result);
+
+/**
+ * createIfdTableArrayBatch()
+ *
+ * Parse the JPEG headers of many files at once
+ *
+ * On Linux the opens and the reads of the first chunkSize bytes of up to
+ * 'depth' files are submitted together through io_uring. A file is parsed
+ * as soon as its first chunk arrives; another read is queued only when its
+ * Exif or MPF segment lies beyond the bytes read so far. Without io_uring,
+ * or on kernels whose io_uring lacks IORING_OP_OPENAT/IORING_OP_READ
+ * (before 5.6), the files are parsed one by one with createIfdTableArray().
+ * Either way the metadata cache (see openIfdTableCache()) is looked up
+ * before a file is opened and updated after it is parsed, as
+ * createIfdTableArray() does.
+ *
+ * parameters
+ *  [in/out] items : array of files to parse, results are stored in place
+ *  [in] count : number of items
+ *  [in] chunkSize : bytes read from the beginning of each file first
+ *  [in] depth : maximum number of files in flight
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * Each items[i].ifdArray must be freed with freeIfdTableArray().
+ */
+int createIfdTableArrayBatch(ExifBatchItem *items, int count,
+                             unsigned int chunkSize, unsigned int depth);
+
+/**
+ * openIfdTableCache()
+ *
+ * Open or create the metadata cache used by createIfdTableArray()
+ *
+ * While the cache is open, createIfdTableArray() looks the file up by
+ * (device, inode, size, mtime) in a memory-mapped hash table before
+ * touching the JPEG, and stores the parsed IFD tables on a miss.
+ * Several processes may share the cache file: a lookup holds a shared
+ * lock (flock) on it and a store an exclusive one, only for the time of
+ * the access. A lookup made while another process holds the exclusive
+ * lock counts as a miss, and a store is skipped while the file is locked.
+ * Not available on Windows.
+ *
+ * parameters
+ *  [in] cacheFileName : cache file
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_WRITE_FILE
+ *      ERR_BUSY : another process kept the file locked for a second
+ *      ERR_MEMALLOC
+ *      ERR_UNKNOWN
+ */
+int openIfdTableCache(const char *cacheFileName);
+
+/**
+ * closeIfdTableCache()
+ *
+ * Close the metadata cache opened by openIfdTableCache()
+ */
+void closeIfdTableCache(void);
+
+/**
+ * freeIfdTables()
+ *
+ * Free the pointer array of the IFD tables
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ */
+void freeIfdTables(void* ifdArray[32]);
+
+/**
+ * freeIfdTableArray()
+ *
+ * Free the pointer array of the IFD tables
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ */
+void freeIfdTableArray(void **ifdArray);
+
+/**
+ * getIfdType()
+ *
+ * Returns the type of the IFD
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *
+ * return
+ *  IFD TYPE value
+ */
+IFD_TYPE getIfdType(void *ifd);
+
+/**
+ * dumpIfdTable()
+ *
+ * Dump the IFD table
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [in] filename: not used, the dump never reads or writes files
+ */
+void dumpIfdTable(void *ifd, const char *filename);
+
+/**
+ * dumpIfdTableArray()
+ *
+ * Dump the array of the IFD tables
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] filename: not used, the dump never reads or writes files
+ */
+void dumpIfdTableArray(void **ifdArray, const char *filename);
+
+// options of getIfdTableArrayJson() and friends
+#define EXIF_JSON_HEX        0x01  // binary data as hex instead of base64
+#define EXIF_JSON_THUMBNAIL  0x02  // include the 1st IFD thumbnail
+
+/**
+ * getIfdTableArrayJson()
+ *
+ * Get the IFD tables as a JSON object
+ *
+ * The object has one member per IFD ("0TH", "1ST", "EXIF", "GPS",
+ * "Interoperability", "MPF", then "MPF_2" and so on if a type repeats)
+ * holding the tags keyed by name, or by "0xXXXX" for unknown tags; only
+ * the first of repeated tags is written. A single number is written as a scalar and
+ * several as an array, rationals as [numerator,denominator] pairs,
+ * ASCII as a string and UNDEFINED as a base64 (or hex) string.
+ * Tags that failed to parse are null.
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [out] pp : NUL terminated JSON text, NULL if memory ran out
+ *             The caller must free it after this function returns.
+ *
+ * return
+ *  length of the JSON text
+ */
+size_t getIfdTableArrayJson(void **ifdArray, int flags, char **pp);
+
+/**
+ * writeIfdTableArrayJson()
+ *
+ * Write the IFD tables as a JSON object to the stream
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [in] fp : output stream
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
+ */
+int writeIfdTableArrayJson(void **ifdArray, int flags, FILE *fp);
+
+// frame of the primary image, from the segments up to the first SOS
+// sampling[] holds the factors of each component as (H << 4) | V.
+// quality is the IJG quality factor (as given to cjpeg -quality) whose
+// scaled Annex K tables are the closest to the tables of the luminance
+// and the first chrominance component; only getJpegInfo() estimates it,
+// it is 0 in ExifSummary.jpeg.
+typedef struct _exifJpegInfo {
+    uint8_t sofMarker;              // SOFn marker (0xC0-0xCF), 0: not found
+    uint8_t precision;              // bits per sample
+    uint8_t components;             // number of components
+    uint8_t progressive;            // 1: progressive (SOF2, SOF6, SOF10, SOF14)
+    uint8_t arithmetic;             // 1: arithmetic coding (SOF9-SOF15)
+    uint8_t subsampling;            // EXIF_JPEG_SUBSAMPLING_xxx
+    uint8_t scanComponents;         // components of the first scan, 0: no SOS
+    uint8_t quality;                // IJG quality estimated from DQT, 0: no table
+    uint16_t width;                 // number of samples per line
+    uint16_t height;                // number of lines, 0: defined by DNL
+    uint16_t restartInterval;       // DRI before the first scan, 0: none
+    uint8_t qualityExact;           // 1: the tables are those of IJG at 'quality'
+    uint8_t quantTables;            // number of DQT tables before the first scan
+    uint8_t componentId[4];
+    uint8_t sampling[4];
+    uint8_t quantTable[4];          // DQT table of each component
+    int64_t sofOffset;              // offset of the SOFn marker
+    int64_t sosOffset;              // offset of the first SOS marker
+} ExifJpegInfo;
+
+#define EXIF_JPEG_SUBSAMPLING_UNKNOWN   0
+#define EXIF_JPEG_SUBSAMPLING_GRAY      1   // single component
+#define EXIF_JPEG_SUBSAMPLING_444       2
+#define EXIF_JPEG_SUBSAMPLING_422       3   // chroma halved horizontally
+#define EXIF_JPEG_SUBSAMPLING_420       4   // chroma halved both ways
+#define EXIF_JPEG_SUBSAMPLING_440       5   // chroma halved vertically
+#define EXIF_JPEG_SUBSAMPLING_411       6   // chroma quartered horizontally
+#define EXIF_JPEG_SUBSAMPLING_OTHER     7   // 4 components or other factors
+
+// common fields filled by getExifSummary() without building the IFD tables
+// Strings are NUL terminated (and truncated to fit), rationals are kept as
+// numerator/denominator pairs, a field is valid only if its EXIF_SUMMARY_xxx
+// bit is set in 'present'.
+typedef struct _exifSummary {
+    uint32_t present;
+    uint16_t orientation;           // Orientation
+    uint8_t gpsAltitudeRef;         // GPSAltitudeRef, 1: below sea level
+    char gpsLatitudeRef;            // GPSLatitudeRef, 'N' or 'S'
+    char gpsLongitudeRef;           // GPSLongitudeRef, 'E' or 'W'
+    char reserved[3];
+    uint32_t pixelWidth;            // PixelXDimension, or ImageWidth of the 0th IFD
+    uint32_t pixelHeight;           // PixelYDimension, or ImageLength of the 0th IFD
+    uint32_t iso;                   // PhotographicSensitivity
+    uint32_t exposureTime[2];       // ExposureTime
+    uint32_t fNumber[2];            // FNumber
+    uint32_t focalLength[2];        // FocalLength
+    uint32_t gpsLatitude[6];        // GPSLatitude, degrees, minutes, seconds
+    uint32_t gpsLongitude[6];       // GPSLongitude
+    uint32_t gpsAltitude[2];        // GPSAltitude
+    char dateTimeOriginal[20];      // DateTimeOriginal "YYYY:MM:DD HH:MM:SS"
+    char subSecTimeOriginal[12];    // SubSecTimeOriginal
+    char offsetTimeOriginal[8];     // OffsetTimeOriginal "+HH:MM"
+    char make[64];                  // Make
+    char model[64];                 // Model
+    char lensModel[64];             // LensModel
+    ExifJpegInfo jpeg;              // frame of the primary image
+} ExifSummary;
+
+#define EXIF_SUMMARY_MAKE               0x00000001
+#define EXIF_SUMMARY_MODEL              0x00000002
+#define EXIF_SUMMARY_DATETIME_ORIGINAL  0x00000004
+#define EXIF_SUMMARY_SUBSEC_ORIGINAL    0x00000008
+#define EXIF_SUMMARY_OFFSET_ORIGINAL    0x00000010
+#define EXIF_SUMMARY_ORIENTATION        0x00000020
+#define EXIF_SUMMARY_PIXEL_WIDTH        0x00000040
+#define EXIF_SUMMARY_PIXEL_HEIGHT       0x00000080
+#define EXIF_SUMMARY_EXPOSURE_TIME      0x00000100
+#define EXIF_SUMMARY_FNUMBER            0x00000200
+#define EXIF_SUMMARY_ISO                0x00000400
+#define EXIF_SUMMARY_FOCAL_LENGTH       0x00000800
+#define EXIF_SUMMARY_LENS_MODEL         0x00001000
+#define EXIF_SUMMARY_GPS_LATITUDE       0x00002000  // GPSLatitude and GPSLatitudeRef
+#define EXIF_SUMMARY_GPS_LONGITUDE      0x00004000  // GPSLongitude and GPSLongitudeRef
+#define EXIF_SUMMARY_GPS_ALTITUDE       0x00008000  // GPSAltitude (GPSAltitudeRef 0 if absent)
+#define EXIF_SUMMARY_JPEG_FRAME         0x00010000  // jpeg, the SOFn segment was found
+
+// values of an ExifSummary converted by convertExifSummaryArray()
+// A value is valid only if its EXIF_SUMMARY_xxx bit is set in 'present';
+// EXIF_SUMMARY_OFFSET_ORIGINAL tells that dateTimeOriginal is in UTC,
+// otherwise it is the local time of the camera taken as UTC.
+typedef struct _exifSummaryValues {
+    uint32_t present;
+    uint32_t reserved;
+    int64_t dateTimeOriginal;       // microseconds since 1970-01-01 00:00:00
+    double exposureTime;            // seconds
+    double fNumber;
+    double focalLength;             // mm
+    double gpsLatitude;             // degrees, negative for south
+    double gpsLongitude;            // degrees, negative for west
+    double gpsAltitude;             // meters, negative below sea level
+} ExifSummaryValues;
+
+// results of convertDateTimeToEpoch()
+#define EXIF_TIME_INVALID  0
+#define EXIF_TIME_UTC      1   // the offset was applied
+#define EXIF_TIME_LOCAL    2   // no valid offset, local time taken as UTC
+
+// column of the columnar export
+typedef struct _exifColumnSpec {
+    IFD_TYPE ifdType;  // IFD_UNKNOWN: the first of the 0th, Exif and GPS IFDs having the tag
+    uint16_t tagId;
+} ExifColumnSpec;
+
+// tag of the presence query, set by initExifTagQuery()
+typedef struct _exifTagQuery {
+    IFD_TYPE ifdType;  // IFD_UNKNOWN: any of the 0th, Exif and GPS IFDs
+    uint16_t tagId;
+    int16_t bit;       // bit of the tag in the presence bitmap, -1 if none
+} ExifTagQuery;
+
+// output formats of the columnar export
+#define EXIF_EXPORT_CSV    1
+#define EXIF_EXPORT_TSV    2
+#define EXIF_EXPORT_ARROW  3  // Arrow IPC stream
+
+/**
+ * getExifSummary()
+ *
+ * Fill the ExifSummary of a JPEG file
+ *
+ * The Exif segment is read with a single read and the 0th, Exif and GPS
+ * IFD entries are scanned in place, without building the IFD tables.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] summary : the fields found
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int getExifSummary(const char *JPEGFileName, ExifSummary *summary);
+
+/**
+ * getExifSummaryFromIO()
+ *
+ * Fill the ExifSummary from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] io : input backend
+ *  [out] summary : the fields found
+ *
+ * return
+ *  same as getExifSummary()
+ */
+int getExifSummaryFromIO(ExifIO *io, ExifSummary *summary);
+
+/**
+ * getExifSummaryFromSegment()
+ *
+ * Fill the ExifSummary from an Exif segment already in memory
+ *
+ * parameters
+ *  [in] segment : contents of the APP1 segment following its length
+ *                 field, starting with "Exif\0\0"
+ *  [in] length : length of the segment data
+ *  [out] summary : the fields found
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ */
+int getExifSummaryFromSegment(const uint8_t *segment, size_t length,
+                              ExifSummary *summary);
+
+/**
+ * getJpegInfo()
+ *
+ * Get the frame of the primary image of a JPEG file
+ *
+ * The segments are walked from the SOI marker to the first SOS marker,
+ * only their markers and lengths are read, plus the contents of the
+ * SOFn, DQT, DRI and SOS segments. The dimensions are those of the encoded
+ * image, which may differ from the PixelX/YDimension tags after an edit.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] info : the frame
+ *
+ * return
+ *   1: OK
+ *   0: no SOFn segment before the first SOS or EOI
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * getExifSummary() fills ExifSummary.jpeg in the same walk, except for
+ * the quality: comparing the DQT tables is left to this function.
+ */
+int getJpegInfo(const char *JPEGFileName, ExifJpegInfo *info);
+
+/**
+ * getJpegInfoFromIO()
+ *
+ * Same as getJpegInfo() for a JPEG read through an I/O backend
+ */
+int getJpegInfoFromIO(ExifIO *io, ExifJpegInfo *info);
+
+/**
+ * getJpegSubsamplingName()
+ *
+ * Get the name of an EXIF_JPEG_SUBSAMPLING_xxx value, e.g. "4:2:0"
+ */
+const char *getJpegSubsamplingName(int subsampling);
+
+// flags of verifyJPEGFile()
+#define EXIF_VERIFY_CHECK_MPF       0x0001  // check the image ranges of the MPF segment
+
+// problems reported by verifyJPEGFile()
+#define EXIF_VERIFY_NOT_JPEG        0x0001  // no SOI marker
+#define EXIF_VERIFY_BAD_MARKER      0x0002  // the chain of the segments is broken
+#define EXIF_VERIFY_TRUNCATED       0x0004  // the file ends within the header segments
+#define EXIF_VERIFY_NO_SOF          0x0008  // no SOFn segment before the first SOS
+#define EXIF_VERIFY_NO_SOS          0x0010  // EOI before the first SOS
+#define EXIF_VERIFY_NO_EOI          0x0020  // the file does not end with EOI
+#define EXIF_VERIFY_BAD_MPF         0x0040  // invalid MPF segment or image out of the file
+
+/**
+ * verifyJPEGFile()
+ *
+ * Check that a JPEG file is complete without decoding it
+ *
+ * The segments are walked from the SOI marker to the first SOS marker,
+ * reading only their markers and lengths, and the last 2 bytes of the
+ * file must be the EOI marker. A file cut during an upload fails one of
+ * them. Only a few reads are made: the header is read in 4 KB blocks,
+ * and the MP entries checked by EXIF_VERIFY_CHECK_MPF come from the same
+ * blocks.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [in] flags : EXIF_VERIFY_CHECK_MPF or 0
+ *  [out] pProblems : EXIF_VERIFY_xxx bits of the problems found
+ *
+ * return
+ *   1: OK
+ *   0: a problem was found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * Data after the EOI marker (e.g. padding appended by some cameras) is
+ * reported as EXIF_VERIFY_NO_EOI, the scan data itself is not checked.
+ */
+int verifyJPEGFile(const char *JPEGFileName, int flags, unsigned int *pProblems);
+
+/**
+ * verifyJPEGFromIO()
+ *
+ * Same as verifyJPEGFile() for a JPEG read through an I/O backend, the
+ * backend must report its size
+ */
+int verifyJPEGFromIO(ExifIO *io, int flags, unsigned int *pProblems);
+
+// one file of getJpegPixelHashBatch()
+typedef struct _exifPixelHashItem {
+    const char *fileName;   // [in] target JPEG file
+    uint64_t hash;          // [out] hash of the image data
+    int result;             // [out] same as the return value of getJpegPixelHash()
+} ExifPixelHashItem;
+
+/**
+ * getJpegPixelHash()
+ *
+ * Hash the image data of a JPEG file regardless of its metadata
+ *
+ * The segments defining the pixels (DQT, DHT, SOFn, DRI, SOS, ...) and
+ * the entropy-coded data are hashed with XXH3 (64-bit), from SOI to the
+ * EOI of the primary image. The APPn and COM segments are skipped, so a
+ * copy with the Exif segment removed or edited has the same hash. The
+ * file is read in 1 MB blocks.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] pHash : hash of the image data
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG : no SOI or SOS, or a broken segment
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The hash is that of the bytes as encoded, the same pixels encoded with
+ * other tables or another order of the segments hash differently.
+ */
+int getJpegPixelHash(const char *JPEGFileName, uint64_t *pHash);
+
+/**
+ * getJpegPixelHashFromIO()
+ *
+ * Same as getJpegPixelHash() for a JPEG read through an I/O backend, the
+ * backend must report its size
+ */
+int getJpegPixelHashFromIO(ExifIO *io, uint64_t *pHash);
+
+/**
+ * getJpegPixelHashBatch()
+ *
+ * Hash the image data of many files on several threads
+ *
+ * parameters
+ *  [in/out] items : files to hash, the results are stored in place
+ *  [in] count : number of items
+ *  [in] threads : number of threads, 0 or less: one per CPU
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * Without POSIX threads the files are hashed one after another.
+ */
+int getJpegPixelHashBatch(ExifPixelHashItem *items, int count, int threads);
+
+// 128-bit fingerprint of the Exif metadata
+typedef struct _exifFingerprint {
+    uint64_t high;
+    uint64_t low;
+} ExifFingerprint;
+
+// one file of getExifFingerprintBatch()
+typedef struct _exifFingerprintItem {
+    const char *fileName;           // [in] target JPEG file
+    ExifFingerprint fingerprint;    // [out] fingerprint of the metadata
+    int result;                     // [out] same as the return value of getExifFingerprint()
+} ExifFingerprintItem;
+
+/**
+ * getExifFingerprintOnIfdTableArray()
+ *
+ * Compute a 128-bit fingerprint of the Exif metadata of parsed IFD tables
+ *
+ * The tables are hashed in a canonical form that does not depend on how
+ * the segment was written: the 0th, 1st, Exif, GPS and Interoperability
+ * IFDs in this order, the tags of each IFD sorted by ID, the values in
+ * host order whatever the byte order of the file, the BYTE, SHORT and
+ * LONG types (and the signed ones) as one integer type, and the trailing
+ * NULs of ASCII values dropped. The IFD pointers, the thumbnail and strip
+ * offsets and the Padding tag are left out, the thumbnail data is hashed.
+ * The hash is XXH3 (128-bit).
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] pFingerprint : fingerprint of the metadata
+ *
+ * return
+ *   1: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * note
+ * The MPF IFD and the maker note internals are not normalized: a maker
+ * note is hashed as its bytes.
+ */
+int getExifFingerprintOnIfdTableArray(void **ifdTableArray, ExifFingerprint *pFingerprint);
+
+/**
+ * getExifFingerprint()
+ *
+ * Compute a 128-bit fingerprint of the Exif metadata of a JPEG file
+ *
+ * The file is parsed with createIfdTableArray() and the tables are hashed
+ * by getExifFingerprintOnIfdTableArray(). Two files have the same
+ * fingerprint when their Exif segments hold the same tags and values,
+ * even if one was rewritten in the other byte order, with the tags in
+ * another order or with other padding.
+ *
+ * parameters
+ *  [in] JPEGFileName : target JPEG file
+ *  [out] pFingerprint : fingerprint of the metadata, zero without Exif
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ */
+int getExifFingerprint(const char *JPEGFileName, ExifFingerprint *pFingerprint);
+
+/**
+ * getExifFingerprintFromIO()
+ *
+ * Same as getExifFingerprint() for a JPEG read through an I/O backend
+ */
+int getExifFingerprintFromIO(ExifIO *io, ExifFingerprint *pFingerprint);
+
+/**
+ * getExifFingerprintBatch()
+ *
+ * Compute the Exif fingerprints of many files on several threads
+ *
+ * parameters
+ *  [in/out] items : files to fingerprint, the results are stored in place
+ *  [in] count : number of items
+ *  [in] threads : number of threads, 0 or less: one per CPU
+ *
+ * return
+ *   0: OK (the status of each file is in items[i].result)
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *
+ * note
+ * Without POSIX threads the files are parsed one after another.
+ */
+int getExifFingerprintBatch(ExifFingerprintItem *items, int count, int threads);
+
+/**
+ * convertRationalToDouble()
+ *
+ * Convert a RATIONAL value (e.g. TagNodeInfo.numData + 2 * i)
+ *
+ * parameters
+ *  [in] rational : numerator and denominator
+ *
+ * return
+ *  the value, NaN if the denominator is 0
+ */
+double convertRationalToDouble(const unsigned int *rational);
+
+/**
+ * convertSRationalToDouble()
+ *
+ * Convert a SRATIONAL value
+ *
+ * parameters
+ *  [in] rational : signed numerator and denominator
+ *
+ * return
+ *  the value, NaN if the denominator is 0
+ */
+double convertSRationalToDouble(const unsigned int *rational);
+
+/**
+ * convertGpsToDegrees()
+ *
+ * Convert a GPSLatitude or GPSLongitude value to decimal degrees
+ *
+ * parameters
+ *  [in] dms : degrees, minutes and seconds as 3 RATIONAL values
+ *  [in] ref : 'N', 'S', 'E' or 'W' from GPSLatitudeRef/GPSLongitudeRef
+ *  [out] pDegrees : degrees, negative for south and west
+ *
+ * return
+ *  1: OK
+ *  0: invalid value or reference
+ */
+int convertGpsToDegrees(const unsigned int *dms, char ref, double *pDegrees);
+
+/**
+ * convertDateTimeToEpoch()
  *
- * Parse the JPEG header and fill in the IFD table
+ * Convert an Exif date and time to microseconds since the Unix epoch
+ * without the C library time functions (no locale, no time zone lookup)
  *
  * parameters
- *  [in] JPEGFileName : target JPEG file
- *  [out] ifdArray[32] : array of IfdTable pointers
+ *  [in] dateTime : "YYYY:MM:DD HH:MM:SS"
+ *  [in] subSec : SubSecTime digits (fraction of the second), or NULL
+ *  [in] offset : OffsetTime "+HH:MM" or "-HH:MM", or NULL
+ *  [out] pMicros : microseconds since 1970-01-01 00:00:00 UTC
  *
  * return
- *   n: number of IFD tables
- *   0: the Exif segment is not found
- *  -n: error
- *      ERR_READ_FILE
- *      ERR_INVALID_JPEG
- *      ERR_INVALID_APP1HEADER
- *      ERR_INVALID_IFD
+ *  EXIF_TIME_UTC: OK, the offset was applied
+ *  EXIF_TIME_LOCAL: OK, no valid offset, the local time is taken as UTC
+ *  EXIF_TIME_INVALID: dateTime is not a valid date and time
  */
-int fillIfdTableArray(const char *JPEGFileName, void* ifdArray[32]);
+int convertDateTimeToEpoch(const char *dateTime, const char *subSec,
+                           const char *offset, int64_t *pMicros);
 
 /**
- * createIfdTableArray()
+ * convertExifSummaryArray()
  *
- * Parse the JPEG header and create the pointer array of the IFD tables
+ * Convert the rationals, GPS coordinates and date of ExifSummary records
+ * at once
  *
  * parameters
- *  [in] JPEGFileName : target JPEG file
- *  [out] result : result status value 
- *   n: number of IFD tables
- *   0: the Exif segment is not found
- *  -n: error
- *      ERR_READ_FILE
- *      ERR_INVALID_JPEG
- *      ERR_INVALID_APP1HEADER
- *      ERR_INVALID_IFD
+ *  [in] summaries : records filled by getExifSummary()
+ *  [in] count : number of the records
+ *  [out] values : converted values, count records
  *
  * return
- *   NULL: error or no Exif segment
- *  !NULL: pointer array of the IFD tables
+ *  number of the records converted
  */
-void **createIfdTableArray(const char *JPEGFileName, int *result);
+int convertExifSummaryArray(const ExifSummary *summaries, int count,
+                            ExifSummaryValues *values);
 
 /**
- * freeIfdTables()
+ * getTagIdFromName()
  *
- * Free the pointer array of the IFD tables
+ * Look up the tag ID by its name
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [in] ifdType : IFD TYPE the tag belongs to
+ *  [in] name : tag name (e.g. "Model")
+ *
+ * return
+ *  >=0: tag ID
+ *  ERR_NOT_EXIST
  */
-void freeIfdTables(void* ifdArray[32]);
+int getTagIdFromName(IFD_TYPE ifdType, const char *name);
 
 /**
- * freeIfdTableArray()
- *
- * Free the pointer array of the IFD tables
+ * openExifColumnWriter()
+ *
+ * Start a columnar export of the selected tags, one row per file.
+ * The rows are collected into column buffers and written in batches.
+ *
+ * The first column "file" holds the file name, the others are named
+ * after the tags (prefixed with the IFD name, e.g. "1ST.ImageWidth",
+ * when a name repeats). Missing tags are null (an empty field in
+ * CSV/TSV). ASCII values are written as is, numbers separated by spaces,
+ * rationals as "n/d" and UNDEFINED data as hex. In the Arrow IPC stream
+ * the tags that have a single integer value (Orientation, ImageWidth,
+ * PhotographicSensitivity, ...) are nullable Int64 columns, those that
+ * have a single rational value (ExposureTime, FNumber, GPSAltitude, ...)
+ * Float64 columns holding n/d, and the others Utf8 columns as above; a
+ * value of another type than expected is null. Each batch holds up to
+ * 65536 rows.
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [in] fp : output stream, opened in binary mode for EXIF_EXPORT_ARROW
+ *  [in] format : EXIF_EXPORT_CSV, EXIF_EXPORT_TSV or EXIF_EXPORT_ARROW
+ *  [in] columns : tags to export
+ *  [in] columnCount : number of the tags
+ *
+ * return
+ *  NULL: error (invalid argument or memory allocation)
+ *  !NULL: handle for addExifColumnRow() and closeExifColumnWriter()
  */
-void freeIfdTableArray(void **ifdArray);
+void *openExifColumnWriter(FILE *fp, int format,
+                           const ExifColumnSpec *columns, int columnCount);
 
 /**
- * getIfdType()
+ * addExifColumnRow()
  *
- * Returns the type of the IFD
+ * Add the row of a file to the columnar export
  *
  * parameters
- *  [in] ifd: target IFD
+ *  [in] writer : handle returned by openExifColumnWriter()
+ *  [in] fileName : value of the "file" column, NULL for null
+ *  [in] ifdArray : IFD tables of the file, NULL if it has none
  *
  * return
- *  IFD TYPE value
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
  */
-IFD_TYPE getIfdType(void *ifd);
+int addExifColumnRow(void *writer, const char *fileName, void **ifdArray);
 
 /**
- * dumpIfdTable()
+ * closeExifColumnWriter()
  *
- * Dump the IFD table
+ * Write the pending rows, finish the export and free the writer.
+ * The output stream is not closed.
  *
  * parameters
- *  [in] ifd: target IFD
+ *  [in] writer : handle returned by openExifColumnWriter()
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
  */
-void dumpIfdTable(void *ifd);
+int closeExifColumnWriter(void *writer);
 
 /**
- * dumpIfdTableArray()
+ * exportIfdTableColumns()
  *
- * Dump the array of the IFD tables
+ * Parse the files and export the selected tags, one row per file
+ * (see openExifColumnWriter())
  *
  * parameters
- *  [in] ifdArray : address of the IFD array
+ *  [in] fp : output stream
+ *  [in] format : EXIF_EXPORT_CSV, EXIF_EXPORT_TSV or EXIF_EXPORT_ARROW
+ *  [in] columns : tags to export
+ *  [in] columnCount : number of the tags
+ *  [in] fileNames : JPEG files
+ *  [in] fileCount : number of the files
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ *  ERR_WRITE_FILE
  */
-void dumpIfdTableArray(void **ifdArray);
+int exportIfdTableColumns(FILE *fp, int format,
+                          const ExifColumnSpec *columns, int columnCount,
+                          const char **fileNames, int fileCount);
 
 /**
  * getTagInfo()
@@ -331,6 +1621,43 @@ int queryTagNodeIsExist(void **ifdTableArray,
                         IFD_TYPE ifdType,
                         uint16_t tagId);
 
+/**
+ * initExifTagQuery()
+ *
+ * Set up a tag of the presence query, the bit of the tag in the presence
+ * bitmap is looked up here once instead of on every query
+ *
+ * parameters
+ *  [out] query : target ExifTagQuery
+ *  [in] ifdType : target IFD type, IFD_UNKNOWN matches the tag in any of
+ *                 the 0th, Exif and GPS IFDs
+ *  [in] tagId : target tag ID
+ */
+void initExifTagQuery(ExifTagQuery *query,
+                      IFD_TYPE ifdType,
+                      uint16_t tagId);
+
+/**
+ * queryTagNodesExist()
+ *
+ * Query the presence of the list of tags in a single call
+ *
+ * parameters
+ *  [in] ifdTableArray: address of the IFD tables array
+ *  [in] tags : tags to query, each set up by initExifTagQuery()
+ *  [in] count : number of the tags
+ *  [out] mask : bit i (mask[i / 64] >> (i % 64)) is set when tags[i]
+ *               exists, needs (count + 63) / 64 words
+ *
+ * return
+ *  >=0: number of the existing tags
+ *  ERR_INVALID_POINTER
+ */
+int queryTagNodesExist(void **ifdTableArray,
+                       const ExifTagQuery *tags,
+                       int count,
+                       uint64_t *mask);
+
 /**
  * createTagInfo()
  *
@@ -490,8 +1817,314 @@ int setThumbnailDataOnIfdTableArray(void **ifdTableArray,
                                     uint8_t *pData,
                                     unsigned int length);
 
+/**
+ * peekThumbnailDataOnIfdTableArray()
+ *
+ * Get the thumbnail data of the 1st IFD table without copying it
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : error status, same as getThumbnailDataOnIfdTableArray()
+ *
+ * return
+ *  NULL: error
+ * !NULL: the thumbnail data, owned by the IFD tables and valid until
+ *        they are freed or the thumbnail is replaced
+ */
+const uint8_t *peekThumbnailDataOnIfdTableArray(void **ifdTableArray,
+                                                unsigned int *pLength,
+                                                int *pResult);
+
+/**
+ * getExifThumbnailRange()
+ *
+ * Locate the thumbnail of the 1st IFD in a JPEG file without parsing the
+ * tags. Only the Exif segment header, the entry count and the next IFD
+ * offset of the 0th IFD, and the entries of the 1st IFD are read.
+ *
+ * parameters
+ *  [in] JPEGFileName : target file
+ *  [out] pOffset : returns the file offset of the thumbnail data
+ *  [out] pLength : returns the length of the thumbnail data
+ *
+ * return
+ *   1: OK
+ *   0: the Exif segment is not found
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_INVALID_APP1HEADER
+ *      ERR_INVALID_IFD
+ *      ERR_INVALID_POINTER
+ *      ERR_NOT_EXIST : no thumbnail
+ */
+int getExifThumbnailRange(const char *JPEGFileName, int64_t *pOffset,
+                          uint32_t *pLength);
+
+/**
+ * getExifThumbnailRangeFromIO()
+ *
+ * Same as getExifThumbnailRange() for a JPEG read through an I/O backend
+ */
+int getExifThumbnailRangeFromIO(ExifIO *io, int64_t *pOffset, uint32_t *pLength);
+
+/**
+ * getExifThumbnailFromBuffer()
+ *
+ * Locate the thumbnail of the 1st IFD in a JPEG file in memory (read or
+ * mapped by the caller), same as getExifThumbnailRange()
+ *
+ * parameters
+ *  [in] jpeg : the whole JPEG file
+ *  [in] length : length of the file
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : result status, same as getExifThumbnailRange()
+ *
+ * return
+ *  NULL: error or no thumbnail
+ * !NULL: the thumbnail data, pointing into 'jpeg'
+ */
+const uint8_t *getExifThumbnailFromBuffer(const uint8_t *jpeg, size_t length,
+                                          uint32_t *pLength, int *pResult);
+
+/**
+ * createThumbnailFromJPEGFile()
+ *
+ * Make a thumbnail of a baseline JPEG image without decoding it fully.
+ * Only the DC coefficient of each 8x8 block is kept, which gives the
+ * image at 1/8 scale; it is reduced by averaging to fit maxWidth x
+ * maxHeight and encoded as a small baseline JPEG.
+ *
+ * parameters
+ *  [in] JPEGFileName : source image
+ *  [in] maxWidth, maxHeight : size to fit in keeping the aspect ratio,
+ *                             e.g. 160 x 120; never enlarged
+ *  [in] quality : 1-100 as in the IJG library
+ *  [out] pLength : returns the length of the thumbnail data
+ *  [out] pResult : result status
+ *   0: OK
+ *  -n: error
+ *      ERR_READ_FILE
+ *      ERR_INVALID_JPEG
+ *      ERR_UNSUPPORTED_JPEG : progressive, arithmetic, 12-bit or CMYK
+ *      ERR_INVALID_POINTER
+ *      ERR_MEMALLOC
+ *
+ * return
+ *  NULL: error
+ * !NULL: the thumbnail data, the caller must free it
+ */
+uint8_t *createThumbnailFromJPEGFile(const char *JPEGFileName,
+                                     unsigned int maxWidth, unsigned int maxHeight,
+                                     int quality, unsigned int *pLength, int *pResult);
+
+/**
+ * createThumbnailFromJPEGIO()
+ *
+ * Same as createThumbnailFromJPEGFile() for an image read through an
+ * I/O backend
+ */
+uint8_t *createThumbnailFromJPEGIO(ExifIO *io,
+                                   unsigned int maxWidth, unsigned int maxHeight,
+                                   int quality, unsigned int *pLength, int *pResult);
+
+/**
+ * addGeneratedThumbnailToJPEGFile()
+ *
+ * Write a copy of a JPEG file with a thumbnail made by
+ * createThumbnailFromJPEGFile() in its 1st IFD, unless it already has
+ * one. A file without the Exif segment gets a new one.
+ *
+ * parameters
+ *  [in] inJPEGFileName : source file
+ *  [in] outJPEGFileName : output file, written only when 1 is returned
+ *  [in] maxWidth, maxHeight, quality : same as createThumbnailFromJPEGFile()
+ *
+ * return
+ *   1: OK
+ *   0: the file already has a thumbnail
+ *  -n: error, same as createThumbnailFromJPEGFile() and
+ *      updateExifSegmentInJPEGFile()
+ */
+int addGeneratedThumbnailToJPEGFile(const char *inJPEGFileName,
+                                    const char *outJPEGFileName,
+                                    unsigned int maxWidth, unsigned int maxHeight,
+                                    int quality);
+
+// receives the text of writeIfdTableDump() chunk by chunk
+typedef void (*ExifDumpWriter)(void *context, const char *text, size_t length);
+
+/**
+ * getIfdTableDump()
+ *
+ * Get the dump of the IFD table as a string
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [out] pp: dump string, NULL if the IFD is NULL or memory ran out
+ *            The caller must free it after this function returns.
+ */
 void getIfdTableDump(void *pIfd, char **pp);
 
+/**
+ * writeIfdTableDump()
+ *
+ * Pass the dump of the IFD table to a caller-supplied writer.
+ * The text is delivered in chunks as it is generated, so the whole dump
+ * is never held in memory.
+ *
+ * parameters
+ *  [in] ifd: target IFD
+ *  [in] writer: function receiving each chunk of the dump
+ *  [in] context: passed through to the writer
+ */
+void writeIfdTableDump(void *pIfd, ExifDumpWriter writer, void *context);
+
+/**
+ * streamIfdTableArrayJson()
+ *
+ * Pass the IFD tables as a JSON object (see getIfdTableArrayJson())
+ * to a caller-supplied writer. The text is delivered in chunks as it is
+ * generated.
+ *
+ * parameters
+ *  [in] ifdArray : address of the IFD array
+ *  [in] flags : EXIF_JSON_xxx options
+ *  [in] writer: function receiving each chunk of the JSON text
+ *  [in] context: passed through to the writer
+ *
+ * return
+ *  0: OK
+ *  ERR_INVALID_POINTER
+ *  ERR_MEMALLOC
+ */
+int streamIfdTableArrayJson(void **ifdArray, int flags,
+                            ExifDumpWriter writer, void *context);
+
+/**
+ * serializeIfdTableArray()
+ *
+ * Encode the IFD tables into a compact, versioned binary format.
+ * Tag ids, types, counts and values are packed contiguously in
+ * little-endian byte order.
+ *
+ * parameters
+ *  [in] ifdTableArray : address of the IFD tables array
+ *  [out] buf : output buffer, may be NULL to get the required size
+ *  [in] bufSize : size of the output buffer
+ *
+ * return
+ *   n: required size in bytes (nothing is written if larger than bufSize)
+ *   0: error
+ */
+size_t serializeIfdTableArray(void **ifdTableArray, uint8_t *buf, size_t bufSize);
+
+/**
+ * deserializeIfdTableArray()
+ *
+ * Create the pointer array of the IFD tables from the binary format
+ *
+ * parameters
+ *  [in] buf : data written by serializeIfdTableArray()
+ *  [in] length : length of the data
+ *  [out] pResult : result status
+ *   n: number of IFD tables
+ *  -n: error
+ *      ERR_INVALID_DATA
+ *      ERR_MEMALLOC
+ *
+ * return
+ *   NULL: error
+ *  !NULL: pointer array of the IFD tables
+ */
+void **deserializeIfdTableArray(const uint8_t *buf, size_t length, int *pResult);
+
+/**
+ * initExifBlobView()
+ *
+ * Check the binary format once and set up a view over it. The accessors
+ * below read the data in place and never allocate. The data must outlive
+ * the view.
+ *
+ * parameters
+ *  [out] view : the view
+ *  [in] buf : data written by serializeIfdTableArray()
+ *  [in] length : length of the data
+ *
+ * return
+ *   0: OK
+ *  -n: error
+ *      ERR_INVALID_POINTER
+ *      ERR_INVALID_DATA
+ */
+int initExifBlobView(ExifBlobView *view, const uint8_t *buf, size_t length);
+
+/**
+ * getExifBlobTagAt()
+ *
+ * Get the n-th tag of the n-th IFD in the view
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [in] ifdIndex : index of the IFD
+ *  [in] tagIndex : index of the tag in the IFD
+ *  [out] tag : the tag
+ *
+ * return
+ *  0: not exist
+ *  1: exist
+ */
+int getExifBlobTagAt(const ExifBlobView *view, unsigned int ifdIndex,
+                     unsigned int tagIndex, ExifBlobTag *tag);
+
+/**
+ * findExifBlobTag()
+ *
+ * Get the tag that matches the IFD_TYPE & TagId in the view
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [in] ifdType : target IFD type
+ *  [in] tagId : target tag ID
+ *  [out] tag : the tag
+ *
+ * return
+ *  0: not exist
+ *  1: exist
+ */
+int findExifBlobTag(const ExifBlobView *view, IFD_TYPE ifdType,
+                    uint16_t tagId, ExifBlobTag *tag);
+
+/**
+ * getExifBlobNumData()
+ *
+ * Get the n-th numeric value of a tag in the view
+ * (rationals are stored as numerator, denominator pairs)
+ *
+ * parameters
+ *  [in] tag : numeric tag
+ *  [in] index : index of the value
+ *
+ * return
+ *  the value
+ */
+unsigned int getExifBlobNumData(const ExifBlobTag *tag, unsigned int index);
+
+/**
+ * getExifBlobThumbnail()
+ *
+ * Get the thumbnail data of the 1st IFD in the view without copying it
+ *
+ * parameters
+ *  [in] view : view set up by initExifBlobView()
+ *  [out] pLength : returns the length of the thumbnail data
+ *
+ * return
+ *  NULL: not exist
+ * !NULL: the thumbnail data inside the view
+ */
+const uint8_t *getExifBlobThumbnail(const ExifBlobView *view, unsigned int *pLength);
 
 /**
  * updateExifSegmentInJPEGFile()
@@ -517,7 +2150,20 @@ int updateExifSegmentInJPEGFile(const char *inJPEGFileName,
                                 const char *outJPGEFileName,
                                 void **ifdTableArray);
 
-void getIfdTableDump(void *pIfd, char **pp);
+/**
+ * updateExifSegmentInJPEGIO()
+ *
+ * Update the Exif segment in a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *  [in] ifdTableArray : address of the IFD tables array
+ *
+ * return
+ *  same as updateExifSegmentInJPEGFile()
+ */
+int updateExifSegmentInJPEGIO(ExifIO *in, ExifIO *out, void **ifdTableArray);
 
 /**
  * removeAdobeMetadataSegmentFromJPEGFile()
@@ -540,6 +2186,20 @@ void getIfdTableDump(void *pIfd, char **pp);
 int removeAdobeMetadataSegmentFromJPEGFile(const char *inJPEGFileName,
                                            const char *outJPGEFileName);
 
+/**
+ * removeAdobeMetadataSegmentFromJPEGIO()
+ *
+ * Remove Adobe's XMP metadata segment from a JPEG read through an I/O backend
+ *
+ * parameters
+ *  [in] in : input backend
+ *  [in] out : output backend, must support write
+ *
+ * return
+ *  same as removeAdobeMetadataSegmentFromJPEGFile()
+ */
+int removeAdobeMetadataSegmentFromJPEGIO(ExifIO *in, ExifIO *out);
+
 // Tag IDs
 // 0th IFD, 1st IFD, Exif IFD
 #define TAG_ImageWidth                   0x0100
@@ -601,6 +2261,9 @@ int removeAdobeMetadataSegmentFromJPEGFile(const char *inJPEGFileName,
 #define TAG_SubSecTime                   0x9290
 #define TAG_SubSecTimeOriginal           0x9291
 #define TAG_SubSecTimeDigitized          0x9292
+#define TAG_OffsetTime                   0x9010
+#define TAG_OffsetTimeOriginal           0x9011
+#define TAG_OffsetTimeDigitized          0x9012
 
 #define TAG_ExposureTime                 0x829A
 #define TAG_FNumber                      0x829D
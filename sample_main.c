@@ -27,6 +27,17 @@
 #include <stdio.h>
 #include <stdlib.h>     // for malloc, free
 #include <string.h>     // for strcpy
+#include <time.h>       // for clock
+#if defined(__linux__)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#endif
 
 #include "exif.h"
 
@@ -37,6 +48,21 @@ int sample_removeSensitiveData(const char *srcJpgFileName, const char *outJpgFil
 int sample_queryTagExists(const char *srcJpgFileName);
 int sample_updateTagData(const char *srcJpgFileName, const char *outJpgFileName);
 int sample_saveThumbnail(const char *srcJpgFileName, const char *outFileName);
+int sample_indexDirectory(int ac, char *av[]);
+int sample_exportColumns(int ac, char *av[]);
+int sample_summary(int ac, char *av[]);
+int sample_plannedRead(int ac, char *av[]);
+int sample_sharedParse(int ac, char *av[]);
+int sample_bigMpo(int ac, char *av[]);
+int sample_mpoFrames(int ac, char *av[]);
+int sample_splitMpo(int ac, char *av[]);
+int sample_mpoBench(int ac, char *av[]);
+int sample_thumbnailRange(int ac, char *av[]);
+int sample_previews(int ac, char *av[]);
+int sample_backfillThumbnails(int ac, char *av[]);
+int sample_verify(int ac, char *av[]);
+int sample_pixelHash(int ac, char *av[]);
+int sample_fingerprint(int ac, char *av[]);
 
 void reportResult(int result, const char* filename)
 {
@@ -84,9 +110,99 @@ int main(int ac, char *av[])
 
     if (ac < 2) {
         printf("usage: %s <JPEG FileName> [-a]dd [-i]nfo [-r]emove [-s]trip [-t]humbnail [-u]pdate [-v]erbose\n", av[0]);
+        printf("       %s --index <Directory> [-j threads] [-o output] [--uring depth] [-c cache] [-f tsv|json]\n", av[0]);
+        printf("       %s --summary [-b iterations] <JPEG FileName...>\n", av[0]);
+        printf("       %s --export <csv|tsv|arrow> <[IFD.]Tag,...> [-o output] [-l list] [JPEG FileName...]\n", av[0]);
+        printf("       %s --plan [-l latency_ms] [-p prefix_size] <JPEG FileName...>\n", av[0]);
+        printf("       %s --shared [-j threads] [-n iterations] <JPEG FileName>\n", av[0]);
+        printf("       %s --bigmpo <template JPEG> <output MPO> [-n frames] [-s]\n", av[0]);
+        printf("       %s --mpo <MPO FileName> [-t] [-x prefix]\n", av[0]);
+        printf("       %s --split <MPO FileName> [-j threads] [-o format]\n", av[0]);
+        printf("       %s --mpobench <template JPEG> <work directory> [-n frames] [-m MB] [-j threads]\n", av[0]);
+        printf("       %s --thumb [-b iterations] <JPEG FileName...>\n", av[0]);
+        printf("       %s --preview [-s WxH] <JPEG FileName...>\n", av[0]);
+        printf("       %s --backfill <Directory> [-s WxH] [-q quality] [-n]\n", av[0]);
+        printf("       %s --verify [-m] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
+        printf("       %s --pixelhash [-d] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
+        printf("       %s --fingerprint [-d] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
         return 0;
     }
 
+    // sample function G: index all files under a directory
+    if (strcmp(av[1], "--index") == 0) {
+        return sample_indexDirectory(ac, av);
+    }
+
+    // sample function I: common fields through the ExifSummary fast path
+    if (strcmp(av[1], "--summary") == 0) {
+        return sample_summary(ac, av);
+    }
+
+    // sample function H: export the selected tags of many files as columns
+    if (strcmp(av[1], "--export") == 0) {
+        return sample_exportColumns(ac, av);
+    }
+
+    // sample function J: compare the direct reads with the read planner
+    if (strcmp(av[1], "--plan") == 0) {
+        return sample_plannedRead(ac, av);
+    }
+
+    // sample function K: parse one file on several threads sharing the descriptor
+    if (strcmp(av[1], "--shared") == 0) {
+        return sample_sharedParse(ac, av);
+    }
+
+    // sample function L: generate a sparse MPO larger than 4 GB and parse it back
+    if (strcmp(av[1], "--bigmpo") == 0) {
+        return sample_bigMpo(ac, av);
+    }
+
+    // sample function M: list or extract the images of an MPO file
+    if (strcmp(av[1], "--mpo") == 0) {
+        return sample_mpoFrames(ac, av);
+    }
+
+    // sample function N: write all the images of an MPO file on several threads
+    if (strcmp(av[1], "--split") == 0) {
+        return sample_splitMpo(ac, av);
+    }
+
+    // sample function O: measure the parallel extraction on a synthetic MPO
+    if (strcmp(av[1], "--mpobench") == 0) {
+        return sample_mpoBench(ac, av);
+    }
+
+    // sample function P: locate the thumbnail without parsing the tags
+    if (strcmp(av[1], "--thumb") == 0) {
+        return sample_thumbnailRange(ac, av);
+    }
+
+    // sample function Q: list the embedded previews and choose one for a size
+    if (strcmp(av[1], "--preview") == 0) {
+        return sample_previews(ac, av);
+    }
+
+    // sample function R: generate the missing thumbnails of a directory tree
+    if (strcmp(av[1], "--backfill") == 0) {
+        return sample_backfillThumbnails(ac, av);
+    }
+
+    // sample function S: check that the files are complete without decoding
+    if (strcmp(av[1], "--verify") == 0) {
+        return sample_verify(ac, av);
+    }
+
+    // sample function T: hash the image data to find copies differing in metadata
+    if (strcmp(av[1], "--pixelhash") == 0) {
+        return sample_pixelHash(ac, av);
+    }
+
+    // sample function U: fingerprint the metadata to find copies differing in layout
+    if (strcmp(av[1], "--fingerprint") == 0) {
+        return sample_fingerprint(ac, av);
+    }
+
     for (i = 2; i < ac; ++i) {
         // -v option
         const char* arg = av[i];
@@ -452,3 +568,2298 @@ int sample_saveThumbnail(const char *srcJpgFileName, const char *outFileName)
     freeIfdTableArray(ifdTableArray);
     return 0;
 }
+
+/**
+ * sample_summary()
+ *
+ * Print the ExifSummary of each file. With -b the files are parsed
+ * 'iterations' times both by getExifSummary() and by
+ * createIfdTableArray() followed by getTagInfo() of the same fields, and
+ * the average time per file is reported.
+ *
+ * usage: exif --summary [-b iterations] <JPEG FileName...>
+ */
+static void summaryWithTagInfo(const char *fileName)
+{
+    static const struct {
+        IFD_TYPE ifdType;
+        uint16_t tagId;
+    } tags[] = {
+        { IFD_0TH, TAG_Make }, { IFD_0TH, TAG_Model }, { IFD_0TH, TAG_Orientation },
+        { IFD_EXIF, TAG_DateTimeOriginal }, { IFD_EXIF, TAG_SubSecTimeOriginal },
+        { IFD_EXIF, TAG_OffsetTimeOriginal }, { IFD_EXIF, TAG_PixelXDimension },
+        { IFD_EXIF, TAG_PixelYDimension }, { IFD_EXIF, TAG_ExposureTime },
+        { IFD_EXIF, TAG_FNumber }, { IFD_EXIF, TAG_PhotographicSensitivity },
+        { IFD_EXIF, TAG_FocalLength }, { IFD_EXIF, TAG_LensModel },
+        { IFD_GPS, TAG_GPSLatitudeRef }, { IFD_GPS, TAG_GPSLatitude },
+        { IFD_GPS, TAG_GPSLongitudeRef }, { IFD_GPS, TAG_GPSLongitude },
+        { IFD_GPS, TAG_GPSAltitudeRef }, { IFD_GPS, TAG_GPSAltitude },
+    };
+    int i, result;
+    void **ifdArray = createIfdTableArray(fileName, &result);
+    if (!ifdArray) {
+        return;
+    }
+    for (i = 0; i < (int)(sizeof(tags) / sizeof(tags[0])); i++) {
+        TagNodeInfo *tag = getTagInfo(ifdArray, tags[i].ifdType, tags[i].tagId);
+        if (tag) {
+            freeTagInfo(tag);
+        }
+    }
+    freeIfdTableArray(ifdArray);
+}
+
+int sample_summary(int ac, char *av[])
+{
+    ExifSummary s;
+    ExifSummaryValues v;
+    ExifJpegInfo info;
+    clock_t t0;
+    double tSummary, tTagInfo;
+    int i, n, sts, first = 2, iterations = 0;
+
+    if (ac > 3 && strcmp(av[2], "-b") == 0) {
+        iterations = atoi(av[3]);
+        first = 4;
+    }
+    if (first >= ac) {
+        fprintf(stderr, "usage: %s --summary [-b iterations] <JPEG FileName...>\n", av[0]);
+        return -1;
+    }
+    if (iterations <= 0) {
+        for (i = first; i < ac; i++) {
+            sts = getExifSummary(av[i], &s);
+            printf("%s: result=%d present=0x%04x\n", av[i], sts, s.present);
+            if (s.present & EXIF_SUMMARY_JPEG_FRAME) {
+                printf("  JPEG %ux%u SOF%d %d-bit %d components %s%s%s",
+                    s.jpeg.width, s.jpeg.height, s.jpeg.sofMarker - 0xC0, s.jpeg.precision,
+                    s.jpeg.components, getJpegSubsamplingName(s.jpeg.subsampling),
+                    s.jpeg.progressive ? " progressive" : " sequential",
+                    s.jpeg.arithmetic ? " arithmetic" : "");
+                // the summary leaves out the quality, getJpegInfo() estimates it
+                if (getJpegInfo(av[i], &info) == 1 && info.quality != 0) {
+                    printf(" quality=%d%s", info.quality,
+                        info.qualityExact ? "" : " (approximate)");
+                }
+                printf("\n");
+            }
+            if (sts <= 0) {
+                continue;
+            }
+            printf("  Make=[%s] Model=[%s] LensModel=[%s] Orientation=%u\n",
+                s.make, s.model, s.lensModel, s.orientation);
+            printf("  DateTimeOriginal=[%s] SubSec=[%s] Offset=[%s]\n",
+                s.dateTimeOriginal, s.subSecTimeOriginal, s.offsetTimeOriginal);
+            printf("  %ux%u ExposureTime=%u/%u FNumber=%u/%u ISO=%u FocalLength=%u/%u\n",
+                s.pixelWidth, s.pixelHeight, s.exposureTime[0], s.exposureTime[1],
+                s.fNumber[0], s.fNumber[1], s.iso, s.focalLength[0], s.focalLength[1]);
+            convertExifSummaryArray(&s, 1, &v);
+            if (v.present & EXIF_SUMMARY_DATETIME_ORIGINAL) {
+                printf("  epoch=%lld.%06d%s\n", (long long)(v.dateTimeOriginal / 1000000),
+                    (int)(v.dateTimeOriginal % 1000000),
+                    (v.present & EXIF_SUMMARY_OFFSET_ORIGINAL) ? " UTC" : " local");
+            }
+            if (v.present & EXIF_SUMMARY_GPS_LATITUDE) {
+                printf("  latitude=%.6f longitude=%.6f altitude=%.1f\n",
+                    v.gpsLatitude, v.gpsLongitude, v.gpsAltitude);
+            }
+            if (s.present & (EXIF_SUMMARY_GPS_LATITUDE|EXIF_SUMMARY_GPS_LONGITUDE)) {
+                printf("  GPS %c %u/%u %u/%u %u/%u, %c %u/%u %u/%u %u/%u, alt %u/%u ref %u\n",
+                    s.gpsLatitudeRef ? s.gpsLatitudeRef : '?',
+                    s.gpsLatitude[0], s.gpsLatitude[1], s.gpsLatitude[2],
+                    s.gpsLatitude[3], s.gpsLatitude[4], s.gpsLatitude[5],
+                    s.gpsLongitudeRef ? s.gpsLongitudeRef : '?',
+                    s.gpsLongitude[0], s.gpsLongitude[1], s.gpsLongitude[2],
+                    s.gpsLongitude[3], s.gpsLongitude[4], s.gpsLongitude[5],
+                    s.gpsAltitude[0], s.gpsAltitude[1], s.gpsAltitudeRef);
+            }
+        }
+        return 0;
+    }
+
+    t0 = clock();
+    for (n = 0; n < iterations; n++) {
+        for (i = first; i < ac; i++) {
+            getExifSummary(av[i], &s);
+        }
+    }
+    tSummary = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    t0 = clock();
+    for (n = 0; n < iterations; n++) {
+        for (i = first; i < ac; i++) {
+            summaryWithTagInfo(av[i]);
+        }
+    }
+    tTagInfo = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    n = iterations * (ac - first);
+    printf("getExifSummary: %.2f us/file\n", tSummary * 1e6 / n);
+    printf("createIfdTableArray + getTagInfo: %.2f us/file (x%.1f)\n",
+        tTagInfo * 1e6 / n, (tSummary > 0) ? tTagInfo / tSummary : 0.0);
+    return 0;
+}
+
+/**
+ * sample_thumbnailRange()
+ *
+ * Locate the thumbnail of each file without parsing the tags. With -b
+ * the fast path is timed against createIfdTableArray() and
+ * getThumbnailDataOnIfdTableArray().
+ *
+ * usage: exif --thumb [-b iterations] <JPEG FileName...>
+ */
+static void thumbnailWithIfdTables(const char *fileName)
+{
+    void **ifdArray;
+    uint8_t *data;
+    unsigned int length;
+    int result;
+
+    ifdArray = createIfdTableArray(fileName, &result);
+    if (!ifdArray) {
+        return;
+    }
+    data = getThumbnailDataOnIfdTableArray(ifdArray, &length, &result);
+    free(data);
+    freeIfdTableArray(ifdArray);
+}
+
+int sample_thumbnailRange(int ac, char *av[])
+{
+    int64_t offset;
+    uint32_t length;
+    clock_t t0;
+    double tRange, tIfd;
+    int i, n, sts, first = 2, iterations = 0;
+
+    if (ac > 3 && strcmp(av[2], "-b") == 0) {
+        iterations = atoi(av[3]);
+        first = 4;
+    }
+    if (first >= ac) {
+        fprintf(stderr, "usage: %s --thumb [-b iterations] <JPEG FileName...>\n", av[0]);
+        return -1;
+    }
+    if (iterations <= 0) {
+        for (i = first; i < ac; i++) {
+            sts = getExifThumbnailRange(av[i], &offset, &length);
+            if (sts == 1) {
+                printf("%s: offset=%lld length=%u\n", av[i], (long long)offset, length);
+            } else {
+                printf("%s: result=%d\n", av[i], sts);
+            }
+        }
+        return 0;
+    }
+
+    t0 = clock();
+    for (n = 0; n < iterations; n++) {
+        for (i = first; i < ac; i++) {
+            getExifThumbnailRange(av[i], &offset, &length);
+        }
+    }
+    tRange = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    t0 = clock();
+    for (n = 0; n < iterations; n++) {
+        for (i = first; i < ac; i++) {
+            thumbnailWithIfdTables(av[i]);
+        }
+    }
+    tIfd = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    n = iterations * (ac - first);
+    printf("getExifThumbnailRange: %.2f us/file\n", tRange * 1e6 / n);
+    printf("createIfdTableArray + getThumbnailDataOnIfdTableArray: %.2f us/file (x%.1f)\n",
+        tIfd * 1e6 / n, (tRange > 0) ? tIfd / tRange : 0.0);
+    return 0;
+}
+
+/**
+ * sample_previews()
+ *
+ * List the JPEG previews embedded in each file with their dimensions.
+ * With -s the smallest one of at least the given size is chosen.
+ *
+ * usage: exif --preview [-s WxH] <JPEG FileName...>
+ */
+int sample_previews(int ac, char *av[])
+{
+    ExifPreview previews[16];
+    unsigned int width = 0, height = 0;
+    int i, j, n, best, first = 2;
+
+    if (ac > 3 && strcmp(av[2], "-s") == 0) {
+        if (sscanf(av[3], "%ux%u", &width, &height) != 2) {
+            width = height = 0;
+        }
+        first = 4;
+    }
+    if (first >= ac) {
+        fprintf(stderr, "usage: %s --preview [-s WxH] <JPEG FileName...>\n", av[0]);
+        return -1;
+    }
+    for (i = first; i < ac; i++) {
+        n = getExifPreviews(av[i], previews, 16);
+        printf("%s: %d previews\n", av[i], n);
+        if (n > 16) {
+            n = 16;
+        }
+        for (j = 0; j < n; j++) {
+            printf("  [%d] %s", j, (previews[j].source == EXIF_PREVIEW_IFD1) ? "IFD1" : "MPF");
+            if (previews[j].source == EXIF_PREVIEW_MPF) {
+                printf(" #%d", previews[j].index);
+            }
+            printf(" %ux%u offset=%lld length=%u\n", previews[j].width, previews[j].height,
+                (long long)previews[j].offset, previews[j].length);
+        }
+        if (width > 0 && n >= 0) {
+            best = selectExifPreview(previews, n, width, height);
+            if (best < 0) {
+                printf("  no preview of %ux%u, use the primary image\n", width, height);
+            } else {
+                printf("  %ux%u => [%d]\n", width, height, best);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * sample_plannedRead()
+ *
+ * Parse each file once directly and once through the read planner, and
+ * count the reads that reach the file. With a remote file system every
+ * read is a round trip, the time spent waiting is estimated from the
+ * latency given by -l (default 20 ms).
+ *
+ * usage: exif --plan [-l latency_ms] [-p prefix_size] <JPEG FileName...>
+ */
+typedef struct _countingIO {
+    ExifIO file;
+    unsigned int reads;
+} COUNTING_IO;
+
+static int64_t countingReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    COUNTING_IO *c = (COUNTING_IO*)context;
+    c->reads++;
+    return c->file.readAt(c->file.context, offset, buf, length);
+}
+
+static int64_t countingSize(void *context)
+{
+    COUNTING_IO *c = (COUNTING_IO*)context;
+    return c->file.size(c->file.context);
+}
+
+int sample_plannedRead(int ac, char *av[])
+{
+    COUNTING_IO counting;
+    ExifIO io, planned;
+    ExifReadStats stats;
+    void **ifdArray;
+    int i, direct, result, first = 2, latency = 20;
+    size_t prefixSize = 0;
+    unsigned int directReads;
+
+    while (first + 1 < ac && av[first][0] == '-') {
+        if (strcmp(av[first], "-l") == 0) {
+            latency = atoi(av[first + 1]);
+        } else if (strcmp(av[first], "-p") == 0) {
+            prefixSize = (size_t)atol(av[first + 1]);
+        } else {
+            break;
+        }
+        first += 2;
+    }
+    if (first >= ac) {
+        fprintf(stderr, "usage: %s --plan [-l latency_ms] [-p prefix_size] <JPEG FileName...>\n", av[0]);
+        return -1;
+    }
+    memset(&io, 0, sizeof(io));
+    io.readAt = countingReadAt;
+    io.size = countingSize;
+    io.context = &counting;
+
+    for (i = first; i < ac; i++) {
+        memset(&counting, 0, sizeof(counting));
+        if (openExifFileIO(&counting.file, av[i], 0) != 0) {
+            printf("failed to open [%s]\n", av[i]);
+            continue;
+        }
+        // direct reads
+        ifdArray = createIfdTableArrayFromIO(&io, &direct);
+        if (ifdArray) {
+            freeIfdTableArray(ifdArray);
+        }
+        directReads = counting.reads;
+
+        // through the planner
+        counting.reads = 0;
+        result = openExifPlannedIO(&planned, &io, prefixSize);
+        if (result == 0) {
+            ifdArray = createIfdTableArrayFromIO(&planned, &result);
+            if (ifdArray) {
+                freeIfdTableArray(ifdArray);
+            }
+            getExifReadStats(&planned, &stats);
+            closeExifIO(&planned);
+        }
+        closeExifIO(&counting.file);
+        if (result != direct) {
+            printf("%s: result=%d, planned result=%d\n", av[i], direct, result);
+            continue;
+        }
+        printf("%s: result=%d direct %u reads (~%u ms), planned %u round trips "
+               "(%u ranges, %u misses, %llu bytes) (~%u ms)\n",
+            av[i], result, directReads, directReads * latency,
+            stats.roundTrips, stats.ranges, stats.misses,
+            (unsigned long long)stats.bytesFetched, stats.roundTrips * latency);
+    }
+    return 0;
+}
+
+/**
+ * sample_mpoFrames()
+ *
+ * List the images of an MPO file. With -t the DateTimeOriginal of each
+ * image is read from its own Exif segment, and with -x each image is
+ * written to <prefix><index>.jpg
+ *
+ * usage: exif --mpo <MPO FileName> [-t] [-x prefix]
+ */
+int sample_mpoFrames(int ac, char *av[])
+{
+    ExifMpoEntry *entries;
+    TagNodeInfo *tag;
+    void *reader = NULL;
+    void **ifdArray;
+    char outName[1024];
+    const char *prefix = NULL;
+    int i, n, sts, times = 0;
+
+    if (ac < 3) {
+        fprintf(stderr, "usage: %s --mpo <MPO FileName> [-t] [-x prefix]\n", av[0]);
+        return -1;
+    }
+    for (i = 3; i < ac; i++) {
+        if (strcmp(av[i], "-x") == 0 && i + 1 < ac) {
+            prefix = av[++i];
+        } else if (strcmp(av[i], "-t") == 0) {
+            times = 1;
+        }
+    }
+    n = getMpoEntries(av[2], NULL, 0);
+    if (n <= 0) {
+        printf("getMpoEntries(%s)=%d\n", av[2], n);
+        return n;
+    }
+    entries = (ExifMpoEntry*)malloc(sizeof(ExifMpoEntry) * n);
+    if (!entries) {
+        return ERR_MEMALLOC;
+    }
+    n = getMpoEntries(av[2], entries, n);
+    if (times) {
+        reader = openMpoFrameReader(av[2], &sts);
+    }
+    for (i = 0; i < n; i++) {
+        printf("[%d] flags=%08x offset=%lld length=%u dependent=%u,%u", i,
+            entries[i].flags, (long long)entries[i].offset, entries[i].length,
+            entries[i].dependent1, entries[i].dependent2);
+        if (reader) {
+            ifdArray = getMpoFrameIfdTableArray(reader, i, &sts);
+            tag = ifdArray ? getTagInfo(ifdArray, IFD_EXIF, TAG_DateTimeOriginal) : NULL;
+            if (tag && !tag->error && tag->byteData) {
+                printf(" DateTimeOriginal=%s", (char*)tag->byteData);
+            } else {
+                printf(" (result=%d)", sts);
+            }
+            if (tag) {
+                freeTagInfo(tag);
+            }
+        }
+        if (prefix) {
+            snprintf(outName, sizeof(outName), "%s%d.jpg", prefix, i);
+            sts = extractMpoFrameToFile(av[2], &entries[i], outName);
+            printf(" => %s (%d)", outName, sts);
+        }
+        printf("\n");
+    }
+    closeMpoFrameReader(reader);
+    free(entries);
+    return 0;
+}
+
+/**
+ * sample_splitMpo()
+ *
+ * Write every image of an MPO file to its own file on several threads,
+ * showing the progress on stderr.
+ *
+ * usage: exif --split <MPO FileName> [-j threads] [-o format]
+ *        format is a printf format with one %d, "frame%d.jpg" by default
+ */
+static void splitProgress(void *context, int framesDone, int frameCount,
+                          uint64_t bytesDone, uint64_t bytesTotal)
+{
+    *(int*)context = 1;
+    fprintf(stderr, "\r%d/%d images, %.1f/%.1f MB", framesDone, frameCount,
+        bytesDone / (1024.0 * 1024.0), bytesTotal / (1024.0 * 1024.0));
+}
+
+int sample_splitMpo(int ac, char *av[])
+{
+    const char *format = "frame%d.jpg";
+    clock_t t0;
+    double sec;
+    int i, sts, shown = 0, threads = 0;
+
+    if (ac < 3) {
+        fprintf(stderr, "usage: %s --split <MPO FileName> [-j threads] [-o format]\n", av[0]);
+        return -1;
+    }
+    for (i = 3; i < ac; i++) {
+        if (strcmp(av[i], "-j") == 0 && i + 1 < ac) {
+            threads = atoi(av[++i]);
+        } else if (strcmp(av[i], "-o") == 0 && i + 1 < ac) {
+            format = av[++i];
+        }
+    }
+    t0 = clock();
+    sts = extractMpoFrames(av[2], format, threads, splitProgress, &shown);
+    sec = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    if (shown) {
+        fprintf(stderr, "\n");
+    }
+    printf("extractMpoFrames(%s)=%d, %.3f s CPU\n", av[2], sts, sec);
+    return (sts > 0) ? 0 : sts;
+}
+
+/**
+ * sample_exportColumns()
+ *
+ * Write one row per file with the selected tags as CSV, TSV or an
+ * Arrow IPC stream (e.g. for DuckDB: SELECT * FROM 'exif.arrow').
+ * The tags are given as "Make,Model,FNumber,1ST.ImageWidth,GPS.0x0002";
+ * a tag without the IFD is taken from whichever of 0TH, EXIF and GPS has
+ * it. The files are taken from the command line and from the list file
+ * (one path per line, "-" for stdin).
+ *
+ * usage: exif --export <csv|tsv|arrow> <[IFD.]Tag,...> [-o output] [-l list]
+ *                      [JPEG FileName...]
+ */
+static int parseColumnSpec(const char *text, ExifColumnSpec *spec)
+{
+    static const struct {
+        const char *name;
+        IFD_TYPE type;
+    } ifds[] = {
+        { "0TH", IFD_0TH }, { "EXIF", IFD_EXIF }, { "GPS", IFD_GPS },
+        { "1ST", IFD_1ST }, { "Interoperability", IFD_IO }, { "MPF", IFD_MPF },
+    };
+    const char *dot = strchr(text, '.');
+    const char *tag = dot ? dot + 1 : text;
+    int i, id, first = 0, last = 2;
+
+    spec->ifdType = IFD_UNKNOWN;
+    if (dot) {
+        for (i = 0; i < (int)(sizeof(ifds) / sizeof(ifds[0])); i++) {
+            if (strlen(ifds[i].name) == (size_t)(dot - text) &&
+                strncmp(ifds[i].name, text, dot - text) == 0) {
+                break;
+            }
+        }
+        if (i == (int)(sizeof(ifds) / sizeof(ifds[0]))) {
+            return 0;
+        }
+        first = last = i;
+    }
+    for (i = first; i <= last; i++) {
+        if (strncmp(tag, "0x", 2) == 0) {
+            id = (int)strtol(tag, NULL, 16);
+        } else {
+            id = getTagIdFromName(ifds[i].type, tag);
+        }
+        if (id >= 0) {
+            if (dot) {
+                spec->ifdType = ifds[i].type;
+            }
+            spec->tagId = (uint16_t)id;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int exportFile(void *writer, const char *fileName)
+{
+    int result, sts;
+    void **ifdArray = createIfdTableArray(fileName, &result);
+    sts = addExifColumnRow(writer, fileName, ifdArray);
+    if (ifdArray) {
+        freeIfdTableArray(ifdArray);
+    }
+    return sts;
+}
+
+int sample_exportColumns(int ac, char *av[])
+{
+    ExifColumnSpec *specs;
+    const char *outName = NULL, *listName = NULL;
+    char *tags, *p, line[4096];
+    void *writer;
+    FILE *fp;
+    int i, format, count = 0, sts = 0;
+
+    if (ac < 4) {
+        fprintf(stderr, "usage: %s --export <csv|tsv|arrow> <[IFD.]Tag,...> [-o output] [-l list] [JPEG FileName...]\n", av[0]);
+        return -1;
+    }
+    format = (strcmp(av[2], "csv") == 0) ? EXIF_EXPORT_CSV :
+             (strcmp(av[2], "tsv") == 0) ? EXIF_EXPORT_TSV :
+             (strcmp(av[2], "arrow") == 0) ? EXIF_EXPORT_ARROW : 0;
+    if (!format) {
+        fprintf(stderr, "Invalid format %s!\n", av[2]);
+        return -1;
+    }
+    specs = (ExifColumnSpec*)malloc(sizeof(ExifColumnSpec) * (strlen(av[3]) / 2 + 1));
+    tags = (char*)malloc(strlen(av[3]) + 1);
+    if (!specs || !tags) {
+        free(specs);
+        free(tags);
+        return ERR_MEMALLOC;
+    }
+    strcpy(tags, av[3]);
+    for (p = strtok(tags, ","); p; p = strtok(NULL, ",")) {
+        if (!parseColumnSpec(p, &specs[count])) {
+            fprintf(stderr, "Unknown tag %s!\n", p);
+            free(specs);
+            free(tags);
+            return -1;
+        }
+        count++;
+    }
+    free(tags);
+    for (i = 4; i < ac; i++) {
+        if (strcmp(av[i], "-o") == 0 && i + 1 < ac) {
+            outName = av[++i];
+        } else if (strcmp(av[i], "-l") == 0 && i + 1 < ac) {
+            listName = av[++i];
+        }
+    }
+
+    fp = outName ? fopen(outName, "wb") : stdout;
+    if (!fp) {
+        fprintf(stderr, "failed to create [%s]\n", outName);
+        free(specs);
+        return ERR_WRITE_FILE;
+    }
+    writer = openExifColumnWriter(fp, format, specs, count);
+    free(specs);
+    if (!writer) {
+        if (fp != stdout) {
+            fclose(fp);
+        }
+        return ERR_MEMALLOC;
+    }
+    for (i = 4; i < ac && sts == 0; i++) {
+        if ((strcmp(av[i], "-o") == 0 || strcmp(av[i], "-l") == 0) && i + 1 < ac) {
+            i++;
+        } else {
+            sts = exportFile(writer, av[i]);
+        }
+    }
+    if (listName && sts == 0) {
+        FILE *list = (strcmp(listName, "-") == 0) ? stdin : fopen(listName, "r");
+        if (!list) {
+            fprintf(stderr, "failed to open [%s]\n", listName);
+            sts = ERR_READ_FILE;
+        }
+        while (sts == 0 && fgets(line, sizeof(line), list)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (line[0]) {
+                sts = exportFile(writer, line);
+            }
+        }
+        if (list && list != stdin) {
+            fclose(list);
+        }
+    }
+    i = closeExifColumnWriter(writer);
+    if (sts == 0) {
+        sts = i;
+    }
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    if (sts != 0) {
+        fprintf(stderr, "export failed: %d\n", sts);
+    }
+    return sts;
+}
+
+/**
+ * sample_indexDirectory()
+ *
+ * Walk a directory tree and parse the Exif segment of every regular
+ * file on several threads. One tab separated record is written per file:
+ *
+ *   path  result  Make  Model  DateTimeOriginal  PixelXDimension  PixelYDimension
+ *
+ * usage: exif --index <Directory> [-j threads] [-o output] [--uring depth] [-c cache]
+ *                      [-f tsv|json]
+ *
+ * With --uring each thread parses up to 'depth' files at a time through
+ * createIfdTableArrayBatch(). With -c the parse results are kept in the
+ * cache file (see openIfdTableCache()) and reused by the next run.
+ * With -f json one JSON object per file is written instead of the TSV line
+ * (NDJSON): {"path":..., "result":..., "exif":{...}} where "exif" is the
+ * output of streamIfdTableArrayJson().
+ */
+#if defined(__linux__)
+
+#define INDEX_QUEUE_SIZE    1024
+#define INDEX_DIRENT_BUF    32768
+#define INDEX_OUTBUF_SIZE   65536
+#define INDEX_RECORD_MAX    16384
+#define INDEX_FIELD_MAX     255
+#define INDEX_CHUNK_SIZE    65536
+
+// directory entry layout returned by getdents64
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+typedef struct _indexJob {
+    // bounded queue of file paths from the walker to the workers
+    char *queue[INDEX_QUEUE_SIZE];
+    int head;
+    int count;
+    int done;
+    int batch;      // files per createIfdTableArrayBatch() call, 0: not used
+    int json;       // 1: NDJSON output
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    // shared output
+    FILE *out;
+    pthread_mutex_t outLock;
+    // totals, updated by each worker when it finishes
+    unsigned long long files;
+    unsigned long long errors;
+    unsigned long long bytes;
+} IndexJob;
+
+// per-worker output buffer, flushed to the shared output in large blocks
+typedef struct _indexOut {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int error;
+} IndexOut;
+
+static void indexQueuePush(IndexJob *job, char *path)
+{
+    pthread_mutex_lock(&job->lock);
+    while (job->count == INDEX_QUEUE_SIZE) {
+        pthread_cond_wait(&job->notFull, &job->lock);
+    }
+    job->queue[(job->head + job->count) % INDEX_QUEUE_SIZE] = path;
+    job->count++;
+    pthread_cond_signal(&job->notEmpty);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// pop up to max paths, returns 0 when the queue is drained
+static int indexQueuePopBatch(IndexJob *job, char **paths, int max)
+{
+    int n = 0;
+    pthread_mutex_lock(&job->lock);
+    while (job->count == 0 && !job->done) {
+        pthread_cond_wait(&job->notEmpty, &job->lock);
+    }
+    while (job->count > 0 && n < max) {
+        paths[n++] = job->queue[job->head];
+        job->head = (job->head + 1) % INDEX_QUEUE_SIZE;
+        job->count--;
+    }
+    if (n > 0) {
+        pthread_cond_broadcast(&job->notFull);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return n;
+}
+
+static void indexFlush(IndexJob *job, IndexOut *o)
+{
+    if (o->len == 0) {
+        return;
+    }
+    pthread_mutex_lock(&job->outLock);
+    fwrite(o->buf, 1, o->len, job->out);
+    pthread_mutex_unlock(&job->outLock);
+    o->len = 0;
+}
+
+// append a tab and the string with the field separators replaced
+static void indexAppendField(IndexOut *o, const char *str)
+{
+    int i;
+    o->buf[o->len++] = '\t';
+    for (i = 0; str && str[i] && i < INDEX_FIELD_MAX; i++) {
+        char c = str[i];
+        o->buf[o->len++] = (c == '\t' || c == '\n' || c == '\r') ? ' ' : c;
+    }
+}
+
+// make sure the buffer can take n more bytes, a JSON record has no size limit
+static int indexReserve(IndexOut *o, size_t n)
+{
+    size_t cap = o->cap;
+    char *p;
+    if (o->len + n <= cap) {
+        return 1;
+    }
+    while (cap < o->len + n) {
+        cap *= 2;
+    }
+    p = (char*)realloc(o->buf, cap);
+    if (!p) {
+        o->error = 1;
+        return 0;
+    }
+    o->buf = p;
+    o->cap = cap;
+    return 1;
+}
+
+static void indexJsonWriter(void *context, const char *text, size_t length)
+{
+    IndexOut *o = (IndexOut*)context;
+    if (indexReserve(o, length)) {
+        memcpy(o->buf + o->len, text, length);
+        o->len += length;
+    }
+}
+
+// quoted JSON string of a path
+static void indexAppendJsonString(IndexOut *o, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    if (!indexReserve(o, strlen(str) * 6 + 2)) {
+        return;
+    }
+    o->buf[o->len++] = '"';
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            o->buf[o->len++] = '\\';
+            o->buf[o->len++] = (char)c;
+        } else if (c < 0x20) {
+            memcpy(o->buf + o->len, "\\u00", 4);
+            o->buf[o->len + 4] = hex[c >> 4];
+            o->buf[o->len + 5] = hex[c & 15];
+            o->len += 6;
+        } else {
+            o->buf[o->len++] = (char)c;
+        }
+    }
+    o->buf[o->len++] = '"';
+}
+
+static void indexAppendTag(IndexOut *o, void **ifdArray, IFD_TYPE ifdType, uint16_t tagId)
+{
+    char num[16];
+    TagNodeInfo *tag = getTagInfo(ifdArray, ifdType, tagId);
+    if (!tag || tag->error) {
+        indexAppendField(o, NULL);
+    } else if (tag->type == TYPE_ASCII) {
+        indexAppendField(o, (char*)tag->byteData);
+    } else if (tag->numData) {
+        sprintf(num, "%u", tag->numData[0]);
+        indexAppendField(o, num);
+    } else {
+        indexAppendField(o, NULL);
+    }
+    if (tag) {
+        freeTagInfo(tag);
+    }
+}
+
+static void indexRecord(IndexOut *o, const char *path, void **ifdArray, int result,
+                        unsigned long long *pBytes)
+{
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        *pBytes += (unsigned long long)st.st_size;
+    }
+    o->len += snprintf(o->buf + o->len, INDEX_RECORD_MAX, "%s\t%d", path, result);
+    indexAppendTag(o, ifdArray, IFD_0TH, TAG_Make);
+    indexAppendTag(o, ifdArray, IFD_0TH, TAG_Model);
+    indexAppendTag(o, ifdArray, IFD_EXIF, TAG_DateTimeOriginal);
+    indexAppendTag(o, ifdArray, IFD_EXIF, TAG_PixelXDimension);
+    indexAppendTag(o, ifdArray, IFD_EXIF, TAG_PixelYDimension);
+    o->buf[o->len++] = '\n';
+}
+
+static void indexRecordJson(IndexOut *o, const char *path, void **ifdArray, int result,
+                            unsigned long long *pBytes)
+{
+    struct stat st;
+    size_t start = o->len;
+    if (stat(path, &st) == 0) {
+        *pBytes += (unsigned long long)st.st_size;
+    }
+    if (!indexReserve(o, 64)) {
+        return;
+    }
+    memcpy(o->buf + o->len, "{\"path\":", 8);
+    o->len += 8;
+    indexAppendJsonString(o, path);
+    if (!indexReserve(o, 64)) {
+        return;
+    }
+    o->len += sprintf(o->buf + o->len, ",\"result\":%d", result);
+    if (ifdArray) {
+        memcpy(o->buf + o->len, ",\"exif\":", 8);
+        o->len += 8;
+        streamIfdTableArrayJson(ifdArray, 0, indexJsonWriter, o);
+    }
+    if (indexReserve(o, 2)) {
+        o->buf[o->len++] = '}';
+        o->buf[o->len++] = '\n';
+    }
+    if (o->error) {
+        // drop the incomplete record
+        o->len = start;
+        o->error = 0;
+    }
+}
+
+static void *indexWorker(void *arg)
+{
+    IndexJob *job = (IndexJob*)arg;
+    IndexOut o;
+    unsigned long long files = 0, errors = 0, bytes = 0;
+    int i, n, max = (job->batch > 0) ? job->batch : 1;
+    char **paths = (char**)malloc(sizeof(char*) * max);
+    ExifBatchItem *items = (ExifBatchItem*)malloc(sizeof(ExifBatchItem) * max);
+
+    o.len = 0;
+    o.cap = INDEX_OUTBUF_SIZE + INDEX_RECORD_MAX;
+    o.error = 0;
+    o.buf = (char*)malloc(o.cap);
+    if (!o.buf || !paths || !items) {
+        free(o.buf);
+        free(paths);
+        free(items);
+        return NULL;
+    }
+    while ((n = indexQueuePopBatch(job, paths, max)) > 0) {
+        if (job->batch > 0) {
+            for (i = 0; i < n; i++) {
+                items[i].fileName = paths[i];
+            }
+            createIfdTableArrayBatch(items, n, INDEX_CHUNK_SIZE, n);
+        } else {
+            items[0].ifdArray = createIfdTableArray(paths[0], &items[0].result);
+        }
+        for (i = 0; i < n; i++) {
+            if (job->json) {
+                indexRecordJson(&o, paths[i], items[i].ifdArray, items[i].result, &bytes);
+            } else {
+                indexRecord(&o, paths[i], items[i].ifdArray, items[i].result, &bytes);
+            }
+            files++;
+            if (items[i].result < 0) {
+                errors++;
+            }
+            if (items[i].ifdArray) {
+                freeIfdTableArray(items[i].ifdArray);
+            }
+            free(paths[i]);
+            if (o.len >= INDEX_OUTBUF_SIZE) {
+                indexFlush(job, &o);
+            }
+        }
+    }
+    indexFlush(job, &o);
+    free(o.buf);
+    free(paths);
+    free(items);
+
+    pthread_mutex_lock(&job->outLock);
+    job->files += files;
+    job->errors += errors;
+    job->bytes += bytes;
+    pthread_mutex_unlock(&job->outLock);
+    return NULL;
+}
+
+// walk the directory with getdents64 and queue every regular file
+static void indexWalk(IndexJob *job, int dirfd, const char *dirPath)
+{
+    char *buf, *path;
+    long n, ofs;
+    size_t dirLen = strlen(dirPath);
+
+    buf = (char*)malloc(INDEX_DIRENT_BUF);
+    if (!buf) {
+        return;
+    }
+    while ((n = syscall(SYS_getdents64, dirfd, buf, INDEX_DIRENT_BUF)) > 0) {
+        for (ofs = 0; ofs < n; ofs += ((struct linux_dirent64*)(buf + ofs))->d_reclen) {
+            struct linux_dirent64 *d = (struct linux_dirent64*)(buf + ofs);
+            unsigned char type = d->d_type;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            if (type == DT_UNKNOWN) {
+                // some file systems do not fill d_type
+                struct stat st;
+                if (fstatat(dirfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+            if (type != DT_DIR && type != DT_REG) {
+                continue;
+            }
+            path = (char*)malloc(dirLen + strlen(d->d_name) + 2);
+            if (!path) {
+                continue;
+            }
+            sprintf(path, "%s%s%s", dirPath,
+                (dirLen > 0 && dirPath[dirLen-1] == '/') ? "" : "/", d->d_name);
+            if (type == DT_DIR) {
+                int fd = openat(dirfd, d->d_name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+                if (fd >= 0) {
+                    indexWalk(job, fd, path);
+                    close(fd);
+                }
+                free(path);
+            } else {
+                indexQueuePush(job, path); // the worker frees the path
+            }
+        }
+    }
+    free(buf);
+}
+
+int sample_indexDirectory(int ac, char *av[])
+{
+    IndexJob job;
+    pthread_t *workers;
+    struct timespec t0, t1;
+    const char *dirName = NULL, *outName = NULL, *cacheName = NULL;
+    double sec, mb;
+    int i, fd, batch = 0, json = 0, threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 2; i < ac; i++) {
+        if (strcmp(av[i], "-j") == 0 && i + 1 < ac) {
+            threads = atoi(av[++i]);
+        } else if (strcmp(av[i], "-o") == 0 && i + 1 < ac) {
+            outName = av[++i];
+        } else if (strcmp(av[i], "--uring") == 0 && i + 1 < ac) {
+            batch = atoi(av[++i]);
+        } else if (strcmp(av[i], "-c") == 0 && i + 1 < ac) {
+            cacheName = av[++i];
+        } else if (strcmp(av[i], "-f") == 0 && i + 1 < ac &&
+                   (strcmp(av[i+1], "tsv") == 0 || strcmp(av[i+1], "json") == 0)) {
+            json = (strcmp(av[++i], "json") == 0);
+        } else if (strcmp(av[i], "-v") == 0) {
+            setVerbose(1);
+        } else if (av[i][0] != '-' && !dirName) {
+            dirName = av[i];
+        } else {
+            fprintf(stderr, "Invalid option %s!\n", av[i]);
+            return -1;
+        }
+    }
+    if (!dirName) {
+        fprintf(stderr, "usage: %s --index <Directory> [-j threads] [-o output] [--uring depth] [-c cache] [-f tsv|json]\n", av[0]);
+        return -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    fd = open(dirName, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open [%s]: %s\n", dirName, strerror(errno));
+        return ERR_READ_FILE;
+    }
+    if (cacheName) {
+        int sts = openIfdTableCache(cacheName);
+        if (sts != 0) {
+            fprintf(stderr, "openIfdTableCache(%s)=%d\n", cacheName, sts);
+            close(fd);
+            return sts;
+        }
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.batch = batch;
+    job.json = json;
+    job.out = stdout;
+    if (outName) {
+        job.out = fopen(outName, "w");
+        if (!job.out) {
+            fprintf(stderr, "failed to create [%s]\n", outName);
+            close(fd);
+            return ERR_WRITE_FILE;
+        }
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_mutex_init(&job.outLock, NULL);
+    pthread_cond_init(&job.notEmpty, NULL);
+    pthread_cond_init(&job.notFull, NULL);
+
+    workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    if (!workers) {
+        close(fd);
+        return ERR_MEMALLOC;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, indexWorker, &job);
+    }
+    indexWalk(&job, fd, dirName);
+    close(fd);
+
+    pthread_mutex_lock(&job.lock);
+    job.done = 1;
+    pthread_cond_broadcast(&job.notEmpty);
+    pthread_mutex_unlock(&job.lock);
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    free(workers);
+
+    if (job.out != stdout) {
+        fclose(job.out);
+    } else {
+        fflush(stdout);
+    }
+    if (cacheName) {
+        closeIfdTableCache();
+    }
+    sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (sec <= 0) {
+        sec = 1e-9;
+    }
+    mb = job.bytes / (1024.0 * 1024.0);
+    fprintf(stderr, "indexed %llu files (%llu errors), %.1f MB in %.3f s with %d threads: "
+                    "%.0f files/s, %.1f MB/s\n",
+        job.files, job.errors, mb, sec, threads, job.files / sec, mb / sec);
+
+    pthread_mutex_destroy(&job.lock);
+    pthread_mutex_destroy(&job.outLock);
+    pthread_cond_destroy(&job.notEmpty);
+    pthread_cond_destroy(&job.notFull);
+    return 0;
+}
+
+#else
+
+int sample_indexDirectory(int ac, char *av[])
+{
+    fprintf(stderr, "--index is only supported on Linux\n");
+    return -1;
+}
+
+#endif
+
+/**
+ * sample_sharedParse()
+ *
+ * Parse one file on several threads at the same time through backends
+ * sharing a single file descriptor (see openExifFdIO()), check that every
+ * parse gives the same IFD tables as a parse on the main thread, and
+ * report the parses per second.
+ *
+ * usage: exif --shared [-j threads] [-n iterations] <JPEG FileName>
+ */
+#if defined(__linux__)
+
+typedef struct _sharedJob {
+    int fd;
+    int iterations;
+    const uint8_t *expected;    // serialized result of the main thread
+    size_t expectedLength;
+    int result;
+    int mismatches;
+} SharedJob;
+
+static void *sharedWorker(void *arg)
+{
+    SharedJob *job = (SharedJob*)arg;
+    uint8_t *buf = (uint8_t*)malloc(job->expectedLength + 1);
+    void **ifdArray;
+    ExifIO io;
+    size_t len;
+    int n, result;
+
+    for (n = 0; n < job->iterations; n++) {
+        openExifFdIO(&io, job->fd);
+        ifdArray = createIfdTableArrayFromIO(&io, &result);
+        len = 0;
+        if (ifdArray) {
+            len = serializeIfdTableArray(ifdArray, buf, job->expectedLength + 1);
+            freeIfdTableArray(ifdArray);
+        }
+        if (result != job->result || len != job->expectedLength ||
+            (len > 0 && memcmp(buf, job->expected, len) != 0)) {
+            job->mismatches++;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+int sample_sharedParse(int ac, char *av[])
+{
+    struct timespec t0, t1;
+    SharedJob *jobs;
+    pthread_t *workers;
+    void **ifdArray;
+    uint8_t *expected = NULL;
+    size_t expectedLength = 0;
+    ExifIO io;
+    double sec;
+    int i, fd, result, mismatches = 0, threads = 4, iterations = 1000, first = 2;
+
+    while (first + 1 < ac && av[first][0] == '-') {
+        if (strcmp(av[first], "-j") == 0) {
+            threads = atoi(av[first + 1]);
+        } else if (strcmp(av[first], "-n") == 0) {
+            iterations = atoi(av[first + 1]);
+        } else {
+            break;
+        }
+        first += 2;
+    }
+    if (first >= ac || threads <= 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s --shared [-j threads] [-n iterations] <JPEG FileName>\n", av[0]);
+        return -1;
+    }
+    fd = open(av[first], O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open [%s]\n", av[first]);
+        return ERR_READ_FILE;
+    }
+
+    // reference result
+    openExifFdIO(&io, fd);
+    ifdArray = createIfdTableArrayFromIO(&io, &result);
+    if (ifdArray) {
+        expectedLength = serializeIfdTableArray(ifdArray, NULL, 0);
+        expected = (uint8_t*)malloc(expectedLength);
+        if (expected) {
+            serializeIfdTableArray(ifdArray, expected, expectedLength);
+        }
+        freeIfdTableArray(ifdArray);
+    }
+    jobs = (SharedJob*)calloc(threads, sizeof(SharedJob));
+    workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    if (!jobs || !workers || (expectedLength > 0 && !expected)) {
+        free(jobs);
+        free(workers);
+        free(expected);
+        close(fd);
+        return ERR_MEMALLOC;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < threads; i++) {
+        jobs[i].fd = fd;
+        jobs[i].iterations = iterations;
+        jobs[i].expected = expected;
+        jobs[i].expectedLength = expectedLength;
+        jobs[i].result = result;
+        pthread_create(&workers[i], NULL, sharedWorker, &jobs[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+        mismatches += jobs[i].mismatches;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close(fd);
+
+    sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (sec <= 0) {
+        sec = 1e-9;
+    }
+    printf("%s: result=%d, %d parses on %d threads sharing one descriptor in %.3f s "
+           "(%.0f parses/s), %d mismatches\n",
+        av[first], result, threads * iterations, threads, sec,
+        threads * iterations / sec, mismatches);
+
+    free(jobs);
+    free(workers);
+    free(expected);
+    return (mismatches > 0) ? -1 : 0;
+}
+
+#else
+
+int sample_sharedParse(int ac, char *av[])
+{
+    fprintf(stderr, "--shared is only supported on Linux\n");
+    return -1;
+}
+
+#endif
+
+/**
+ * sample_bigMpo()
+ *
+ * Generate a sparse MPO file larger than 4 GB from a JPEG file with the
+ * Exif segment, and parse it back. The template is stored as every frame;
+ * an MPF segment is inserted after the Exif segment of the first frame,
+ * and the other frames are spread up to the largest offset the MP entries
+ * can hold, so the last one starts beyond 4 GB. Each frame is parsed
+ * through the shared descriptor at its 64-bit offset and checked against
+ * the template. With -s the Exif segment is also removed from the whole
+ * file to measure the copy throughput (writes the full size to disk).
+ *
+ * usage: exif --bigmpo <template JPEG> <output MPO> [-n frames] [-s]
+ */
+#if defined(__linux__)
+
+#define BIGMPO_MAX_FRAMES   16
+#define BIGMPO_MPF_LENGTH   (2 + 4 + 8 + 2 + 12 * 3 + 4)   // without the entries
+
+// backend reading a frame at 'base' of the underlying backend
+typedef struct _frameIO {
+    ExifIO *file;
+    int64_t base;
+} FRAME_IO;
+
+static int64_t frameReadAt(void *context, int64_t offset, void *buf, size_t length)
+{
+    FRAME_IO *f = (FRAME_IO*)context;
+    return f->file->readAt(f->file->context, f->base + offset, buf, length);
+}
+
+static void bigMpoPut16(uint8_t *p, uint16_t v, int bigEndian)
+{
+    p[bigEndian ? 0 : 1] = (uint8_t)(v >> 8);
+    p[bigEndian ? 1 : 0] = (uint8_t)v;
+}
+
+static void bigMpoPut32(uint8_t *p, uint32_t v, int bigEndian)
+{
+    bigMpoPut16(p + (bigEndian ? 0 : 2), (uint16_t)(v >> 16), bigEndian);
+    bigMpoPut16(p + (bigEndian ? 2 : 0), (uint16_t)v, bigEndian);
+}
+
+static void bigMpoPutTag(uint8_t *p, uint16_t tagId, uint16_t type, uint32_t count,
+                         uint32_t value, int bigEndian)
+{
+    bigMpoPut16(p, tagId, bigEndian);
+    bigMpoPut16(p + 2, type, bigEndian);
+    bigMpoPut32(p + 4, count, bigEndian);
+    bigMpoPut32(p + 8, value, bigEndian);
+}
+
+// offset after the Exif segment of a JPEG image, where the MPF segment goes
+static size_t bigMpoFindInsert(const uint8_t *jpeg, size_t length, int *pBigEndian)
+{
+    size_t pos = 2, len;
+
+    while (pos + 16 <= length && jpeg[pos] == 0xFF &&
+           jpeg[pos + 1] >= 0xE0 && jpeg[pos + 1] <= 0xEF) {
+        len = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+        if (jpeg[pos + 1] == 0xE1 && memcmp(jpeg + pos + 4, "Exif\0", 5) == 0) {
+            *pBigEndian = (jpeg[pos + 10] == 'M');
+            return (pos + 2 + len <= length) ? pos + 2 + len : 0;
+        }
+        pos += 2 + len;
+    }
+    return 0;
+}
+
+// the template with the MPF segment inserted at 'insertAt', in the byte
+// order of its Exif segment; 'rel' are relative to the MPF TIFF header
+static void bigMpoFirstFrame(uint8_t *out, const uint8_t *tmpl, size_t tmplLength,
+                             size_t insertAt, int frames, const uint32_t *length,
+                             const uint32_t *rel, int bigEndian)
+{
+    size_t mpfLength = BIGMPO_MPF_LENGTH + 16 * frames;
+    uint8_t *mpf = out + insertAt, *entries;
+    int i;
+
+    memcpy(out, tmpl, insertAt);
+    mpf[0] = 0xFF;
+    mpf[1] = 0xE2;
+    mpf[2] = (uint8_t)((mpfLength - 2) >> 8);
+    mpf[3] = (uint8_t)(mpfLength - 2);
+    memcpy(mpf + 4, "MPF\0", 4);
+    memcpy(mpf + 8, bigEndian ? "MM" : "II", 2);
+    bigMpoPut16(mpf + 10, 0x002A, bigEndian);
+    bigMpoPut32(mpf + 12, 8, bigEndian);
+    bigMpoPut16(mpf + 16, 3, bigEndian);
+    bigMpoPutTag(mpf + 18, TAG_MPFVersion, TYPE_UNDEFINED, 4, 0, bigEndian);
+    memcpy(mpf + 26, "0100", 4);
+    bigMpoPutTag(mpf + 30, TAG_NumberOfImage, TYPE_LONG, 1, frames, bigEndian);
+    bigMpoPutTag(mpf + 42, TAG_MPImageList, TYPE_UNDEFINED, 16 * frames,
+                 BIGMPO_MPF_LENGTH - 8, bigEndian);
+    bigMpoPut32(mpf + 54, 0, bigEndian); // no next IFD
+    entries = mpf + BIGMPO_MPF_LENGTH;
+    memset(entries, 0, 16 * frames);
+    for (i = 0; i < frames; i++) {
+        // the first one is the representative baseline primary image
+        bigMpoPut32(entries + 16 * i, (i == 0) ? 0x20030000 : 0x00020002, bigEndian);
+        bigMpoPut32(entries + 16 * i + 4, length[i], bigEndian);
+        bigMpoPut32(entries + 16 * i + 8, rel[i], bigEndian);
+    }
+    memcpy(out + insertAt + mpfLength, tmpl + insertAt, tmplLength - insertAt);
+}
+
+static int64_t bigMpoWriteAt(int fd, const uint8_t *buf, size_t length, int64_t offset)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd, buf + done, length - done, (off_t)(offset + done));
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return (int64_t)done;
+}
+
+int sample_bigMpo(int ac, char *av[])
+{
+    struct timespec t0, t1;
+    struct stat st;
+    ExifIO file, frame;
+    FRAME_IO view;
+    FILE *fp;
+    uint8_t *tmpl = NULL, *frame0 = NULL;
+    int64_t frameStart[BIGMPO_MAX_FRAMES];
+    uint32_t rel[BIGMPO_MAX_FRAMES], length[BIGMPO_MAX_FRAMES];
+    size_t tmplLength, mpfLength, insertAt;
+    void **ifdArray;
+    double sec;
+    int i, fd, bigEndian, result, expected, sts = -1, frames = 3, strip = 0;
+
+    for (i = 4; i < ac; i++) {
+        if (strcmp(av[i], "-n") == 0 && i + 1 < ac) {
+            frames = atoi(av[++i]);
+        } else if (strcmp(av[i], "-s") == 0) {
+            strip = 1;
+        }
+    }
+    if (ac < 4 || frames < 2 || frames > BIGMPO_MAX_FRAMES) {
+        fprintf(stderr, "usage: %s --bigmpo <template JPEG> <output MPO> [-n frames(2-%d)] [-s]\n",
+            av[0], BIGMPO_MAX_FRAMES);
+        return -1;
+    }
+
+    // load the template
+    fp = fopen(av[2], "rb");
+    if (!fp) {
+        fprintf(stderr, "failed to open [%s]\n", av[2]);
+        return ERR_READ_FILE;
+    }
+    fseek(fp, 0, SEEK_END);
+    tmplLength = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    tmpl = (uint8_t*)malloc(tmplLength + 1);
+    if (!tmpl || fread(tmpl, 1, tmplLength, fp) != tmplLength) {
+        fclose(fp);
+        free(tmpl);
+        return ERR_READ_FILE;
+    }
+    fclose(fp);
+
+    insertAt = bigMpoFindInsert(tmpl, tmplLength, &bigEndian);
+    if (insertAt == 0) {
+        fprintf(stderr, "[%s] does not have the Exif segment\n", av[2]);
+        free(tmpl);
+        return ERR_INVALID_APP1HEADER;
+    }
+
+    // offsets of the frames, relative to the TIFF header of the MPF segment
+    // as in the MP entries; the last one is the largest value they can hold
+    mpfLength = BIGMPO_MPF_LENGTH + 16 * frames;
+    for (i = 0; i < frames; i++) {
+        rel[i] = (i == 0) ? 0 : (uint32_t)((uint64_t)0xFFFFFFF0u * i / (frames - 1));
+        frameStart[i] = (i == 0) ? 0 : (int64_t)(insertAt + 8) + rel[i];
+    }
+
+    // first frame: template with the MPF segment
+    frame0 = (uint8_t*)calloc(1, tmplLength + mpfLength);
+    if (!frame0) {
+        free(tmpl);
+        return ERR_MEMALLOC;
+    }
+    for (i = 0; i < frames; i++) {
+        length[i] = (uint32_t)((i == 0) ? tmplLength + mpfLength : tmplLength);
+    }
+    bigMpoFirstFrame(frame0, tmpl, tmplLength, insertAt, frames, length, rel, bigEndian);
+
+    // write the frames, leaving holes between them
+    fd = open(av[3], O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create [%s]\n", av[3]);
+        goto DONE;
+    }
+    result = (bigMpoWriteAt(fd, frame0, tmplLength + mpfLength, 0) < 0) ? ERR_WRITE_FILE : 0;
+    for (i = 1; i < frames && result == 0; i++) {
+        if (bigMpoWriteAt(fd, tmpl, tmplLength, frameStart[i]) < 0) {
+            result = ERR_WRITE_FILE;
+        }
+    }
+    close(fd);
+    if (result != 0) {
+        fprintf(stderr, "failed to write [%s]\n", av[3]);
+        goto DONE;
+    }
+    stat(av[3], &st);
+    printf("%s: %lld bytes (%lld bytes on disk), %d frames\n", av[3],
+        (long long)st.st_size, (long long)st.st_blocks * 512, frames);
+
+    // parse the first frame, then every frame at its 64-bit offset
+    ifdArray = createIfdTableArray(av[2], &expected);
+    if (ifdArray) {
+        freeIfdTableArray(ifdArray);
+    }
+    if (openExifFileIO(&file, av[3], 0) != 0) {
+        goto DONE;
+    }
+    memset(&frame, 0, sizeof(frame));
+    frame.readAt = frameReadAt;
+    frame.context = &view;
+    view.file = &file;
+    sts = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < frames; i++) {
+        view.base = frameStart[i];
+        ifdArray = createIfdTableArrayFromIO(&frame, &result);
+        if (i == 0 && ifdArray) {
+            TagNodeInfo *tag = getTagInfo(ifdArray, IFD_MPF, TAG_NumberOfImage);
+            if (!tag || tag->error || tag->numData[0] != (unsigned int)frames) {
+                result = ERR_INVALID_IFD;
+            }
+            if (tag) {
+                freeTagInfo(tag);
+            }
+        }
+        if (ifdArray) {
+            freeIfdTableArray(ifdArray);
+        }
+        printf("  frame %d @ %lld (0x%llx): result=%d%s\n", i, (long long)frameStart[i],
+            (unsigned long long)frameStart[i], result,
+            (i == 0 ? result == expected + 1 : result == expected) ? "" : " MISMATCH");
+        if (i == 0 ? result != expected + 1 : result != expected) {
+            sts = -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    closeExifIO(&file);
+    sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("parsed %d frames in %.3f ms\n", frames, sec * 1e3);
+
+    if (strip && sts == 0) {
+        char outName[1024];
+        snprintf(outName, sizeof(outName), "%s.stripped", av[3]);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        result = removeExifSegmentFromJPEGFile(av[3], outName);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        stat(outName, &st);
+        printf("removeExifSegmentFromJPEGFile: result=%d, %lld bytes in %.3f s (%.1f MB/s)\n",
+            result, (long long)st.st_size, sec, st.st_size / (1024.0 * 1024.0) / (sec > 0 ? sec : 1e-9));
+        if (result != 1) {
+            sts = -1;
+        }
+    }
+DONE:
+    free(frame0);
+    free(tmpl);
+    return sts;
+}
+
+/**
+ * sample_mpoBench()
+ *
+ * Measure extractMpoFrames() on a synthetic MPO file. The file is built
+ * in the work directory from a JPEG file with the Exif segment: every
+ * frame is the template followed by the given size of filler after EOI
+ * (ignored by decoders), and the first one has the MPF segment. The
+ * images are then extracted with 1, 2, 4 ... up to the given number of
+ * threads and compared with the frames. The first run also warms the
+ * page cache.
+ *
+ * usage: exif --mpobench <template JPEG> <work directory> [-n frames]
+ *                        [-m MB per frame] [-j threads]
+ */
+static int mpoBenchCompare(int fd, int64_t offset, const char *fileName, uint32_t length)
+{
+    uint8_t a[65536], b[65536];
+    uint32_t done;
+    size_t n;
+    FILE *fp = fopen(fileName, "rb");
+
+    if (!fp) {
+        return -1;
+    }
+    for (done = 0; done < length; done += (uint32_t)n) {
+        n = (length - done < sizeof(a)) ? length - done : sizeof(a);
+        if (pread(fd, a, n, (off_t)(offset + done)) != (ssize_t)n ||
+            fread(b, 1, n, fp) != n || memcmp(a, b, n) != 0) {
+            fclose(fp);
+            return -1;
+        }
+    }
+    n = fread(b, 1, 1, fp); // must be at the end
+    fclose(fp);
+    return (n == 0) ? 0 : -1;
+}
+
+int sample_mpoBench(int ac, char *av[])
+{
+    struct timespec t0, t1;
+    FILE *fp;
+    uint8_t *tmpl = NULL, *frame0 = NULL, *filler = NULL;
+    int64_t frameStart[BIGMPO_MAX_FRAMES];
+    uint32_t rel[BIGMPO_MAX_FRAMES], length[BIGMPO_MAX_FRAMES], x = 2463534242u;
+    size_t tmplLength, mpfLength, fillLength, insertAt, k;
+    char mpoName[1024], format[1024], outName[1024];
+    uint64_t total = 0;
+    double sec;
+    int i, fd, bigEndian, threads, result, sts = -1;
+    int frames = 8, megaBytes = 32, maxThreads = 8;
+
+    for (i = 4; i < ac; i++) {
+        if (strcmp(av[i], "-n") == 0 && i + 1 < ac) {
+            frames = atoi(av[++i]);
+        } else if (strcmp(av[i], "-m") == 0 && i + 1 < ac) {
+            megaBytes = atoi(av[++i]);
+        } else if (strcmp(av[i], "-j") == 0 && i + 1 < ac) {
+            maxThreads = atoi(av[++i]);
+        }
+    }
+    if (ac < 4 || frames < 2 || frames > BIGMPO_MAX_FRAMES ||
+        megaBytes < 0 || megaBytes > 256 || maxThreads < 1) {
+        fprintf(stderr, "usage: %s --mpobench <template JPEG> <work directory> "
+            "[-n frames(2-%d)] [-m MB per frame(0-256)] [-j threads]\n", av[0], BIGMPO_MAX_FRAMES);
+        return -1;
+    }
+
+    // load the template
+    fp = fopen(av[2], "rb");
+    if (!fp) {
+        fprintf(stderr, "failed to open [%s]\n", av[2]);
+        return ERR_READ_FILE;
+    }
+    fseek(fp, 0, SEEK_END);
+    tmplLength = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    tmpl = (uint8_t*)malloc(tmplLength + 1);
+    if (!tmpl || fread(tmpl, 1, tmplLength, fp) != tmplLength) {
+        fclose(fp);
+        free(tmpl);
+        return ERR_READ_FILE;
+    }
+    fclose(fp);
+    insertAt = bigMpoFindInsert(tmpl, tmplLength, &bigEndian);
+    if (insertAt == 0) {
+        fprintf(stderr, "[%s] does not have the Exif segment\n", av[2]);
+        free(tmpl);
+        return ERR_INVALID_APP1HEADER;
+    }
+
+    // frames one after another, each with the same pseudo-random filler
+    mpfLength = BIGMPO_MPF_LENGTH + 16 * frames;
+    fillLength = (size_t)megaBytes * 1024 * 1024;
+    for (i = 0; i < frames; i++) {
+        length[i] = (uint32_t)(tmplLength + fillLength + ((i == 0) ? mpfLength : 0));
+        frameStart[i] = (i == 0) ? 0 : frameStart[i - 1] + length[i - 1];
+        rel[i] = (i == 0) ? 0 : (uint32_t)(frameStart[i] - (int64_t)(insertAt + 8));
+        total += length[i];
+    }
+    frame0 = (uint8_t*)calloc(1, tmplLength + mpfLength);
+    filler = (uint8_t*)malloc(fillLength + 1);
+    if (!frame0 || !filler) {
+        goto DONE;
+    }
+    for (k = 0; k < fillLength; k++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        filler[k] = (uint8_t)x;
+    }
+    bigMpoFirstFrame(frame0, tmpl, tmplLength, insertAt, frames, length, rel, bigEndian);
+
+    snprintf(mpoName, sizeof(mpoName), "%s/bench.mpo", av[3]);
+    snprintf(format, sizeof(format), "%s/bench_%%d.jpg", av[3]);
+    fd = open(mpoName, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create [%s]\n", mpoName);
+        goto DONE;
+    }
+    result = 0;
+    for (i = 0; i < frames && result == 0; i++) {
+        size_t head = (i == 0) ? tmplLength + mpfLength : tmplLength;
+        if (bigMpoWriteAt(fd, (i == 0) ? frame0 : tmpl, head, frameStart[i]) < 0 ||
+            bigMpoWriteAt(fd, filler, fillLength, frameStart[i] + head) < 0) {
+            result = ERR_WRITE_FILE;
+        }
+    }
+    close(fd);
+    if (result != 0) {
+        fprintf(stderr, "failed to write [%s]\n", mpoName);
+        goto DONE;
+    }
+    printf("%s: %d frames, %.1f MB\n", mpoName, frames, total / (1024.0 * 1024.0));
+
+    fd = open(mpoName, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        goto DONE;
+    }
+    sts = 0;
+    for (threads = 1; threads <= maxThreads && sts == 0; threads *= 2) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        result = extractMpoFrames(mpoName, format, threads, NULL, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (result != frames) {
+            sts = -1;
+        }
+        for (i = 0; i < frames && sts == 0; i++) {
+            snprintf(outName, sizeof(outName), format, i);
+            if (mpoBenchCompare(fd, frameStart[i], outName, length[i]) != 0) {
+                fprintf(stderr, "[%s] differs from frame %d\n", outName, i);
+                sts = -1;
+            }
+        }
+        printf("threads=%d: result=%d, %.3f s (%.1f MB/s)%s\n", threads, result, sec,
+            total / (1024.0 * 1024.0) / (sec > 0 ? sec : 1e-9), (sts == 0) ? "" : " MISMATCH");
+    }
+    close(fd);
+DONE:
+    free(filler);
+    free(frame0);
+    free(tmpl);
+    return sts;
+}
+
+#else
+
+int sample_bigMpo(int ac, char *av[])
+{
+    fprintf(stderr, "--bigmpo is only supported on Linux\n");
+    return -1;
+}
+
+int sample_mpoBench(int ac, char *av[])
+{
+    fprintf(stderr, "--mpobench is only supported on Linux\n");
+    return -1;
+}
+
+#endif
+
+/**
+ * sample_backfillThumbnails()
+ *
+ * Walk a directory tree and add a thumbnail generated from the primary
+ * image to every JPEG file that has none. Each file is written to a
+ * temporary file next to it that takes the mode and owner of the original
+ * and replaces it only when the thumbnail was added. Files with several
+ * hard links are skipped, since the rename would split them from the
+ * other names. With -n the files are only checked.
+ *
+ * usage: exif --backfill <Directory> [-s WxH] [-q quality] [-n]
+ */
+#if defined(__linux__)
+
+typedef struct _backfillJob {
+    unsigned int width;
+    unsigned int height;
+    int quality;
+    int dryRun;
+    unsigned long files;
+    unsigned long added;
+    unsigned long skipped;
+    unsigned long unsupported;
+    unsigned long linked;
+    unsigned long errors;
+} BackfillJob;
+
+static int isJpegName(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    if (!ext) {
+        return 0;
+    }
+    return strcasecmp(ext, ".jpg") == 0 || strcasecmp(ext, ".jpeg") == 0;
+}
+
+// give the temporary file the owner and mode of the original
+static int backfillCopyAttributes(const char *tmp, const struct stat *st)
+{
+    int sts = 0;
+    int fd = open(tmp, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // chown first, it may clear the set-user-ID and set-group-ID bits
+    if (fchown(fd, st->st_uid, st->st_gid) != 0 ||
+        fchmod(fd, st->st_mode & 07777) != 0) {
+        sts = -1;
+    }
+    close(fd);
+    return sts;
+}
+
+static void backfillFile(BackfillJob *job, const char *path, const struct stat *st)
+{
+    char tmp[4096];
+    uint32_t length;
+    int64_t offset;
+    int sts;
+
+    job->files++;
+    if (st->st_nlink > 1) {
+        printf("%s: %lu hard links, skipped\n", path, (unsigned long)st->st_nlink);
+        job->linked++;
+        return;
+    }
+    if (job->dryRun) {
+        sts = getExifThumbnailRange(path, &offset, &length);
+        if (sts == 1) {
+            job->skipped++;
+        } else if (sts == 0 || sts == ERR_NOT_EXIST) {
+            printf("%s: no thumbnail\n", path);
+            job->added++;
+        } else {
+            fprintf(stderr, "%s: error %d\n", path, sts);
+            job->errors++;
+        }
+        return;
+    }
+    if (snprintf(tmp, sizeof(tmp), "%s.backfill.tmp", path) >= (int)sizeof(tmp)) {
+        job->errors++;
+        return;
+    }
+    sts = addGeneratedThumbnailToJPEGFile(path, tmp, job->width, job->height, job->quality);
+    if (sts == 1) {
+        if (backfillCopyAttributes(tmp, st) != 0) {
+            fprintf(stderr, "%s: cannot keep the owner and mode (%s)\n", path, strerror(errno));
+            unlink(tmp);
+            job->errors++;
+            return;
+        }
+        if (rename(tmp, path) != 0) {
+            fprintf(stderr, "%s: rename failed (%s)\n", path, strerror(errno));
+            unlink(tmp);
+            job->errors++;
+            return;
+        }
+        printf("%s: thumbnail added\n", path);
+        job->added++;
+    } else if (sts == 0) {
+        job->skipped++;
+    } else if (sts == ERR_UNSUPPORTED_JPEG) {
+        unlink(tmp);
+        printf("%s: not a baseline JPEG, skipped\n", path);
+        job->unsupported++;
+    } else {
+        unlink(tmp);
+        fprintf(stderr, "%s: error %d\n", path, sts);
+        job->errors++;
+    }
+}
+
+static void backfillWalk(BackfillJob *job, const char *dirPath)
+{
+    char path[4096];
+    struct dirent *ent;
+    struct stat st;
+    DIR *dir = opendir(dirPath);
+
+    if (!dir) {
+        fprintf(stderr, "%s: %s\n", dirPath, strerror(errno));
+        job->errors++;
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", dirPath, ent->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+        if (lstat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            backfillWalk(job, path);
+        } else if (S_ISREG(st.st_mode) && isJpegName(ent->d_name)) {
+            backfillFile(job, path, &st);
+        }
+    }
+    closedir(dir);
+}
+
+int sample_backfillThumbnails(int ac, char *av[])
+{
+    BackfillJob job;
+    int i;
+
+    if (ac < 3) {
+        fprintf(stderr, "usage: %s --backfill <Directory> [-s WxH] [-q quality] [-n]\n", av[0]);
+        return -1;
+    }
+    memset(&job, 0, sizeof(job));
+    job.width = job.height = 160;
+    job.quality = 75;
+    for (i = 3; i < ac; i++) {
+        if (strcmp(av[i], "-s") == 0 && i + 1 < ac) {
+            if (sscanf(av[++i], "%ux%u", &job.width, &job.height) != 2) {
+                job.width = job.height = 160;
+            }
+        } else if (strcmp(av[i], "-q") == 0 && i + 1 < ac) {
+            job.quality = atoi(av[++i]);
+        } else if (strcmp(av[i], "-n") == 0) {
+            job.dryRun = 1;
+        }
+    }
+    backfillWalk(&job, av[2]);
+    printf("%lu files, %lu %s, %lu with a thumbnail, %lu unsupported, %lu hard linked, %lu errors\n",
+        job.files, job.added, job.dryRun ? "without a thumbnail" : "thumbnails added",
+        job.skipped, job.unsupported, job.linked, job.errors);
+    return (job.errors > 0) ? -1 : 0;
+}
+
+#else
+
+int sample_backfillThumbnails(int ac, char *av[])
+{
+    fprintf(stderr, "--backfill is only supported on Linux\n");
+    return -1;
+}
+
+#endif
+
+// file names given as arguments or listed in a file, one per line
+typedef struct _pathList {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
+
+static int pathListAdd(PathList *list, const char *path)
+{
+    char **paths;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        paths = (char**)realloc(list->paths, sizeof(char*) * capacity);
+        if (!paths) {
+            return ERR_MEMALLOC;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count] = (char*)malloc(strlen(path) + 1);
+    if (!list->paths[list->count]) {
+        return ERR_MEMALLOC;
+    }
+    strcpy(list->paths[list->count], path);
+    list->count++;
+    return 0;
+}
+
+// add the lines of a list file, "-" for stdin
+static int pathListLoad(PathList *list, const char *listName)
+{
+    char line[4096];
+    FILE *fp = (strcmp(listName, "-") == 0) ? stdin : fopen(listName, "r");
+    int sts = 0;
+
+    if (!fp) {
+        fprintf(stderr, "failed to open [%s]\n", listName);
+        return ERR_READ_FILE;
+    }
+    while (sts == 0 && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0]) {
+            sts = pathListAdd(list, line);
+        }
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return sts;
+}
+
+static void pathListFree(PathList *list)
+{
+    size_t i;
+    for (i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+    memset(list, 0, sizeof(PathList));
+}
+
+/**
+ * sample_verify()
+ *
+ * Check many files with verifyJPEGFile() on several threads and print
+ * those having a problem. The files are given as arguments or listed one
+ * per line in a file (-l, "-" for stdin). With -m the images of the MPF
+ * segment are also checked.
+ *
+ * usage: exif --verify [-m] [-j threads] [-l list] [JPEG FileName...]
+ */
+#if defined(__linux__)
+
+typedef struct _verifyJob {
+    PathList files;
+    size_t next;
+    int flags;
+    unsigned long bad;
+    unsigned long errors;
+    pthread_mutex_t lock;
+} VerifyJob;
+
+static void verifyPrint(const char *path, int sts, unsigned int problems)
+{
+    static const char *names[] = {
+        "not-jpeg", "bad-marker", "truncated", "no-sof", "no-sos", "no-eoi", "bad-mpf"
+    };
+    int i;
+
+    if (sts < 0) {
+        printf("%s: error %d\n", path, sts);
+        return;
+    }
+    printf("%s:", path);
+    for (i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (problems & (1u << i)) {
+            printf(" %s", names[i]);
+        }
+    }
+    printf("\n");
+}
+
+static void *verifyWorker(void *arg)
+{
+    VerifyJob *job = (VerifyJob*)arg;
+    unsigned int problems;
+    size_t i;
+    int sts;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        i = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (i >= job->files.count) {
+            break;
+        }
+        sts = verifyJPEGFile(job->files.paths[i], job->flags, &problems);
+        if (sts == 1) {
+            continue;
+        }
+        pthread_mutex_lock(&job->lock);
+        if (sts < 0) {
+            job->errors++;
+        } else {
+            job->bad++;
+        }
+        verifyPrint(job->files.paths[i], sts, problems);
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+int sample_verify(int ac, char *av[])
+{
+    VerifyJob job;
+    pthread_t *workers = NULL;
+    int n, threads = 4, started = 0, sts = 0;
+    clock_t t0;
+
+    memset(&job, 0, sizeof(job));
+    for (n = 2; n < ac && sts == 0; n++) {
+        if (strcmp(av[n], "-m") == 0) {
+            job.flags |= EXIF_VERIFY_CHECK_MPF;
+        } else if (strcmp(av[n], "-j") == 0 && n + 1 < ac) {
+            threads = atoi(av[++n]);
+        } else if (strcmp(av[n], "-l") == 0 && n + 1 < ac) {
+            sts = pathListLoad(&job.files, av[++n]);
+        } else {
+            sts = pathListAdd(&job.files, av[n]);
+        }
+    }
+    if (sts == 0 && job.files.count == 0) {
+        fprintf(stderr, "usage: %s --verify [-m] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
+        sts = -1;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (sts == 0) {
+        workers = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+        if (!workers) {
+            sts = ERR_MEMALLOC;
+        }
+    }
+    if (sts == 0) {
+        pthread_mutex_init(&job.lock, NULL);
+        t0 = clock();
+        for (started = 0; started < threads - 1; started++) {
+            if (pthread_create(&workers[started], NULL, verifyWorker, &job) != 0) {
+                break;
+            }
+        }
+        verifyWorker(&job);
+        for (n = 0; n < started; n++) {
+            pthread_join(workers[n], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
+        fprintf(stderr, "%lu files, %lu with problems, %lu errors (%.1f s CPU)\n",
+            (unsigned long)job.files.count, job.bad, job.errors,
+            (double)(clock() - t0) / CLOCKS_PER_SEC);
+        sts = (job.bad > 0 || job.errors > 0) ? 1 : 0;
+    }
+    pathListFree(&job.files);
+    free(workers);
+    return sts;
+}
+
+#else
+
+int sample_verify(int ac, char *av[])
+{
+    fprintf(stderr, "--verify is only supported on Linux\n");
+    return -1;
+}
+
+#endif
+
+/**
+ * sample_pixelHash()
+ *
+ * Hash the image data of many files with getJpegPixelHashBatch() and
+ * print "hash file" lines. With -d only the files whose image data is
+ * the same as that of another file are printed, in groups separated by
+ * a blank line.
+ *
+ * usage: exif --pixelhash [-d] [-j threads] [-l list] [JPEG FileName...]
+ */
+static int comparePixelHashItem(const void *a, const void *b)
+{
+    const ExifPixelHashItem *x = (const ExifPixelHashItem*)a;
+    const ExifPixelHashItem *y = (const ExifPixelHashItem*)b;
+    if (x->result != y->result) {
+        return (x->result < y->result) ? -1 : 1;
+    }
+    if (x->hash != y->hash) {
+        return (x->hash < y->hash) ? -1 : 1;
+    }
+    return strcmp(x->fileName, y->fileName);
+}
+
+int sample_pixelHash(int ac, char *av[])
+{
+    ExifPixelHashItem *items = NULL;
+    PathList files;
+    size_t i, j, k;
+    int n, threads = 0, duplicates = 0, sts = 0;
+    unsigned long groups = 0, errors = 0;
+    clock_t t0;
+
+    memset(&files, 0, sizeof(files));
+    for (n = 2; n < ac && sts == 0; n++) {
+        if (strcmp(av[n], "-d") == 0) {
+            duplicates = 1;
+        } else if (strcmp(av[n], "-j") == 0 && n + 1 < ac) {
+            threads = atoi(av[++n]);
+        } else if (strcmp(av[n], "-l") == 0 && n + 1 < ac) {
+            sts = pathListLoad(&files, av[++n]);
+        } else {
+            sts = pathListAdd(&files, av[n]);
+        }
+    }
+    if (sts == 0 && files.count == 0) {
+        fprintf(stderr, "usage: %s --pixelhash [-d] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
+        sts = -1;
+    }
+    if (sts == 0) {
+        items = (ExifPixelHashItem*)calloc(files.count, sizeof(ExifPixelHashItem));
+        if (!items) {
+            sts = ERR_MEMALLOC;
+        }
+    }
+    if (sts != 0) {
+        pathListFree(&files);
+        return sts;
+    }
+    for (i = 0; i < files.count; i++) {
+        items[i].fileName = files.paths[i];
+    }
+    t0 = clock();
+    getJpegPixelHashBatch(items, (int)files.count, threads);
+    if (duplicates) {
+        qsort(items, files.count, sizeof(ExifPixelHashItem), comparePixelHashItem);
+    }
+    for (i = 0; i < files.count; i = j) {
+        j = i + 1;
+        if (items[i].result != 1) {
+            fprintf(stderr, "%s: error %d\n", items[i].fileName, items[i].result);
+            errors++;
+            continue;
+        }
+        if (!duplicates) {
+            printf("%016llx  %s\n", (unsigned long long)items[i].hash, items[i].fileName);
+            continue;
+        }
+        while (j < files.count && items[j].result == 1 && items[j].hash == items[i].hash) {
+            j++;
+        }
+        if (j - i < 2) {
+            continue;
+        }
+        if (groups++ > 0) {
+            printf("\n");
+        }
+        for (k = i; k < j; k++) {
+            printf("%016llx  %s\n", (unsigned long long)items[k].hash, items[k].fileName);
+        }
+    }
+    fprintf(stderr, "%lu files, %lu errors", (unsigned long)files.count, errors);
+    if (duplicates) {
+        fprintf(stderr, ", %lu groups of duplicates", groups);
+    }
+    fprintf(stderr, " (%.1f s CPU)\n", (double)(clock() - t0) / CLOCKS_PER_SEC);
+    free(items);
+    pathListFree(&files);
+    return 0;
+}
+
+/**
+ * sample_fingerprint()
+ *
+ * Fingerprint the Exif metadata of many files with getExifFingerprintBatch()
+ * and print "fingerprint file" lines. With -d only the files whose
+ * metadata is the same as that of another file are printed, in groups
+ * separated by a blank line.
+ *
+ * usage: exif --fingerprint [-d] [-j threads] [-l list] [JPEG FileName...]
+ */
+static int compareFingerprintItem(const void *a, const void *b)
+{
+    const ExifFingerprintItem *x = (const ExifFingerprintItem*)a;
+    const ExifFingerprintItem *y = (const ExifFingerprintItem*)b;
+    if (x->result != y->result) {
+        return (x->result < y->result) ? -1 : 1;
+    }
+    if (x->fingerprint.high != y->fingerprint.high) {
+        return (x->fingerprint.high < y->fingerprint.high) ? -1 : 1;
+    }
+    if (x->fingerprint.low != y->fingerprint.low) {
+        return (x->fingerprint.low < y->fingerprint.low) ? -1 : 1;
+    }
+    return strcmp(x->fileName, y->fileName);
+}
+
+static int sameFingerprint(const ExifFingerprintItem *x, const ExifFingerprintItem *y)
+{
+    return x->result == 1 && y->result == 1 &&
+           x->fingerprint.high == y->fingerprint.high &&
+           x->fingerprint.low == y->fingerprint.low;
+}
+
+int sample_fingerprint(int ac, char *av[])
+{
+    ExifFingerprintItem *items = NULL;
+    PathList files;
+    size_t i, j, k;
+    int n, threads = 0, duplicates = 0, sts = 0;
+    unsigned long groups = 0, noExif = 0, errors = 0;
+    clock_t t0;
+
+    memset(&files, 0, sizeof(files));
+    for (n = 2; n < ac && sts == 0; n++) {
+        if (strcmp(av[n], "-d") == 0) {
+            duplicates = 1;
+        } else if (strcmp(av[n], "-j") == 0 && n + 1 < ac) {
+            threads = atoi(av[++n]);
+        } else if (strcmp(av[n], "-l") == 0 && n + 1 < ac) {
+            sts = pathListLoad(&files, av[++n]);
+        } else {
+            sts = pathListAdd(&files, av[n]);
+        }
+    }
+    if (sts == 0 && files.count == 0) {
+        fprintf(stderr, "usage: %s --fingerprint [-d] [-j threads] [-l list] [JPEG FileName...]\n", av[0]);
+        sts = -1;
+    }
+    if (sts == 0) {
+        items = (ExifFingerprintItem*)calloc(files.count, sizeof(ExifFingerprintItem));
+        if (!items) {
+            sts = ERR_MEMALLOC;
+        }
+    }
+    if (sts != 0) {
+        pathListFree(&files);
+        return sts;
+    }
+    for (i = 0; i < files.count; i++) {
+        items[i].fileName = files.paths[i];
+    }
+    t0 = clock();
+    getExifFingerprintBatch(items, (int)files.count, threads);
+    if (duplicates) {
+        qsort(items, files.count, sizeof(ExifFingerprintItem), compareFingerprintItem);
+    }
+    for (i = 0; i < files.count; i = j) {
+        j = i + 1;
+        if (items[i].result == 0) {
+            noExif++;
+            continue;
+        }
+        if (items[i].result != 1) {
+            fprintf(stderr, "%s: error %d\n", items[i].fileName, items[i].result);
+            errors++;
+            continue;
+        }
+        if (!duplicates) {
+            printf("%016llx%016llx  %s\n", (unsigned long long)items[i].fingerprint.high,
+                (unsigned long long)items[i].fingerprint.low, items[i].fileName);
+            continue;
+        }
+        while (j < files.count && sameFingerprint(&items[j], &items[i])) {
+            j++;
+        }
+        if (j - i < 2) {
+            continue;
+        }
+        if (groups++ > 0) {
+            printf("\n");
+        }
+        for (k = i; k < j; k++) {
+            printf("%016llx%016llx  %s\n", (unsigned long long)items[k].fingerprint.high,
+                (unsigned long long)items[k].fingerprint.low, items[k].fileName);
+        }
+    }
+    fprintf(stderr, "%lu files, %lu without Exif, %lu errors",
+        (unsigned long)files.count, noExif, errors);
+    if (duplicates) {
+        fprintf(stderr, ", %lu groups of duplicates", groups);
+    }
+    fprintf(stderr, " (%.1f s CPU)\n", (double)(clock() - t0) / CLOCKS_PER_SEC);
+    free(items);
+    pathListFree(&files);
+    return 0;
+}